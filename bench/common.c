@@ -0,0 +1,69 @@
+#include "common.h"
+
+#include "process/process.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+double bench_now_ns(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+bool bench_run_cc(const char* opt_level, const char* source, const char* path)
+{
+    const char* with_level[] = {"cc", opt_level, "-o", path, source};
+    const char* without[] = {"cc", "-o", path, source};
+    ProcessCreateResult cc = opt_level != NULL
+                                 ? process_run((ProcessCStrBuf)BUF_ARRAY(with_level), PROCESS_OPTION_SEARCH_USER_PATH)
+                                 : process_run((ProcessCStrBuf)BUF_ARRAY(without), PROCESS_OPTION_SEARCH_USER_PATH);
+    bool ok = cc.present && cc.value.returnCode == 0;
+    if (cc.present)
+    {
+        process_destroy(&cc.value);
+    }
+    return ok;
+}
+
+bool bench_link_module(
+    const WaccIrModule* module, const WaccX86Options* options, WaccX86Stats* stats, const char* path)
+{
+    char asm_path[] = "/tmp/wacc-bench-XXXXXX.s";
+    int fd = mkstemps(asm_path, 2);
+    FILE* asm_file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (asm_file == NULL)
+    {
+        return false;
+    }
+    wacc_x86_compile(module, options, stats, asm_file);
+    (void)fclose(asm_file);
+    bool ok = bench_run_cc(NULL, asm_path, path);
+    (void)remove(asm_path);
+    return ok;
+}
+
+double bench_time_executable(const char* path, int num_runs, int* code)
+{
+    double best = -1;
+    for (int run = 0; run < num_runs; run++)
+    {
+        const char* args[] = {path};
+        double start = bench_now_ns();
+        ProcessCreateResult result = process_run((ProcessCStrBuf)BUF_ARRAY(args), PROCESS_OPTION_SEARCH_USER_PATH);
+        double elapsed = (bench_now_ns() - start) / 1e6;
+        if (!result.present)
+        {
+            return -1;
+        }
+        *code = result.value.returnCode;
+        process_destroy(&result.value);
+        if (best < 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "wacc/ir.h"
+#include "wacc/x86.h"
+
+#include <stdbool.h>
+
+// What the benchmarks share: a clock, building executables through the
+// system compiler driver, and timing them.
+
+// monotonic time in nanoseconds
+double bench_now_ns(void);
+
+// Compile `source`, C or assembly, into an executable at `path` with cc,
+// passing `opt_level` (e.g. "-O1") unless it is NULL.
+bool bench_run_cc(const char* opt_level, const char* source, const char* path);
+
+// Generate assembly for `module` into a temporary file and link it against
+// the C library into an executable at `path`.
+bool bench_link_module(
+    const WaccIrModule* module, const WaccX86Options* options, WaccX86Stats* stats, const char* path);
+
+// Fastest of `num_runs` runs of the executable at `path` in milliseconds, or
+// a negative value on failure. `code` gets the exit status.
+double bench_time_executable(const char* path, int num_runs, int* code);
@@ -0,0 +1,146 @@
+// Runtime of call-heavy code: the naive recursive fib, built as IR and
+// compiled with each register allocator, against the same function compiled
+// from C by the system compiler at -O0 and -O1. Arguments and results travel
+// in registers under the System V convention throughout; the difference is
+// how much each compiler moves and saves around the calls.
+
+#include "common.h"
+
+#include "wacc/ir.h"
+#include "wacc/opt.h"
+#include "wacc/x86.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+enum
+{
+    FIB_N = 35,
+    NUM_RUNS = 5,
+};
+
+static const char c_source[] = "int fib(int n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }\n"
+                               "int main(void) { return fib(35) & 255; }\n";
+
+// fib(n): return n < 2 ? n : fib(n - 1) + fib(n - 2);
+static void build_fib(WaccIrModule* module)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("fib"), i32, 1);
+    WaccIrBlockId base = wacc_ir_block_new(f);
+    WaccIrBlockId recurse = wacc_ir_block_new(f);
+    WaccIrValue n = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue two = wacc_ir_emit_const(f, 0, i32, 2);
+    wacc_ir_emit_cbr(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_SLT, WACC_IR_TYPE_I1, n, two), base, recurse);
+    wacc_ir_emit_ret(f, base, n);
+    WaccIrValue one = wacc_ir_emit_const(f, recurse, i32, 1);
+    WaccIrValue n1 = wacc_ir_emit_binary(f, recurse, WACC_IR_SUB, i32, n, one);
+    WaccIrValue fib1 = wacc_ir_emit_call(f, recurse, i32, 0, &n1, 1);
+    WaccIrValue n2 = wacc_ir_emit_binary(f, recurse, WACC_IR_SUB, i32, n, two);
+    WaccIrValue fib2 = wacc_ir_emit_call(f, recurse, i32, 0, &n2, 1);
+    wacc_ir_emit_ret(f, recurse, wacc_ir_emit_binary(f, recurse, WACC_IR_ADD, i32, fib1, fib2));
+
+    WaccIrFunction* caller = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    WaccIrValue arg = wacc_ir_emit_const(caller, 0, i32, FIB_N);
+    WaccIrValue result = wacc_ir_emit_call(caller, 0, i32, 0, &arg, 1);
+    WaccIrValue mask = wacc_ir_emit_const(caller, 0, i32, 255);
+    wacc_ir_emit_ret(caller, 0, wacc_ir_emit_binary(caller, 0, WACC_IR_AND, i32, result, mask));
+}
+
+static bool build_wacc(WaccX86Regalloc regalloc, const char* path)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_fib(module);
+    for (uint64_t k = 0; k < module->functions.len; k++)
+    {
+        wacc_ir_compute_preds(module->functions.ptr[k]);
+    }
+    // the scalar passes; fib is recursive, so there is nothing to inline
+    WaccOptOptions opt = {.level = 1};
+    WaccOptStats opt_stats = {0};
+    wacc_opt_module(module, &opt, &opt_stats);
+    WaccX86Options options = {
+        .regalloc = regalloc,
+        .peephole = true,
+        .omit_frame_pointer = true,
+        .function_align = 16,
+        .loop_align = 16,
+        .loop_max_skip = 10,
+    };
+    WaccX86Stats x86_stats = {0};
+    bool ok = bench_link_module(module, &options, &x86_stats, path);
+    wacc_ir_module_free(module);
+    return ok;
+}
+
+static bool build_c(const char* opt_level, const char* path)
+{
+    char c_path[] = "/tmp/wacc-bench-XXXXXX.c";
+    int fd = mkstemps(c_path, 2);
+    FILE* c_file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (c_file == NULL)
+    {
+        return false;
+    }
+    (void)fputs(c_source, c_file);
+    (void)fclose(c_file);
+    bool ok = bench_run_cc(opt_level, c_path, path);
+    (void)remove(c_path);
+    return ok;
+}
+
+int main(void)
+{
+    enum
+    {
+        WACC_NAIVE,
+        WACC_LINEAR_SCAN,
+        CC_O0,
+        CC_O1,
+        NUM_VARIANTS,
+    };
+    static const char* const names[NUM_VARIANTS] = {
+        "wacc -O1, naive regalloc",
+        "wacc -O1, linear scan",
+        "cc -O0",
+        "cc -O1",
+    };
+    static const char* const paths[NUM_VARIANTS] = {
+        "./wacc-bench-naive",
+        "./wacc-bench-linear",
+        "./wacc-bench-cc-O0",
+        "./wacc-bench-cc-O1",
+    };
+    double times[NUM_VARIANTS];
+    int codes[NUM_VARIANTS];
+    for (int i = 0; i < NUM_VARIANTS; i++)
+    {
+        bool built = i == WACC_NAIVE          ? build_wacc(WACC_X86_REGALLOC_NAIVE, paths[i])
+                     : i == WACC_LINEAR_SCAN ? build_wacc(WACC_X86_REGALLOC_LINEAR_SCAN, paths[i])
+                     : i == CC_O0            ? build_c("-O0", paths[i])
+                                             : build_c("-O1", paths[i]);
+        if (!built)
+        {
+            (void)fprintf(stderr, "failed to build %s\n", paths[i]);
+            return 1;
+        }
+        times[i] = bench_time_executable(paths[i], NUM_RUNS, &codes[i]);
+        (void)remove(paths[i]);
+        if (times[i] < 0)
+        {
+            (void)fprintf(stderr, "failed to run %s\n", paths[i]);
+            return 1;
+        }
+        if (codes[i] != codes[0])
+        {
+            (void)fprintf(stderr, "results differ: %d (%s) vs %d (%s)\n", codes[i], names[i], codes[0], names[0]);
+            return 1;
+        }
+    }
+    (void)printf("recursive fib(%d), best of %d runs:\n", FIB_N, NUM_RUNS);
+    for (int i = 0; i < NUM_VARIANTS; i++)
+    {
+        (void)printf("  %-26s %8.1f ms  (%.2fx cc -O1)\n", names[i], times[i], times[i] / times[CC_O1]);
+    }
+    return 0;
+}
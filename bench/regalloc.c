@@ -0,0 +1,137 @@
+// Runtime of generated code under each register allocator: a loop keeping a
+// few values live and one keeping more values live than there are registers,
+// compiled with the naive allocator that keeps every value on the stack and
+// with linear scan.
+
+#include "common.h"
+
+#include "wacc/ir.h"
+#include "wacc/x86.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+enum
+{
+    ITERATIONS = 50000000,
+    NUM_RUNS = 5,
+};
+
+// kernel(n): `width` accumulators, each updated from itself, its neighbour and
+// the counter on every iteration, xor-ed together at the end
+static void build_kernel(WaccIrModule* module, uint32_t width)
+{
+    static const WaccIrOpcode ops[] = {WACC_IR_ADD, WACC_IR_XOR, WACC_IR_SUB, WACC_IR_MUL};
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("kernel"), i32, 1);
+    WaccIrBlockId entry = 0;
+    WaccIrBlockId head = wacc_ir_block_new(f);
+    WaccIrBlockId body = wacc_ir_block_new(f);
+    WaccIrBlockId exit = wacc_ir_block_new(f);
+    WaccIrValue n = wacc_ir_emit_param(f, entry, i32, 0);
+    WaccIrValue zero = wacc_ir_emit_const(f, entry, i32, 0);
+    WaccIrValue* acc = malloc(sizeof(WaccIrValue) * width);
+    WaccIrValue* next = malloc(sizeof(WaccIrValue) * width);
+    for (uint32_t j = 0; j < width; j++)
+    {
+        next[j] = wacc_ir_emit_const(f, entry, i32, j + 1);
+    }
+    wacc_ir_emit_br(f, entry, head);
+    for (uint32_t j = 0; j < width; j++)
+    {
+        WaccIrOperand in[] = {{next[j], entry}, {0, body}};
+        acc[j] = wacc_ir_emit_phi(f, head, i32, in, 2);
+    }
+    WaccIrOperand counter_in[] = {{zero, entry}, {0, body}};
+    WaccIrValue i = wacc_ir_emit_phi(f, head, i32, counter_in, 2);
+    wacc_ir_emit_cbr(f, head, wacc_ir_emit_binary(f, head, WACC_IR_SLT, WACC_IR_TYPE_I1, i, n), body, exit);
+    for (uint32_t j = 0; j < width; j++)
+    {
+        WaccIrValue t = wacc_ir_emit_binary(f, body, ops[j % 4], i32, acc[j], acc[(j + 1) % width]);
+        next[j] = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, t, i);
+    }
+    WaccIrValue one = wacc_ir_emit_const(f, body, i32, 1);
+    WaccIrValue i_next = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, i, one);
+    wacc_ir_emit_br(f, body, head);
+    WaccIrValue total = acc[0];
+    for (uint32_t j = 1; j < width; j++)
+    {
+        total = wacc_ir_emit_binary(f, exit, WACC_IR_XOR, i32, total, acc[j]);
+    }
+    wacc_ir_emit_ret(f, exit, total);
+    // the back edge operands of the phis, now that the body defines them
+    for (uint32_t j = 0; j < width; j++)
+    {
+        wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[j])[1].value = next[j];
+    }
+    wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[width])[1].value = i_next;
+    free(acc);
+    free(next);
+}
+
+// main(): kernel(ITERATIONS) & 255, so the exit status checks the result
+static void build_main(WaccIrModule* module)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    WaccIrValue n = wacc_ir_emit_const(f, 0, i32, ITERATIONS);
+    WaccIrValue result = wacc_ir_emit_call(f, 0, i32, 0, &n, 1);
+    WaccIrValue mask = wacc_ir_emit_const(f, 0, i32, 255);
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_AND, i32, result, mask));
+}
+
+static bool build_executable(uint32_t width, WaccX86Regalloc regalloc, const char* path, WaccX86Stats* stats)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_kernel(module, width);
+    build_main(module);
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        wacc_ir_compute_preds(module->functions.ptr[i]);
+    }
+    WaccX86Options options = {.regalloc = regalloc};
+    bool ok = bench_link_module(module, &options, stats, path);
+    wacc_ir_module_free(module);
+    return ok;
+}
+
+static int bench(const char* name, uint32_t width)
+{
+    static const char* const paths[] = {"./wacc-bench-naive", "./wacc-bench-linear"};
+    static const WaccX86Regalloc regallocs[] = {WACC_X86_REGALLOC_NAIVE, WACC_X86_REGALLOC_LINEAR_SCAN};
+    double times[2];
+    int codes[2];
+    WaccX86Stats stats[2] = {0};
+    for (int i = 0; i < 2; i++)
+    {
+        if (!build_executable(width, regallocs[i], paths[i], &stats[i]))
+        {
+            (void)fprintf(stderr, "%s: failed to build %s\n", name, paths[i]);
+            return 1;
+        }
+        times[i] = bench_time_executable(paths[i], NUM_RUNS, &codes[i]);
+        (void)remove(paths[i]);
+        if (times[i] < 0)
+        {
+            (void)fprintf(stderr, "%s: failed to run %s\n", name, paths[i]);
+            return 1;
+        }
+    }
+    if (codes[0] != codes[1])
+    {
+        (void)fprintf(stderr, "%s: results differ: %d (naive) vs %d (linear)\n", name, codes[0], codes[1]);
+        return 1;
+    }
+    (void)printf("%s (%u live values, best of %d runs):\n", name, width + 1, NUM_RUNS);
+    (void)printf("  naive:  %8.1f ms, %zu spilled\n", times[0], stats[0].spilled);
+    (void)printf("  linear: %8.1f ms, %zu spilled\n", times[1], stats[1].spilled);
+    (void)printf("  speedup: %.2fx\n", times[0] / times[1]);
+    return 0;
+}
+
+int main(void)
+{
+    int failed = bench("low pressure", 4);
+    failed |= bench("high pressure", 24);
+    return failed;
+}
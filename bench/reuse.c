@@ -0,0 +1,96 @@
+// Fixed per-file cost of the front end on many tiny inputs: a fresh WaccSystem and
+// parser context for every input, against one of each reset between inputs.
+
+#include "common.h"
+
+#include "packcc/grammar.h"
+#include "wacc/ast.h"
+#include "wacc/system.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+    NUM_INPUTS = 10000,
+};
+
+static char inputs[NUM_INPUTS][64];
+
+static FILE* open_input(size_t i)
+{
+    return fmemopen(inputs[i], strlen(inputs[i]), "r");
+}
+
+static size_t parse_one(WaccSystem* sys, wacc_context_t* ctx)
+{
+    size_t units = 0;
+    int rest = 1;
+    while (rest != 0)
+    {
+        WaccNode* unit = NULL;
+        rest = wacc_parse(ctx, &unit);
+        if (unit == NULL)
+        {
+            return sys->source.num_errors + 1;
+        }
+        ast_free(sys->alloc, unit);
+        units++;
+    }
+    // every input is a single function
+    return sys->source.num_errors + (units != 1);
+}
+
+static double bench_fresh(size_t* errors)
+{
+    double start = bench_now_ns();
+    for (size_t i = 0; i < NUM_INPUTS; i++)
+    {
+        WaccSystem* sys = wacc_system_new(stderr, NULL);
+        wacc_system_open_stream(sys, str_lit("<bench>"), open_input(i));
+        wacc_context_t* ctx = wacc_create(sys);
+        *errors += parse_one(sys, ctx);
+        wacc_destroy(ctx);
+        wacc_system_free(sys);
+    }
+    return (bench_now_ns() - start) / NUM_INPUTS;
+}
+
+static double bench_reused(size_t* errors)
+{
+    double start = bench_now_ns();
+    WaccSystem* sys = wacc_system_new(stderr, NULL);
+    wacc_context_t* ctx = wacc_create(sys);
+    for (size_t i = 0; i < NUM_INPUTS; i++)
+    {
+        wacc_system_reset(sys);
+        wacc_system_open_stream(sys, str_lit("<bench>"), open_input(i));
+        *errors += parse_one(sys, ctx);
+    }
+    wacc_destroy(ctx);
+    wacc_system_free(sys);
+    return (bench_now_ns() - start) / NUM_INPUTS;
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < NUM_INPUTS; i++)
+    {
+        (void)snprintf(inputs[i], sizeof(inputs[i]), "int main() {\n    return %zu;\n}\n", i);
+    }
+
+    size_t errors = 0;
+    // warm up the heap and caches before measuring either strategy
+    (void)bench_fresh(&errors);
+    double fresh = bench_fresh(&errors);
+    double reused = bench_reused(&errors);
+    if (errors > 0)
+    {
+        (void)fprintf(stderr, "%zu inputs failed to parse\n", errors);
+        return 1;
+    }
+    printf("%d inputs\n", NUM_INPUTS);
+    printf("fresh context:  %8.0f ns/file\n", fresh);
+    printf("reused context: %8.0f ns/file\n", reused);
+    return 0;
+}
@@ -0,0 +1,109 @@
+// Startup latency of generated executables: a main that only returns, written
+// freestanding by wacc and linked against the C library by cc, each run many
+// times so that process creation, loading and exit dominate.
+
+#include "common.h"
+
+#include "wacc/ir.h"
+#include "wacc/x86.h"
+
+#include <spawn.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+enum
+{
+    NUM_RUNS = 10000,
+    EXIT_CODE = 42,
+};
+
+// main(): EXIT_CODE
+static WaccIrModule* build_module(void)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("main"), WACC_IR_TYPE_I32, 0);
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_const(f, 0, WACC_IR_TYPE_I32, EXIT_CODE));
+    wacc_ir_compute_preds(f);
+    return module;
+}
+
+static bool build_freestanding(const WaccIrModule* module, const char* path)
+{
+    WaccX86Options options = {.peephole = true, .omit_frame_pointer = true};
+    WaccX86Stats stats = {0};
+    WaccX86Code code;
+    wacc_x86_compile_code(module, &options, &stats, &code);
+    bool ok = wacc_x86_write_executable(&code, 0, path);
+    wacc_x86_code_free(&code);
+    return ok;
+}
+
+static bool build_linked(const WaccIrModule* module, const char* path)
+{
+    WaccX86Options options = {.peephole = true, .omit_frame_pointer = true};
+    WaccX86Stats stats = {0};
+    return bench_link_module(module, &options, &stats, path);
+}
+
+// Mean microseconds per run over NUM_RUNS runs, or a negative value if a run
+// fails or exits with the wrong status. The runs are spawned directly, as
+// the pipes process_run sets up would cost more than some of the programs.
+static double time_executable(const char* path)
+{
+    char* args[] = {(char*)path, NULL};
+    double start = bench_now_ns();
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        pid_t child;
+        int status;
+        if (posix_spawn(&child, path, NULL, NULL, args, environ) != 0 || waitpid(child, &status, 0) != child ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_CODE)
+        {
+            return -1;
+        }
+    }
+    return (bench_now_ns() - start) / 1e3 / NUM_RUNS;
+}
+
+static long file_size(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+int main(void)
+{
+    static const char* const names[] = {"freestanding", "cc-linked"};
+    static const char* const paths[] = {"./wacc-bench-freestanding", "./wacc-bench-linked"};
+    WaccIrModule* module = build_module();
+    bool built = build_freestanding(module, paths[0]) && build_linked(module, paths[1]);
+    wacc_ir_module_free(module);
+    if (!built)
+    {
+        (void)fprintf(stderr, "failed to build the executables\n");
+        return 1;
+    }
+    double times[2];
+    long sizes[2];
+    for (int i = 0; i < 2; i++)
+    {
+        sizes[i] = file_size(paths[i]);
+        times[i] = time_executable(paths[i]);
+        (void)remove(paths[i]);
+        if (times[i] < 0)
+        {
+            (void)fprintf(stderr, "failed to run %s\n", paths[i]);
+            return 1;
+        }
+    }
+    (void)printf("startup (mean of %d runs):\n", NUM_RUNS);
+    for (int i = 0; i < 2; i++)
+    {
+        (void)printf("  %-12s %8.1f us, %6ld bytes\n", names[i], times[i], sizes[i]);
+    }
+    (void)printf("  speedup: %.2fx\n", times[1] / times[0]);
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Peak memory of the compiler on growing inputs: the whole module kept until
+// code generation, against --stream, which generates each function as soon as
+// it is parsed and then releases it. Each compile runs in a child process so
+// that its peak resident set size can be read back on its own.
+
+#include "common.h"
+
+#include "wacc/run.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum
+{
+    // calls in the body of every function, which keeps them all the same size
+    CALL_DEPTH = 64,
+};
+
+// f0 returns its first argument and every later function nests CALL_DEPTH
+// calls to the one before it; main calls the last
+static bool write_source(const char* path, int num_functions)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        return false;
+    }
+    (void)fprintf(file, "int f0(int a, int b) { return a; }\n");
+    for (int i = 1; i < num_functions; i++)
+    {
+        (void)fprintf(file, "int f%d(int a, int b) {\n    return ", i);
+        for (int d = 0; d < CALL_DEPTH; d++)
+        {
+            (void)fprintf(file, "f%d(%s, ", i - 1, d % 2 == 0 ? "a" : "b");
+        }
+        (void)fprintf(file, "%d", i);
+        for (int d = 0; d < CALL_DEPTH; d++)
+        {
+            (void)fputc(')', file);
+        }
+        (void)fprintf(file, ";\n}\n");
+    }
+    (void)fprintf(file, "int main() { return f%d(1, 2); }\n", num_functions - 1);
+    return fclose(file) == 0;
+}
+
+// Compiles `source` to assembly in a child process and returns its peak RSS
+// in KiB, or a negative value on failure.
+static long compile_peak_rss(const char* source, bool stream, double* ms)
+{
+    double start = bench_now_ns();
+    pid_t child = fork();
+    if (child < 0)
+    {
+        return -1;
+    }
+    if (child == 0)
+    {
+        char* args[] = {"wacc", "--optimize", "1", "--asm", "--out", "/dev/null", (char*)source, "--stream"};
+        int argc = stream ? 8 : 7;
+        _exit(run((WaccArgBuf)BUF_REF(args, argc), stdout, stderr));
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return -1;
+    }
+    *ms = (bench_now_ns() - start) / 1e6;
+    return usage.ru_maxrss;
+}
+
+int main(void)
+{
+    static const int sizes[] = {1000, 2000, 4000};
+    char path[] = "/tmp/wacc-bench-XXXXXX.c";
+    int fd = mkstemps(path, 2);
+    if (fd < 0)
+    {
+        (void)fprintf(stderr, "failed to create a source file\n");
+        return 1;
+    }
+    (void)close(fd);
+    (void)printf("peak RSS compiling N functions of %d calls each with -O1 -S:\n", CALL_DEPTH);
+    (void)printf("  %8s %14s %14s %10s\n", "N", "whole module", "--stream", "ratio");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        double whole_ms = 0;
+        double stream_ms = 0;
+        long whole = write_source(path, sizes[i]) ? compile_peak_rss(path, false, &whole_ms) : -1;
+        long streamed = whole < 0 ? -1 : compile_peak_rss(path, true, &stream_ms);
+        if (streamed < 0)
+        {
+            (void)fprintf(stderr, "failed to compile %d functions\n", sizes[i]);
+            (void)remove(path);
+            return 1;
+        }
+        (void)printf("  %8d %10ld KiB %10ld KiB %9.2fx  (%.0f ms vs %.0f ms)\n",
+            sizes[i],
+            whole,
+            streamed,
+            (double)whole / (double)streamed,
+            whole_ms,
+            stream_ms);
+    }
+    (void)remove(path);
+    return 0;
+}
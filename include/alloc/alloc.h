@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A memory source. Containers that hold an `Allocator*` route every
+// allocation through it; a NULL allocator stands for the C library heap.
+typedef struct
+{
+    void* (*alloc)(void* ctx, size_t size);
+    void* (*realloc)(void* ctx, void* ptr, size_t size);
+    void (*free)(void* ctx, void* ptr);
+    void* ctx;
+} Allocator;
+
+static inline void* allocator_alloc(const Allocator* a, size_t size)
+{
+    return a ? a->alloc(a->ctx, size) : malloc(size);
+}
+
+static inline void* allocator_realloc(const Allocator* a, void* ptr, size_t size)
+{
+    return a ? a->realloc(a->ctx, ptr, size) : realloc(ptr, size);
+}
+
+static inline void allocator_free(const Allocator* a, void* ptr)
+{
+    if (a)
+    {
+        a->free(a->ctx, ptr);
+    }
+    else
+    {
+        free(ptr);
+    }
+}
+
+// the compiler has no sensible way to continue without memory
+static inline _Noreturn void allocator_oom(void)
+{
+    (void)fputs("fatal: out of memory\n", stderr);
+    abort();
+}
+
+// the C library heap as an explicit allocator
+extern const Allocator malloc_allocator;
+
+// Bump allocator: blocks are carved out of large chunks and individual frees
+// are no-ops. Everything is released at once by arena_reset or arena_free.
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct
+{
+    ArenaChunk* chunks;
+    size_t chunk_size;
+} Arena;
+
+// `chunk_size` of 0 picks a default
+void arena_init(Arena* arena, size_t chunk_size);
+Allocator arena_allocator(Arena* arena);
+// drop every allocation but keep the largest chunk for reuse
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
+
+// Wraps another allocator and records how it is used.
+typedef struct
+{
+    const Allocator* inner;
+    // number of alloc and realloc calls
+    size_t count;
+    // total bytes requested, counting only the growth of reallocs
+    size_t bytes;
+    // bytes currently allocated, and the most ever at once
+    size_t live;
+    size_t peak;
+} CountingAllocator;
+
+void counting_allocator_init(CountingAllocator* counter, const Allocator* inner);
+Allocator counting_allocator(CountingAllocator* counter);
@@ -1,49 +1,118 @@
 #pragma once
 
+#include "alloc/alloc.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Growth policy, overridable before the first include: the first allocation
+// holds BUF_MIN_CAP elements and every later one BUF_GROW(cap).
+#ifndef BUF_MIN_CAP
+#define BUF_MIN_CAP 8
+#endif
+
+#ifndef BUF_GROW
+#define BUF_GROW(cap) ((cap) * 2)
+#endif
+
+// `alloc` is where the storage comes from; NULL means the C library heap.
 #define BUF(T) \
 	struct { \
 		T* ptr; \
 		uint64_t len; \
 		uint64_t cap; \
 		bool ref; \
+		const Allocator* alloc; \
 	}
 
 #define BUF_EMPTY \
-	{ .ptr = NULL, .len = 0, .cap = 0, .ref = false }
+	{ .ptr = NULL, .len = 0, .cap = 0, .ref = false, .alloc = NULL }
 
 #define BUF_REF(p, sz) \
-	{ .ptr = (p), .len = (sz), .cap = (sz), .ref = true }
+	{ .ptr = (p), .len = (sz), .cap = (sz), .ref = true, .alloc = NULL }
 
 #define BUF_ARRAY(a) BUF_REF((a), sizeof(a) / sizeof((a)[0]))
 
 #define BUF_OWNER(p, sz) \
-	{ .ptr = (p), .len = (sz), .cap = (sz), .ref = false }
+	{ .ptr = (p), .len = (sz), .cap = (sz), .ref = false, .alloc = NULL }
 
 #define BUF_NEW \
-	{ .ptr = NULL, .len = 0, .cap = 0, .ref = false }
+	{ .ptr = NULL, .len = 0, .cap = 0, .ref = false, .alloc = NULL }
+
+// an empty buffer that allocates from `a`
+#define BUF_NEW_IN(a) \
+	{ .ptr = NULL, .len = 0, .cap = 0, .ref = false, .alloc = (a) }
 
 #define BUF_FREE(buf) \
 	do { \
 		if (!(buf).ref) { \
-			free((buf).ptr); \
+			allocator_free((buf).alloc, (buf).ptr); \
+		} \
+	} while (false)
+
+// grow `ptr` to at least `need` elements of `size` bytes; aborts when out of
+// memory so callers never see a half-grown buffer
+static inline void* buf_grow_(void* ptr, uint64_t* cap, uint64_t need, size_t size, const Allocator* a)
+{
+	uint64_t new_cap = *cap ? *cap : BUF_MIN_CAP;
+	while (new_cap < need) {
+		new_cap = BUF_GROW(new_cap);
+	}
+	void* new_ptr = allocator_realloc(a, ptr, new_cap * size);
+	if (new_ptr == NULL) {
+		allocator_oom();
+	}
+	*cap = new_cap;
+	return new_ptr;
+}
+
+// make room for at least `n` elements in total
+#define BUF_RESERVE(buf, n) \
+	do { \
+		if ((buf)->cap < (uint64_t)(n)) { \
+			(buf)->ptr = buf_grow_((buf)->ptr, &(buf)->cap, (n), sizeof(*(buf)->ptr), (buf)->alloc); \
 		} \
 	} while (false)
 
 #define BUF_PUSH(buf, val) \
 	do { \
 		if ((buf)->len == (buf)->cap) { \
-			(buf)->cap = (buf)->cap ? (buf)->cap * 2 : 1; \
-			(buf)->ptr = realloc((buf)->ptr, (buf)->cap * sizeof(*(buf)->ptr)); \
+			(buf)->ptr = buf_grow_((buf)->ptr, &(buf)->cap, (buf)->len + 1, sizeof(*(buf)->ptr), (buf)->alloc); \
 		} \
 		(buf)->ptr[(buf)->len++] = (val); \
 	} while (false)
 
+// append `n` elements copied from `src`
+#define BUF_EXTEND(buf, src, n) \
+	do { \
+		uint64_t buf_n_ = (n); \
+		BUF_RESERVE(buf, (buf)->len + buf_n_); \
+		if (buf_n_ > 0) { \
+			memcpy((buf)->ptr + (buf)->len, (src), buf_n_ * sizeof(*(buf)->ptr)); \
+		} \
+		(buf)->len += buf_n_; \
+	} while (false)
+
+// release the capacity beyond `len`
+#define BUF_SHRINK(buf) \
+	do { \
+		if (!(buf)->ref && (buf)->cap > (buf)->len) { \
+			if ((buf)->len == 0) { \
+				allocator_free((buf)->alloc, (buf)->ptr); \
+				(buf)->ptr = NULL; \
+			} else { \
+				void* buf_p_ = allocator_realloc((buf)->alloc, (buf)->ptr, (buf)->len * sizeof(*(buf)->ptr)); \
+				if (buf_p_ != NULL) { \
+					(buf)->ptr = buf_p_; \
+				} \
+			} \
+			(buf)->cap = (buf)->len; \
+		} \
+	} while (false)
+
 #define BUF_POP_FIRST(buf) \
 	do { \
 		if ((buf)->len > 0) { \
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "alloc/alloc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Open-addressing hash map using Robin Hood probing.
+//
+// `hashfn` and `eqfn` are supplied per operation, in the same way BUF_FIND
+// takes `eq`: `hashfn(key)` must yield a uint64_t and `eqfn(a, b)` a truth
+// value. For `str` keys, use `str_hash` and `str_eq` from "str/str.h".
+//
+// Every slot caches the hash of its key with the top bit set, so a cached hash
+// of zero marks an empty slot and growing never calls `hashfn` again. Removal
+// shifts the following run back by one slot instead of leaving tombstones.
+#define HASHMAP(K, V) \
+	struct { \
+		struct { \
+			K key; \
+			V value; \
+			uint64_t hash; \
+		}* slots; \
+		uint64_t len; \
+		uint64_t cap; \
+		const Allocator* alloc; \
+	}
+
+#define HASHMAP_NEW \
+	{ .slots = NULL, .len = 0, .cap = 0, .alloc = NULL }
+
+// an empty map whose slots come from `a`
+#define HASHMAP_NEW_IN(a) \
+	{ .slots = NULL, .len = 0, .cap = 0, .alloc = (a) }
+
+// smallest capacity of an allocated map, must be a power of two
+#define HASHMAP_MIN_CAP 8
+
+// a map of capacity `cap` holds at most `cap * 7 / 8` entries
+#define HASHMAP_MAX_LEN(cap) ((cap) - (cap) / 8)
+
+#define HASHMAP_HASH_(h) ((uint64_t)(h) | UINT64_C(0x8000000000000000))
+
+#define HASHMAP_DIST_(map, i) (((i) - (map)->slots[i].hash) & ((map)->cap - 1))
+
+#define HASHMAP_SLOT_USED(map, i) ((map).slots[i].hash != 0)
+
+#define HASHMAP_FREE(map) \
+	do { \
+		allocator_free((map).alloc, (map).slots); \
+	} while (false)
+
+// remove every entry, keeping the allocated slots
+#define HASHMAP_CLEAR(map) \
+	do { \
+		if ((map)->cap > 0) { \
+			memset((map)->slots, 0, (map)->cap * sizeof(*(map)->slots)); \
+		} \
+		(map)->len = 0; \
+	} while (false)
+
+// place an entry known not to be in the map; used when rehashing
+#define HASHMAP_PLACE_(map, entry) \
+	do { \
+		__typeof__(*(map)->slots) hm_carry_ = (entry); \
+		uint64_t hm_i_ = hm_carry_.hash & ((map)->cap - 1); \
+		uint64_t hm_dist_ = 0; \
+		while ((map)->slots[hm_i_].hash != 0) { \
+			uint64_t hm_slot_dist_ = HASHMAP_DIST_(map, hm_i_); \
+			if (hm_slot_dist_ < hm_dist_) { \
+				__typeof__(hm_carry_) hm_tmp_ = (map)->slots[hm_i_]; \
+				(map)->slots[hm_i_] = hm_carry_; \
+				hm_carry_ = hm_tmp_; \
+				hm_dist_ = hm_slot_dist_; \
+			} \
+			hm_i_ = (hm_i_ + 1) & ((map)->cap - 1); \
+			hm_dist_++; \
+		} \
+		(map)->slots[hm_i_] = hm_carry_; \
+	} while (false)
+
+// make room for at least `n` entries without further rehashing
+#define HASHMAP_RESERVE(map, n) \
+	do { \
+		uint64_t hm_want_ = (map)->cap ? (map)->cap : HASHMAP_MIN_CAP; \
+		while (HASHMAP_MAX_LEN(hm_want_) < (uint64_t)(n)) { \
+			hm_want_ *= 2; \
+		} \
+		if (hm_want_ != (map)->cap) { \
+			__typeof__((map)->slots) hm_old_ = (map)->slots; \
+			uint64_t hm_old_cap_ = (map)->cap; \
+			(map)->slots = allocator_alloc((map)->alloc, hm_want_ * sizeof(*(map)->slots)); \
+			if ((map)->slots == NULL) { \
+				allocator_oom(); \
+			} \
+			memset((map)->slots, 0, hm_want_ * sizeof(*(map)->slots)); \
+			(map)->cap = hm_want_; \
+			for (uint64_t hm_j_ = 0; hm_j_ < hm_old_cap_; hm_j_++) { \
+				if (hm_old_[hm_j_].hash != 0) { \
+					HASHMAP_PLACE_(map, hm_old_[hm_j_]); \
+				} \
+			} \
+			allocator_free((map)->alloc, hm_old_); \
+		} \
+	} while (false)
+
+// insert `k` -> `v`; if `k` is already present, only its value is replaced
+#define HASHMAP_PUT(map, k, v, hashfn, eqfn) \
+	do { \
+		HASHMAP_RESERVE(map, (map)->len + 1); \
+		__typeof__(*(map)->slots) hm_carry_; \
+		hm_carry_.key = (k); \
+		hm_carry_.value = (v); \
+		hm_carry_.hash = HASHMAP_HASH_(hashfn(hm_carry_.key)); \
+		uint64_t hm_i_ = hm_carry_.hash & ((map)->cap - 1); \
+		uint64_t hm_dist_ = 0; \
+		bool hm_displaced_ = false; \
+		for (;;) { \
+			if ((map)->slots[hm_i_].hash == 0) { \
+				(map)->slots[hm_i_] = hm_carry_; \
+				(map)->len++; \
+				break; \
+			} \
+			if (!hm_displaced_ && (map)->slots[hm_i_].hash == hm_carry_.hash && \
+				eqfn((map)->slots[hm_i_].key, hm_carry_.key)) { \
+				(map)->slots[hm_i_].value = hm_carry_.value; \
+				break; \
+			} \
+			uint64_t hm_slot_dist_ = HASHMAP_DIST_(map, hm_i_); \
+			if (hm_slot_dist_ < hm_dist_) { \
+				__typeof__(hm_carry_) hm_tmp_ = (map)->slots[hm_i_]; \
+				(map)->slots[hm_i_] = hm_carry_; \
+				hm_carry_ = hm_tmp_; \
+				hm_dist_ = hm_slot_dist_; \
+				hm_displaced_ = true; \
+			} \
+			hm_i_ = (hm_i_ + 1) & ((map)->cap - 1); \
+			hm_dist_++; \
+		} \
+	} while (false)
+
+// index of the slot holding `k` into `*(index)`, or `map.cap` if absent
+#define HASHMAP_INDEX_(map, k, hashfn, eqfn, index) \
+	do { \
+		*(index) = (map).cap; \
+		if ((map).len > 0) { \
+			__typeof__((map).slots->key) hm_key_ = (k); \
+			uint64_t hm_hash_ = HASHMAP_HASH_(hashfn(hm_key_)); \
+			uint64_t hm_i_ = hm_hash_ & ((map).cap - 1); \
+			for (uint64_t hm_dist_ = 0;; hm_dist_++) { \
+				if ((map).slots[hm_i_].hash == 0 || HASHMAP_DIST_(&(map), hm_i_) < hm_dist_) { \
+					break; \
+				} \
+				if ((map).slots[hm_i_].hash == hm_hash_ && eqfn((map).slots[hm_i_].key, hm_key_)) { \
+					*(index) = hm_i_; \
+					break; \
+				} \
+				hm_i_ = (hm_i_ + 1) & ((map).cap - 1); \
+			} \
+		} \
+	} while (false)
+
+// like BUF_FIND: `*(target)` is pointed at the value for `k`, if there is one
+#define HASHMAP_GET(map, k, hashfn, eqfn, target) \
+	do { \
+		uint64_t hm_found_; \
+		HASHMAP_INDEX_(map, k, hashfn, eqfn, &hm_found_); \
+		if (hm_found_ != (map).cap) { \
+			*(target) = &(map).slots[hm_found_].value; \
+		} \
+	} while (false)
+
+// remove `k`; if `removed` is not NULL the evicted slot is copied to it, so
+// owned keys and values can be released by the caller
+#define HASHMAP_REMOVE(map, k, hashfn, eqfn, removed) \
+	do { \
+		uint64_t hm_found_; \
+		HASHMAP_INDEX_(*(map), k, hashfn, eqfn, &hm_found_); \
+		if (hm_found_ != (map)->cap) { \
+			__typeof__((map)->slots) hm_out_ = (removed); \
+			if (hm_out_ != NULL) { \
+				*hm_out_ = (map)->slots[hm_found_]; \
+			} \
+			(map)->len--; \
+			for (;;) { \
+				uint64_t hm_next_ = (hm_found_ + 1) & ((map)->cap - 1); \
+				if ((map)->slots[hm_next_].hash == 0 || HASHMAP_DIST_(map, hm_next_) == 0) { \
+					(map)->slots[hm_found_].hash = 0; \
+					break; \
+				} \
+				(map)->slots[hm_found_] = (map)->slots[hm_next_]; \
+				hm_found_ = hm_next_; \
+			} \
+		} \
+	} while (false)
+
+// finalizer from MurmurHash3, usable as `hashfn` for integer and pointer keys
+static inline uint64_t hashmap_hash_u64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= UINT64_C(0xff51afd7ed558ccd);
+	x ^= x >> 33;
+	x *= UINT64_C(0xc4ceb9fe1a85ec53);
+	x ^= x >> 33;
+	return x;
+}
+
+#define hashmap_eq_scalar(a, b) ((a) == (b))
@@ -32,7 +32,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include "alloc/alloc.h"
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -46,10 +49,12 @@ typedef struct
     const char* ptr;
     size_t len;
     bool owner;
+    // of an owner: where its chars came from and go back to, NULL for the C library heap
+    const Allocator* alloc;
 } str;
 
 // NULL string
-#define str_null ((str){0, 0, false})
+#define str_null ((str){0, 0, false, NULL})
 
 // string properties ----------------------------------------------------------------------
 // length of the string
@@ -89,6 +94,14 @@ static inline bool str_is_ref(const str s)
 }
 
 // string memory control -------------------------------------------------------------------
+// select the allocator for every string created on this thread, returning the previous
+// one; NULL (the default) is the C library heap. A string keeps the allocator it was
+// created with and is freed through it, whichever allocator or thread frees it.
+const Allocator* str_set_allocator(const Allocator* alloc);
+
+// the allocator strings on this thread currently use
+const Allocator* str_get_allocator(void);
+
 // free memory allocated for the string
 void str_free(str s);
 
@@ -149,6 +162,9 @@ static inline bool str_eq_ci(const str s1, const str s2)
     return str_cmp_ci(s1, s2) == 0;
 }
 
+// hash of the string contents (FNV-1a), e.g. for HASHMAP keys
+uint64_t str_hash(str s);
+
 // test for prefix
 bool str_has_prefix(str s, str prefix);
 
@@ -176,11 +192,11 @@ int str_join_range(str* dest, str sep, const str* src, size_t count);
 
 // constructors ----------------------------------------------------------------------------
 // string reference from a string literal
-#define str_lit(s) ((str){"" s, sizeof(s) - 1, false})
+#define str_lit(s) ((str){"" s, sizeof(s) - 1, false, NULL})
 
 static inline str str_ref_(const str s)
 {
-    return (str){s.ptr, s.len, false};
+    return (str){s.ptr, s.len, false, NULL};
 }
 
 str str_ref_from_ptr_(const char* s);
@@ -191,7 +207,7 @@ str str_ref_from_ptr_(const char* s);
 // create a reference to the given range of chars
 str str_ref_chars(const char* s, size_t n);
 
-// take ownership of the given range of chars
+// take ownership of the given range of chars, allocated through str_get_allocator()
 str str_acquire_chars(const char* s, size_t n);
 
 // take ownership of the given string
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "alloc/alloc.h"
+#include "buf/buf.h"
 #include "str/str.h"
+#include "wacc/range.h"
 
 #include <stdint.h>
 
@@ -16,15 +19,35 @@ typedef struct
     WaccExpressionType type;
 } WaccExpression;
 
+typedef BUF(WaccExpression*) WaccExpressionBuf;
+
 typedef struct
 {
     WaccExpression base;
     uint64_t value;
 } WaccConstantExpression;
 
+// a parameter of the enclosing function
+typedef struct
+{
+    WaccExpression base;
+    // position of the name in the source, see wacc_system_text
+    Range name;
+} WaccVariableExpression;
+
+typedef struct
+{
+    WaccExpression base;
+    // position of the callee's name in the source, see wacc_system_text
+    Range name;
+    WaccExpressionBuf args;
+} WaccCallExpression;
+
 typedef struct
 {
     WaccExpression* expression;
+    // position in the source, see wacc_system_line
+    Range span;
 } WaccStatement;
 
 typedef enum
@@ -39,17 +62,18 @@ typedef struct
     WaccFunctionType type;
 } WaccFunction;
 
+// positions of the parameter names in the source; every parameter is an int
+typedef BUF(Range) WaccParameterBuf;
+
 typedef struct
 {
     WaccFunction base;
-    str name;
+    // position of the name in the source, see wacc_system_text
+    Range name;
+    WaccParameterBuf params;
     WaccStatement statement;
 } WaccActualFunction;
 
-typedef struct
-{
-    WaccFunction* function;
-} WaccProgram;
 
 typedef enum
 {
@@ -62,22 +86,33 @@ typedef struct
 {
     WaccNodeKind kind;
     union {
-        str text;
-        WaccProgram program;
+        Range span;
         WaccFunction* function;
         WaccStatement statement;
         WaccExpression* expression;
+        WaccParameterBuf parameters;
+        WaccExpressionBuf arguments;
     } as;
 } WaccNode;
 
-WaccNode* wacc_node_new_text(str text);
-WaccNode* wacc_node_new_program(WaccFunction* function);
-WaccNode* wacc_node_new_function(str name, WaccStatement statement);
-WaccNode* wacc_node_new_statement(WaccExpression* expression);
-WaccNode* wacc_node_new_expression(uint64_t value);
+WaccNode* wacc_node_new_span(const Allocator* alloc, Range span);
+WaccNode* wacc_node_new_function(const Allocator* alloc, Range name, WaccParameterBuf params, WaccStatement statement);
+WaccNode* wacc_node_new_parameters(const Allocator* alloc);
+void wacc_node_add_parameter(WaccNode* parameters, Range name);
+WaccNode* wacc_node_new_statement(const Allocator* alloc, WaccExpression* expression, Range span);
+WaccNode* wacc_node_new_expression(const Allocator* alloc, uint64_t value);
+WaccNode* wacc_node_new_variable(const Allocator* alloc, Range name);
+WaccNode* wacc_node_new_call(const Allocator* alloc, Range name, WaccExpressionBuf args);
+WaccNode* wacc_node_new_arguments(const Allocator* alloc);
+void wacc_node_add_argument(WaccNode* arguments, WaccExpression* expression);
+
+WaccNode* wacc_error_node_function(const Allocator* alloc);
+WaccNode* wacc_error_node_expression(const Allocator* alloc);
 
-WaccNode* wacc_error_node_function(void);
-WaccNode* wacc_error_node_expression(void);
+// free only the node itself, once its payload has been moved elsewhere
+void wacc_node_release(const Allocator* alloc, WaccNode* node);
 
-void ast_free(WaccNode* ast);
-void statement_free(WaccStatement statement);
+// free a top-level function node, as wacc_parse returns one per call
+void ast_free(const Allocator* alloc, WaccNode* ast);
+void statement_free(const Allocator* alloc, WaccStatement statement);
+void parameters_free(WaccParameterBuf params);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "alloc/alloc.h"
+#include "wacc/ir.h"
+
+#include <buf/buf.h>
+#include <stdint.h>
+
+// In-process interpreter over the IR.
+//
+// Every function is translated once into a compact bytecode: one instruction
+// per IR instruction reading and writing slots of a frame indexed by value,
+// with constants preloaded into the frame, phis turned into copies on the
+// edges into their block and branch targets resolved to code offsets. Values
+// wrap and compare exactly as wacc_ir_fold evaluates them, and shift counts
+// are masked to the width of the type as the x86 backend leaves them to the
+// hardware, so a program computes what its compiled form would.
+
+typedef enum
+{
+    WACC_INTERP_OK,
+    // division by zero or of the most negative value by -1
+    WACC_INTERP_ARITHMETIC_TRAP,
+    WACC_INTERP_STACK_OVERFLOW,
+} WaccInterpStatus;
+
+typedef struct
+{
+    WaccInterpStatus status;
+    // the return value, normalized to the function's type
+    int64_t value;
+} WaccInterpResult;
+
+typedef struct WaccInterpFunction WaccInterpFunction;
+
+typedef BUF(WaccInterpFunction*) WaccInterpFunctionBuf;
+
+typedef struct
+{
+    WaccInterpFunctionBuf functions;
+    // frames of the running calls, reused between calls
+    BUF(int64_t) stack;
+    // the module's profile counters, added to by every call
+    BUF(uint64_t) counters;
+    const Allocator* alloc;
+} WaccInterp;
+
+// translate every function of a verified module; the interpreter does not
+// refer to `module` afterwards
+WaccInterp* wacc_interp_new(const WaccIrModule* module, const Allocator* alloc);
+void wacc_interp_free(WaccInterp* interp);
+
+// call the function at index `function` of the module with `args`, one per
+// parameter
+WaccInterpResult wacc_interp_call(WaccInterp* interp, uint32_t function, const int64_t* args, uint32_t num_args);
+
+const char* wacc_interp_status_message(WaccInterpStatus status);
@@ -0,0 +1,315 @@
+#pragma once
+
+#include "alloc/alloc.h"
+#include "wacc/ast.h"
+#include "wacc/system.h"
+
+#include <buf/buf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <str/str.h>
+
+// SSA intermediate representation.
+//
+// A module is a list of functions. Each function owns an arena that backs all
+// of its arrays: blocks, the instructions of each block, the type of every
+// virtual register and the operand lists of phis and calls. Freeing a function
+// releases the whole arena at once.
+//
+// Virtual registers are numbered from 1 within their function; 0 means "no
+// value". Every register is defined by exactly one instruction. Block 0 is the
+// entry block; every block ends in exactly one terminator and its phis come
+// first.
+
+typedef uint32_t WaccIrValue;
+typedef uint32_t WaccIrBlockId;
+
+#define WACC_IR_NO_VALUE ((WaccIrValue)0)
+#define WACC_IR_NO_BLOCK ((WaccIrBlockId)UINT32_MAX)
+
+typedef enum
+{
+#define X(x) WACC_IR_TYPE_##x,
+#include "wacc/ir/types.def"
+#undef X
+} WaccIrType;
+
+enum
+{
+    // defines a value
+    WACC_IR_DEST = 1 << 0,
+    // no side effects: removable when unused, never changes memory
+    WACC_IR_PURE = 1 << 1,
+    WACC_IR_TERMINATOR = 1 << 2,
+    WACC_IR_COMMUTATIVE = 1 << 3,
+    // may fault at run time, so must not be executed speculatively
+    WACC_IR_TRAPS = 1 << 4,
+    WACC_IR_COMPARE = 1 << 5,
+};
+
+typedef enum
+{
+#define X(x, args, flags) WACC_IR_##x,
+#include "wacc/ir/opcodes.def"
+#undef X
+} WaccIrOpcode;
+
+typedef struct
+{
+    const char* name;
+    uint8_t num_args;
+    uint8_t flags;
+} WaccIrOpcodeInfo;
+
+extern const WaccIrOpcodeInfo wacc_ir_opcodes[];
+
+// an entry of a phi or call operand list; `block` is the incoming edge of a phi
+typedef struct
+{
+    WaccIrValue value;
+    WaccIrBlockId block;
+} WaccIrOperand;
+
+typedef struct
+{
+    WaccIrOpcode op;
+    // type of `dest`, or of the operand for terminators
+    WaccIrType type;
+    WaccIrValue dest;
+    WaccIrValue args[2];
+    // the source line the instruction was built from, 0 if it has none
+    uint32_t line;
+    // CONST: the value, sign-extended from `type`; PARAM: the parameter index;
+    // CALL: the index of the callee in the module; COUNT: the counter
+    int64_t imm;
+    // BR: the target; CBR: the targets when the condition is nonzero and zero
+    WaccIrBlockId targets[2];
+    // PHI and CALL: a range of WaccIrFunction.operands
+    uint32_t first;
+    uint32_t count;
+} WaccIrInst;
+
+typedef BUF(WaccIrInst) WaccIrInstBuf;
+typedef BUF(WaccIrBlockId) WaccIrBlockIdBuf;
+typedef BUF(WaccIrValue) WaccIrValueBuf;
+typedef BUF(WaccIrType) WaccIrTypeBuf;
+typedef BUF(WaccIrOperand) WaccIrOperandBuf;
+
+typedef struct
+{
+    WaccIrInstBuf insts;
+    // filled in by wacc_ir_compute_preds
+    WaccIrBlockIdBuf preds;
+    // with a profile, how often the block ran and, if it ends in a CBR, how
+    // often it went to targets[0]
+    uint64_t count;
+    uint64_t taken;
+} WaccIrBlock;
+
+typedef BUF(WaccIrBlock) WaccIrBlockBuf;
+
+typedef struct
+{
+    // owned, or a reference to a literal; freed with the function
+    str name;
+    WaccIrType ret_type;
+    uint32_t num_params;
+    // visible outside the translation unit
+    bool exported;
+    // the source line of the definition, 0 if unknown
+    uint32_t line;
+    // whether the block counts come from a profile; passes that add blocks
+    // give them counts of their own
+    bool profiled;
+    WaccIrBlockBuf blocks;
+    // indexed by WaccIrValue
+    WaccIrTypeBuf value_types;
+    WaccIrOperandBuf operands;
+    Arena arena;
+    Allocator alloc;
+} WaccIrFunction;
+
+typedef BUF(WaccIrFunction*) WaccIrFunctionBuf;
+
+// The counters COUNT instructions add to, which the program writes out as it
+// exits; none unless the module was instrumented.
+typedef struct
+{
+    uint32_t num_counters;
+    // of the functions and blocks the counters were numbered over
+    uint64_t checksum;
+    // the file to write
+    str path;
+} WaccIrCounters;
+
+typedef struct
+{
+    WaccIrFunctionBuf functions;
+    WaccIrCounters counters;
+    const Allocator* alloc;
+} WaccIrModule;
+
+static inline bool wacc_ir_has_flag(WaccIrOpcode op, int flag)
+{
+    return (wacc_ir_opcodes[op].flags & flag) != 0;
+}
+
+static inline WaccIrInst* wacc_ir_terminator(WaccIrBlock* block)
+{
+    return block->insts.len > 0 ? &block->insts.ptr[block->insts.len - 1] : NULL;
+}
+
+// width in bits of an integer type
+uint32_t wacc_ir_type_bits(WaccIrType type);
+// wrap `value` to `type` the way the machine would, sign-extended to 64 bits; i1 values
+// are 0 or 1
+int64_t wacc_ir_normalize(WaccIrType type, int64_t value);
+
+// Evaluate `op` on constants with C semantics: two's-complement wrap-around, truncating
+// division. `arg_type` is the type of the operands, which differs from `type` for
+// comparisons and conversions. Returns false when the result must be left to run time:
+// division by zero, the most negative value divided by -1, and shift counts outside the
+// width of the type.
+bool wacc_ir_fold(WaccIrOpcode op, WaccIrType type, WaccIrType arg_type, int64_t a, int64_t b, int64_t* result);
+
+WaccIrModule* wacc_ir_module_new(const Allocator* alloc);
+void wacc_ir_module_free(WaccIrModule* module);
+
+// append a function with an empty entry block
+WaccIrFunction* wacc_ir_function_new(WaccIrModule* module, str name, WaccIrType ret_type, uint32_t num_params);
+// Free the body of a function that has been compiled, keeping its declaration for
+// the calls in functions built after it. The function is left without blocks.
+void wacc_ir_function_release(WaccIrFunction* function);
+void wacc_ir_function_free(const Allocator* alloc, WaccIrFunction* function);
+
+WaccIrBlockId wacc_ir_block_new(WaccIrFunction* function);
+WaccIrValue wacc_ir_value_new(WaccIrFunction* function, WaccIrType type);
+
+static inline WaccIrType wacc_ir_value_type(const WaccIrFunction* function, WaccIrValue value)
+{
+    return function->value_types.ptr[value];
+}
+
+// append `inst` to `block`, giving it a fresh destination if its opcode defines one
+WaccIrValue wacc_ir_append(WaccIrFunction* function, WaccIrBlockId block, WaccIrInst inst);
+
+WaccIrValue wacc_ir_emit_const(WaccIrFunction* function, WaccIrBlockId block, WaccIrType type, int64_t value);
+WaccIrValue wacc_ir_emit_param(WaccIrFunction* function, WaccIrBlockId block, WaccIrType type, uint32_t index);
+WaccIrValue wacc_ir_emit_unary(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrOpcode op, WaccIrType type, WaccIrValue a);
+WaccIrValue wacc_ir_emit_binary(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrOpcode op, WaccIrType type, WaccIrValue a, WaccIrValue b);
+// `incoming` values may be WACC_IR_NO_VALUE and patched once known
+WaccIrValue wacc_ir_emit_phi(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrType type, const WaccIrOperand* incoming, uint32_t count);
+WaccIrValue wacc_ir_emit_call(WaccIrFunction* function,
+    WaccIrBlockId block,
+    WaccIrType type,
+    uint32_t callee,
+    const WaccIrValue* args,
+    uint32_t count);
+void wacc_ir_emit_br(WaccIrFunction* function, WaccIrBlockId block, WaccIrBlockId target);
+void wacc_ir_emit_cbr(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrValue cond, WaccIrBlockId if_true, WaccIrBlockId if_false);
+void wacc_ir_emit_ret(WaccIrFunction* function, WaccIrBlockId block, WaccIrValue value);
+
+// the phi or call operand list of `inst`
+static inline WaccIrOperand* wacc_ir_operands(const WaccIrFunction* function, const WaccIrInst* inst)
+{
+    return function->operands.ptr + inst->first;
+}
+
+// reserve `count` fresh operand slots and point `inst` at them
+void wacc_ir_set_operands(WaccIrFunction* function, WaccIrInst* inst, const WaccIrOperand* operands, uint32_t count);
+
+// Number of values `inst` reads, and a pointer to the i-th of them so passes
+// can rewrite uses in place. Unused slots (a void `ret`) read as WACC_IR_NO_VALUE.
+uint32_t wacc_ir_num_uses(const WaccIrInst* inst);
+WaccIrValue* wacc_ir_use(WaccIrFunction* function, WaccIrInst* inst, uint32_t i);
+
+// successors of a block from its terminator; returns how many were written
+uint32_t wacc_ir_successors(const WaccIrBlock* block, WaccIrBlockId out[2]);
+
+// How often control went from `from` to `to`, one of its successors, by the
+// counts of a profiled function.
+uint64_t wacc_ir_edge_count(const WaccIrFunction* function, WaccIrBlockId from, WaccIrBlockId to);
+
+// rebuild every block's predecessor list from the terminators
+void wacc_ir_compute_preds(WaccIrFunction* function);
+
+// blocks reachable from the entry in reverse postorder
+void wacc_ir_reverse_postorder(const WaccIrFunction* function, WaccIrBlockIdBuf* out);
+
+// Immediate dominators from the predecessor lists, after Cooper, Harvey and
+// Kennedy: idom[b] is the immediate dominator of block b, the entry is its own
+// and blocks unreachable from the entry have WACC_IR_NO_BLOCK.
+void wacc_ir_dominators(const WaccIrFunction* function, WaccIrBlockIdBuf* idom);
+
+// whether block `a` dominates block `b` in the tree `idom`
+bool wacc_ir_dominates(const WaccIrBlockIdBuf* idom, WaccIrBlockId a, WaccIrBlockId b);
+
+// total number of instructions
+size_t wacc_ir_num_insts(const WaccIrFunction* function);
+
+// where an instruction is
+typedef struct
+{
+    WaccIrBlockId block;
+    uint32_t index;
+} WaccIrInstRef;
+
+typedef BUF(WaccIrInstRef) WaccIrInstRefBuf;
+
+// Def-use chains. The instructions reading value v are
+// users.ptr[start.ptr[v] .. start.ptr[v + 1]], once per operand slot, and
+// defs.ptr[v] is the instruction defining it. Any change to the function
+// invalidates them.
+typedef struct
+{
+    BUF(uint32_t) start;
+    WaccIrInstRefBuf users;
+    WaccIrInstRefBuf defs;
+} WaccIrUses;
+
+void wacc_ir_uses_build(const WaccIrFunction* function, WaccIrUses* uses);
+void wacc_ir_uses_free(WaccIrUses* uses);
+
+// turn `inst` into a nop; wacc_ir_remove_nops deletes them in one sweep
+static inline void wacc_ir_kill(WaccIrInst* inst)
+{
+    *inst = (WaccIrInst){.op = WACC_IR_NOP, .type = WACC_IR_TYPE_VOID};
+}
+
+// delete every nop, returning how many there were
+size_t wacc_ir_remove_nops(WaccIrFunction* function);
+
+// check structural invariants, describing the first violation to `err`
+bool wacc_ir_verify(const WaccIrFunction* function, FILE* err);
+
+void wacc_ir_print_function(const WaccIrFunction* function, FILE* out);
+void wacc_ir_print(const WaccIrModule* module, FILE* out);
+
+// Lowers a program into a module a function at a time, as the parser produces
+// them. Names are resolved here and their errors reported to `system`; the
+// module is only meaningful when none were.
+typedef struct WaccIrBuilder WaccIrBuilder;
+
+WaccIrBuilder* wacc_ir_builder_new(WaccSystem* system, WaccIrModule* module);
+void wacc_ir_builder_free(WaccIrBuilder* builder);
+// Append a function that parsed without errors to the module. It may call
+// itself and the functions appended before it; its name is copied, so the
+// module does not refer to the source text.
+WaccIrFunction* wacc_ir_build_function(WaccIrBuilder* builder, const WaccActualFunction* function);
+
+// A whole program, of one file or several, is built by declaring every one of
+// its functions before defining any, so that a call may go to a function
+// declared after its caller or in another file, as the linker would resolve
+// it. Each file is declared and defined after wacc_ir_builder_set_file.
+
+// go on with the file of `system`
+void wacc_ir_builder_set_file(WaccIrBuilder* builder, WaccSystem* system);
+// append `function` to the module with an empty body
+WaccIrFunction* wacc_ir_declare_function(WaccIrBuilder* builder, const WaccActualFunction* function);
+// build the body of function `index` of the module, declared from `function`
+void wacc_ir_define_function(WaccIrBuilder* builder, uint32_t index, const WaccActualFunction* function);
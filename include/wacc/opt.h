@@ -0,0 +1,92 @@
+#pragma once
+
+#include "wacc/ir.h"
+#include "wacc/pool.h"
+
+#include <stddef.h>
+
+// Optimization passes over the SSA IR.
+//
+// Every pass works on one function at a time, except the inliner which works
+// on the whole module. Passes keep the functions valid for wacc_ir_verify and
+// add what they did to a WaccOptStats.
+
+typedef struct
+{
+    // instructions replaced by a constant
+    size_t folded;
+    // conditional branches replaced by a jump
+    size_t branches_resolved;
+    // instructions deleted
+    size_t removed;
+    // multiplications, divisions and remainders by constants rewritten
+    size_t reduced;
+    // call sites replaced by the body of the callee
+    size_t inlined;
+    // blocks unreachable from the entry deleted
+    size_t blocks_removed;
+    // functions neither exported nor called deleted
+    size_t functions_removed;
+    // loop-invariant instructions moved out of their loop
+    size_t hoisted;
+    // multiplications of induction variables replaced by additions
+    size_t ivs_reduced;
+} WaccOptStats;
+
+enum
+{
+    WACC_OPT_DEFAULT_INLINE_THRESHOLD = 32,
+};
+
+typedef struct
+{
+    // 0 runs no passes
+    int level;
+    // callees of at most this many instructions are inlined at every call site
+    uint32_t inline_threshold;
+    // runs the function passes of wacc_opt_module on its workers; NULL runs
+    // them on the caller's thread
+    WaccPool* pool;
+} WaccOptOptions;
+
+// Sparse conditional constant propagation: finds every value that is constant
+// on all executable paths, replaces it by a constant, resolves branches on
+// constant conditions and deletes the computations that became unused.
+// Operations whose result is only known at run time (see wacc_ir_fold) keep
+// their run-time behavior.
+void wacc_opt_sccp(WaccIrFunction* function, WaccOptStats* stats);
+
+// Strength reduction: division and remainder by a constant become
+// multiplications by a fixed-point reciprocal and shifts, multiplication by a
+// power of two a shift.
+void wacc_opt_strength(WaccIrFunction* function, WaccOptStats* stats);
+
+// Loop optimizations: gives every natural loop a preheader, moves the
+// computations that do not change between iterations into it, and replaces
+// multiplications of an induction variable by new induction variables.
+void wacc_opt_loops(WaccIrFunction* function, WaccOptStats* stats);
+
+// Dead code elimination: deletes the blocks unreachable from the entry and
+// every pure instruction that no call or terminator depends on, directly or
+// through other instructions.
+void wacc_opt_dce(WaccIrFunction* function, WaccOptStats* stats);
+
+// delete the functions that are not exported and not called from the
+// exported ones, directly or indirectly; calls are renumbered to match
+void wacc_opt_remove_dead_functions(WaccIrModule* module, WaccOptStats* stats);
+
+// Inlining, bottom-up over the call graph: a call is replaced by the body of
+// the callee when the callee is small enough for `options->inline_threshold`,
+// or when it is not exported and has no other call site. Recursive calls are
+// kept. With a profile, hot calls get a larger threshold and calls that never
+// ran none.
+void wacc_opt_inline(WaccIrModule* module, const WaccOptOptions* options, WaccOptStats* stats);
+
+// run the passes enabled at `options->level` on every function
+void wacc_opt_module(WaccIrModule* module, const WaccOptOptions* options, WaccOptStats* stats);
+
+// run the passes enabled at `options->level` that look at one function only,
+// for callers that compile each function before the next exists
+void wacc_opt_function(WaccIrFunction* function, const WaccOptOptions* options, WaccOptStats* stats);
+
+void wacc_opt_print_stats(const WaccOptStats* stats, FILE* out);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Worker threads for the passes that handle one function at a time.
+//
+// A loop over `count` indices gives every worker, the calling thread among
+// them, a contiguous share of the indices to take from the front. A worker
+// whose share runs out steals the back half of another's, so a few large
+// functions do not hold up the rest. Tasks may run in any order and on any
+// worker; they stay deterministic by writing only to what belongs to their
+// index, and to per-worker state that the caller combines afterwards.
+
+typedef struct WaccPool WaccPool;
+
+// `index` is the item to process and `worker`, below wacc_pool_size, the
+// worker processing it
+typedef void WaccPoolTask(void* context, uint64_t index, uint32_t worker);
+
+// a pool of `num_workers` workers counting the calling thread, fewer if the
+// system refuses to start more threads; 1 starts none
+WaccPool* wacc_pool_new(uint32_t num_workers);
+void wacc_pool_free(WaccPool* pool);
+
+// the number of workers; a NULL pool runs everything on the calling thread
+uint32_t wacc_pool_size(const WaccPool* pool);
+
+// run `task` for every index below `count` and return once all have finished
+void wacc_pool_for(WaccPool* pool, uint64_t count, WaccPoolTask* task, void* context);
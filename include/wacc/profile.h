@@ -0,0 +1,46 @@
+#pragma once
+
+#include "wacc/ir.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <str/str.h>
+
+// Profile-guided optimization.
+//
+// An instrumented module counts how often each of its blocks runs, with a
+// COUNT after the phis of every block, and how often each conditional branch
+// goes to its first target, with a COUNT on a block of its own split into
+// that edge; the other edge is the difference. The program writes the
+// counters to a file as it exits: WACC_PROFILE_HEADER_SIZE bytes of header,
+// the magic "WACCPROF", the checksum and the number of counters, then the
+// counters, all 64-bit little-endian. Each run replaces the file.
+//
+// Compiling the same source with the file gives the blocks of the module
+// their counts before any pass runs, for the inliner, the block layout and
+// the register allocator to go by. Counters are numbered function by
+// function, every block in order and then every conditional branch in order,
+// over the module as built from the source; the checksum covers that shape,
+// so that the profile of another program is refused instead of misapplied.
+
+enum
+{
+    WACC_PROFILE_HEADER_SIZE = 24,
+};
+
+// Count the blocks and branches of a module fresh from the builder, and have
+// the program write the counters to `path`.
+void wacc_profile_instrument(WaccIrModule* module, str path);
+
+// the header of the file of `counters`
+void wacc_profile_header(const WaccIrCounters* counters, uint8_t header[WACC_PROFILE_HEADER_SIZE]);
+
+// Write `values`, one per counter, as the program would, for programs run
+// in-process. false after reporting why the file cannot be written.
+bool wacc_profile_write(const WaccIrCounters* counters, const uint64_t* values, FILE* err);
+
+// Give the blocks of a module fresh from the builder the counts of the
+// profile at `path` and mark its functions profiled. false after reporting
+// why the profile cannot be read or does not fit the module.
+bool wacc_profile_annotate(WaccIrModule* module, str path, FILE* err);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "alloc/alloc.h"
 #include "wacc/range.h"
 
 #include <buf/buf.h>
@@ -17,12 +18,19 @@ typedef struct
     Text text;
     LineStartBuf line_starts;
     size_t num_errors;
+    // complete lines dropped from the front of `text` by wacc_system_forget_lines
+    size_t forgotten_lines;
+    // A parser context reused across inputs numbers positions continuously from the
+    // start of its first input; this is where the current input begins in that count.
+    size_t base;
 } Source;
 
 typedef struct
 {
     Source source;
     FILE* err_stream;
+    // backs the system, its source buffers, the parser and the AST
+    const Allocator* alloc;
 } WaccSystem;
 
 typedef enum
@@ -32,8 +40,25 @@ typedef enum
 #undef X
 } ErrorKind;
 
-WaccSystem* wacc_system_new(FILE* err);
+WaccSystem* wacc_system_new(FILE* err, const Allocator* alloc);
 void wacc_system_free(WaccSystem* system);
 int wacc_system_open_file(WaccSystem* system, str path, FILE* err);
+// read from an already open stream, which the system takes ownership of
+void wacc_system_open_stream(WaccSystem* system, str name, FILE* fp);
+// Forget the current input so the system, and the parser context reading from it, can
+// take the next one. Buffers keep their capacity.
+void wacc_system_reset(WaccSystem* system);
 int wacc_system_read_source(WaccSystem* system);
 void wacc_system_handle_error(WaccSystem* system, ErrorKind error, Range range);
+// translate positions reported by the parser into a range of the current source
+Range wacc_system_range(const WaccSystem* system, size_t start, size_t end);
+// reference to the source text covered by `range`; stays valid until the system is freed,
+// though the source buffer may still move while the parser is reading it
+str wacc_system_text(const WaccSystem* system, Range range);
+// the 1-based line of the current source holding position `pos`
+size_t wacc_system_line(const WaccSystem* system, size_t pos);
+// Drop the text of every complete line read so far, keeping the line being read. Between
+// two top-level definitions that parsed cleanly, the parser has read nothing beyond the
+// first character of the next one, so nothing it reports later lies in the dropped text;
+// ranges and strings from before the call are invalid after it.
+void wacc_system_forget_lines(WaccSystem* system);
@@ -0,0 +1,431 @@
+#pragma once
+
+#include "alloc/alloc.h"
+#include "wacc/ir.h"
+#include "wacc/pool.h"
+
+#include <buf/buf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <str/str.h>
+
+// x86-64 backend.
+//
+// The IR is lowered to machine instructions over virtual registers, which the
+// register allocator then maps onto the hardware registers; the frame pass
+// adds the prologue and epilogue and the emitter prints AT&T assembly.
+//
+// Registers 0 to 15 are the hardware registers in encoding order; virtual
+// registers are numbered from WACC_X86_FIRST_VREG. Stack slots hold spilled
+// registers and get their addresses from the frame pass.
+
+typedef enum
+{
+#define X(x, name64, name32, name8, preserved) WACC_X86_##x,
+#include "wacc/x86/regs.def"
+#undef X
+    WACC_X86_NUM_REGS,
+} WaccX86Reg;
+
+#define WACC_X86_FIRST_VREG ((uint32_t)WACC_X86_NUM_REGS)
+#define WACC_X86_NO_REG UINT32_MAX
+
+typedef struct
+{
+    const char* name64;
+    const char* name32;
+    const char* name8;
+    // callee-saved in the SysV ABI
+    bool preserved;
+} WaccX86RegInfo;
+
+extern const WaccX86RegInfo wacc_x86_regs[];
+
+// SysV registers for the first integer arguments
+extern const WaccX86Reg wacc_x86_arg_regs[6];
+
+typedef enum
+{
+#define X(x, suffix, code) WACC_X86_COND_##x,
+#include "wacc/x86/conds.def"
+#undef X
+} WaccX86Cond;
+
+extern const char* const wacc_x86_cond_suffixes[];
+
+enum
+{
+    // writes operand 0
+    WACC_X86_DEF0 = 1 << 0,
+    // reads operand 0
+    WACC_X86_USE0 = 1 << 1,
+    // reads operand 1
+    WACC_X86_USE1 = 1 << 2,
+    // operand 0 is a block
+    WACC_X86_BRANCH = 1 << 3,
+    // the mnemonic takes no size suffix
+    WACC_X86_UNSIZED = 1 << 4,
+    // clobbers the flags
+    WACC_X86_FLAGS = 1 << 5,
+    WACC_X86_READS_FLAGS = 1 << 6,
+};
+
+typedef enum
+{
+#define X(x, mnemonic, flags) WACC_X86_##x,
+#include "wacc/x86/opcodes.def"
+#undef X
+} WaccX86Opcode;
+
+typedef struct
+{
+    const char* mnemonic;
+    uint8_t flags;
+} WaccX86OpcodeInfo;
+
+extern const WaccX86OpcodeInfo wacc_x86_opcodes[];
+
+typedef enum
+{
+    WACC_X86_OPERAND_NONE,
+    WACC_X86_OPERAND_REG,
+    WACC_X86_OPERAND_IMM,
+    // base + index * scale + disp; `index` may be WACC_X86_NO_REG
+    WACC_X86_OPERAND_MEM,
+    // a stack slot of the function
+    WACC_X86_OPERAND_SLOT,
+    WACC_X86_OPERAND_BLOCK,
+    // a function of the module, by index
+    WACC_X86_OPERAND_FUNC,
+    // a 64-bit counter of the module's profile, by index, addressed relative
+    // to %rip
+    WACC_X86_OPERAND_COUNTER,
+} WaccX86OperandKind;
+
+typedef struct
+{
+    WaccX86OperandKind kind;
+    union
+    {
+        uint32_t reg;
+        int64_t imm;
+        struct
+        {
+            uint32_t base;
+            uint32_t index;
+            uint8_t scale;
+            int32_t disp;
+        } mem;
+        uint32_t slot;
+        uint32_t block;
+        uint32_t func;
+        uint32_t counter;
+    };
+} WaccX86Operand;
+
+typedef struct
+{
+    WaccX86Opcode op;
+    // operand size in bytes, 4 or 8
+    uint8_t size;
+    // JCC and SETCC
+    WaccX86Cond cond;
+    // CALL: how many argument registers it reads
+    uint8_t num_args;
+    // CALL: whether it leaves a result in %rax; RET: whether it returns %rax
+    bool has_value;
+    // the source line of the IR instruction it was lowered from, 0 if none
+    uint32_t line;
+    WaccX86Operand ops[2];
+} WaccX86Inst;
+
+typedef BUF(WaccX86Inst) WaccX86InstBuf;
+
+typedef struct
+{
+    WaccX86InstBuf insts;
+    // pad with no-ops to a multiple of this many bytes before the block, 0
+    // for none, unless that takes more than `max_skip` bytes of padding
+    uint32_t align;
+    uint32_t max_skip;
+    // how often the block ran, if the function is profiled
+    uint64_t count;
+} WaccX86Block;
+
+typedef BUF(WaccX86Block) WaccX86BlockBuf;
+
+typedef struct
+{
+    str name;
+    bool exported;
+    // the source line of the definition, 0 if unknown
+    uint32_t line;
+    // the alignment of the entry in bytes, 0 for none
+    uint32_t align;
+    // whether the block counts come from a profile
+    bool profiled;
+    // in layout order; a block without a final jmp or ret falls through
+    WaccX86BlockBuf blocks;
+    // hardware and virtual registers
+    uint32_t num_regs;
+    // virtual registers the allocator must not spill, indexed by register
+    BUF(bool) unspillable;
+    uint32_t num_slots;
+    // filled in by the frame pass
+    uint32_t preserved_mask;
+    uint32_t frame_size;
+    // whether the function sets up %rbp; slots are relative to %rsp otherwise
+    bool frame_pointer;
+    Arena arena;
+    Allocator alloc;
+} WaccX86Function;
+
+typedef BUF(WaccX86Function*) WaccX86FunctionBuf;
+
+typedef struct
+{
+    WaccX86FunctionBuf functions;
+    // the module the functions were lowered from; a call names its callee by
+    // its index there
+    const WaccIrModule* ir;
+    // the source file line numbers refer to, empty to leave out debug
+    // information
+    str source;
+    const Allocator* alloc;
+} WaccX86Module;
+
+typedef enum
+{
+    WACC_X86_REGALLOC_LINEAR_SCAN,
+    // give every virtual register a stack slot, as a code generator without
+    // an allocator would
+    WACC_X86_REGALLOC_NAIVE,
+} WaccX86Regalloc;
+
+typedef struct
+{
+    WaccX86Regalloc regalloc;
+    bool peephole;
+    // drop the frame of leaf functions that need no stack beyond the red zone
+    bool omit_frame_pointer;
+    // the source file to describe in DWARF line tables and function ranges,
+    // empty for none
+    str debug_source;
+    // alignment in bytes of function entries and loop headers, a power of
+    // two or 0 for none, and the most padding a loop header is worth, 0 for
+    // no limit
+    uint32_t function_align;
+    uint32_t loop_align;
+    uint32_t loop_max_skip;
+    // generates, prints and encodes the functions on its workers; NULL keeps
+    // to the caller's thread
+    WaccPool* pool;
+} WaccX86Options;
+
+typedef enum
+{
+#define X(x, rule, description, ...) WACC_X86_PEEPHOLE_##x,
+#include "wacc/x86/peephole.def"
+#undef X
+    WACC_X86_NUM_PEEPHOLE_RULES,
+} WaccX86PeepholeRule;
+
+extern const char* const wacc_x86_peephole_descriptions[];
+
+typedef struct
+{
+    // virtual registers moved to the stack
+    size_t spilled;
+    size_t spill_loads;
+    size_t spill_stores;
+    // how often each peephole rule fired
+    size_t peephole[WACC_X86_NUM_PEEPHOLE_RULES];
+} WaccX86Stats;
+
+static inline WaccX86Operand wacc_x86_reg(uint32_t reg)
+{
+    return (WaccX86Operand){.kind = WACC_X86_OPERAND_REG, .reg = reg};
+}
+
+static inline WaccX86Operand wacc_x86_imm(int64_t imm)
+{
+    return (WaccX86Operand){.kind = WACC_X86_OPERAND_IMM, .imm = imm};
+}
+
+static inline WaccX86Operand wacc_x86_slot(uint32_t slot)
+{
+    return (WaccX86Operand){.kind = WACC_X86_OPERAND_SLOT, .slot = slot};
+}
+
+static inline WaccX86Operand wacc_x86_block(uint32_t block)
+{
+    return (WaccX86Operand){.kind = WACC_X86_OPERAND_BLOCK, .block = block};
+}
+
+static inline bool wacc_x86_has_flag(WaccX86Opcode op, int flag)
+{
+    return (wacc_x86_opcodes[op].flags & flag) != 0;
+}
+
+static inline bool wacc_x86_is_vreg(uint32_t reg)
+{
+    return reg >= WACC_X86_FIRST_VREG && reg != WACC_X86_NO_REG;
+}
+
+WaccX86Module* wacc_x86_module_new(const Allocator* alloc);
+void wacc_x86_module_free(WaccX86Module* module);
+WaccX86Function* wacc_x86_function_new(WaccX86Module* module, str name);
+uint32_t wacc_x86_block_new(WaccX86Function* function);
+uint32_t wacc_x86_vreg_new(WaccX86Function* function);
+uint32_t wacc_x86_slot_new(WaccX86Function* function);
+void wacc_x86_append(WaccX86Function* function, uint32_t block, WaccX86Inst inst);
+
+// Hardware registers `inst` reads and writes beyond its operands, as a mask
+// over WaccX86Reg.
+void wacc_x86_implicit_regs(const WaccX86Inst* inst, uint32_t* uses, uint32_t* defs);
+
+// blocks control can reach from the end of `block`; returns how many
+uint32_t wacc_x86_successors(const WaccX86Function* function, uint32_t block, uint32_t out[2]);
+
+// lower every function of a verified IR module
+WaccX86Module* wacc_x86_lower(const WaccIrModule* ir, const Allocator* alloc);
+// lower `ir` into `function`, fresh from wacc_x86_function_new; nothing else
+// is written, so that the functions of a module can be lowered in parallel
+void wacc_x86_lower_function(WaccX86Function* function, const WaccIrFunction* ir);
+
+// assign a hardware register to every virtual register
+void wacc_x86_regalloc(WaccX86Function* function, const WaccX86Options* options, WaccX86Stats* stats);
+
+// lay out the stack frame and add the prologue and epilogue, if the function
+// needs them
+void wacc_x86_frame(WaccX86Function* function, const WaccX86Options* options);
+
+// Rewrite short instruction sequences into cheaper ones after the frame is
+// laid out; the rules are listed in wacc/x86/peephole.def.
+void wacc_x86_peephole(WaccX86Function* function, WaccX86Stats* stats);
+
+// Mark the function entry and the loop headers, the targets of backward
+// branches, for alignment as `options` asks.
+void wacc_x86_align(WaccX86Function* function, const WaccX86Options* options);
+
+// The workers of `pool`, if any, print the functions into buffers of their
+// own, which are written out in order. An instrumented module also gets its
+// counters and a function writing them to the profile as the program exits.
+void wacc_x86_emit(const WaccX86Module* module, WaccPool* pool, FILE* out);
+// The same assembly in pieces, for a program compiled a function at a time:
+// the header, the functions of any number of modules, then the trailer.
+void wacc_x86_emit_begin(str source, FILE* out);
+void wacc_x86_emit_functions(const WaccX86Module* module, WaccPool* pool, FILE* out);
+void wacc_x86_emit_end(FILE* out);
+
+typedef struct
+{
+    // where the function starts in WaccX86Code.bytes
+    uint32_t offset;
+    uint32_t size;
+    str name;
+    bool exported;
+    uint32_t line;
+} WaccX86CodeFunction;
+
+// a row of the line table: the code from `offset` on comes from `line`
+typedef struct
+{
+    uint32_t offset;
+    uint32_t line;
+} WaccX86CodeLine;
+
+// an instruction adding to a counter, whose displacement at `at` counts from
+// the end of the instruction, `end`, to where the counter is loaded
+typedef struct
+{
+    uint32_t at;
+    uint32_t end;
+    uint32_t counter;
+} WaccX86CodeCounter;
+
+typedef struct
+{
+    BUF(uint8_t) bytes;
+    // one per function of the module
+    BUF(WaccX86CodeFunction) functions;
+    // in address order; empty unless the module has a source
+    BUF(WaccX86CodeLine) lines;
+    // in address order; empty unless the module is instrumented
+    BUF(WaccX86CodeCounter) counter_refs;
+    WaccIrCounters counters;
+    str source;
+    // the alignment the code must be loaded at for its own to hold
+    uint32_t align;
+} WaccX86Code;
+
+// Encode an allocated module as machine code. Calls and branches are resolved
+// relative to one another, so the code runs wherever it is loaded at a
+// multiple of its alignment. The workers of `pool`, if any, encode the
+// functions apart; the bytes are the same as from a single thread.
+void wacc_x86_encode(const WaccX86Module* module, WaccPool* pool, WaccX86Code* code);
+void wacc_x86_code_free(WaccX86Code* code);
+
+// Point the counter references of `code`, whose bytes have been copied to
+// `bytes`, at counters loaded `distance` bytes after the first byte of the
+// code, 8 bytes each.
+void wacc_x86_place_counters(const WaccX86Code* code, uint8_t* bytes, int64_t distance);
+
+typedef BUF(uint8_t) WaccX86Bytes;
+
+// the DWARF 4 sections describing encoded code: one compilation unit with a
+// subprogram per function, and its line table
+typedef struct
+{
+    WaccX86Bytes abbrev;
+    WaccX86Bytes info;
+    WaccX86Bytes line;
+} WaccX86Dwarf;
+
+// `address` is where the first byte of `code` is loaded; `code` must have a
+// source
+void wacc_x86_dwarf(const WaccX86Code* code, uint64_t address, WaccX86Dwarf* dwarf);
+void wacc_x86_dwarf_free(WaccX86Dwarf* dwarf);
+
+// Executable memory holding encoded code. The pages are writable while the
+// code is copied in and executable afterwards, never both at once. The
+// counters of an instrumented module follow on pages that stay writable.
+typedef struct
+{
+    uint8_t* memory;
+    size_t size;
+    // NULL unless the module is instrumented
+    uint64_t* counters;
+} WaccX86Jit;
+
+// false if the system refuses the mapping
+bool wacc_x86_jit_load(WaccX86Jit* jit, const WaccX86Code* code);
+void wacc_x86_jit_unload(WaccX86Jit* jit);
+
+// Write `code` as a static executable that needs neither the C library nor a
+// dynamic loader: its entry point calls function `main_function` and exits
+// with the result, writing the profile first if the module is instrumented.
+// false if the file cannot be written.
+bool wacc_x86_write_executable(const WaccX86Code* code, uint32_t main_function, const char* path);
+
+// the address of function `function` of the loaded code, to be cast to the
+// function's signature
+static inline uintptr_t wacc_x86_jit_address(const WaccX86Jit* jit, const WaccX86Code* code, uint32_t function)
+{
+    return (uintptr_t)(jit->memory + code->functions.ptr[function].offset);
+}
+
+// lower, allocate and print `ir` as assembly
+void wacc_x86_compile(const WaccIrModule* ir, const WaccX86Options* options, WaccX86Stats* stats, FILE* out);
+
+// print function `index` of `ir` alone, between wacc_x86_emit_begin and
+// wacc_x86_emit_end
+void wacc_x86_compile_function(
+    const WaccIrModule* ir, uint32_t index, const WaccX86Options* options, WaccX86Stats* stats, FILE* out);
+
+// lower, allocate and encode `ir` as machine code
+void wacc_x86_compile_code(
+    const WaccIrModule* ir, const WaccX86Options* options, WaccX86Stats* stats, WaccX86Code* code);
+
+void wacc_x86_print_stats(const WaccX86Stats* stats, FILE* out);
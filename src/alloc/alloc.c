@@ -0,0 +1,267 @@
+#include "alloc/alloc.h"
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <string.h>
+
+// malloc ---------------------------------------------------------------------------------
+static void* malloc_alloc(void* ctx, size_t size)
+{
+    (void)ctx;
+    return malloc(size);
+}
+
+static void* malloc_realloc(void* ctx, void* ptr, size_t size)
+{
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+static void malloc_free(void* ctx, void* ptr)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+const Allocator malloc_allocator = {
+    .alloc = malloc_alloc,
+    .realloc = malloc_realloc,
+    .free = malloc_free,
+    .ctx = NULL,
+};
+
+// every block handed out below is preceded by its size, padded so the block
+// itself stays maximally aligned
+typedef union
+{
+    size_t size;
+    max_align_t align;
+} BlockHeader;
+
+#define ALIGN_UP(n) (((n) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+static inline BlockHeader* block_header(void* ptr)
+{
+    return (BlockHeader*)ptr - 1;
+}
+
+// arena ----------------------------------------------------------------------------------
+struct ArenaChunk
+{
+    ArenaChunk* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+enum
+{
+    ARENA_DEFAULT_CHUNK_SIZE = 64 * 1024,
+};
+
+void arena_init(Arena* arena, size_t chunk_size)
+{
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+}
+
+static ArenaChunk* arena_new_chunk(Arena* arena, size_t need)
+{
+    size_t size = need > arena->chunk_size ? need : arena->chunk_size;
+    ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    chunk->next = arena->chunks;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+static void* arena_alloc(void* ctx, size_t size)
+{
+    Arena* arena = ctx;
+    size_t need = sizeof(BlockHeader) + ALIGN_UP(size);
+    ArenaChunk* chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < need)
+    {
+        chunk = arena_new_chunk(arena, need);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+    }
+    BlockHeader* header = (BlockHeader*)((char*)chunk->data + chunk->used);
+    header->size = size;
+    chunk->used += need;
+    return header + 1;
+}
+
+static void* arena_realloc(void* ctx, void* ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return arena_alloc(ctx, size);
+    }
+    Arena* arena = ctx;
+    BlockHeader* header = block_header(ptr);
+    ArenaChunk* chunk = arena->chunks;
+    char* end = (char*)ptr + ALIGN_UP(header->size);
+    // the most recent block can grow or shrink where it is
+    if (end == (char*)chunk->data + chunk->used)
+    {
+        size_t used = (size_t)((char*)ptr - (char*)chunk->data);
+        if (chunk->size - used >= ALIGN_UP(size))
+        {
+            chunk->used = used + ALIGN_UP(size);
+            header->size = size;
+            return ptr;
+        }
+    }
+    if (size <= header->size)
+    {
+        header->size = size;
+        return ptr;
+    }
+    void* new_ptr = arena_alloc(ctx, size);
+    if (new_ptr != NULL)
+    {
+        memcpy(new_ptr, ptr, header->size);
+    }
+    return new_ptr;
+}
+
+static void arena_free_block(void* ctx, void* ptr)
+{
+    // blocks live until the whole arena is reset or freed
+    (void)ctx;
+    (void)ptr;
+}
+
+Allocator arena_allocator(Arena* arena)
+{
+    return (Allocator){
+        .alloc = arena_alloc,
+        .realloc = arena_realloc,
+        .free = arena_free_block,
+        .ctx = arena,
+    };
+}
+
+void arena_reset(Arena* arena)
+{
+    if (arena->chunks == NULL)
+    {
+        return;
+    }
+    // keep the largest chunk so the next compilation starts warm
+    ArenaChunk* keep = arena->chunks;
+    for (ArenaChunk* chunk = arena->chunks->next; chunk != NULL; chunk = chunk->next)
+    {
+        if (chunk->size > keep->size)
+        {
+            keep = chunk;
+        }
+    }
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk != NULL)
+    {
+        ArenaChunk* next = chunk->next;
+        if (chunk != keep)
+        {
+            free(chunk);
+        }
+        chunk = next;
+    }
+    keep->next = NULL;
+    keep->used = 0;
+    arena->chunks = keep;
+}
+
+void arena_free(Arena* arena)
+{
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk != NULL)
+    {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+// counting -------------------------------------------------------------------------------
+static void counter_track(CountingAllocator* counter, size_t freed, size_t allocated)
+{
+    counter->live = counter->live - freed + allocated;
+    if (counter->live > counter->peak)
+    {
+        counter->peak = counter->live;
+    }
+}
+
+static void* counting_alloc(void* ctx, size_t size)
+{
+    CountingAllocator* counter = ctx;
+    BlockHeader* header = allocator_alloc(counter->inner, sizeof(BlockHeader) + size);
+    if (header == NULL)
+    {
+        return NULL;
+    }
+    header->size = size;
+    counter->count++;
+    counter->bytes += size;
+    counter_track(counter, 0, size);
+    return header + 1;
+}
+
+static void* counting_realloc(void* ctx, void* ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return counting_alloc(ctx, size);
+    }
+    CountingAllocator* counter = ctx;
+    size_t old_size = block_header(ptr)->size;
+    BlockHeader* header = allocator_realloc(counter->inner, block_header(ptr), sizeof(BlockHeader) + size);
+    if (header == NULL)
+    {
+        return NULL;
+    }
+    header->size = size;
+    counter->count++;
+    if (size > old_size)
+    {
+        counter->bytes += size - old_size;
+    }
+    counter_track(counter, old_size, size);
+    return header + 1;
+}
+
+static void counting_free(void* ctx, void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    CountingAllocator* counter = ctx;
+    counter_track(counter, block_header(ptr)->size, 0);
+    allocator_free(counter->inner, block_header(ptr));
+}
+
+void counting_allocator_init(CountingAllocator* counter, const Allocator* inner)
+{
+    *counter = (CountingAllocator){.inner = inner};
+}
+
+Allocator counting_allocator(CountingAllocator* counter)
+{
+    return (Allocator){
+        .alloc = counting_alloc,
+        .realloc = counting_realloc,
+        .free = counting_free,
+        .ctx = counter,
+    };
+}
@@ -83,7 +83,7 @@ SlurpFileResult slurp_file(str filename)
 
     size_t len = platform_filelen(f);
 
-    char* buf = malloc(len + 1);
+    char* buf = allocator_alloc(str_get_allocator(), len + 1);
     if (buf == NULL)
     {
         platform_fclose(f);
@@ -95,7 +95,7 @@ SlurpFileResult slurp_file(str filename)
     if (read != len)
     {
         platform_fclose(f);
-        free(buf);
+        allocator_free(str_get_allocator(), buf);
         str msg = str_printf("failed to read '" str_fmt "' contents", str_arg(filename));
         return (SlurpFileResult)ERR(msg);
     }
@@ -55,11 +55,32 @@ static inline void* mempcpy(void* dest, const void* src, const size_t n)
 }
 #endif
 
-static inline void str_mem_free(void* p)
+// where the strings created on this thread come from; each owner records its own
+// allocator, so this never decides how a string is freed
+static _Thread_local const Allocator* str_allocator = NULL;
+
+const Allocator* str_set_allocator(const Allocator* const alloc)
+{
+    const Allocator* const prev = str_allocator;
+    str_allocator = alloc;
+    return prev;
+}
+
+const Allocator* str_get_allocator(void)
+{
+    return str_allocator;
+}
+
+static inline void* str_mem_alloc(const size_t n)
+{
+    return allocator_alloc(str_allocator, n);
+}
+
+static inline void str_mem_free(const Allocator* alloc, void* p)
 {
     if (p)
     {
-        free(p);
+        allocator_free(alloc, p);
     }
 }
 
@@ -68,7 +89,7 @@ void str_free(const str s)
 {
     if (str_is_owner(s))
     {
-        str_mem_free((void*)s.ptr);
+        str_mem_free(s.alloc, (void*)s.ptr);
     }
 }
 
@@ -81,19 +102,6 @@ void str_free_(const str* const ps)
     }
 }
 
-// memory allocation helpers
-#define REALLOC(p, n) \
-    ({ \
-        void* const s___ = (p); \
-        void* const p___ = realloc(s___, (n)); \
-        if (!p___) \
-        { \
-            str_mem_free(s___); \
-            return ENOMEM; \
-        } \
-        p___; \
-    })
-
 // errno checker
 #define EINTR_RETRY(expr) \
     while ((expr) < 0) \
@@ -152,6 +160,27 @@ int str_cmp_ci(const str s1, const str s2)
     return (n1 < n2) ? -1 : 1;
 }
 
+// hash of the string contents
+uint64_t str_hash(const str s)
+{
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+    const char* const end = str_end(s);
+
+    for (const char* p = str_ptr(s); p < end; ++p)
+    {
+        h ^= (unsigned char)*p;
+        h *= UINT64_C(0x100000001b3);
+    }
+
+    // FNV-1a mixes the high bits far better than the low ones, which are the
+    // ones a power-of-two table indexes by
+    h ^= h >> 32;
+    h *= UINT64_C(0xd6e8feb86659fd93);
+    h ^= h >> 32;
+
+    return h;
+}
+
 // test for prefix
 bool str_has_prefix(const str s, const str prefix)
 {
@@ -172,7 +201,7 @@ bool str_has_suffix(const str s, const str suffix)
 // create a reference to the given range of chars
 str str_ref_chars(const char* const s, const size_t n)
 {
-    return (s && n > 0) ? ((str){s, n, false}) : str_null;
+    return (s && n > 0) ? ((str){s, n, false, NULL}) : str_null;
 }
 
 str str_ref_from_ptr_(const char* const s)
@@ -190,11 +219,11 @@ str str_acquire_chars(const char* const s, const size_t n)
 
     if (n == 0)
     {
-        free((void*)s);
+        str_mem_free(str_allocator, (void*)s);
         return str_null;
     }
 
-    return (str){s, n, true};
+    return (str){s, n, true, str_allocator};
 }
 
 // take ownership of the given C string
@@ -217,7 +246,7 @@ static str str_vprintf(const char* const fmt, va_list ap)
         return str_null;
     }
 
-    char* const s = malloc((size_t)n + 1);
+    char* const s = str_mem_alloc((size_t)n + 1);
 
     if (!s)
     {
@@ -249,7 +278,7 @@ int str_cpy(str* const dest, const str s)
     }
     else
     {
-        char* const p = memcpy(malloc(n + 1), str_ptr(s), n);
+        char* const p = memcpy(str_mem_alloc(n + 1), str_ptr(s), n);
 
         p[n] = 0;
         str_assign(dest, str_acquire_chars(p, n));
@@ -296,7 +325,7 @@ int str_cat_range(str* const dest, const str* src, size_t count)
     }
 
     // allocate
-    char* const buff = malloc(num + 1);
+    char* const buff = str_mem_alloc(num + 1);
 
     // copy bytes
     char* p = buff;
@@ -336,7 +365,7 @@ int str_join_range(str* const dest, const str sep, const str* src, size_t count)
     const size_t num = total_length(src, count) + sep.len * (count - 1);
 
     // allocate
-    char* const buff = malloc(num + 1);
+    char* const buff = str_mem_alloc(num + 1);
 
     // copy bytes
     char* p = append_str(buff, *src++);
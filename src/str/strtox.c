@@ -50,13 +50,15 @@ Str2U64Result str2u64(str in, int base)
         return (Str2U64Result){.err = EINVAL};
     }
 
-    const char* save = in.ptr;
+    // the input need not be null-terminated: spans into source text stop at `stop`
+    const char* save = str_ptr(in);
+    const char* const stop = str_end(in);
     const char* s = save;
-    while (char_is_space(*s))
+    while (s < stop && char_is_space(*s))
     {
         s++;
     }
-    if (*s == '\0')
+    if (s == stop)
     {
         // no number
         return (Str2U64Result){.endptr = in.ptr};
@@ -67,9 +69,9 @@ Str2U64Result str2u64(str in, int base)
         s++;
     }
 
-    if (*s == '0')
+    if (s < stop && *s == '0')
     {
-        if ((base == 0 || base == 16) && char_to_upper(s[1]) == 'X')
+        if ((base == 0 || base == 16) && s + 1 < stop && char_to_upper(s[1]) == 'X')
         {
             base = 16;
             s += 2;
@@ -90,16 +92,12 @@ Str2U64Result str2u64(str in, int base)
     uint64_t cutoff = cutoff_tab[base - 2];
     uint64_t cutlim = cutlim_tab[base - 2];
     bool overflow = false;
-    char c = *s;
 
     uint64_t i = 0;
 
-    while (c != '\0')
+    while (s < stop)
     {
-        if (s == end)
-        {
-            break;
-        }
+        char c = *s;
 
         if (c >= '0' && c <= '9')
         {
@@ -130,7 +128,6 @@ Str2U64Result str2u64(str in, int base)
         }
 
         s++;
-        c = *s;
     }
 
     if (s == save)
@@ -3,92 +3,168 @@
 #include <assert.h>
 #include <stdlib.h>
 
-WaccNode* wacc_node_new_text(str text)
+static void* ast_alloc(const Allocator* alloc, size_t size)
 {
-    WaccNode* node = malloc(sizeof(WaccNode));
-    node->kind = WACC_NODE_TEXT;
-    node->as.text = text;
-    return node;
+    void* p = allocator_alloc(alloc, size);
+    if (p == NULL)
+    {
+        allocator_oom();
+    }
+    return p;
 }
 
-WaccNode* wacc_node_new_program(WaccFunction* function)
+WaccNode* wacc_node_new_span(const Allocator* alloc, Range span)
 {
-    WaccNode* node = malloc(sizeof(WaccNode));
-    node->kind = WACC_NODE_PROGRAM;
-    node->as.program.function = function;
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
+    node->kind = WACC_NODE_SPAN;
+    node->as.span = span;
     return node;
 }
 
-WaccNode* wacc_node_new_function(str name, WaccStatement statement)
+WaccNode* wacc_node_new_function(const Allocator* alloc, Range name, WaccParameterBuf params, WaccStatement statement)
 {
-    WaccNode* node = malloc(sizeof(WaccNode));
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
     node->kind = WACC_NODE_FUNCTION;
-    WaccActualFunction* func = malloc(sizeof(WaccActualFunction));
+    WaccActualFunction* func = ast_alloc(alloc, sizeof(WaccActualFunction));
     func->base.type = WACC_FUNC_FUNCTION;
     func->name = name;
+    func->params = params;
     func->statement = statement;
     node->as.function = (WaccFunction*)func;
     return node;
 }
 
-WaccNode* wacc_node_new_statement(WaccExpression* expression)
+WaccNode* wacc_node_new_parameters(const Allocator* alloc)
 {
-    WaccNode* node = malloc(sizeof(WaccNode));
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
+    node->kind = WACC_NODE_PARAMETERS;
+    node->as.parameters = (WaccParameterBuf)BUF_NEW_IN(alloc);
+    return node;
+}
+
+void wacc_node_add_parameter(WaccNode* parameters, Range name)
+{
+    assert(parameters->kind == WACC_NODE_PARAMETERS);
+    BUF_PUSH(&parameters->as.parameters, name);
+}
+
+WaccNode* wacc_node_new_statement(const Allocator* alloc, WaccExpression* expression, Range span)
+{
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
     node->kind = WACC_NODE_STATEMENT;
     node->as.statement.expression = expression;
+    node->as.statement.span = span;
     return node;
 }
 
-WaccNode* wacc_node_new_expression(uint64_t value)
+WaccNode* wacc_node_new_expression(const Allocator* alloc, uint64_t value)
 {
-    WaccNode* node = malloc(sizeof(WaccNode));
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
     node->kind = WACC_NODE_EXPRESSION;
-    WaccConstantExpression* constant = malloc(sizeof(WaccConstantExpression));
+    WaccConstantExpression* constant = ast_alloc(alloc, sizeof(WaccConstantExpression));
     constant->base.type = WACC_EXPR_CONSTANT;
     constant->value = value;
     node->as.expression = (WaccExpression*)constant;
     return node;
 }
 
-WaccNode* wacc_error_node_function(void)
+WaccNode* wacc_node_new_variable(const Allocator* alloc, Range name)
+{
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
+    node->kind = WACC_NODE_EXPRESSION;
+    WaccVariableExpression* variable = ast_alloc(alloc, sizeof(WaccVariableExpression));
+    variable->base.type = WACC_EXPR_VARIABLE;
+    variable->name = name;
+    node->as.expression = (WaccExpression*)variable;
+    return node;
+}
+
+WaccNode* wacc_node_new_call(const Allocator* alloc, Range name, WaccExpressionBuf args)
+{
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
+    node->kind = WACC_NODE_EXPRESSION;
+    WaccCallExpression* call = ast_alloc(alloc, sizeof(WaccCallExpression));
+    call->base.type = WACC_EXPR_CALL;
+    call->name = name;
+    call->args = args;
+    node->as.expression = (WaccExpression*)call;
+    return node;
+}
+
+WaccNode* wacc_node_new_arguments(const Allocator* alloc)
 {
-    WaccNode* node = malloc(sizeof(WaccNode));
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
+    node->kind = WACC_NODE_ARGUMENTS;
+    node->as.arguments = (WaccExpressionBuf)BUF_NEW_IN(alloc);
+    return node;
+}
+
+void wacc_node_add_argument(WaccNode* arguments, WaccExpression* expression)
+{
+    assert(arguments->kind == WACC_NODE_ARGUMENTS);
+    BUF_PUSH(&arguments->as.arguments, expression);
+}
+
+WaccNode* wacc_error_node_function(const Allocator* alloc)
+{
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
     node->kind = WACC_NODE_FUNCTION;
-    WaccFunction* func = malloc(sizeof(WaccFunction));
+    WaccFunction* func = ast_alloc(alloc, sizeof(WaccFunction));
     func->type = WACC_FUNC_ERROR;
     node->as.function = func;
     return node;
 }
 
-WaccNode* wacc_error_node_expression(void)
+WaccNode* wacc_error_node_expression(const Allocator* alloc)
 {
-    WaccNode* node = malloc(sizeof(WaccNode));
+    WaccNode* node = ast_alloc(alloc, sizeof(WaccNode));
     node->kind = WACC_NODE_EXPRESSION;
-    WaccExpression* error_expr = malloc(sizeof(WaccExpression));
+    WaccExpression* error_expr = ast_alloc(alloc, sizeof(WaccExpression));
     error_expr->type = WACC_EXPR_ERROR;
     node->as.expression = error_expr;
     return node;
 }
 
-static void expression_free(WaccExpression* expr)
+void wacc_node_release(const Allocator* alloc, WaccNode* node)
+{
+    allocator_free(alloc, node);
+}
+
+static void expression_free(const Allocator* alloc, WaccExpression* expr)
 {
     switch (expr->type)
     {
+        case WACC_EXPR_CALL: {
+            WaccCallExpression* call = (WaccCallExpression*)expr;
+            for (uint64_t i = 0; i < call->args.len; i++)
+            {
+                expression_free(alloc, call->args.ptr[i]);
+            }
+            BUF_FREE(call->args);
+            allocator_free(alloc, expr);
+            break;
+        }
         case WACC_EXPR_CONSTANT:
+        case WACC_EXPR_VARIABLE:
         case WACC_EXPR_ERROR:
-            free(expr);
+            allocator_free(alloc, expr);
             break;
         default:
             abort();
     }
 }
 
-void statement_free(WaccStatement stmt)
+void statement_free(const Allocator* alloc, WaccStatement stmt)
+{
+    expression_free(alloc, stmt.expression);
+}
+
+void parameters_free(WaccParameterBuf params)
 {
-    expression_free(stmt.expression);
+    BUF_FREE(params);
 }
 
-static void function_free(WaccFunction* function)
+static void function_free(const Allocator* alloc, WaccFunction* function)
 {
     if (function == NULL)
     {
@@ -97,21 +173,21 @@ static void function_free(WaccFunction* function)
     switch (function->type)
     {
         case WACC_FUNC_FUNCTION:
-            str_free(((WaccActualFunction*)function)->name);
-            statement_free(((WaccActualFunction*)function)->statement);
-            free(function);
+            parameters_free(((WaccActualFunction*)function)->params);
+            statement_free(alloc, ((WaccActualFunction*)function)->statement);
+            allocator_free(alloc, function);
             break;
         case WACC_FUNC_ERROR:
-            free(function);
+            allocator_free(alloc, function);
             break;
         default:
             abort();
     }
 }
 
-void ast_free(WaccNode* ast)
+void ast_free(const Allocator* alloc, WaccNode* ast)
 {
-    assert(ast->kind == WACC_NODE_PROGRAM);
-    function_free(ast->as.program.function);
-    free(ast);
+    assert(ast->kind == WACC_NODE_FUNCTION);
+    function_free(alloc, ast->as.function);
+    allocator_free(alloc, ast);
 }
@@ -0,0 +1,431 @@
+#include "wacc/interp.h"
+
+#include <string.h>
+
+enum
+{
+    // deeper recursion is reported instead of exhausting memory
+    MAX_CALL_DEPTH = 1 << 18,
+};
+
+// One bytecode instruction. Operands are frame slots, one per IR value, and
+// slot 0 always holds zero. BR jumps to `a`; CBR tests `dest` and jumps to `a`
+// when it is nonzero and to `b` otherwise; CALL calls function `a` with the
+// arguments listed at `b` in the call argument table; COPY moves `a` to
+// `dest`; COUNT adds one to counter `a`; other opcodes evaluate `a` and `b`
+// into `dest`.
+typedef struct
+{
+    uint8_t op;
+    uint8_t type;
+    uint8_t arg_type;
+    uint32_t dest;
+    uint32_t a;
+    uint32_t b;
+} Code;
+
+typedef BUF(Code) CodeBuf;
+typedef BUF(uint32_t) IndexBuf;
+
+struct WaccInterpFunction
+{
+    CodeBuf code;
+    // initial contents of a frame: the constants, zero elsewhere
+    BUF(int64_t) frame;
+    // slot of each parameter
+    IndexBuf params;
+    // for every call, the number of arguments followed by their slots
+    IndexBuf call_args;
+};
+
+typedef struct
+{
+    const WaccIrFunction* ir;
+    WaccInterpFunction* function;
+    // code offset of every block, then of every edge stub
+    IndexBuf block_pc;
+    // the edges from a conditional branch that need phi copies, as pairs of
+    // blocks, in stub order
+    IndexBuf stubs;
+    // first slot free for the temporaries of parallel copies
+    uint32_t scratch;
+} Translation;
+
+static void push_code(Translation* t, Code code)
+{
+    BUF_PUSH(&t->function->code, code);
+}
+
+static bool has_phis(const WaccIrFunction* function, WaccIrBlockId block)
+{
+    const WaccIrInstBuf* insts = &function->blocks.ptr[block].insts;
+    return insts->len > 0 && insts->ptr[0].op == WACC_IR_PHI;
+}
+
+// the copies of the phis of `to` for the edge from `from`, as a parallel copy:
+// through temporaries when one copy overwrites the source of another
+static void emit_copies(Translation* t, WaccIrBlockId from, WaccIrBlockId to)
+{
+    const WaccIrInstBuf* insts = &t->ir->blocks.ptr[to].insts;
+    uint64_t first = t->function->code.len;
+    for (uint64_t i = 0; i < insts->len && insts->ptr[i].op == WACC_IR_PHI; i++)
+    {
+        const WaccIrInst* phi = &insts->ptr[i];
+        const WaccIrOperand* operands = wacc_ir_operands(t->ir, phi);
+        for (uint32_t j = 0; j < phi->count; j++)
+        {
+            if (operands[j].block == from && operands[j].value != phi->dest)
+            {
+                push_code(t, (Code){.op = WACC_IR_COPY, .dest = phi->dest, .a = operands[j].value});
+                break;
+            }
+        }
+    }
+    uint64_t count = t->function->code.len - first;
+    Code* copies = t->function->code.ptr + first;
+    bool overlap = false;
+    for (uint64_t i = 0; i < count && !overlap; i++)
+    {
+        for (uint64_t j = 0; j < count && !overlap; j++)
+        {
+            overlap = i != j && copies[i].dest == copies[j].a;
+        }
+    }
+    if (!overlap)
+    {
+        return;
+    }
+    for (uint64_t i = 0; i < count; i++)
+    {
+        Code copy = t->function->code.ptr[first + i];
+        t->function->code.ptr[first + i].dest = t->scratch + (uint32_t)i;
+        push_code(t, (Code){.op = WACC_IR_COPY, .dest = copy.dest, .a = t->scratch + (uint32_t)i});
+    }
+}
+
+// the target of a conditional branch from `from` to `to`: the block itself, or
+// a stub doing the phi copies first
+static uint32_t edge_target(Translation* t, WaccIrBlockId from, WaccIrBlockId to)
+{
+    if (!has_phis(t->ir, to))
+    {
+        return to;
+    }
+    for (uint64_t s = 0; s < t->stubs.len; s += 2)
+    {
+        if (t->stubs.ptr[s] == from && t->stubs.ptr[s + 1] == to)
+        {
+            return (uint32_t)(t->ir->blocks.len + s / 2);
+        }
+    }
+    BUF_PUSH(&t->stubs, from);
+    BUF_PUSH(&t->stubs, to);
+    return (uint32_t)(t->ir->blocks.len + t->stubs.len / 2 - 1);
+}
+
+static void translate_inst(Translation* t, WaccIrBlockId block, const WaccIrInst* inst)
+{
+    WaccInterpFunction* function = t->function;
+    switch (inst->op)
+    {
+        case WACC_IR_NOP:
+        case WACC_IR_PHI:
+            break;
+        case WACC_IR_CONST:
+            function->frame.ptr[inst->dest] = inst->imm;
+            break;
+        case WACC_IR_PARAM:
+            function->params.ptr[inst->imm] = inst->dest;
+            break;
+        case WACC_IR_CALL:
+        {
+            uint32_t first = (uint32_t)function->call_args.len;
+            const WaccIrOperand* args = wacc_ir_operands(t->ir, inst);
+            BUF_PUSH(&function->call_args, inst->count);
+            for (uint32_t i = 0; i < inst->count; i++)
+            {
+                BUF_PUSH(&function->call_args, args[i].value);
+            }
+            push_code(t, (Code){.op = WACC_IR_CALL, .dest = inst->dest, .a = (uint32_t)inst->imm, .b = first});
+            break;
+        }
+        case WACC_IR_BR:
+            emit_copies(t, block, inst->targets[0]);
+            push_code(t, (Code){.op = WACC_IR_BR, .a = inst->targets[0]});
+            break;
+        case WACC_IR_CBR:
+        {
+            uint32_t if_true = edge_target(t, block, inst->targets[0]);
+            uint32_t if_false = edge_target(t, block, inst->targets[1]);
+            push_code(t, (Code){.op = WACC_IR_CBR, .dest = inst->args[0], .a = if_true, .b = if_false});
+            break;
+        }
+        case WACC_IR_RET:
+            push_code(t, (Code){.op = WACC_IR_RET, .a = inst->args[0]});
+            break;
+        case WACC_IR_COUNT:
+            push_code(t, (Code){.op = WACC_IR_COUNT, .a = (uint32_t)inst->imm});
+            break;
+        default:
+            push_code(t,
+                (Code){
+                    .op = (uint8_t)inst->op,
+                    .type = (uint8_t)inst->type,
+                    .arg_type = (uint8_t)wacc_ir_value_type(t->ir, inst->args[0]),
+                    .dest = inst->dest,
+                    .a = inst->args[0],
+                    .b = inst->args[1],
+                });
+            break;
+    }
+}
+
+static WaccInterpFunction* translate(const WaccIrFunction* ir, const Allocator* alloc)
+{
+    WaccInterpFunction* function = allocator_alloc(alloc, sizeof(WaccInterpFunction));
+    if (function == NULL)
+    {
+        allocator_oom();
+    }
+    *function = (WaccInterpFunction){
+        .code = BUF_NEW_IN(alloc),
+        .frame = BUF_NEW_IN(alloc),
+        .params = BUF_NEW_IN(alloc),
+        .call_args = BUF_NEW_IN(alloc),
+    };
+    // a parallel copy needs at most one temporary per phi of its block
+    uint32_t max_phis = 0;
+    for (uint64_t b = 0; b < ir->blocks.len; b++)
+    {
+        uint32_t phis = 0;
+        while (phis < ir->blocks.ptr[b].insts.len && ir->blocks.ptr[b].insts.ptr[phis].op == WACC_IR_PHI)
+        {
+            phis++;
+        }
+        max_phis = phis > max_phis ? phis : max_phis;
+    }
+    // and the last slot takes the arguments of parameters nothing reads
+    uint64_t num_slots = ir->value_types.len + max_phis + 1;
+    BUF_RESERVE(&function->frame, num_slots);
+    memset(function->frame.ptr, 0, num_slots * sizeof(int64_t));
+    function->frame.len = num_slots;
+    BUF_RESERVE(&function->params, ir->num_params);
+    for (uint32_t i = 0; i < ir->num_params; i++)
+    {
+        BUF_PUSH(&function->params, (uint32_t)num_slots - 1);
+    }
+
+    Translation t = {
+        .ir = ir,
+        .function = function,
+        .block_pc = BUF_NEW,
+        .stubs = BUF_NEW,
+        .scratch = (uint32_t)ir->value_types.len,
+    };
+    for (uint64_t b = 0; b < ir->blocks.len; b++)
+    {
+        BUF_PUSH(&t.block_pc, (uint32_t)function->code.len);
+        const WaccIrInstBuf* insts = &ir->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            translate_inst(&t, (WaccIrBlockId)b, &insts->ptr[i]);
+        }
+    }
+    for (uint64_t s = 0; s < t.stubs.len; s += 2)
+    {
+        BUF_PUSH(&t.block_pc, (uint32_t)function->code.len);
+        emit_copies(&t, t.stubs.ptr[s], t.stubs.ptr[s + 1]);
+        push_code(&t, (Code){.op = WACC_IR_BR, .a = t.stubs.ptr[s + 1]});
+    }
+    for (uint64_t pc = 0; pc < function->code.len; pc++)
+    {
+        Code* code = &function->code.ptr[pc];
+        if (code->op == WACC_IR_BR || code->op == WACC_IR_CBR)
+        {
+            code->a = t.block_pc.ptr[code->a];
+            code->b = code->op == WACC_IR_CBR ? t.block_pc.ptr[code->b] : 0;
+        }
+    }
+    BUF_FREE(t.stubs);
+    BUF_FREE(t.block_pc);
+    return function;
+}
+
+WaccInterp* wacc_interp_new(const WaccIrModule* module, const Allocator* alloc)
+{
+    WaccInterp* interp = allocator_alloc(alloc, sizeof(WaccInterp));
+    if (interp == NULL)
+    {
+        allocator_oom();
+    }
+    *interp = (WaccInterp){
+        .functions = BUF_NEW_IN(alloc),
+        .stack = BUF_NEW_IN(alloc),
+        .counters = BUF_NEW_IN(alloc),
+        .alloc = alloc,
+    };
+    for (uint32_t i = 0; i < module->counters.num_counters; i++)
+    {
+        BUF_PUSH(&interp->counters, 0);
+    }
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        BUF_PUSH(&interp->functions, translate(module->functions.ptr[i], alloc));
+    }
+    return interp;
+}
+
+void wacc_interp_free(WaccInterp* interp)
+{
+    for (uint64_t i = 0; i < interp->functions.len; i++)
+    {
+        WaccInterpFunction* function = interp->functions.ptr[i];
+        BUF_FREE(function->code);
+        BUF_FREE(function->frame);
+        BUF_FREE(function->params);
+        BUF_FREE(function->call_args);
+        allocator_free(interp->alloc, function);
+    }
+    BUF_FREE(interp->functions);
+    BUF_FREE(interp->stack);
+    BUF_FREE(interp->counters);
+    allocator_free(interp->alloc, interp);
+}
+
+typedef struct
+{
+    const WaccInterpFunction* function;
+    // where execution resumes once the callee returns
+    uint32_t pc;
+    // first slot of the frame in the stack
+    uint64_t base;
+    // caller slot receiving the return value
+    uint32_t dest;
+} Frame;
+
+typedef BUF(Frame) FrameBuf;
+
+// push a fresh frame for `function` and return its base
+static uint64_t push_frame(WaccInterp* interp, const WaccInterpFunction* function)
+{
+    uint64_t base = interp->stack.len;
+    uint64_t size = function->frame.len;
+    BUF_RESERVE(&interp->stack, base + size);
+    memcpy(interp->stack.ptr + base, function->frame.ptr, size * sizeof(int64_t));
+    interp->stack.len = base + size;
+    return base;
+}
+
+// evaluate an arithmetic or comparison instruction; false if it traps
+static bool evaluate(const Code* code, int64_t* slots)
+{
+    int64_t b = slots[code->b];
+    if (code->op == WACC_IR_SHL || code->op == WACC_IR_SAR || code->op == WACC_IR_SHR)
+    {
+        b &= wacc_ir_type_bits((WaccIrType)code->arg_type) - 1;
+    }
+    WaccIrType type = (WaccIrType)code->type;
+    WaccIrType arg_type = (WaccIrType)code->arg_type;
+    return wacc_ir_fold((WaccIrOpcode)code->op, type, arg_type, slots[code->a], b, &slots[code->dest]);
+}
+
+WaccInterpResult wacc_interp_call(WaccInterp* interp, uint32_t function, const int64_t* args, uint32_t num_args)
+{
+    FrameBuf frames = BUF_NEW;
+    interp->stack.len = 0;
+    const WaccInterpFunction* current = interp->functions.ptr[function];
+    uint64_t base = push_frame(interp, current);
+    for (uint32_t i = 0; i < num_args && i < current->params.len; i++)
+    {
+        interp->stack.ptr[base + current->params.ptr[i]] = args[i];
+    }
+    BUF_PUSH(&frames, ((Frame){.function = current, .base = base}));
+    WaccInterpResult result = {.status = WACC_INTERP_OK};
+    const Code* code = current->code.ptr;
+    int64_t* slots = interp->stack.ptr + base;
+    uint32_t pc = 0;
+    for (;;)
+    {
+        const Code* c = &code[pc++];
+        switch ((WaccIrOpcode)c->op)
+        {
+            case WACC_IR_COPY:
+                slots[c->dest] = slots[c->a];
+                break;
+            case WACC_IR_BR:
+                pc = c->a;
+                break;
+            case WACC_IR_CBR:
+                pc = slots[c->dest] != 0 ? c->a : c->b;
+                break;
+            case WACC_IR_COUNT:
+                interp->counters.ptr[c->a]++;
+                break;
+            case WACC_IR_CALL:
+            {
+                if (frames.len >= MAX_CALL_DEPTH)
+                {
+                    result.status = WACC_INTERP_STACK_OVERFLOW;
+                    BUF_FREE(frames);
+                    return result;
+                }
+                frames.ptr[frames.len - 1].pc = pc;
+                uint64_t caller = frames.ptr[frames.len - 1].base;
+                const uint32_t* call_args = current->call_args.ptr + c->b;
+                current = interp->functions.ptr[c->a];
+                base = push_frame(interp, current);
+                for (uint32_t i = 0; i < call_args[0]; i++)
+                {
+                    interp->stack.ptr[base + current->params.ptr[i]] = interp->stack.ptr[caller + call_args[1 + i]];
+                }
+                BUF_PUSH(&frames, ((Frame){.function = current, .base = base, .dest = c->dest}));
+                code = current->code.ptr;
+                slots = interp->stack.ptr + base;
+                pc = 0;
+                break;
+            }
+            case WACC_IR_RET:
+            {
+                int64_t value = slots[c->a];
+                Frame done = frames.ptr[--frames.len];
+                interp->stack.len = done.base;
+                if (frames.len == 0)
+                {
+                    result.value = value;
+                    BUF_FREE(frames);
+                    return result;
+                }
+                const Frame* caller = &frames.ptr[frames.len - 1];
+                current = caller->function;
+                code = current->code.ptr;
+                slots = interp->stack.ptr + caller->base;
+                pc = caller->pc;
+                // a void call writes the zero slot, which stays zero
+                slots[done.dest] = done.dest == 0 ? 0 : value;
+                break;
+            }
+            default:
+                if (!evaluate(c, slots))
+                {
+                    result.status = WACC_INTERP_ARITHMETIC_TRAP;
+                    BUF_FREE(frames);
+                    return result;
+                }
+                break;
+        }
+    }
+}
+
+const char* wacc_interp_status_message(WaccInterpStatus status)
+{
+    switch (status)
+    {
+        case WACC_INTERP_OK:
+            return "ok";
+        case WACC_INTERP_ARITHMETIC_TRAP:
+            return "arithmetic exception";
+        case WACC_INTERP_STACK_OVERFLOW:
+            return "call stack exhausted";
+    }
+    abort();
+}
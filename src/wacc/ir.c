@@ -0,0 +1,911 @@
+#include "wacc/ir.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+const WaccIrOpcodeInfo wacc_ir_opcodes[] = {
+#define X(x, args, flags) {#x, args, flags},
+#include "wacc/ir/opcodes.def"
+#undef X
+};
+
+static const char* const type_names[] = {
+#define X(x) #x,
+#include "wacc/ir/types.def"
+#undef X
+};
+
+enum
+{
+    FUNCTION_ARENA_CHUNK_SIZE = 4096,
+};
+
+uint32_t wacc_ir_type_bits(WaccIrType type)
+{
+    switch (type)
+    {
+        case WACC_IR_TYPE_VOID:
+            return 0;
+        case WACC_IR_TYPE_I1:
+            return 1;
+        case WACC_IR_TYPE_I32:
+            return 32;
+        case WACC_IR_TYPE_I64:
+            return 64;
+    }
+    abort();
+}
+
+int64_t wacc_ir_normalize(WaccIrType type, int64_t value)
+{
+    switch (type)
+    {
+        case WACC_IR_TYPE_VOID:
+            return 0;
+        case WACC_IR_TYPE_I1:
+            return value & 1;
+        case WACC_IR_TYPE_I32:
+            return (int64_t)(int32_t)(uint32_t)(uint64_t)value;
+        case WACC_IR_TYPE_I64:
+            return value;
+    }
+    abort();
+}
+
+static uint64_t type_mask(WaccIrType type)
+{
+    uint32_t bits = wacc_ir_type_bits(type);
+    return bits >= 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+}
+
+// high half of the 128-bit product
+static uint64_t umulh64(uint64_t a, uint64_t b)
+{
+    uint64_t a_lo = a & UINT32_MAX;
+    uint64_t a_hi = a >> 32;
+    uint64_t b_lo = b & UINT32_MAX;
+    uint64_t b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & UINT32_MAX) + lo_hi;
+    return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+bool wacc_ir_fold(WaccIrOpcode op, WaccIrType type, WaccIrType arg_type, int64_t a, int64_t b, int64_t* result)
+{
+    uint64_t ua = (uint64_t)a & type_mask(arg_type);
+    uint64_t ub = (uint64_t)b & type_mask(arg_type);
+    int64_t min = -(int64_t)(type_mask(arg_type) >> 1) - 1;
+    uint64_t r;
+    switch (op)
+    {
+        case WACC_IR_COPY:
+        case WACC_IR_SEXT:
+        case WACC_IR_TRUNC:
+            r = (uint64_t)a;
+            break;
+        case WACC_IR_ZEXT:
+            r = ua;
+            break;
+        case WACC_IR_NEG:
+            r = -(uint64_t)a;
+            break;
+        case WACC_IR_NOT:
+            r = ~(uint64_t)a;
+            break;
+        case WACC_IR_ADD:
+            r = (uint64_t)a + (uint64_t)b;
+            break;
+        case WACC_IR_SUB:
+            r = (uint64_t)a - (uint64_t)b;
+            break;
+        case WACC_IR_MUL:
+            r = (uint64_t)a * (uint64_t)b;
+            break;
+        case WACC_IR_SMULH:
+            if (arg_type == WACC_IR_TYPE_I64)
+            {
+                // the signed product differs from the unsigned one by the
+                // other operand for every negative operand
+                r = umulh64(ua, ub) - (a < 0 ? ub : 0) - (b < 0 ? ua : 0);
+            }
+            else
+            {
+                r = (uint64_t)((a * b) >> 32);
+            }
+            break;
+        case WACC_IR_UMULH:
+            r = arg_type == WACC_IR_TYPE_I64 ? umulh64(ua, ub) : (ua * ub) >> 32;
+            break;
+        case WACC_IR_SDIV:
+        case WACC_IR_SREM:
+            if (b == 0 || (a == min && b == -1))
+            {
+                return false;
+            }
+            r = (uint64_t)(op == WACC_IR_SDIV ? a / b : a % b);
+            break;
+        case WACC_IR_UDIV:
+        case WACC_IR_UREM:
+            if (ub == 0)
+            {
+                return false;
+            }
+            r = op == WACC_IR_UDIV ? ua / ub : ua % ub;
+            break;
+        case WACC_IR_AND:
+            r = (uint64_t)a & (uint64_t)b;
+            break;
+        case WACC_IR_OR:
+            r = (uint64_t)a | (uint64_t)b;
+            break;
+        case WACC_IR_XOR:
+            r = (uint64_t)a ^ (uint64_t)b;
+            break;
+        case WACC_IR_SHL:
+        case WACC_IR_SAR:
+        case WACC_IR_SHR:
+            if (b < 0 || b >= (int64_t)wacc_ir_type_bits(arg_type))
+            {
+                return false;
+            }
+            r = op == WACC_IR_SHL ? (uint64_t)a << b : op == WACC_IR_SHR ? ua >> b : (uint64_t)(a >> b);
+            break;
+        case WACC_IR_EQ:
+            r = a == b;
+            break;
+        case WACC_IR_NE:
+            r = a != b;
+            break;
+        case WACC_IR_SLT:
+            r = a < b;
+            break;
+        case WACC_IR_SLE:
+            r = a <= b;
+            break;
+        case WACC_IR_SGT:
+            r = a > b;
+            break;
+        case WACC_IR_SGE:
+            r = a >= b;
+            break;
+        case WACC_IR_ULT:
+            r = ua < ub;
+            break;
+        case WACC_IR_ULE:
+            r = ua <= ub;
+            break;
+        case WACC_IR_UGT:
+            r = ua > ub;
+            break;
+        case WACC_IR_UGE:
+            r = ua >= ub;
+            break;
+        default:
+            return false;
+    }
+    *result = wacc_ir_normalize(type, (int64_t)r);
+    return true;
+}
+
+WaccIrModule* wacc_ir_module_new(const Allocator* alloc)
+{
+    WaccIrModule* module = allocator_alloc(alloc, sizeof(WaccIrModule));
+    if (module == NULL)
+    {
+        allocator_oom();
+    }
+    module->functions = (WaccIrFunctionBuf)BUF_NEW_IN(alloc);
+    module->counters = (WaccIrCounters){0};
+    module->alloc = alloc;
+    return module;
+}
+
+void wacc_ir_module_free(WaccIrModule* module)
+{
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        wacc_ir_function_free(module->alloc, module->functions.ptr[i]);
+    }
+    BUF_FREE(module->functions);
+    allocator_free(module->alloc, module);
+}
+
+WaccIrFunction* wacc_ir_function_new(WaccIrModule* module, str name, WaccIrType ret_type, uint32_t num_params)
+{
+    WaccIrFunction* function = allocator_alloc(module->alloc, sizeof(WaccIrFunction));
+    if (function == NULL)
+    {
+        allocator_oom();
+    }
+    function->name = name;
+    function->ret_type = ret_type;
+    function->num_params = num_params;
+    function->exported = true;
+    function->profiled = false;
+    arena_init(&function->arena, FUNCTION_ARENA_CHUNK_SIZE);
+    function->alloc = arena_allocator(&function->arena);
+    function->blocks = (WaccIrBlockBuf)BUF_NEW_IN(&function->alloc);
+    function->value_types = (WaccIrTypeBuf)BUF_NEW_IN(&function->alloc);
+    function->operands = (WaccIrOperandBuf)BUF_NEW_IN(&function->alloc);
+    // value 0 is "no value"
+    BUF_PUSH(&function->value_types, WACC_IR_TYPE_VOID);
+    (void)wacc_ir_block_new(function);
+    BUF_PUSH(&module->functions, function);
+    return function;
+}
+
+void wacc_ir_function_release(WaccIrFunction* function)
+{
+    arena_free(&function->arena);
+    function->blocks = (WaccIrBlockBuf)BUF_NEW_IN(&function->alloc);
+    function->value_types = (WaccIrTypeBuf)BUF_NEW_IN(&function->alloc);
+    function->operands = (WaccIrOperandBuf)BUF_NEW_IN(&function->alloc);
+}
+
+void wacc_ir_function_free(const Allocator* alloc, WaccIrFunction* function)
+{
+    str_free(function->name);
+    arena_free(&function->arena);
+    allocator_free(alloc, function);
+}
+
+WaccIrBlockId wacc_ir_block_new(WaccIrFunction* function)
+{
+    WaccIrBlock block = {
+        .insts = BUF_NEW_IN(&function->alloc),
+        .preds = BUF_NEW_IN(&function->alloc),
+    };
+    BUF_PUSH(&function->blocks, block);
+    return (WaccIrBlockId)(function->blocks.len - 1);
+}
+
+WaccIrValue wacc_ir_value_new(WaccIrFunction* function, WaccIrType type)
+{
+    BUF_PUSH(&function->value_types, type);
+    return (WaccIrValue)(function->value_types.len - 1);
+}
+
+WaccIrValue wacc_ir_append(WaccIrFunction* function, WaccIrBlockId block, WaccIrInst inst)
+{
+    if (wacc_ir_has_flag(inst.op, WACC_IR_DEST) && inst.dest == WACC_IR_NO_VALUE && inst.type != WACC_IR_TYPE_VOID)
+    {
+        inst.dest = wacc_ir_value_new(function, inst.type);
+    }
+    BUF_PUSH(&function->blocks.ptr[block].insts, inst);
+    return inst.dest;
+}
+
+WaccIrValue wacc_ir_emit_const(WaccIrFunction* function, WaccIrBlockId block, WaccIrType type, int64_t value)
+{
+    return wacc_ir_append(function,
+        block,
+        (WaccIrInst){
+            .op = WACC_IR_CONST,
+            .type = type,
+            .imm = wacc_ir_normalize(type, value),
+        });
+}
+
+WaccIrValue wacc_ir_emit_param(WaccIrFunction* function, WaccIrBlockId block, WaccIrType type, uint32_t index)
+{
+    return wacc_ir_append(function, block, (WaccIrInst){.op = WACC_IR_PARAM, .type = type, .imm = index});
+}
+
+WaccIrValue wacc_ir_emit_unary(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrOpcode op, WaccIrType type, WaccIrValue a)
+{
+    assert(wacc_ir_opcodes[op].num_args == 1);
+    return wacc_ir_append(function, block, (WaccIrInst){.op = op, .type = type, .args = {a}});
+}
+
+WaccIrValue wacc_ir_emit_binary(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrOpcode op, WaccIrType type, WaccIrValue a, WaccIrValue b)
+{
+    assert(wacc_ir_opcodes[op].num_args == 2);
+    return wacc_ir_append(function, block, (WaccIrInst){.op = op, .type = type, .args = {a, b}});
+}
+
+void wacc_ir_set_operands(WaccIrFunction* function, WaccIrInst* inst, const WaccIrOperand* operands, uint32_t count)
+{
+    inst->first = (uint32_t)function->operands.len;
+    inst->count = count;
+    BUF_EXTEND(&function->operands, operands, count);
+}
+
+WaccIrValue wacc_ir_emit_phi(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrType type, const WaccIrOperand* incoming, uint32_t count)
+{
+    WaccIrInst inst = {.op = WACC_IR_PHI, .type = type, .dest = wacc_ir_value_new(function, type)};
+    wacc_ir_set_operands(function, &inst, incoming, count);
+
+    // phis stay grouped at the start of the block
+    WaccIrInstBuf* insts = &function->blocks.ptr[block].insts;
+    uint64_t at = 0;
+    while (at < insts->len && insts->ptr[at].op == WACC_IR_PHI)
+    {
+        at++;
+    }
+    BUF_PUSH(insts, inst);
+    memmove(insts->ptr + at + 1, insts->ptr + at, (insts->len - at - 1) * sizeof(WaccIrInst));
+    insts->ptr[at] = inst;
+    return inst.dest;
+}
+
+WaccIrValue wacc_ir_emit_call(WaccIrFunction* function,
+    WaccIrBlockId block,
+    WaccIrType type,
+    uint32_t callee,
+    const WaccIrValue* args,
+    uint32_t count)
+{
+    WaccIrInst inst = {.op = WACC_IR_CALL, .type = type, .imm = callee};
+    inst.first = (uint32_t)function->operands.len;
+    inst.count = count;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        WaccIrOperand operand = {.value = args[i], .block = WACC_IR_NO_BLOCK};
+        BUF_PUSH(&function->operands, operand);
+    }
+    return wacc_ir_append(function, block, inst);
+}
+
+void wacc_ir_emit_br(WaccIrFunction* function, WaccIrBlockId block, WaccIrBlockId target)
+{
+    (void)wacc_ir_append(function,
+        block,
+        (WaccIrInst){
+            .op = WACC_IR_BR,
+            .type = WACC_IR_TYPE_VOID,
+            .targets = {target, WACC_IR_NO_BLOCK},
+        });
+}
+
+void wacc_ir_emit_cbr(
+    WaccIrFunction* function, WaccIrBlockId block, WaccIrValue cond, WaccIrBlockId if_true, WaccIrBlockId if_false)
+{
+    (void)wacc_ir_append(function,
+        block,
+        (WaccIrInst){
+            .op = WACC_IR_CBR,
+            .type = wacc_ir_value_type(function, cond),
+            .args = {cond},
+            .targets = {if_true, if_false},
+        });
+}
+
+void wacc_ir_emit_ret(WaccIrFunction* function, WaccIrBlockId block, WaccIrValue value)
+{
+    (void)wacc_ir_append(function,
+        block,
+        (WaccIrInst){
+            .op = WACC_IR_RET,
+            .type = wacc_ir_value_type(function, value),
+            .args = {value},
+        });
+}
+
+uint32_t wacc_ir_num_uses(const WaccIrInst* inst)
+{
+    if (inst->op == WACC_IR_PHI || inst->op == WACC_IR_CALL)
+    {
+        return inst->count;
+    }
+    return wacc_ir_opcodes[inst->op].num_args;
+}
+
+WaccIrValue* wacc_ir_use(WaccIrFunction* function, WaccIrInst* inst, uint32_t i)
+{
+    if (inst->op == WACC_IR_PHI || inst->op == WACC_IR_CALL)
+    {
+        return &function->operands.ptr[inst->first + i].value;
+    }
+    return &inst->args[i];
+}
+
+uint32_t wacc_ir_successors(const WaccIrBlock* block, WaccIrBlockId out[2])
+{
+    if (block->insts.len == 0)
+    {
+        return 0;
+    }
+    const WaccIrInst* term = &block->insts.ptr[block->insts.len - 1];
+    switch (term->op)
+    {
+        case WACC_IR_BR:
+            out[0] = term->targets[0];
+            return 1;
+        case WACC_IR_CBR:
+            out[0] = term->targets[0];
+            if (term->targets[1] == term->targets[0])
+            {
+                return 1;
+            }
+            out[1] = term->targets[1];
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+uint64_t wacc_ir_edge_count(const WaccIrFunction* function, WaccIrBlockId from, WaccIrBlockId to)
+{
+    const WaccIrBlock* block = &function->blocks.ptr[from];
+    const WaccIrInst* term = &block->insts.ptr[block->insts.len - 1];
+    if (term->op != WACC_IR_CBR || term->targets[0] == term->targets[1])
+    {
+        return block->count;
+    }
+    return to == term->targets[0] ? block->taken : block->count - block->taken;
+}
+
+void wacc_ir_compute_preds(WaccIrFunction* function)
+{
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        function->blocks.ptr[b].preds.len = 0;
+    }
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccIrBlockId succs[2];
+        uint32_t n = wacc_ir_successors(&function->blocks.ptr[b], succs);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            BUF_PUSH(&function->blocks.ptr[succs[i]].preds, (WaccIrBlockId)b);
+        }
+    }
+}
+
+void wacc_ir_reverse_postorder(const WaccIrFunction* function, WaccIrBlockIdBuf* out)
+{
+    typedef struct
+    {
+        WaccIrBlockId block;
+        uint32_t next_succ;
+    } Frame;
+    typedef BUF(Frame) FrameBuf;
+
+    uint64_t n = function->blocks.len;
+    out->len = 0;
+    BUF_RESERVE(out, n);
+    out->len = n;
+    uint64_t fill = n;
+
+    BUF(bool) visited = BUF_NEW;
+    BUF_RESERVE(&visited, n);
+    memset(visited.ptr, 0, n * sizeof(bool));
+    FrameBuf stack = BUF_NEW;
+
+    visited.ptr[0] = true;
+    BUF_PUSH(&stack, ((Frame){0, 0}));
+    while (stack.len > 0)
+    {
+        Frame* top = &stack.ptr[stack.len - 1];
+        WaccIrBlockId succs[2];
+        uint32_t num_succs = wacc_ir_successors(&function->blocks.ptr[top->block], succs);
+        if (top->next_succ < num_succs)
+        {
+            WaccIrBlockId succ = succs[top->next_succ++];
+            if (!visited.ptr[succ])
+            {
+                visited.ptr[succ] = true;
+                BUF_PUSH(&stack, ((Frame){succ, 0}));
+            }
+            continue;
+        }
+        out->ptr[--fill] = top->block;
+        stack.len--;
+    }
+
+    // drop the unused prefix left by unreachable blocks
+    memmove(out->ptr, out->ptr + fill, (n - fill) * sizeof(WaccIrBlockId));
+    out->len = n - fill;
+
+    BUF_FREE(stack);
+    BUF_FREE(visited);
+}
+
+void wacc_ir_dominators(const WaccIrFunction* function, WaccIrBlockIdBuf* idom)
+{
+    uint64_t n = function->blocks.len;
+    WaccIrBlockIdBuf order = BUF_NEW;
+    wacc_ir_reverse_postorder(function, &order);
+    // position of each block in `order`, which the intersection walks by
+    BUF(uint32_t) position = BUF_NEW;
+    BUF_RESERVE(&position, n);
+    position.len = n;
+    idom->len = 0;
+    BUF_RESERVE(idom, n);
+    idom->len = n;
+    for (uint64_t b = 0; b < n; b++)
+    {
+        idom->ptr[b] = WACC_IR_NO_BLOCK;
+    }
+    for (uint64_t k = 0; k < order.len; k++)
+    {
+        position.ptr[order.ptr[k]] = (uint32_t)k;
+    }
+    idom->ptr[0] = 0;
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint64_t k = 1; k < order.len; k++)
+        {
+            WaccIrBlockId b = order.ptr[k];
+            const WaccIrBlockIdBuf* preds = &function->blocks.ptr[b].preds;
+            WaccIrBlockId new_idom = WACC_IR_NO_BLOCK;
+            for (uint64_t p = 0; p < preds->len; p++)
+            {
+                WaccIrBlockId pred = preds->ptr[p];
+                if (idom->ptr[pred] == WACC_IR_NO_BLOCK)
+                {
+                    continue;
+                }
+                if (new_idom == WACC_IR_NO_BLOCK)
+                {
+                    new_idom = pred;
+                    continue;
+                }
+                // walk both up the tree to their closest common dominator
+                WaccIrBlockId x = pred;
+                WaccIrBlockId y = new_idom;
+                while (x != y)
+                {
+                    while (position.ptr[x] > position.ptr[y])
+                    {
+                        x = idom->ptr[x];
+                    }
+                    while (position.ptr[y] > position.ptr[x])
+                    {
+                        y = idom->ptr[y];
+                    }
+                }
+                new_idom = x;
+            }
+            if (idom->ptr[b] != new_idom)
+            {
+                idom->ptr[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    BUF_FREE(position);
+    BUF_FREE(order);
+}
+
+bool wacc_ir_dominates(const WaccIrBlockIdBuf* idom, WaccIrBlockId a, WaccIrBlockId b)
+{
+    if (idom->ptr[b] == WACC_IR_NO_BLOCK)
+    {
+        return false;
+    }
+    while (b != a && b != 0)
+    {
+        b = idom->ptr[b];
+    }
+    return b == a;
+}
+
+size_t wacc_ir_num_insts(const WaccIrFunction* function)
+{
+    size_t count = 0;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        count += function->blocks.ptr[b].insts.len;
+    }
+    return count;
+}
+
+void wacc_ir_uses_build(const WaccIrFunction* function, WaccIrUses* uses)
+{
+    uint64_t num_values = function->value_types.len;
+    *uses = (WaccIrUses){.start = BUF_NEW, .users = BUF_NEW, .defs = BUF_NEW};
+    BUF_RESERVE(&uses->start, num_values + 1);
+    BUF_RESERVE(&uses->defs, num_values);
+    memset(uses->start.ptr, 0, (num_values + 1) * sizeof(uint32_t));
+    memset(uses->defs.ptr, 0, num_values * sizeof(WaccIrInstRef));
+    uses->start.len = num_values + 1;
+    uses->defs.len = num_values;
+
+    // count the uses of each value into start[v + 1], then turn the counts
+    // into offsets and fill the users in a second pass
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccIrBlock* block = &function->blocks.ptr[b];
+        for (uint64_t i = 0; i < block->insts.len; i++)
+        {
+            WaccIrInst* inst = &block->insts.ptr[i];
+            if (inst->dest != WACC_IR_NO_VALUE)
+            {
+                uses->defs.ptr[inst->dest] = (WaccIrInstRef){(WaccIrBlockId)b, (uint32_t)i};
+            }
+            uint32_t n = wacc_ir_num_uses(inst);
+            for (uint32_t j = 0; j < n; j++)
+            {
+                uses->start.ptr[*wacc_ir_use((WaccIrFunction*)function, inst, j) + 1]++;
+            }
+        }
+    }
+    for (uint64_t v = 0; v < num_values; v++)
+    {
+        uses->start.ptr[v + 1] += uses->start.ptr[v];
+    }
+    uint32_t total = uses->start.ptr[num_values];
+    BUF_RESERVE(&uses->users, total);
+    uses->users.len = total;
+    BUF(uint32_t) fill = BUF_NEW;
+    BUF_EXTEND(&fill, uses->start.ptr, num_values);
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccIrBlock* block = &function->blocks.ptr[b];
+        for (uint64_t i = 0; i < block->insts.len; i++)
+        {
+            WaccIrInst* inst = &block->insts.ptr[i];
+            uint32_t n = wacc_ir_num_uses(inst);
+            for (uint32_t j = 0; j < n; j++)
+            {
+                WaccIrValue v = *wacc_ir_use((WaccIrFunction*)function, inst, j);
+                uses->users.ptr[fill.ptr[v]++] = (WaccIrInstRef){(WaccIrBlockId)b, (uint32_t)i};
+            }
+        }
+    }
+    BUF_FREE(fill);
+}
+
+void wacc_ir_uses_free(WaccIrUses* uses)
+{
+    BUF_FREE(uses->start);
+    BUF_FREE(uses->users);
+    BUF_FREE(uses->defs);
+}
+
+size_t wacc_ir_remove_nops(WaccIrFunction* function)
+{
+    size_t removed = 0;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        uint64_t kept = 0;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            if (insts->ptr[i].op != WACC_IR_NOP)
+            {
+                insts->ptr[kept++] = insts->ptr[i];
+            }
+        }
+        removed += insts->len - kept;
+        insts->len = kept;
+    }
+    return removed;
+}
+
+#define VERIFY(cond, ...) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            (void)fprintf(err, "ir error in '" str_fmt "': ", str_arg(function->name)); \
+            (void)fprintf(err, __VA_ARGS__); \
+            (void)fputc('\n', err); \
+            ok = false; \
+            goto done; \
+        } \
+    } while (false)
+
+static bool block_has_pred(const WaccIrFunction* function, WaccIrBlockId block, WaccIrBlockId pred)
+{
+    WaccIrBlockId succs[2];
+    uint32_t n = wacc_ir_successors(&function->blocks.ptr[pred], succs);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (succs[i] == block)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool wacc_ir_verify(const WaccIrFunction* function, FILE* err)
+{
+    bool ok = true;
+    uint64_t num_values = function->value_types.len;
+    uint64_t num_blocks = function->blocks.len;
+    BUF(bool) defined = BUF_NEW;
+    BUF(uint32_t) num_preds = BUF_NEW;
+    BUF_RESERVE(&defined, num_values);
+    memset(defined.ptr, 0, num_values * sizeof(bool));
+    BUF_RESERVE(&num_preds, num_blocks);
+    memset(num_preds.ptr, 0, num_blocks * sizeof(uint32_t));
+
+    for (uint64_t b = 0; b < num_blocks; b++)
+    {
+        const WaccIrBlock* block = &function->blocks.ptr[b];
+        WaccIrBlockId succs[2];
+        uint32_t n = wacc_ir_successors(block, succs);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            VERIFY(succs[i] < num_blocks, "b%zu branches to missing block b%u", b, succs[i]);
+            num_preds.ptr[succs[i]]++;
+        }
+        for (uint64_t i = 0; i < block->insts.len; i++)
+        {
+            const WaccIrInst* inst = &block->insts.ptr[i];
+            if (inst->dest != WACC_IR_NO_VALUE)
+            {
+                VERIFY(inst->dest < num_values, "b%zu defines unknown value %%%u", b, inst->dest);
+                VERIFY(!defined.ptr[inst->dest], "%%%u is defined twice", inst->dest);
+                VERIFY(function->value_types.ptr[inst->dest] == inst->type, "%%%u defined with wrong type", inst->dest);
+                defined.ptr[inst->dest] = true;
+            }
+        }
+    }
+
+    for (uint64_t b = 0; b < num_blocks; b++)
+    {
+        const WaccIrBlock* block = &function->blocks.ptr[b];
+        VERIFY(block->insts.len > 0, "b%zu is empty", b);
+        bool in_phis = true;
+        for (uint64_t i = 0; i < block->insts.len; i++)
+        {
+            const WaccIrInst* inst = &block->insts.ptr[i];
+            bool last = i + 1 == block->insts.len;
+            VERIFY(wacc_ir_has_flag(inst->op, WACC_IR_TERMINATOR) == last,
+                "b%zu: %s %s the end of the block",
+                b,
+                wacc_ir_opcodes[inst->op].name,
+                last ? "is not a terminator at" : "is a terminator before");
+            if (inst->op == WACC_IR_PHI)
+            {
+                VERIFY(in_phis, "b%zu: phi %%%u after a non-phi instruction", b, inst->dest);
+                VERIFY(inst->count == num_preds.ptr[b],
+                    "b%zu: phi %%%u has %u operands for %u predecessors",
+                    b,
+                    inst->dest,
+                    inst->count,
+                    num_preds.ptr[b]);
+                for (uint32_t j = 0; j < inst->count; j++)
+                {
+                    WaccIrBlockId from = function->operands.ptr[inst->first + j].block;
+                    VERIFY(from < num_blocks && block_has_pred(function, (WaccIrBlockId)b, from),
+                        "b%zu: phi %%%u has an operand for b%u, which is not a predecessor",
+                        b,
+                        inst->dest,
+                        from);
+                }
+            }
+            else
+            {
+                in_phis = false;
+            }
+            uint32_t num_uses = wacc_ir_num_uses(inst);
+            for (uint32_t j = 0; j < num_uses; j++)
+            {
+                WaccIrValue v = wacc_ir_use((WaccIrFunction*)function, (WaccIrInst*)inst, j)[0];
+                if (v == WACC_IR_NO_VALUE && inst->op == WACC_IR_RET)
+                {
+                    continue;
+                }
+                VERIFY(v < num_values && defined.ptr[v],
+                    "b%zu: %s uses undefined value %%%u",
+                    b,
+                    wacc_ir_opcodes[inst->op].name,
+                    v);
+            }
+        }
+    }
+
+done:
+    BUF_FREE(defined);
+    BUF_FREE(num_preds);
+    return ok;
+}
+
+#undef VERIFY
+
+static void print_lower(const char* s, FILE* out)
+{
+    for (; *s; s++)
+    {
+        (void)fputc(tolower((unsigned char)*s), out);
+    }
+}
+
+static void print_type(WaccIrType type, FILE* out)
+{
+    print_lower(type_names[type], out);
+}
+
+void wacc_ir_print_function(const WaccIrFunction* function, FILE* out)
+{
+    (void)fprintf(out, "function " str_fmt "(", str_arg(function->name));
+    for (uint32_t i = 0; i < function->num_params; i++)
+    {
+        (void)fprintf(out, i > 0 ? ", p%u" : "p%u", i);
+    }
+    (void)fprintf(out, ") -> ");
+    print_type(function->ret_type, out);
+    (void)fprintf(out, " {\n");
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccIrBlock* block = &function->blocks.ptr[b];
+        (void)fprintf(out, "b%zu:", b);
+        if (function->profiled)
+        {
+            (void)fprintf(out, " ; count %llu", (unsigned long long)block->count);
+        }
+        (void)fputc('\n', out);
+        for (uint64_t i = 0; i < block->insts.len; i++)
+        {
+            const WaccIrInst* inst = &block->insts.ptr[i];
+            (void)fprintf(out, "    ");
+            if (inst->dest != WACC_IR_NO_VALUE)
+            {
+                (void)fprintf(out, "%%%u:", inst->dest);
+                print_type(inst->type, out);
+                (void)fprintf(out, " = ");
+            }
+            print_lower(wacc_ir_opcodes[inst->op].name, out);
+            switch (inst->op)
+            {
+                case WACC_IR_CONST:
+                    (void)fprintf(out, " %lld", (long long)inst->imm);
+                    break;
+                case WACC_IR_PARAM:
+                    (void)fprintf(out, " p%lld", (long long)inst->imm);
+                    break;
+                case WACC_IR_PHI:
+                    for (uint32_t j = 0; j < inst->count; j++)
+                    {
+                        const WaccIrOperand* op = &function->operands.ptr[inst->first + j];
+                        (void)fprintf(out, "%s[b%u: %%%u]", j > 0 ? ", " : " ", op->block, op->value);
+                    }
+                    break;
+                case WACC_IR_CALL:
+                    (void)fprintf(out, " @%lld(", (long long)inst->imm);
+                    for (uint32_t j = 0; j < inst->count; j++)
+                    {
+                        (void)fprintf(out, j > 0 ? ", %%%u" : "%%%u", function->operands.ptr[inst->first + j].value);
+                    }
+                    (void)fprintf(out, ")");
+                    break;
+                case WACC_IR_COUNT:
+                    (void)fprintf(out, " #%lld", (long long)inst->imm);
+                    break;
+                case WACC_IR_BR:
+                    (void)fprintf(out, " b%u", inst->targets[0]);
+                    break;
+                case WACC_IR_CBR:
+                    (void)fprintf(out, " %%%u, b%u, b%u", inst->args[0], inst->targets[0], inst->targets[1]);
+                    break;
+                default:
+                    for (uint32_t j = 0; j < wacc_ir_opcodes[inst->op].num_args; j++)
+                    {
+                        if (inst->args[j] != WACC_IR_NO_VALUE)
+                        {
+                            (void)fprintf(out, j > 0 ? ", %%%u" : " %%%u", inst->args[j]);
+                        }
+                    }
+                    break;
+            }
+            (void)fputc('\n', out);
+        }
+    }
+    (void)fprintf(out, "}\n");
+}
+
+void wacc_ir_print(const WaccIrModule* module, FILE* out)
+{
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        if (i > 0)
+        {
+            (void)fputc('\n', out);
+        }
+        wacc_ir_print_function(module->functions.ptr[i], out);
+    }
+}
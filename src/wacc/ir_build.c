@@ -0,0 +1,219 @@
+#include "wacc/ir.h"
+
+#include <hashmap/hashmap.h>
+#include <stdlib.h>
+
+// A call resolves to whatever function is declared by that name when it is
+// built. A program is normally declared whole before any body is built, so a
+// function may call any other; built one at a time, as they are streamed, a
+// function can only call itself and those built before it, as C requires of a
+// definition without a prior declaration. An unknown name or a call with the
+// wrong number of arguments is reported and built as the constant 0, which
+// keeps the module well formed for the caller to discard.
+
+struct WaccIrBuilder
+{
+    WaccSystem* system;
+    WaccIrModule* module;
+    // index of every function by name, keyed by the names the module owns; a
+    // large file has too many functions to look each callee up by scanning
+    HASHMAP(str, uint32_t) functions;
+    // of the function being built
+    const WaccActualFunction* source;
+    WaccIrFunction* function;
+    WaccIrBlockId block;
+    // the value of each parameter, read once in the entry block
+    WaccIrValue* params;
+};
+
+typedef WaccIrBuilder IrBuilder;
+
+static WaccIrValue build_expression(IrBuilder* builder, const WaccExpression* expr);
+
+static WaccIrValue build_error(IrBuilder* builder, ErrorKind error, Range range)
+{
+    wacc_system_handle_error(builder->system, error, range);
+    return wacc_ir_emit_const(builder->function, builder->block, WACC_IR_TYPE_I32, 0);
+}
+
+static WaccIrValue build_variable(IrBuilder* builder, const WaccVariableExpression* variable)
+{
+    str name = wacc_system_text(builder->system, variable->name);
+    for (uint64_t i = 0; i < builder->source->params.len; i++)
+    {
+        if (str_eq(name, wacc_system_text(builder->system, builder->source->params.ptr[i])))
+        {
+            return builder->params[i];
+        }
+    }
+    return build_error(builder, ERROR_UNKNOWN_VARIABLE, variable->name);
+}
+
+static bool find_function(const IrBuilder* builder, str name, uint32_t* index)
+{
+    uint32_t* found = NULL;
+    HASHMAP_GET(builder->functions, name, str_hash, str_eq, &found);
+    if (found == NULL)
+    {
+        return false;
+    }
+    *index = *found;
+    return true;
+}
+
+static WaccIrValue build_call(IrBuilder* builder, const WaccCallExpression* call)
+{
+    uint32_t callee;
+    if (!find_function(builder, wacc_system_text(builder->system, call->name), &callee))
+    {
+        return build_error(builder, ERROR_UNKNOWN_FUNCTION, call->name);
+    }
+    if (call->args.len != builder->module->functions.ptr[callee]->num_params)
+    {
+        return build_error(builder, ERROR_WRONG_ARGUMENT_COUNT, call->name);
+    }
+    WaccIrValue* args = allocator_alloc(&builder->function->alloc, (call->args.len + 1) * sizeof(WaccIrValue));
+    if (args == NULL)
+    {
+        allocator_oom();
+    }
+    for (uint64_t i = 0; i < call->args.len; i++)
+    {
+        args[i] = build_expression(builder, call->args.ptr[i]);
+    }
+    return wacc_ir_emit_call(
+        builder->function, builder->block, WACC_IR_TYPE_I32, callee, args, (uint32_t)call->args.len);
+}
+
+static WaccIrValue build_expression(IrBuilder* builder, const WaccExpression* expr)
+{
+    switch (expr->type)
+    {
+        case WACC_EXPR_CONSTANT:
+            return wacc_ir_emit_const(builder->function,
+                builder->block,
+                WACC_IR_TYPE_I32,
+                (int64_t)((const WaccConstantExpression*)expr)->value);
+        case WACC_EXPR_VARIABLE:
+            return build_variable(builder, (const WaccVariableExpression*)expr);
+        case WACC_EXPR_CALL:
+            return build_call(builder, (const WaccCallExpression*)expr);
+        case WACC_EXPR_ERROR:
+        default:
+            // only error-free programs are lowered
+            abort();
+    }
+}
+
+static uint32_t source_line(const IrBuilder* builder, Range range)
+{
+    return (uint32_t)wacc_system_line(builder->system, range.start);
+}
+
+static void build_statement(IrBuilder* builder, const WaccStatement* stmt)
+{
+    WaccIrInstBuf* insts = &builder->function->blocks.ptr[builder->block].insts;
+    uint64_t first = insts->len;
+    WaccIrValue value = build_expression(builder, stmt->expression);
+    wacc_ir_emit_ret(builder->function, builder->block, value);
+    // everything the statement computes maps back to its line
+    uint32_t line = source_line(builder, stmt->span);
+    for (uint64_t i = first; i < insts->len; i++)
+    {
+        insts->ptr[i].line = line;
+    }
+}
+
+WaccIrBuilder* wacc_ir_builder_new(WaccSystem* system, WaccIrModule* module)
+{
+    WaccIrBuilder* builder = allocator_alloc(module->alloc, sizeof(WaccIrBuilder));
+    if (builder == NULL)
+    {
+        allocator_oom();
+    }
+    *builder = (WaccIrBuilder){
+        .system = system,
+        .module = module,
+        .functions = HASHMAP_NEW_IN(module->alloc),
+    };
+    return builder;
+}
+
+void wacc_ir_builder_free(WaccIrBuilder* builder)
+{
+    HASHMAP_FREE(builder->functions);
+    allocator_free(builder->module->alloc, builder);
+}
+
+static void check_params(IrBuilder* builder, const WaccActualFunction* func)
+{
+    for (uint64_t i = 0; i < func->params.len; i++)
+    {
+        for (uint64_t j = 0; j < i; j++)
+        {
+            if (str_eq(wacc_system_text(builder->system, func->params.ptr[i]),
+                    wacc_system_text(builder->system, func->params.ptr[j])))
+            {
+                wacc_system_handle_error(builder->system, ERROR_DUPLICATE_PARAMETER, func->params.ptr[i]);
+                break;
+            }
+        }
+    }
+}
+
+void wacc_ir_builder_set_file(WaccIrBuilder* builder, WaccSystem* system)
+{
+    builder->system = system;
+}
+
+WaccIrFunction* wacc_ir_declare_function(WaccIrBuilder* builder, const WaccActualFunction* func)
+{
+    str name = wacc_system_text(builder->system, func->name);
+    uint32_t existing;
+    bool duplicate = find_function(builder, name, &existing);
+    if (duplicate)
+    {
+        wacc_system_handle_error(builder->system, ERROR_DUPLICATE_FUNCTION, func->name);
+    }
+    check_params(builder, func);
+    // the module may outlive the source text
+    str copy = str_null;
+    str_cpy(&copy, name);
+    WaccIrFunction* function =
+        wacc_ir_function_new(builder->module, copy, WACC_IR_TYPE_I32, (uint32_t)func->params.len);
+    function->line = source_line(builder, func->name);
+    if (!duplicate)
+    {
+        // calls keep going to the first definition
+        uint32_t index = (uint32_t)(builder->module->functions.len - 1);
+        HASHMAP_PUT(&builder->functions, function->name, index, str_hash, str_eq);
+    }
+    return function;
+}
+
+void wacc_ir_define_function(WaccIrBuilder* builder, uint32_t index, const WaccActualFunction* func)
+{
+    WaccIrFunction* function = builder->module->functions.ptr[index];
+    builder->source = func;
+    builder->function = function;
+    builder->block = 0;
+    builder->params = allocator_alloc(&function->alloc, (func->params.len + 1) * sizeof(WaccIrValue));
+    if (builder->params == NULL)
+    {
+        allocator_oom();
+    }
+    for (uint32_t i = 0; i < func->params.len; i++)
+    {
+        builder->params[i] = wacc_ir_emit_param(function, builder->block, WACC_IR_TYPE_I32, i);
+    }
+    build_statement(builder, &func->statement);
+    wacc_ir_compute_preds(function);
+}
+
+WaccIrFunction* wacc_ir_build_function(WaccIrBuilder* builder, const WaccActualFunction* func)
+{
+    // declared before its body is built, so that it can call itself
+    WaccIrFunction* function = wacc_ir_declare_function(builder, func);
+    wacc_ir_define_function(builder, (uint32_t)(builder->module->functions.len - 1), func);
+    return function;
+}
@@ -0,0 +1,230 @@
+#include "wacc/opt.h"
+
+#include <string.h>
+
+// Dead code elimination.
+//
+// Blocks the entry cannot reach are deleted and the rest renumbered. Then
+// instructions are marked live starting from those with effects (calls and
+// terminators) and following their operands through the def-use chains; every
+// pure instruction left unmarked is deleted. Unlike deleting values without
+// uses, this also removes cycles of phis and arithmetic that only feed each
+// other, such as a counter nothing reads.
+
+typedef BUF(uint32_t) IndexBuf;
+typedef BUF(bool) BoolBuf;
+
+#define REMOVED UINT32_MAX
+
+// delete the blocks not reachable from the entry, renumbering the others
+static void remove_unreachable(WaccIrFunction* function, WaccOptStats* stats)
+{
+    WaccIrBlockIdBuf order = BUF_NEW;
+    wacc_ir_reverse_postorder(function, &order);
+    uint64_t num_blocks = function->blocks.len;
+    if (order.len == num_blocks)
+    {
+        BUF_FREE(order);
+        return;
+    }
+
+    // new numbers keep the original order of the blocks that stay
+    IndexBuf renumber = BUF_NEW;
+    BUF_RESERVE(&renumber, num_blocks);
+    renumber.len = num_blocks;
+    for (uint64_t b = 0; b < num_blocks; b++)
+    {
+        renumber.ptr[b] = REMOVED;
+    }
+    for (uint64_t k = 0; k < order.len; k++)
+    {
+        renumber.ptr[order.ptr[k]] = 0;
+    }
+    uint32_t kept = 0;
+    for (uint64_t b = 0; b < num_blocks; b++)
+    {
+        if (renumber.ptr[b] != REMOVED)
+        {
+            renumber.ptr[b] = kept;
+            function->blocks.ptr[kept++] = function->blocks.ptr[b];
+        }
+    }
+    stats->blocks_removed += num_blocks - kept;
+    function->blocks.len = kept;
+
+    for (uint64_t b = 0; b < kept; b++)
+    {
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            WaccIrInst* inst = &insts->ptr[i];
+            if (inst->op == WACC_IR_PHI)
+            {
+                // the edges from deleted blocks are gone
+                WaccIrOperand* operands = wacc_ir_operands(function, inst);
+                uint32_t count = 0;
+                for (uint32_t j = 0; j < inst->count; j++)
+                {
+                    if (renumber.ptr[operands[j].block] != REMOVED)
+                    {
+                        operands[count] = operands[j];
+                        operands[count++].block = renumber.ptr[operands[j].block];
+                    }
+                }
+                inst->count = count;
+            }
+            else if (inst->op == WACC_IR_BR || inst->op == WACC_IR_CBR)
+            {
+                for (uint32_t t = 0; t < 2; t++)
+                {
+                    if (inst->targets[t] != WACC_IR_NO_BLOCK)
+                    {
+                        inst->targets[t] = renumber.ptr[inst->targets[t]];
+                    }
+                }
+            }
+        }
+    }
+    wacc_ir_compute_preds(function);
+    BUF_FREE(renumber);
+    BUF_FREE(order);
+}
+
+static void mark(BoolBuf* live, IndexBuf* work, WaccIrValue value)
+{
+    if (value != WACC_IR_NO_VALUE && !live->ptr[value])
+    {
+        live->ptr[value] = true;
+        BUF_PUSH(work, value);
+    }
+}
+
+static void mark_operands(WaccIrFunction* function, WaccIrInst* inst, BoolBuf* live, IndexBuf* work)
+{
+    uint32_t n = wacc_ir_num_uses(inst);
+    for (uint32_t j = 0; j < n; j++)
+    {
+        mark(live, work, *wacc_ir_use(function, inst, j));
+    }
+}
+
+static void remove_dead_values(WaccIrFunction* function, WaccOptStats* stats)
+{
+    WaccIrUses uses;
+    wacc_ir_uses_build(function, &uses);
+    uint64_t num_values = function->value_types.len;
+    BoolBuf live = BUF_NEW;
+    IndexBuf work = BUF_NEW;
+    BUF_RESERVE(&live, num_values);
+    memset(live.ptr, 0, num_values * sizeof(bool));
+    live.len = num_values;
+
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            WaccIrInst* inst = &insts->ptr[i];
+            if (!wacc_ir_has_flag(inst->op, WACC_IR_PURE))
+            {
+                mark(&live, &work, inst->dest);
+                mark_operands(function, inst, &live, &work);
+            }
+        }
+    }
+    while (work.len > 0)
+    {
+        WaccIrInstRef def = uses.defs.ptr[work.ptr[--work.len]];
+        mark_operands(function, &function->blocks.ptr[def.block].insts.ptr[def.index], &live, &work);
+    }
+
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            WaccIrInst* inst = &insts->ptr[i];
+            if (inst->dest != WACC_IR_NO_VALUE && !live.ptr[inst->dest])
+            {
+                wacc_ir_kill(inst);
+            }
+        }
+    }
+    stats->removed += wacc_ir_remove_nops(function);
+    BUF_FREE(work);
+    BUF_FREE(live);
+    wacc_ir_uses_free(&uses);
+}
+
+void wacc_opt_dce(WaccIrFunction* function, WaccOptStats* stats)
+{
+    remove_unreachable(function, stats);
+    remove_dead_values(function, stats);
+}
+
+void wacc_opt_remove_dead_functions(WaccIrModule* module, WaccOptStats* stats)
+{
+    uint64_t num_functions = module->functions.len;
+    IndexBuf renumber = BUF_NEW;
+    IndexBuf work = BUF_NEW;
+    BUF_RESERVE(&renumber, num_functions);
+    renumber.len = num_functions;
+    for (uint32_t f = 0; f < num_functions; f++)
+    {
+        renumber.ptr[f] = REMOVED;
+        if (module->functions.ptr[f]->exported)
+        {
+            renumber.ptr[f] = 0;
+            BUF_PUSH(&work, f);
+        }
+    }
+    while (work.len > 0)
+    {
+        const WaccIrFunction* function = module->functions.ptr[work.ptr[--work.len]];
+        for (uint64_t b = 0; b < function->blocks.len; b++)
+        {
+            const WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+            for (uint64_t i = 0; i < insts->len; i++)
+            {
+                if (insts->ptr[i].op == WACC_IR_CALL && renumber.ptr[insts->ptr[i].imm] == REMOVED)
+                {
+                    renumber.ptr[insts->ptr[i].imm] = 0;
+                    BUF_PUSH(&work, (uint32_t)insts->ptr[i].imm);
+                }
+            }
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint64_t f = 0; f < num_functions; f++)
+    {
+        WaccIrFunction* function = module->functions.ptr[f];
+        if (renumber.ptr[f] == REMOVED)
+        {
+            wacc_ir_function_free(module->alloc, function);
+            continue;
+        }
+        renumber.ptr[f] = kept;
+        module->functions.ptr[kept++] = function;
+    }
+    stats->functions_removed += num_functions - kept;
+    module->functions.len = kept;
+    // calls name their callee by its index in the module
+    for (uint64_t f = 0; f < kept; f++)
+    {
+        WaccIrFunction* function = module->functions.ptr[f];
+        for (uint64_t b = 0; b < function->blocks.len; b++)
+        {
+            WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+            for (uint64_t i = 0; i < insts->len; i++)
+            {
+                if (insts->ptr[i].op == WACC_IR_CALL)
+                {
+                    insts->ptr[i].imm = renumber.ptr[insts->ptr[i].imm];
+                }
+            }
+        }
+    }
+    BUF_FREE(work);
+    BUF_FREE(renumber);
+}
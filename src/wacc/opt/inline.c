@@ -0,0 +1,422 @@
+#include "wacc/opt.h"
+
+#include <string.h>
+
+// Bottom-up inlining over the call graph.
+//
+// The strongly connected components of the call graph are found with Tarjan's
+// algorithm, which completes them callees first. Visiting functions in that
+// order means a callee has already absorbed its own callees when it is
+// considered for its callers, so the size the cost model sees is the size that
+// would be copied. Calls within one component are recursive and never inlined.
+//
+// A call site is inlined when the callee has at most `inline_threshold`
+// instructions, or when the callee is not exported and this is its only call
+// site: the out-of-line copy is then dead and inlining only removes code.
+//
+// With a profile, the threshold follows how often the call ran: a call that
+// never ran is only inlined for the second reason, and one that ran at least
+// 1/HOT_FRACTION as often as the hottest block of the module gets HOT_FACTOR
+// times the threshold. The copied blocks get the callee's counts scaled by
+// the share of the callee's runs that came from this call.
+
+enum
+{
+    HOT_FRACTION = 1000,
+    HOT_FACTOR = 4,
+};
+
+typedef BUF(uint32_t) IndexBuf;
+
+#define UNVISITED UINT32_MAX
+
+typedef struct
+{
+    const WaccIrModule* module;
+    // Tarjan's bookkeeping, indexed by function
+    IndexBuf index;
+    IndexBuf low;
+    BUF(bool) on_stack;
+    IndexBuf stack;
+    uint32_t next_index;
+    // the component of each function
+    IndexBuf component;
+    uint32_t num_components;
+    // every function, callees before their callers
+    IndexBuf order;
+} CallGraph;
+
+typedef struct
+{
+    WaccIrModule* module;
+    const WaccOptOptions* options;
+    WaccOptStats* stats;
+    CallGraph graph;
+    // number of calls to each function in the module
+    IndexBuf call_sites;
+    // with a profile, the count of the most frequent block of the module
+    uint64_t hottest;
+} Inliner;
+
+static void strong_connect(CallGraph* g, uint32_t f)
+{
+    g->index.ptr[f] = g->next_index;
+    g->low.ptr[f] = g->next_index;
+    g->next_index++;
+    BUF_PUSH(&g->stack, f);
+    g->on_stack.ptr[f] = true;
+
+    const WaccIrFunction* function = g->module->functions.ptr[f];
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            if (insts->ptr[i].op != WACC_IR_CALL)
+            {
+                continue;
+            }
+            uint32_t callee = (uint32_t)insts->ptr[i].imm;
+            if (g->index.ptr[callee] == UNVISITED)
+            {
+                strong_connect(g, callee);
+                g->low.ptr[f] = g->low.ptr[callee] < g->low.ptr[f] ? g->low.ptr[callee] : g->low.ptr[f];
+            }
+            else if (g->on_stack.ptr[callee])
+            {
+                g->low.ptr[f] = g->index.ptr[callee] < g->low.ptr[f] ? g->index.ptr[callee] : g->low.ptr[f];
+            }
+        }
+    }
+
+    if (g->low.ptr[f] == g->index.ptr[f])
+    {
+        uint32_t member;
+        do
+        {
+            member = g->stack.ptr[--g->stack.len];
+            g->on_stack.ptr[member] = false;
+            g->component.ptr[member] = g->num_components;
+            BUF_PUSH(&g->order, member);
+        } while (member != f);
+        g->num_components++;
+    }
+}
+
+static void call_graph_build(CallGraph* g, const WaccIrModule* module)
+{
+    uint64_t n = module->functions.len;
+    *g = (CallGraph){
+        .module = module,
+        .index = BUF_NEW,
+        .low = BUF_NEW,
+        .on_stack = BUF_NEW,
+        .stack = BUF_NEW,
+        .component = BUF_NEW,
+        .order = BUF_NEW,
+    };
+    BUF_RESERVE(&g->index, n);
+    BUF_RESERVE(&g->low, n);
+    BUF_RESERVE(&g->on_stack, n);
+    BUF_RESERVE(&g->component, n);
+    for (uint64_t f = 0; f < n; f++)
+    {
+        BUF_PUSH(&g->index, UNVISITED);
+        BUF_PUSH(&g->low, 0);
+        BUF_PUSH(&g->on_stack, false);
+        BUF_PUSH(&g->component, 0);
+    }
+    for (uint32_t f = 0; f < n; f++)
+    {
+        if (g->index.ptr[f] == UNVISITED)
+        {
+            strong_connect(g, f);
+        }
+    }
+}
+
+static void call_graph_free(CallGraph* g)
+{
+    BUF_FREE(g->index);
+    BUF_FREE(g->low);
+    BUF_FREE(g->on_stack);
+    BUF_FREE(g->stack);
+    BUF_FREE(g->component);
+    BUF_FREE(g->order);
+}
+
+// whether a branch leads back to the entry block, whose copy could then not
+// simply be jumped to from the call site
+static bool entry_has_preds(const WaccIrFunction* function)
+{
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccIrBlockId succs[2];
+        uint32_t n = wacc_ir_successors(&function->blocks.ptr[b], succs);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (succs[i] == 0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// the most instructions a callee may have to be inlined at a call in `block`
+static uint64_t threshold(const Inliner* in, const WaccIrFunction* caller, WaccIrBlockId block)
+{
+    uint64_t count = caller->blocks.ptr[block].count;
+    if (!caller->profiled)
+    {
+        return in->options->inline_threshold;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (count >= in->hottest / HOT_FRACTION)
+    {
+        return (uint64_t)in->options->inline_threshold * HOT_FACTOR;
+    }
+    return in->options->inline_threshold;
+}
+
+static bool should_inline(const Inliner* in, uint32_t caller, WaccIrBlockId block, uint32_t callee)
+{
+    if (in->graph.component.ptr[caller] == in->graph.component.ptr[callee])
+    {
+        return false;
+    }
+    const WaccIrFunction* function = in->module->functions.ptr[callee];
+    if (entry_has_preds(function))
+    {
+        return false;
+    }
+    return wacc_ir_num_insts(function) <= threshold(in, in->module->functions.ptr[caller], block) ||
+           (!function->exported && in->call_sites.ptr[callee] == 1);
+}
+
+// point the phis of the successors of `block` that name `old` as their
+// predecessor at `block` instead
+static void retarget_phis(WaccIrFunction* function, WaccIrBlockId block, WaccIrBlockId old)
+{
+    WaccIrBlockId succs[2];
+    uint32_t n = wacc_ir_successors(&function->blocks.ptr[block], succs);
+    for (uint32_t s = 0; s < n; s++)
+    {
+        const WaccIrInstBuf* insts = &function->blocks.ptr[succs[s]].insts;
+        for (uint64_t i = 0; i < insts->len && insts->ptr[i].op == WACC_IR_PHI; i++)
+        {
+            WaccIrOperand* operands = wacc_ir_operands(function, &insts->ptr[i]);
+            for (uint32_t j = 0; j < insts->ptr[i].count; j++)
+            {
+                if (operands[j].block == old)
+                {
+                    operands[j].block = block;
+                }
+            }
+        }
+    }
+}
+
+// Replace the call at `index` in `block` by a copy of the callee's body: the
+// block branches to the copied entry, every `ret` branches to a new block
+// holding the instructions after the call, and a phi there merges the
+// returned values into the call's destination. Returns the new block.
+static WaccIrBlockId inline_call(Inliner* in, WaccIrFunction* caller, WaccIrBlockId block, uint32_t index)
+{
+    WaccIrInst call = caller->blocks.ptr[block].insts.ptr[index];
+    const WaccIrFunction* callee = in->module->functions.ptr[call.imm];
+
+    WaccIrBlockId rest = wacc_ir_block_new(caller);
+    WaccIrInstBuf* insts = &caller->blocks.ptr[block].insts;
+    BUF_EXTEND(&caller->blocks.ptr[rest].insts, insts->ptr + index + 1, insts->len - index - 1);
+    insts->len = index;
+    retarget_phis(caller, rest, block);
+    WaccIrBlock* call_block = &caller->blocks.ptr[block];
+    caller->blocks.ptr[rest].count = call_block->count;
+    caller->blocks.ptr[rest].taken = call_block->taken;
+    call_block->taken = 0;
+    // how the callee's counts carry over to this call
+    uint64_t entry = callee->blocks.ptr[0].count;
+    double scale = entry > 0 ? (double)call_block->count / (double)entry : 0;
+
+    // the callee's values renumbered into the caller; parameters become the
+    // arguments of the call
+    IndexBuf values = BUF_NEW;
+    BUF_RESERVE(&values, callee->value_types.len);
+    memset(values.ptr, 0, callee->value_types.len * sizeof(uint32_t));
+    values.len = callee->value_types.len;
+    const WaccIrOperand* args = wacc_ir_operands(caller, &call);
+    WaccIrBlockId first_block = (WaccIrBlockId)caller->blocks.len;
+    for (uint64_t b = 0; b < callee->blocks.len; b++)
+    {
+        WaccIrBlockId copy_block = wacc_ir_block_new(caller);
+        WaccIrBlock* copy = &caller->blocks.ptr[copy_block];
+        copy->count = (uint64_t)((double)callee->blocks.ptr[b].count * scale);
+        copy->taken = (uint64_t)((double)callee->blocks.ptr[b].taken * scale);
+        const WaccIrInstBuf* callee_insts = &callee->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < callee_insts->len; i++)
+        {
+            const WaccIrInst* inst = &callee_insts->ptr[i];
+            if (inst->op == WACC_IR_PARAM)
+            {
+                values.ptr[inst->dest] = args[inst->imm].value;
+            }
+            else if (inst->dest != WACC_IR_NO_VALUE)
+            {
+                values.ptr[inst->dest] = wacc_ir_value_new(caller, inst->type);
+            }
+        }
+    }
+
+    WaccIrOperandBuf operands = BUF_NEW;
+    WaccIrOperandBuf returns = BUF_NEW;
+    for (uint64_t b = 0; b < callee->blocks.len; b++)
+    {
+        WaccIrBlockId copy_block = first_block + (WaccIrBlockId)b;
+        const WaccIrInstBuf* callee_insts = &callee->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < callee_insts->len; i++)
+        {
+            WaccIrInst inst = callee_insts->ptr[i];
+            switch (inst.op)
+            {
+                case WACC_IR_PARAM:
+                    continue;
+                case WACC_IR_RET:
+                    BUF_PUSH(&returns, ((WaccIrOperand){values.ptr[inst.args[0]], copy_block}));
+                    wacc_ir_emit_br(caller, copy_block, rest);
+                    continue;
+                case WACC_IR_BR:
+                case WACC_IR_CBR:
+                    for (uint32_t t = 0; t < 2; t++)
+                    {
+                        inst.targets[t] += inst.targets[t] == WACC_IR_NO_BLOCK ? 0 : first_block;
+                    }
+                    break;
+                case WACC_IR_CALL:
+                    in->call_sites.ptr[inst.imm]++;
+                    break;
+                default:
+                    break;
+            }
+            inst.dest = values.ptr[inst.dest];
+            if (inst.op == WACC_IR_PHI || inst.op == WACC_IR_CALL)
+            {
+                const WaccIrOperand* from = wacc_ir_operands(callee, &inst);
+                operands.len = 0;
+                for (uint32_t j = 0; j < inst.count; j++)
+                {
+                    WaccIrOperand operand = {values.ptr[from[j].value], from[j].block};
+                    operand.block += operand.block == WACC_IR_NO_BLOCK ? 0 : first_block;
+                    BUF_PUSH(&operands, operand);
+                }
+                wacc_ir_set_operands(caller, &inst, operands.ptr, inst.count);
+            }
+            else
+            {
+                for (uint32_t j = 0; j < wacc_ir_opcodes[inst.op].num_args; j++)
+                {
+                    inst.args[j] = values.ptr[inst.args[j]];
+                }
+            }
+            BUF_PUSH(&caller->blocks.ptr[copy_block].insts, inst);
+        }
+    }
+    wacc_ir_emit_br(caller, block, first_block);
+
+    if (call.dest != WACC_IR_NO_VALUE)
+    {
+        // the continuation starts without phis, so this one goes first
+        WaccIrInst phi = {.op = WACC_IR_PHI, .type = call.type, .dest = call.dest};
+        wacc_ir_set_operands(caller, &phi, returns.ptr, (uint32_t)returns.len);
+        WaccIrInstBuf* rest_insts = &caller->blocks.ptr[rest].insts;
+        BUF_PUSH(rest_insts, phi);
+        memmove(rest_insts->ptr + 1, rest_insts->ptr, (rest_insts->len - 1) * sizeof(WaccIrInst));
+        rest_insts->ptr[0] = phi;
+    }
+
+    in->call_sites.ptr[call.imm]--;
+    in->stats->inlined++;
+    BUF_FREE(values);
+    BUF_FREE(operands);
+    BUF_FREE(returns);
+    return rest;
+}
+
+static void inline_into(Inliner* in, uint32_t f)
+{
+    WaccIrFunction* caller = in->module->functions.ptr[f];
+    // the blocks to scan for calls: the original ones and the continuations
+    // split off at inlined calls, but not the inlined bodies, whose calls
+    // were already turned down when the callee itself was visited
+    IndexBuf work = BUF_NEW;
+    for (uint32_t b = 0; b < caller->blocks.len; b++)
+    {
+        BUF_PUSH(&work, b);
+    }
+    bool changed = false;
+    for (uint64_t w = 0; w < work.len; w++)
+    {
+        WaccIrBlockId block = work.ptr[w];
+        const WaccIrInstBuf* insts = &caller->blocks.ptr[block].insts;
+        for (uint32_t i = 0; i < insts->len; i++)
+        {
+            const WaccIrInst* inst = &insts->ptr[i];
+            if (inst->op == WACC_IR_CALL && should_inline(in, f, block, (uint32_t)inst->imm))
+            {
+                BUF_PUSH(&work, inline_call(in, caller, block, i));
+                changed = true;
+                break;
+            }
+        }
+    }
+    if (changed)
+    {
+        wacc_ir_compute_preds(caller);
+    }
+    BUF_FREE(work);
+}
+
+void wacc_opt_inline(WaccIrModule* module, const WaccOptOptions* options, WaccOptStats* stats)
+{
+    Inliner in = {
+        .module = module,
+        .options = options,
+        .stats = stats,
+        .call_sites = BUF_NEW,
+    };
+    call_graph_build(&in.graph, module);
+    BUF_RESERVE(&in.call_sites, module->functions.len);
+    memset(in.call_sites.ptr, 0, module->functions.len * sizeof(uint32_t));
+    in.call_sites.len = module->functions.len;
+    for (uint64_t f = 0; f < module->functions.len; f++)
+    {
+        const WaccIrFunction* function = module->functions.ptr[f];
+        for (uint64_t b = 0; b < function->blocks.len; b++)
+        {
+            if (function->profiled && function->blocks.ptr[b].count > in.hottest)
+            {
+                in.hottest = function->blocks.ptr[b].count;
+            }
+            const WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+            for (uint64_t i = 0; i < insts->len; i++)
+            {
+                if (insts->ptr[i].op == WACC_IR_CALL)
+                {
+                    in.call_sites.ptr[insts->ptr[i].imm]++;
+                }
+            }
+        }
+    }
+
+    for (uint64_t k = 0; k < in.graph.order.len; k++)
+    {
+        inline_into(&in, in.graph.order.ptr[k]);
+    }
+
+    call_graph_free(&in.graph);
+    BUF_FREE(in.call_sites);
+}
@@ -0,0 +1,510 @@
+#include "wacc/opt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Loop optimizations over natural loops.
+//
+// A back edge is an edge n -> h where h dominates n, and the natural loop of h
+// is h with every block that reaches such an n without passing through h.
+// Back edges to the same header make one loop. Each loop first gets a
+// preheader: a block that is the header's only predecessor from outside the
+// loop and only branches to it, to hold the code that runs once before the
+// loop.
+//
+// Invariant code motion moves a pure instruction to the preheader when every
+// operand is defined outside the loop, innermost loops first so code can move
+// out of a whole nest. Instructions that may trap stay where they are, since
+// the loop body might never run.
+//
+// A basic induction variable is a header phi i = phi(init, i + step) with an
+// invariant step. Every multiplication i * k by an invariant k is replaced by
+// a new induction variable j = phi(init * k, j + step * k), trading a
+// multiplication per iteration for an addition. Multiplications by constants
+// are left alone: strength reduction and the backend already turn them into
+// shifts and lea, which cost no more than the addition and need no extra
+// register across the loop.
+
+typedef BUF(uint32_t) IndexBuf;
+typedef BUF(bool) BoolBuf;
+
+typedef struct
+{
+    WaccIrBlockId header;
+    // WACC_IR_NO_BLOCK when the loop could not be given one
+    WaccIrBlockId preheader;
+    // the sources of the back edges
+    WaccIrBlockIdBuf latches;
+    // indexed by block
+    BoolBuf body;
+    uint32_t size;
+} Loop;
+
+typedef BUF(Loop) LoopBuf;
+
+typedef struct
+{
+    WaccIrFunction* function;
+    WaccOptStats* stats;
+    // where each value is defined, kept current as instructions move
+    WaccIrInstRefBuf defs;
+    // the value that replaces each value, or WACC_IR_NO_VALUE
+    IndexBuf replace;
+} LoopOpt;
+
+typedef struct
+{
+    WaccIrValue product;
+    WaccIrValue factor;
+} Candidate;
+
+typedef BUF(Candidate) CandidateBuf;
+
+static void loops_free(LoopBuf* loops)
+{
+    for (uint64_t k = 0; k < loops->len; k++)
+    {
+        BUF_FREE(loops->ptr[k].latches);
+        BUF_FREE(loops->ptr[k].body);
+    }
+    loops->len = 0;
+}
+
+static Loop* loop_for_header(LoopBuf* loops, WaccIrBlockId header, uint64_t num_blocks)
+{
+    for (uint64_t k = 0; k < loops->len; k++)
+    {
+        if (loops->ptr[k].header == header)
+        {
+            return &loops->ptr[k];
+        }
+    }
+    Loop loop = {.header = header, .preheader = WACC_IR_NO_BLOCK, .latches = BUF_NEW, .body = BUF_NEW};
+    BUF_RESERVE(&loop.body, num_blocks);
+    memset(loop.body.ptr, 0, num_blocks * sizeof(bool));
+    loop.body.len = num_blocks;
+    BUF_PUSH(loops, loop);
+    return &loops->ptr[loops->len - 1];
+}
+
+// the natural loops of `function`, whose predecessor lists must be current
+static void find_loops(const WaccIrFunction* function, LoopBuf* loops)
+{
+    uint64_t num_blocks = function->blocks.len;
+    WaccIrBlockIdBuf idom = BUF_NEW;
+    wacc_ir_dominators(function, &idom);
+    for (uint64_t b = 0; b < num_blocks; b++)
+    {
+        WaccIrBlockId succs[2];
+        uint32_t n = wacc_ir_successors(&function->blocks.ptr[b], succs);
+        for (uint32_t s = 0; s < n; s++)
+        {
+            if (wacc_ir_dominates(&idom, succs[s], (WaccIrBlockId)b))
+            {
+                BUF_PUSH(&loop_for_header(loops, succs[s], num_blocks)->latches, (WaccIrBlockId)b);
+            }
+        }
+    }
+
+    WaccIrBlockIdBuf work = BUF_NEW;
+    for (uint64_t k = 0; k < loops->len; k++)
+    {
+        Loop* loop = &loops->ptr[k];
+        loop->body.ptr[loop->header] = true;
+        loop->size = 1;
+        BUF_EXTEND(&work, loop->latches.ptr, loop->latches.len);
+        while (work.len > 0)
+        {
+            WaccIrBlockId b = work.ptr[--work.len];
+            if (loop->body.ptr[b])
+            {
+                continue;
+            }
+            loop->body.ptr[b] = true;
+            loop->size++;
+            const WaccIrBlockIdBuf* preds = &function->blocks.ptr[b].preds;
+            BUF_EXTEND(&work, preds->ptr, preds->len);
+        }
+    }
+    BUF_FREE(work);
+    BUF_FREE(idom);
+}
+
+// the predecessor of the header from outside the loop if it is the only one
+// and branches nowhere else
+static WaccIrBlockId find_preheader(const WaccIrFunction* function, const Loop* loop)
+{
+    const WaccIrBlockIdBuf* preds = &function->blocks.ptr[loop->header].preds;
+    WaccIrBlockId outside = WACC_IR_NO_BLOCK;
+    for (uint64_t p = 0; p < preds->len; p++)
+    {
+        if (!loop->body.ptr[preds->ptr[p]])
+        {
+            if (outside != WACC_IR_NO_BLOCK)
+            {
+                return WACC_IR_NO_BLOCK;
+            }
+            outside = preds->ptr[p];
+        }
+    }
+    WaccIrBlockId succs[2];
+    if (outside == WACC_IR_NO_BLOCK || wacc_ir_successors(&function->blocks.ptr[outside], succs) != 1)
+    {
+        return WACC_IR_NO_BLOCK;
+    }
+    return outside;
+}
+
+// Route the edges entering the loop from outside through a new block. The
+// header's phis keep one operand for it; when several edges entered, a phi in
+// the new block merges their values first. Returns whether a block was added.
+static bool insert_preheader(WaccIrFunction* function, const Loop* loop)
+{
+    WaccIrBlockId header = loop->header;
+    // the entry block has no predecessors to route
+    if (header == 0 || find_preheader(function, loop) != WACC_IR_NO_BLOCK)
+    {
+        return false;
+    }
+    WaccIrBlockIdBuf outside = BUF_NEW;
+    const WaccIrBlockIdBuf* preds = &function->blocks.ptr[header].preds;
+    for (uint64_t p = 0; p < preds->len; p++)
+    {
+        if (!loop->body.ptr[preds->ptr[p]])
+        {
+            BUF_PUSH(&outside, preds->ptr[p]);
+        }
+    }
+    // with a profile, the preheader runs as often as the loop is entered
+    uint64_t count = 0;
+    for (uint64_t p = 0; p < outside.len; p++)
+    {
+        count += wacc_ir_edge_count(function, outside.ptr[p], header);
+    }
+    WaccIrBlockId preheader = wacc_ir_block_new(function);
+    function->blocks.ptr[preheader].count = count;
+    for (uint64_t p = 0; p < outside.len; p++)
+    {
+        WaccIrInst* term = wacc_ir_terminator(&function->blocks.ptr[outside.ptr[p]]);
+        for (uint32_t t = 0; t < 2; t++)
+        {
+            if (term->targets[t] == header)
+            {
+                term->targets[t] = preheader;
+            }
+        }
+    }
+
+    WaccIrOperandBuf inside = BUF_NEW;
+    WaccIrOperandBuf entering = BUF_NEW;
+    for (uint64_t i = 0; function->blocks.ptr[header].insts.ptr[i].op == WACC_IR_PHI; i++)
+    {
+        WaccIrInst phi = function->blocks.ptr[header].insts.ptr[i];
+        const WaccIrOperand* operands = wacc_ir_operands(function, &phi);
+        inside.len = 0;
+        entering.len = 0;
+        for (uint32_t j = 0; j < phi.count; j++)
+        {
+            if (loop->body.ptr[operands[j].block])
+            {
+                BUF_PUSH(&inside, operands[j]);
+            }
+            else
+            {
+                BUF_PUSH(&entering, operands[j]);
+            }
+        }
+        WaccIrOperand merged = {entering.len > 0 ? entering.ptr[0].value : WACC_IR_NO_VALUE, preheader};
+        if (entering.len > 1)
+        {
+            merged.value = wacc_ir_emit_phi(function, preheader, phi.type, entering.ptr, (uint32_t)entering.len);
+        }
+        BUF_PUSH(&inside, merged);
+        wacc_ir_set_operands(function, &phi, inside.ptr, (uint32_t)inside.len);
+        function->blocks.ptr[header].insts.ptr[i] = phi;
+    }
+    wacc_ir_emit_br(function, preheader, header);
+    BUF_FREE(inside);
+    BUF_FREE(entering);
+    BUF_FREE(outside);
+    return true;
+}
+
+static int compare_size(const void* a, const void* b)
+{
+    const Loop* x = a;
+    const Loop* y = b;
+    return x->size < y->size ? -1 : x->size > y->size;
+}
+
+static void record_defs(LoopOpt* o, WaccIrBlockId block)
+{
+    while (o->defs.len < o->function->value_types.len)
+    {
+        BUF_PUSH(&o->defs, ((WaccIrInstRef){WACC_IR_NO_BLOCK, 0}));
+        BUF_PUSH(&o->replace, WACC_IR_NO_VALUE);
+    }
+    const WaccIrInstBuf* insts = &o->function->blocks.ptr[block].insts;
+    for (uint64_t i = 0; i < insts->len; i++)
+    {
+        if (insts->ptr[i].dest != WACC_IR_NO_VALUE)
+        {
+            o->defs.ptr[insts->ptr[i].dest] = (WaccIrInstRef){block, (uint32_t)i};
+        }
+    }
+}
+
+static WaccIrInst* def_of(const LoopOpt* o, WaccIrValue value)
+{
+    WaccIrInstRef def = o->defs.ptr[value];
+    return def.block == WACC_IR_NO_BLOCK ? NULL : &o->function->blocks.ptr[def.block].insts.ptr[def.index];
+}
+
+static bool is_invariant(const LoopOpt* o, const Loop* loop, WaccIrValue value)
+{
+    WaccIrBlockId block = o->defs.ptr[value].block;
+    return block != WACC_IR_NO_BLOCK && !loop->body.ptr[block];
+}
+
+// add `inst` to `block` just before its terminator
+static WaccIrValue insert_before_terminator(LoopOpt* o, WaccIrBlockId block, WaccIrInst inst)
+{
+    if (wacc_ir_has_flag(inst.op, WACC_IR_DEST) && inst.dest == WACC_IR_NO_VALUE)
+    {
+        inst.dest = wacc_ir_value_new(o->function, inst.type);
+    }
+    WaccIrInstBuf* insts = &o->function->blocks.ptr[block].insts;
+    WaccIrInst term = insts->ptr[insts->len - 1];
+    insts->ptr[insts->len - 1] = inst;
+    BUF_PUSH(insts, term);
+    record_defs(o, block);
+    return inst.dest;
+}
+
+static bool can_hoist(const WaccIrInst* inst)
+{
+    return inst->dest != WACC_IR_NO_VALUE && inst->op != WACC_IR_PHI && wacc_ir_has_flag(inst->op, WACC_IR_PURE) &&
+           !wacc_ir_has_flag(inst->op, WACC_IR_TRAPS);
+}
+
+static void hoist(LoopOpt* o, const Loop* loop, const WaccIrBlockIdBuf* order)
+{
+    WaccIrFunction* function = o->function;
+    for (uint64_t k = 0; k < order->len; k++)
+    {
+        WaccIrBlockId b = order->ptr[k];
+        if (!loop->body.ptr[b])
+        {
+            continue;
+        }
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            WaccIrInst* inst = &insts->ptr[i];
+            if (!can_hoist(inst))
+            {
+                continue;
+            }
+            bool invariant = true;
+            for (uint32_t j = 0; j < wacc_ir_num_uses(inst) && invariant; j++)
+            {
+                invariant = is_invariant(o, loop, *wacc_ir_use(function, inst, j));
+            }
+            if (!invariant)
+            {
+                continue;
+            }
+            // constants are only moved so that what uses them can follow
+            o->stats->hoisted += inst->op != WACC_IR_CONST;
+            WaccIrInst moved = *inst;
+            wacc_ir_kill(inst);
+            (void)insert_before_terminator(o, loop->preheader, moved);
+        }
+    }
+}
+
+static bool is_const(const LoopOpt* o, WaccIrValue value, int64_t imm)
+{
+    const WaccIrInst* def = def_of(o, value);
+    return def != NULL && def->op == WACC_IR_CONST && def->imm == imm;
+}
+
+// a * b in `block`, without the multiplication when a is 0 or 1, as the
+// initial value and step of a counter usually are
+static WaccIrValue multiply(LoopOpt* o, WaccIrBlockId block, WaccIrType type, WaccIrValue a, WaccIrValue b)
+{
+    if (is_const(o, a, 0) || is_const(o, a, 1))
+    {
+        return is_const(o, a, 1) ? b : a;
+    }
+    return insert_before_terminator(o, block, (WaccIrInst){.op = WACC_IR_MUL, .type = type, .args = {a, b}});
+}
+
+// the multiplications of the induction variable `iv` by an invariant that is
+// not a constant
+static void find_candidates(const LoopOpt* o, const Loop* loop, WaccIrValue iv, CandidateBuf* out)
+{
+    out->len = 0;
+    for (uint64_t b = 0; b < o->function->blocks.len; b++)
+    {
+        if (!loop->body.ptr[b])
+        {
+            continue;
+        }
+        const WaccIrInstBuf* insts = &o->function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            const WaccIrInst* inst = &insts->ptr[i];
+            if (inst->op != WACC_IR_MUL)
+            {
+                continue;
+            }
+            for (uint32_t j = 0; j < 2; j++)
+            {
+                WaccIrValue factor = inst->args[1 - j];
+                if (inst->args[j] == iv && is_invariant(o, loop, factor) && def_of(o, factor)->op != WACC_IR_CONST)
+                {
+                    BUF_PUSH(out, ((Candidate){inst->dest, factor}));
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void reduce_induction_variables(LoopOpt* o, const Loop* loop)
+{
+    WaccIrFunction* function = o->function;
+    WaccIrBlockId header = loop->header;
+    WaccIrBlockId latch = loop->latches.ptr[0];
+    CandidateBuf candidates = BUF_NEW;
+    uint64_t num_phis = 0;
+    while (function->blocks.ptr[header].insts.ptr[num_phis].op == WACC_IR_PHI)
+    {
+        num_phis++;
+    }
+    for (uint64_t p = 0; p < num_phis; p++)
+    {
+        WaccIrInst phi = function->blocks.ptr[header].insts.ptr[p];
+        const WaccIrOperand* operands = wacc_ir_operands(function, &phi);
+        if (phi.count != 2)
+        {
+            continue;
+        }
+        uint32_t back = operands[0].block == latch ? 0 : 1;
+        WaccIrValue init = operands[1 - back].value;
+        const WaccIrInst* next = def_of(o, operands[back].value);
+        if (next == NULL || next->op != WACC_IR_ADD || next->type != phi.type)
+        {
+            continue;
+        }
+        uint32_t step_arg = next->args[0] == phi.dest ? 1 : 0;
+        WaccIrValue step = next->args[step_arg];
+        if (next->args[1 - step_arg] != phi.dest || !is_invariant(o, loop, step))
+        {
+            continue;
+        }
+
+        find_candidates(o, loop, phi.dest, &candidates);
+        for (uint64_t c = 0; c < candidates.len; c++)
+        {
+            WaccIrValue factor = candidates.ptr[c].factor;
+            WaccIrValue init_scaled = multiply(o, loop->preheader, phi.type, init, factor);
+            WaccIrValue step_scaled = multiply(o, loop->preheader, phi.type, step, factor);
+            WaccIrOperand incoming[2];
+            incoming[1 - back] = (WaccIrOperand){init_scaled, loop->preheader};
+            incoming[back] = (WaccIrOperand){WACC_IR_NO_VALUE, latch};
+            WaccIrValue scaled = wacc_ir_emit_phi(function, header, phi.type, incoming, 2);
+            record_defs(o, header);
+            WaccIrValue scaled_next = insert_before_terminator(o,
+                latch,
+                (WaccIrInst){.op = WACC_IR_ADD, .type = phi.type, .args = {scaled, step_scaled}});
+            wacc_ir_operands(function, def_of(o, scaled))[back].value = scaled_next;
+
+            o->replace.ptr[candidates.ptr[c].product] = scaled;
+            wacc_ir_kill(def_of(o, candidates.ptr[c].product));
+            o->defs.ptr[candidates.ptr[c].product].block = WACC_IR_NO_BLOCK;
+            o->stats->ivs_reduced++;
+        }
+    }
+    BUF_FREE(candidates);
+}
+
+static void apply_replacements(LoopOpt* o)
+{
+    WaccIrFunction* function = o->function;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            uint32_t n = wacc_ir_num_uses(&insts->ptr[i]);
+            for (uint32_t j = 0; j < n; j++)
+            {
+                WaccIrValue* use = wacc_ir_use(function, &insts->ptr[i], j);
+                if (*use != WACC_IR_NO_VALUE && o->replace.ptr[*use] != WACC_IR_NO_VALUE)
+                {
+                    *use = o->replace.ptr[*use];
+                }
+            }
+        }
+    }
+}
+
+void wacc_opt_loops(WaccIrFunction* function, WaccOptStats* stats)
+{
+    LoopBuf loops = BUF_NEW;
+    find_loops(function, &loops);
+    if (loops.len == 0)
+    {
+        BUF_FREE(loops);
+        return;
+    }
+    bool added = false;
+    for (uint64_t k = 0; k < loops.len; k++)
+    {
+        added = insert_preheader(function, &loops.ptr[k]) || added;
+    }
+    if (added)
+    {
+        // the new blocks belong to the loops around them
+        wacc_ir_compute_preds(function);
+        loops_free(&loops);
+        find_loops(function, &loops);
+    }
+    for (uint64_t k = 0; k < loops.len; k++)
+    {
+        loops.ptr[k].preheader = find_preheader(function, &loops.ptr[k]);
+    }
+    qsort(loops.ptr, loops.len, sizeof(Loop), compare_size);
+
+    LoopOpt o = {.function = function, .stats = stats, .defs = BUF_NEW, .replace = BUF_NEW};
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        record_defs(&o, (WaccIrBlockId)b);
+    }
+    WaccIrBlockIdBuf order = BUF_NEW;
+    wacc_ir_reverse_postorder(function, &order);
+    for (uint64_t k = 0; k < loops.len; k++)
+    {
+        if (loops.ptr[k].preheader != WACC_IR_NO_BLOCK)
+        {
+            hoist(&o, &loops.ptr[k], &order);
+        }
+    }
+    for (uint64_t k = 0; k < loops.len; k++)
+    {
+        if (loops.ptr[k].preheader != WACC_IR_NO_BLOCK && loops.ptr[k].latches.len == 1)
+        {
+            reduce_induction_variables(&o, &loops.ptr[k]);
+        }
+    }
+    apply_replacements(&o);
+    (void)wacc_ir_remove_nops(function);
+
+    BUF_FREE(order);
+    BUF_FREE(o.defs);
+    BUF_FREE(o.replace);
+    loops_free(&loops);
+    BUF_FREE(loops);
+}
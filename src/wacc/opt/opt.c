@@ -0,0 +1,85 @@
+#include "wacc/opt.h"
+
+#include <string.h>
+
+void wacc_opt_function(WaccIrFunction* function, const WaccOptOptions* options, WaccOptStats* stats)
+{
+    if (options->level < 1)
+    {
+        return;
+    }
+    wacc_opt_sccp(function, stats);
+    // before strength reduction, which would turn the multiplications of
+    // induction variables into shifts
+    wacc_opt_loops(function, stats);
+    wacc_opt_strength(function, stats);
+    wacc_opt_dce(function, stats);
+    wacc_ir_compute_preds(function);
+}
+
+typedef struct
+{
+    WaccIrModule* module;
+    const WaccOptOptions* options;
+    // one per worker
+    WaccOptStats* stats;
+} FunctionPasses;
+
+static void run_function_passes(void* context, uint64_t index, uint32_t worker)
+{
+    FunctionPasses* passes = context;
+    wacc_opt_function(passes->module->functions.ptr[index], passes->options, &passes->stats[worker]);
+}
+
+static void add_stats(WaccOptStats* total, const WaccOptStats* stats)
+{
+    total->folded += stats->folded;
+    total->branches_resolved += stats->branches_resolved;
+    total->removed += stats->removed;
+    total->reduced += stats->reduced;
+    total->inlined += stats->inlined;
+    total->blocks_removed += stats->blocks_removed;
+    total->functions_removed += stats->functions_removed;
+    total->hoisted += stats->hoisted;
+    total->ivs_reduced += stats->ivs_reduced;
+}
+
+void wacc_opt_module(WaccIrModule* module, const WaccOptOptions* options, WaccOptStats* stats)
+{
+    if (options->level < 1)
+    {
+        return;
+    }
+    // first, so that the other passes see the constants passed to callees
+    wacc_opt_inline(module, options, stats);
+    uint32_t num_workers = wacc_pool_size(options->pool);
+    BUF(WaccOptStats) worker_stats = BUF_NEW;
+    BUF_RESERVE(&worker_stats, num_workers);
+    memset(worker_stats.ptr, 0, num_workers * sizeof(WaccOptStats));
+    FunctionPasses passes = {.module = module, .options = options, .stats = worker_stats.ptr};
+    wacc_pool_for(options->pool, module->functions.len, run_function_passes, &passes);
+    // sums, the same whichever worker ran which function
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        add_stats(stats, &worker_stats.ptr[w]);
+    }
+    BUF_FREE(worker_stats);
+    // last, once inlining has taken over the calls to static functions
+    wacc_opt_remove_dead_functions(module, stats);
+}
+
+void wacc_opt_print_stats(const WaccOptStats* stats, FILE* out)
+{
+    (void)fprintf(out,
+        "opt: %zu inlined, %zu folded, %zu branches resolved, %zu instructions removed, %zu blocks removed, "
+        "%zu functions removed, %zu hoisted, %zu induction variables reduced, %zu strength-reduced\n",
+        stats->inlined,
+        stats->folded,
+        stats->branches_resolved,
+        stats->removed,
+        stats->blocks_removed,
+        stats->functions_removed,
+        stats->hoisted,
+        stats->ivs_reduced,
+        stats->reduced);
+}
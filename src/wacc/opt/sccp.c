@@ -0,0 +1,381 @@
+#include "wacc/opt.h"
+
+#include <hashmap/hashmap.h>
+#include <string.h>
+
+// Sparse conditional constant propagation after Wegman and Zadeck: values
+// start out unknown and only ever move down the lattice
+// unknown -> constant -> varying, while blocks only become reachable once an
+// executable edge leads to them.
+
+typedef enum
+{
+    // no executable definition seen yet
+    LATTICE_UNKNOWN,
+    LATTICE_CONST,
+    // not a compile-time constant
+    LATTICE_VARYING,
+} LatticeKind;
+
+typedef struct
+{
+    LatticeKind kind;
+    int64_t value;
+} Lattice;
+
+typedef struct
+{
+    WaccIrBlockId from;
+    WaccIrBlockId to;
+} Edge;
+
+typedef struct
+{
+    WaccIrFunction* function;
+    WaccIrUses uses;
+    BUF(Lattice) values;
+    BUF(bool) reachable;
+    // the executable edges, keyed by edge_key
+    HASHMAP(uint64_t, bool) edges;
+    BUF(Edge) cfg_work;
+    BUF(WaccIrValue) ssa_work;
+} Sccp;
+
+static uint64_t edge_key(WaccIrBlockId from, WaccIrBlockId to)
+{
+    return (uint64_t)from << 32 | to;
+}
+
+static bool edge_executable(const Sccp* s, WaccIrBlockId from, WaccIrBlockId to)
+{
+    bool* found = NULL;
+    HASHMAP_GET(s->edges, edge_key(from, to), hashmap_hash_u64, hashmap_eq_scalar, &found);
+    return found != NULL;
+}
+
+static void add_edge(Sccp* s, WaccIrBlockId from, WaccIrBlockId to)
+{
+    if (edge_executable(s, from, to))
+    {
+        return;
+    }
+    uint64_t key = edge_key(from, to);
+    HASHMAP_PUT(&s->edges, key, true, hashmap_hash_u64, hashmap_eq_scalar);
+    BUF_PUSH(&s->cfg_work, ((Edge){from, to}));
+}
+
+static Lattice meet(Lattice a, Lattice b)
+{
+    if (a.kind == LATTICE_UNKNOWN)
+    {
+        return b;
+    }
+    if (b.kind == LATTICE_UNKNOWN)
+    {
+        return a;
+    }
+    if (a.kind == LATTICE_CONST && b.kind == LATTICE_CONST && a.value == b.value)
+    {
+        return a;
+    }
+    return (Lattice){LATTICE_VARYING, 0};
+}
+
+static void set_value(Sccp* s, WaccIrValue v, Lattice lattice)
+{
+    Lattice old = s->values.ptr[v];
+    // only ever move down, so the analysis terminates
+    lattice = meet(old, lattice);
+    if (lattice.kind == old.kind && lattice.value == old.value)
+    {
+        return;
+    }
+    s->values.ptr[v] = lattice;
+    BUF_PUSH(&s->ssa_work, v);
+}
+
+static Lattice evaluate(const Sccp* s, WaccIrBlockId block, const WaccIrInst* inst)
+{
+    switch (inst->op)
+    {
+        case WACC_IR_CONST:
+            return (Lattice){LATTICE_CONST, inst->imm};
+        case WACC_IR_PARAM:
+        case WACC_IR_CALL:
+            return (Lattice){LATTICE_VARYING, 0};
+        case WACC_IR_PHI:
+        {
+            Lattice result = {LATTICE_UNKNOWN, 0};
+            const WaccIrOperand* operands = wacc_ir_operands(s->function, inst);
+            for (uint32_t i = 0; i < inst->count; i++)
+            {
+                if (edge_executable(s, operands[i].block, block))
+                {
+                    result = meet(result, s->values.ptr[operands[i].value]);
+                }
+            }
+            return result;
+        }
+        default:
+            break;
+    }
+
+    uint32_t num_args = wacc_ir_opcodes[inst->op].num_args;
+    Lattice args[2] = {{LATTICE_CONST, 0}, {LATTICE_CONST, 0}};
+    for (uint32_t i = 0; i < num_args; i++)
+    {
+        args[i] = s->values.ptr[inst->args[i]];
+        if (args[i].kind == LATTICE_VARYING)
+        {
+            return args[i];
+        }
+    }
+    for (uint32_t i = 0; i < num_args; i++)
+    {
+        if (args[i].kind == LATTICE_UNKNOWN)
+        {
+            return args[i];
+        }
+    }
+    WaccIrType arg_type = num_args > 0 ? wacc_ir_value_type(s->function, inst->args[0]) : inst->type;
+    int64_t result;
+    if (!wacc_ir_fold(inst->op, inst->type, arg_type, args[0].value, args[1].value, &result))
+    {
+        return (Lattice){LATTICE_VARYING, 0};
+    }
+    return (Lattice){LATTICE_CONST, result};
+}
+
+static void visit(Sccp* s, WaccIrBlockId block, uint32_t index)
+{
+    const WaccIrInst* inst = &s->function->blocks.ptr[block].insts.ptr[index];
+    switch (inst->op)
+    {
+        case WACC_IR_NOP:
+        case WACC_IR_COUNT:
+        case WACC_IR_RET:
+            return;
+        case WACC_IR_BR:
+            add_edge(s, block, inst->targets[0]);
+            return;
+        case WACC_IR_CBR:
+        {
+            Lattice cond = s->values.ptr[inst->args[0]];
+            if (cond.kind == LATTICE_CONST)
+            {
+                add_edge(s, block, inst->targets[cond.value != 0 ? 0 : 1]);
+            }
+            else if (cond.kind == LATTICE_VARYING)
+            {
+                add_edge(s, block, inst->targets[0]);
+                add_edge(s, block, inst->targets[1]);
+            }
+            return;
+        }
+        default:
+            set_value(s, inst->dest, evaluate(s, block, inst));
+            return;
+    }
+}
+
+static void solve(Sccp* s)
+{
+    add_edge(s, WACC_IR_NO_BLOCK, 0);
+    while (s->cfg_work.len > 0 || s->ssa_work.len > 0)
+    {
+        while (s->cfg_work.len > 0)
+        {
+            Edge edge = s->cfg_work.ptr[--s->cfg_work.len];
+            const WaccIrBlock* block = &s->function->blocks.ptr[edge.to];
+            // a block seen before only needs its phis updated for the new edge
+            bool first_visit = !s->reachable.ptr[edge.to];
+            s->reachable.ptr[edge.to] = true;
+            for (uint32_t i = 0; i < block->insts.len; i++)
+            {
+                if (!first_visit && block->insts.ptr[i].op != WACC_IR_PHI)
+                {
+                    break;
+                }
+                visit(s, edge.to, i);
+            }
+        }
+        while (s->ssa_work.len > 0)
+        {
+            WaccIrValue v = s->ssa_work.ptr[--s->ssa_work.len];
+            for (uint32_t u = s->uses.start.ptr[v]; u < s->uses.start.ptr[v + 1]; u++)
+            {
+                WaccIrInstRef user = s->uses.users.ptr[u];
+                if (s->reachable.ptr[user.block])
+                {
+                    visit(s, user.block, user.index);
+                }
+            }
+        }
+    }
+}
+
+// drop the operands for the edge from `pred` from the phis of `block`
+static void remove_phi_operands(WaccIrFunction* function, WaccIrBlockId block, WaccIrBlockId pred)
+{
+    WaccIrInstBuf* insts = &function->blocks.ptr[block].insts;
+    for (uint64_t i = 0; i < insts->len && insts->ptr[i].op == WACC_IR_PHI; i++)
+    {
+        WaccIrInst* phi = &insts->ptr[i];
+        WaccIrOperand* operands = wacc_ir_operands(function, phi);
+        uint32_t kept = 0;
+        for (uint32_t j = 0; j < phi->count; j++)
+        {
+            if (operands[j].block != pred)
+            {
+                operands[kept++] = operands[j];
+            }
+        }
+        phi->count = kept;
+    }
+}
+
+// Phis replaced by constants are no longer phis; move them behind the phis
+// that remain so the block still starts with its phis.
+static void reorder_phis(WaccIrInstBuf* insts, uint64_t num_phis)
+{
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < num_phis; i++)
+    {
+        if (insts->ptr[i].op == WACC_IR_PHI)
+        {
+            WaccIrInst phi = insts->ptr[i];
+            memmove(insts->ptr + kept + 1, insts->ptr + kept, (i - kept) * sizeof(WaccIrInst));
+            insts->ptr[kept++] = phi;
+        }
+    }
+}
+
+static void rewrite(Sccp* s, WaccOptStats* stats)
+{
+    WaccIrFunction* function = s->function;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        if (!s->reachable.ptr[b])
+        {
+            continue;
+        }
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        uint64_t num_phis = 0;
+        while (num_phis < insts->len && insts->ptr[num_phis].op == WACC_IR_PHI)
+        {
+            num_phis++;
+        }
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            WaccIrInst* inst = &insts->ptr[i];
+            if (inst->dest != WACC_IR_NO_VALUE && inst->op != WACC_IR_CONST &&
+                s->values.ptr[inst->dest].kind == LATTICE_CONST)
+            {
+                *inst = (WaccIrInst){
+                    .op = WACC_IR_CONST,
+                    .type = inst->type,
+                    .dest = inst->dest,
+                    .line = inst->line,
+                    .imm = s->values.ptr[inst->dest].value,
+                };
+                stats->folded++;
+            }
+            else if (inst->op == WACC_IR_CBR && s->values.ptr[inst->args[0]].kind == LATTICE_CONST)
+            {
+                bool taken = s->values.ptr[inst->args[0]].value != 0;
+                WaccIrBlockId target = inst->targets[taken ? 0 : 1];
+                WaccIrBlockId dropped = inst->targets[taken ? 1 : 0];
+                if (dropped != target)
+                {
+                    remove_phi_operands(function, dropped, (WaccIrBlockId)b);
+                }
+                *inst = (WaccIrInst){
+                    .op = WACC_IR_BR,
+                    .type = WACC_IR_TYPE_VOID,
+                    .line = inst->line,
+                    .targets = {target},
+                };
+                stats->branches_resolved++;
+            }
+        }
+        reorder_phis(insts, num_phis);
+    }
+}
+
+// Delete pure instructions whose results are unused, following the chain to
+// the operands that lose their last use in turn.
+static void sweep(WaccIrFunction* function, WaccOptStats* stats)
+{
+    WaccIrUses uses;
+    wacc_ir_uses_build(function, &uses);
+    uint64_t num_values = function->value_types.len;
+    BUF(uint32_t) num_uses = BUF_NEW;
+    BUF(WaccIrValue) dead = BUF_NEW;
+    BUF_RESERVE(&num_uses, num_values);
+    num_uses.len = num_values;
+    for (WaccIrValue v = 1; v < num_values; v++)
+    {
+        num_uses.ptr[v] = uses.start.ptr[v + 1] - uses.start.ptr[v];
+        if (num_uses.ptr[v] == 0)
+        {
+            BUF_PUSH(&dead, v);
+        }
+    }
+    while (dead.len > 0)
+    {
+        WaccIrValue v = dead.ptr[--dead.len];
+        WaccIrInstRef def = uses.defs.ptr[v];
+        WaccIrInst* inst = &function->blocks.ptr[def.block].insts.ptr[def.index];
+        if (inst->dest != v || !wacc_ir_has_flag(inst->op, WACC_IR_PURE))
+        {
+            continue;
+        }
+        uint32_t n = wacc_ir_num_uses(inst);
+        for (uint32_t j = 0; j < n; j++)
+        {
+            WaccIrValue arg = *wacc_ir_use(function, inst, j);
+            if (arg != WACC_IR_NO_VALUE && --num_uses.ptr[arg] == 0)
+            {
+                BUF_PUSH(&dead, arg);
+            }
+        }
+        wacc_ir_kill(inst);
+    }
+    stats->removed += wacc_ir_remove_nops(function);
+    BUF_FREE(dead);
+    BUF_FREE(num_uses);
+    wacc_ir_uses_free(&uses);
+}
+
+void wacc_opt_sccp(WaccIrFunction* function, WaccOptStats* stats)
+{
+    uint64_t num_values = function->value_types.len;
+    uint64_t num_blocks = function->blocks.len;
+    Sccp s = {
+        .function = function,
+        .values = BUF_NEW,
+        .reachable = BUF_NEW,
+        .edges = HASHMAP_NEW,
+        .cfg_work = BUF_NEW,
+        .ssa_work = BUF_NEW,
+    };
+    wacc_ir_uses_build(function, &s.uses);
+    BUF_RESERVE(&s.values, num_values);
+    memset(s.values.ptr, 0, num_values * sizeof(Lattice));
+    s.values.len = num_values;
+    BUF_RESERVE(&s.reachable, num_blocks);
+    memset(s.reachable.ptr, 0, num_blocks * sizeof(bool));
+    s.reachable.len = num_blocks;
+
+    solve(&s);
+    rewrite(&s, stats);
+
+    BUF_FREE(s.ssa_work);
+    BUF_FREE(s.cfg_work);
+    HASHMAP_FREE(s.edges);
+    BUF_FREE(s.reachable);
+    BUF_FREE(s.values);
+    wacc_ir_uses_free(&s.uses);
+
+    sweep(function, stats);
+}
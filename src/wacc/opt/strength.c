@@ -0,0 +1,340 @@
+#include "wacc/opt.h"
+
+// Strength reduction of multiplication, division and remainder by constants.
+//
+// Division uses the multiply-high method of Granlund and Montgomery, with the
+// magic numbers computed as in Hacker's Delight, chapter 10: the quotient is
+// the high half of the dividend times a fixed-point reciprocal of the divisor,
+// plus corrections. Remainders become x - (x / d) * d. Multiplication by a
+// power of two becomes a shift; other small factors are left to the backend,
+// which knows about lea. Divisions that trap, by 0 and by -1, are kept as they
+// are.
+
+typedef BUF(bool) BoolBuf;
+typedef BUF(int64_t) ImmBuf;
+
+typedef struct
+{
+    WaccIrFunction* function;
+    WaccIrInstBuf* out;
+    WaccIrType type;
+} Builder;
+
+// append `op` to the rewritten block; the result goes to `dest` if it is not
+// WACC_IR_NO_VALUE
+static WaccIrValue emit_to(Builder* b, WaccIrOpcode op, WaccIrType type, WaccIrValue x, WaccIrValue y, WaccIrValue dest)
+{
+    if (dest == WACC_IR_NO_VALUE)
+    {
+        dest = wacc_ir_value_new(b->function, type);
+    }
+    BUF_PUSH(b->out, ((WaccIrInst){.op = op, .type = type, .dest = dest, .args = {x, y}}));
+    return dest;
+}
+
+static WaccIrValue emit(Builder* b, WaccIrOpcode op, WaccIrValue x, WaccIrValue y)
+{
+    return emit_to(b, op, b->type, x, y, WACC_IR_NO_VALUE);
+}
+
+static WaccIrValue emit_const(Builder* b, int64_t value)
+{
+    WaccIrValue dest = wacc_ir_value_new(b->function, b->type);
+    BUF_PUSH(b->out,
+        ((WaccIrInst){.op = WACC_IR_CONST, .type = b->type, .dest = dest, .imm = wacc_ir_normalize(b->type, value)}));
+    return dest;
+}
+
+static WaccIrValue emit_shift(Builder* b, WaccIrOpcode op, WaccIrValue x, uint32_t count)
+{
+    return count == 0 ? x : emit(b, op, x, emit_const(b, count));
+}
+
+static uint64_t type_mask(WaccIrType type)
+{
+    uint32_t bits = wacc_ir_type_bits(type);
+    return bits >= 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+}
+
+static int32_t log2_exact(uint64_t value)
+{
+    if (value == 0 || (value & (value - 1)) != 0)
+    {
+        return -1;
+    }
+    int32_t log = 0;
+    while (value > 1)
+    {
+        value >>= 1;
+        log++;
+    }
+    return log;
+}
+
+typedef struct
+{
+    uint64_t multiplier;
+    uint32_t shift;
+    // unsigned only: the multiplier needs one bit more than the type has
+    bool add;
+} Magic;
+
+// Hacker's Delight, figure 10-1, for `bits`-wide d with 2 <= |d|
+static Magic signed_magic(int64_t d, uint32_t bits)
+{
+    uint64_t mask = bits >= 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+    uint64_t two_n1 = UINT64_C(1) << (bits - 1);
+    uint64_t ad = (d < 0 ? -(uint64_t)d : (uint64_t)d) & mask;
+    uint64_t t = two_n1 + (((uint64_t)d & mask) >> (bits - 1));
+    uint64_t anc = t - 1 - t % ad;
+    uint32_t p = bits - 1;
+    uint64_t q1 = two_n1 / anc;
+    uint64_t r1 = two_n1 - q1 * anc;
+    uint64_t q2 = two_n1 / ad;
+    uint64_t r2 = two_n1 - q2 * ad;
+    uint64_t delta;
+    do
+    {
+        p++;
+        q1 = (2 * q1) & mask;
+        r1 = (2 * r1) & mask;
+        if (r1 >= anc)
+        {
+            q1 = (q1 + 1) & mask;
+            r1 = (r1 - anc) & mask;
+        }
+        q2 = (2 * q2) & mask;
+        r2 = (2 * r2) & mask;
+        if (r2 >= ad)
+        {
+            q2 = (q2 + 1) & mask;
+            r2 = (r2 - ad) & mask;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    uint64_t multiplier = (q2 + 1) & mask;
+    if (d < 0)
+    {
+        multiplier = -multiplier & mask;
+    }
+    return (Magic){.multiplier = multiplier, .shift = p - bits};
+}
+
+// Hacker's Delight, figure 10-2, for `bits`-wide unsigned d with d >= 1
+static Magic unsigned_magic(uint64_t d, uint32_t bits)
+{
+    uint64_t mask = bits >= 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+    uint64_t max_signed = mask >> 1;
+    bool add = false;
+    uint32_t p = bits - 1;
+    uint64_t q = max_signed / d;
+    uint64_t r = max_signed - q * d;
+    // 2^(p - bits)
+    uint64_t p_pow = 0;
+    uint64_t delta;
+    do
+    {
+        p++;
+        p_pow = p == bits ? 1 : 2 * p_pow;
+        if (r + 1 >= d - r)
+        {
+            add = add || q >= max_signed;
+            q = (2 * q + 1) & mask;
+            r = (2 * r + 1 - d) & mask;
+        }
+        else
+        {
+            add = add || q >= max_signed + 1;
+            q = (2 * q) & mask;
+            r = (2 * r + 1) & mask;
+        }
+        delta = d - 1 - r;
+    } while (p < 2 * bits && p_pow < delta);
+    return (Magic){.multiplier = (q + 1) & mask, .shift = p - bits, .add = add};
+}
+
+// x / d for signed d other than 0 and -1
+static WaccIrValue signed_quotient(Builder* b, WaccIrValue x, int64_t d)
+{
+    uint32_t bits = wacc_ir_type_bits(b->type);
+    uint64_t ad = (d < 0 ? -(uint64_t)d : (uint64_t)d) & type_mask(b->type);
+    int32_t k = log2_exact(ad);
+    if (k == 0)
+    {
+        return x;
+    }
+    WaccIrValue q;
+    if (k > 0)
+    {
+        // round towards zero by adding 2^k - 1 to negative dividends first
+        WaccIrValue sign = emit_shift(b, WACC_IR_SAR, x, (uint32_t)k - 1);
+        WaccIrValue bias = emit_shift(b, WACC_IR_SHR, sign, bits - (uint32_t)k);
+        q = emit_shift(b, WACC_IR_SAR, emit(b, WACC_IR_ADD, x, bias), (uint32_t)k);
+        return d < 0 ? emit(b, WACC_IR_NEG, q, WACC_IR_NO_VALUE) : q;
+    }
+    Magic magic = signed_magic(d, bits);
+    int64_t multiplier = wacc_ir_normalize(b->type, (int64_t)magic.multiplier);
+    q = emit(b, WACC_IR_SMULH, x, emit_const(b, multiplier));
+    if (d > 0 && multiplier < 0)
+    {
+        q = emit(b, WACC_IR_ADD, q, x);
+    }
+    else if (d < 0 && multiplier > 0)
+    {
+        q = emit(b, WACC_IR_SUB, q, x);
+    }
+    q = emit_shift(b, WACC_IR_SAR, q, magic.shift);
+    // add one for negative quotients, which were rounded down
+    return emit(b, WACC_IR_ADD, q, emit_shift(b, WACC_IR_SHR, q, bits - 1));
+}
+
+// x / d for unsigned d other than 0
+static WaccIrValue unsigned_quotient(Builder* b, WaccIrValue x, uint64_t d)
+{
+    uint32_t bits = wacc_ir_type_bits(b->type);
+    int32_t k = log2_exact(d);
+    if (k >= 0)
+    {
+        return emit_shift(b, WACC_IR_SHR, x, (uint32_t)k);
+    }
+    if (d > type_mask(b->type) >> 1)
+    {
+        // the quotient is 0 or 1
+        WaccIrValue ge = emit_to(b, WACC_IR_UGE, WACC_IR_TYPE_I1, x, emit_const(b, (int64_t)d), WACC_IR_NO_VALUE);
+        return emit_to(b, WACC_IR_ZEXT, b->type, ge, WACC_IR_NO_VALUE, WACC_IR_NO_VALUE);
+    }
+    Magic magic = unsigned_magic(d, bits);
+    WaccIrValue t = emit(b, WACC_IR_UMULH, x, emit_const(b, (int64_t)magic.multiplier));
+    if (!magic.add)
+    {
+        return emit_shift(b, WACC_IR_SHR, t, magic.shift);
+    }
+    // the multiplier is 2^bits + `multiplier`: (x * it) >> bits without
+    // overflowing is t + (x - t) / 2
+    WaccIrValue half = emit_shift(b, WACC_IR_SHR, emit(b, WACC_IR_SUB, x, t), 1);
+    return emit_shift(b, WACC_IR_SHR, emit(b, WACC_IR_ADD, half, t), magic.shift - 1);
+}
+
+// the replacement of `inst`, whose second operand is the constant `c`, into
+// `b`; returns false to keep `inst`
+static bool reduce(Builder* b, const WaccIrInst* inst, WaccIrValue x, int64_t c)
+{
+    uint64_t uc = (uint64_t)c & type_mask(inst->type);
+    WaccIrValue q;
+    switch (inst->op)
+    {
+        case WACC_IR_MUL:
+        {
+            int32_t k = log2_exact(uc);
+            if (k < 0)
+            {
+                return false;
+            }
+            q = emit_shift(b, WACC_IR_SHL, x, (uint32_t)k);
+            break;
+        }
+        case WACC_IR_SDIV:
+        case WACC_IR_SREM:
+            if (c == 0 || c == -1)
+            {
+                return false;
+            }
+            q = signed_quotient(b, x, c);
+            if (inst->op == WACC_IR_SREM)
+            {
+                q = emit(b, WACC_IR_SUB, x, emit(b, WACC_IR_MUL, q, emit_const(b, c)));
+            }
+            break;
+        case WACC_IR_UDIV:
+        case WACC_IR_UREM:
+            if (uc == 0)
+            {
+                return false;
+            }
+            if (inst->op == WACC_IR_UREM && log2_exact(uc) >= 0)
+            {
+                q = emit(b, WACC_IR_AND, x, emit_const(b, (int64_t)(uc - 1)));
+                break;
+            }
+            q = unsigned_quotient(b, x, uc);
+            if (inst->op == WACC_IR_UREM)
+            {
+                q = emit(b, WACC_IR_SUB, x, emit(b, WACC_IR_MUL, q, emit_const(b, c)));
+            }
+            break;
+        default:
+            return false;
+    }
+    // the last instruction takes over the original destination
+    WaccIrInst* last = &b->out->ptr[b->out->len - 1];
+    if (q == last->dest && q != x)
+    {
+        last->dest = inst->dest;
+    }
+    else
+    {
+        emit_to(b, WACC_IR_COPY, inst->type, q, WACC_IR_NO_VALUE, inst->dest);
+    }
+    return true;
+}
+
+void wacc_opt_strength(WaccIrFunction* function, WaccOptStats* stats)
+{
+    uint64_t num_values = function->value_types.len;
+    BoolBuf is_const = BUF_NEW;
+    ImmBuf imms = BUF_NEW;
+    BUF_RESERVE(&is_const, num_values);
+    BUF_RESERVE(&imms, num_values);
+    is_const.len = num_values;
+    imms.len = num_values;
+    for (uint64_t v = 0; v < num_values; v++)
+    {
+        is_const.ptr[v] = false;
+    }
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            if (insts->ptr[i].op == WACC_IR_CONST)
+            {
+                is_const.ptr[insts->ptr[i].dest] = true;
+                imms.ptr[insts->ptr[i].dest] = insts->ptr[i].imm;
+            }
+        }
+    }
+
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        WaccIrInstBuf out = BUF_NEW_IN(&function->alloc);
+        BUF_RESERVE(&out, insts->len);
+        Builder builder = {.function = function, .out = &out};
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            WaccIrInst inst = insts->ptr[i];
+            WaccIrValue x = inst.args[0];
+            WaccIrValue y = inst.args[1];
+            if (inst.op == WACC_IR_MUL && is_const.ptr[x])
+            {
+                x = inst.args[1];
+                y = inst.args[0];
+            }
+            bool reducible = wacc_ir_opcodes[inst.op].num_args == 2 && !wacc_ir_has_flag(inst.op, WACC_IR_COMPARE) &&
+                             !is_const.ptr[x] && is_const.ptr[y];
+            builder.type = inst.type;
+            if (reducible && reduce(&builder, &inst, x, imms.ptr[y]))
+            {
+                stats->reduced++;
+            }
+            else
+            {
+                BUF_PUSH(&out, inst);
+            }
+        }
+        BUF_FREE(*insts);
+        *insts = out;
+    }
+    BUF_FREE(is_const);
+    BUF_FREE(imms);
+}
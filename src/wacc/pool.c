@@ -0,0 +1,226 @@
+#include "wacc/pool.h"
+
+#include "alloc/alloc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// The indices a worker has left, [next, end). The owner takes from the front
+// and thieves cut off the back, each under the lock; tasks take long enough
+// that an uncontended lock per index costs nothing measurable.
+typedef struct
+{
+    pthread_mutex_t lock;
+    uint64_t next;
+    uint64_t end;
+} Share;
+
+struct WaccPool
+{
+    uint32_t num_workers;
+    // the helpers, one fewer than the workers
+    pthread_t* threads;
+    Share* shares;
+    // guards everything below
+    pthread_mutex_t lock;
+    // signalled when a loop starts or the pool shuts down
+    pthread_cond_t start;
+    // signalled when the last helper is done with a loop
+    pthread_cond_t done;
+    uint64_t generation;
+    uint32_t busy;
+    bool stop;
+    WaccPoolTask* task;
+    void* context;
+};
+
+typedef struct
+{
+    WaccPool* pool;
+    uint32_t worker;
+} Helper;
+
+static bool take(Share* share, uint64_t* index)
+{
+    pthread_mutex_lock(&share->lock);
+    bool found = share->next < share->end;
+    if (found)
+    {
+        *index = share->next++;
+    }
+    pthread_mutex_unlock(&share->lock);
+    return found;
+}
+
+// Move the back half of another worker's share, at least one index, into
+// the empty share of `worker` and take its first index. Victims are tried in
+// turn from the next worker on, which spreads the thieves out.
+static bool steal(WaccPool* pool, uint32_t worker, uint64_t* index)
+{
+    for (uint32_t k = 1; k < pool->num_workers; k++)
+    {
+        Share* victim = &pool->shares[(worker + k) % pool->num_workers];
+        pthread_mutex_lock(&victim->lock);
+        uint64_t left = victim->end - victim->next;
+        uint64_t mid = victim->next + left / 2;
+        uint64_t end = victim->end;
+        victim->end = mid;
+        pthread_mutex_unlock(&victim->lock);
+        if (left > 0)
+        {
+            Share* own = &pool->shares[worker];
+            pthread_mutex_lock(&own->lock);
+            own->next = mid + 1;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            *index = mid;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Indices are never added once a loop has started, so a worker that finds
+// nothing left to steal is done; whatever it missed in flight between two
+// shares belongs to the thief moving it.
+static void work(WaccPool* pool, uint32_t worker)
+{
+    uint64_t index;
+    while (take(&pool->shares[worker], &index) || steal(pool, worker, &index))
+    {
+        pool->task(pool->context, index, worker);
+    }
+}
+
+static void* helper_main(void* arg)
+{
+    Helper* helper = arg;
+    WaccPool* pool = helper->pool;
+    uint32_t worker = helper->worker;
+    allocator_free(NULL, helper);
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (!pool->stop && pool->generation == seen)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop)
+        {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        work(pool, worker);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+WaccPool* wacc_pool_new(uint32_t num_workers)
+{
+    WaccPool* pool = allocator_alloc(NULL, sizeof(WaccPool));
+    uint32_t max_workers = num_workers > 0 ? num_workers : 1;
+    pthread_t* threads = allocator_alloc(NULL, sizeof(pthread_t) * max_workers);
+    Share* shares = allocator_alloc(NULL, sizeof(Share) * max_workers);
+    if (pool == NULL || threads == NULL || shares == NULL)
+    {
+        allocator_oom();
+    }
+    *pool = (WaccPool){.num_workers = 1, .threads = threads, .shares = shares};
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (uint32_t w = 0; w < max_workers; w++)
+    {
+        pthread_mutex_init(&shares[w].lock, NULL);
+        shares[w].next = 0;
+        shares[w].end = 0;
+    }
+    for (uint32_t w = 1; w < max_workers; w++)
+    {
+        Helper* helper = allocator_alloc(NULL, sizeof(Helper));
+        if (helper == NULL)
+        {
+            allocator_oom();
+        }
+        *helper = (Helper){pool, w};
+        if (pthread_create(&threads[w - 1], NULL, helper_main, helper) != 0)
+        {
+            allocator_free(NULL, helper);
+            break;
+        }
+        pool->num_workers++;
+    }
+    return pool;
+}
+
+void wacc_pool_free(WaccPool* pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t w = 1; w < pool->num_workers; w++)
+    {
+        pthread_join(pool->threads[w - 1], NULL);
+    }
+    for (uint32_t w = 0; w < pool->num_workers; w++)
+    {
+        pthread_mutex_destroy(&pool->shares[w].lock);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    allocator_free(NULL, pool->shares);
+    allocator_free(NULL, pool->threads);
+    allocator_free(NULL, pool);
+}
+
+uint32_t wacc_pool_size(const WaccPool* pool)
+{
+    return pool == NULL ? 1 : pool->num_workers;
+}
+
+void wacc_pool_for(WaccPool* pool, uint64_t count, WaccPoolTask* task, void* context)
+{
+    if (pool == NULL || pool->num_workers == 1 || count <= 1)
+    {
+        for (uint64_t i = 0; i < count; i++)
+        {
+            task(context, i, 0);
+        }
+        return;
+    }
+    uint32_t n = pool->num_workers;
+    for (uint32_t w = 0; w < n; w++)
+    {
+        // the helpers are all waiting, so nothing else touches the shares
+        pool->shares[w].next = count * w / n;
+        pool->shares[w].end = count * (w + 1) / n;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->busy = n - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    work(pool, 0);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,251 @@
+#include "wacc/profile.h"
+
+#include <string.h>
+
+static const char magic[8] = {'W', 'A', 'C', 'C', 'P', 'R', 'O', 'F'};
+
+#define FNV_OFFSET_BASIS UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+typedef BUF(uint8_t) ByteBuf;
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t hash_u32(uint64_t hash, uint32_t value)
+{
+    uint8_t bytes[4];
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    return hash_bytes(hash, bytes, sizeof(bytes));
+}
+
+// whether the branch ending a block gets a counter of its own
+static bool counts_taken(const WaccIrBlock* block)
+{
+    const WaccIrInst* term = &block->insts.ptr[block->insts.len - 1];
+    return term->op == WACC_IR_CBR && term->targets[0] != term->targets[1];
+}
+
+// FNV-1a over the names of the functions and the control flow of their
+// blocks, which is what the counters are numbered by
+static uint64_t checksum(const WaccIrModule* module, uint32_t* num_counters)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    *num_counters = 0;
+    for (uint64_t f = 0; f < module->functions.len; f++)
+    {
+        const WaccIrFunction* function = module->functions.ptr[f];
+        hash = hash_bytes(hash, function->name.ptr, function->name.len);
+        hash = hash_u32(hash, (uint32_t)function->blocks.len);
+        for (uint64_t b = 0; b < function->blocks.len; b++)
+        {
+            const WaccIrBlock* block = &function->blocks.ptr[b];
+            const WaccIrInst* term = &block->insts.ptr[block->insts.len - 1];
+            hash = hash_u32(hash, term->op);
+            WaccIrBlockId succs[2];
+            uint32_t n = wacc_ir_successors(block, succs);
+            for (uint32_t s = 0; s < n; s++)
+            {
+                hash = hash_u32(hash, succs[s]);
+            }
+            *num_counters += 1 + (counts_taken(block) ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+static WaccIrInst count_inst(uint32_t counter)
+{
+    return (WaccIrInst){.op = WACC_IR_COUNT, .type = WACC_IR_TYPE_VOID, .imm = counter};
+}
+
+// Route the edge from `block` to the first target of its branch through a
+// new block counting it. The phis of the target take their operand for the
+// edge from the new block.
+static void count_edge(WaccIrFunction* function, WaccIrBlockId block, uint32_t counter)
+{
+    WaccIrBlockId edge = wacc_ir_block_new(function);
+    WaccIrInst* term = wacc_ir_terminator(&function->blocks.ptr[block]);
+    WaccIrBlockId target = term->targets[0];
+    term->targets[0] = edge;
+    (void)wacc_ir_append(function, edge, count_inst(counter));
+    wacc_ir_emit_br(function, edge, target);
+    const WaccIrInstBuf* insts = &function->blocks.ptr[target].insts;
+    for (uint64_t i = 0; i < insts->len && insts->ptr[i].op == WACC_IR_PHI; i++)
+    {
+        WaccIrOperand* operands = wacc_ir_operands(function, &insts->ptr[i]);
+        for (uint32_t j = 0; j < insts->ptr[i].count; j++)
+        {
+            if (operands[j].block == block)
+            {
+                operands[j].block = edge;
+            }
+        }
+    }
+}
+
+void wacc_profile_instrument(WaccIrModule* module, str path)
+{
+    uint32_t num_counters;
+    module->counters.checksum = checksum(module, &num_counters);
+    module->counters.num_counters = num_counters;
+    module->counters.path = path;
+    uint32_t counter = 0;
+    for (uint64_t f = 0; f < module->functions.len; f++)
+    {
+        WaccIrFunction* function = module->functions.ptr[f];
+        uint64_t num_blocks = function->blocks.len;
+        for (uint64_t b = 0; b < num_blocks; b++)
+        {
+            WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+            uint64_t at = 0;
+            while (insts->ptr[at].op == WACC_IR_PHI)
+            {
+                at++;
+            }
+            WaccIrInst count = count_inst(counter++);
+            BUF_PUSH(insts, count);
+            memmove(insts->ptr + at + 1, insts->ptr + at, (insts->len - at - 1) * sizeof(WaccIrInst));
+            insts->ptr[at] = count;
+        }
+        for (uint64_t b = 0; b < num_blocks; b++)
+        {
+            if (counts_taken(&function->blocks.ptr[b]))
+            {
+                count_edge(function, (WaccIrBlockId)b, counter++);
+            }
+        }
+        wacc_ir_compute_preds(function);
+    }
+}
+
+static void put_u64(uint8_t* out, uint64_t value)
+{
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_u64(const uint8_t* in)
+{
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+void wacc_profile_header(const WaccIrCounters* counters, uint8_t header[WACC_PROFILE_HEADER_SIZE])
+{
+    memcpy(header, magic, sizeof(magic));
+    put_u64(header + 8, counters->checksum);
+    put_u64(header + 16, counters->num_counters);
+}
+
+bool wacc_profile_write(const WaccIrCounters* counters, const uint64_t* values, FILE* err)
+{
+    str path = str_null;
+    str_cpy(&path, counters->path);
+    FILE* out = fopen(path.ptr, "wb");
+    str_free(path);
+    if (out == NULL)
+    {
+        (void)fprintf(err, "error: cannot write profile '" str_fmt "'\n", str_arg(counters->path));
+        return false;
+    }
+    uint8_t bytes[WACC_PROFILE_HEADER_SIZE];
+    wacc_profile_header(counters, bytes);
+    bool ok = fwrite(bytes, sizeof(bytes), 1, out) == 1;
+    for (uint32_t i = 0; i < counters->num_counters && ok; i++)
+    {
+        put_u64(bytes, values[i]);
+        ok = fwrite(bytes, 8, 1, out) == 1;
+    }
+    if (fclose(out) != 0 || !ok)
+    {
+        (void)fprintf(err, "error: cannot write profile '" str_fmt "'\n", str_arg(counters->path));
+        return false;
+    }
+    return true;
+}
+
+// read the whole file at `path` into `bytes`; false if it cannot be opened
+static bool read_file(str path, ByteBuf* bytes)
+{
+    str c_path = str_null;
+    str_cpy(&c_path, path);
+    FILE* in = fopen(c_path.ptr, "rb");
+    str_free(c_path);
+    if (in == NULL)
+    {
+        return false;
+    }
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    {
+        BUF_EXTEND(bytes, chunk, n);
+    }
+    bool ok = ferror(in) == 0;
+    (void)fclose(in);
+    return ok;
+}
+
+bool wacc_profile_annotate(WaccIrModule* module, str path, FILE* err)
+{
+    ByteBuf bytes = BUF_NEW;
+    if (!read_file(path, &bytes))
+    {
+        (void)fprintf(err, "error: cannot read profile '" str_fmt "'\n", str_arg(path));
+        BUF_FREE(bytes);
+        return false;
+    }
+    uint32_t num_counters;
+    uint64_t sum = checksum(module, &num_counters);
+    if (bytes.len < WACC_PROFILE_HEADER_SIZE || memcmp(bytes.ptr, magic, sizeof(magic)) != 0 ||
+        bytes.len != WACC_PROFILE_HEADER_SIZE + 8 * get_u64(bytes.ptr + 16))
+    {
+        (void)fprintf(err, "error: '" str_fmt "' is not a profile\n", str_arg(path));
+        BUF_FREE(bytes);
+        return false;
+    }
+    if (get_u64(bytes.ptr + 8) != sum || get_u64(bytes.ptr + 16) != num_counters)
+    {
+        (void)fprintf(err, "error: profile '" str_fmt "' does not match the program\n", str_arg(path));
+        BUF_FREE(bytes);
+        return false;
+    }
+    const uint8_t* values = bytes.ptr + WACC_PROFILE_HEADER_SIZE;
+    uint32_t counter = 0;
+    for (uint64_t f = 0; f < module->functions.len; f++)
+    {
+        WaccIrFunction* function = module->functions.ptr[f];
+        for (uint64_t b = 0; b < function->blocks.len; b++)
+        {
+            function->blocks.ptr[b].count = get_u64(values + 8 * counter++);
+        }
+        for (uint64_t b = 0; b < function->blocks.len; b++)
+        {
+            WaccIrBlock* block = &function->blocks.ptr[b];
+            uint64_t taken = counts_taken(block) ? get_u64(values + 8 * counter++) : 0;
+            // a branch is not taken more often than its block runs, whatever
+            // the file says
+            block->taken = taken < block->count ? taken : block->count;
+        }
+        function->profiled = true;
+    }
+    BUF_FREE(bytes);
+    return true;
+}
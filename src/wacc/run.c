@@ -2,21 +2,622 @@
 
 #include "packcc/grammar.h"
 #include "wacc/ast.h"
+#include "wacc/interp.h"
+#include "wacc/ir.h"
+#include "wacc/opt.h"
+#include "wacc/profile.h"
+#include "wacc/x86.h"
 
 #include <arg/arg.h>
 #include <assert.h>
+#include <process/process.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <str/strtox.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #define arg_str_to_str(arg_str) (str_ref_chars((arg_str).ptr, arg_str_len(arg_str)))
 
+typedef struct
+{
+    bool print_ir;
+    // stop at assembly instead of producing an executable
+    bool emit_asm;
+    // link executables against the C library with the system compiler driver
+    // instead of writing them freestanding
+    bool libc;
+    // execute `main` in-process and exit with its result instead, with the
+    // interpreter or as machine code
+    bool interpret;
+    bool jit;
+    bool opt_stats;
+    // compile each function as soon as it is parsed and release it, for
+    // assembly output
+    bool stream;
+    // threads for the passes over one function at a time of a whole module
+    uint32_t jobs;
+    // the files are the whole program: calls cross them and nothing but main
+    // is visible outside
+    bool whole_program;
+    // count how often every block and branch runs and write the counts to
+    // this file as the program exits, or read them back from it for the
+    // optimizations to go by; empty for neither
+    str profile_generate;
+    str profile_use;
+    // empty for the default: `out` for assembly, a.out for executables
+    str output;
+    WaccOptOptions opt;
+    WaccX86Options x86;
+} CompileOptions;
+
+#ifndef NDEBUG
+static bool verify_module(const WaccIrModule* module, FILE* err)
+{
+    bool ok = true;
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        ok = wacc_ir_verify(module->functions.ptr[i], err) && ok;
+    }
+    return ok;
+}
+#endif
+
+// assemble and link `asm_path` with the system compiler driver
+static int assemble(const char* asm_path, const char* output, FILE* err)
+{
+    const char* args[] = {"cc", "-o", output, asm_path};
+    ProcessCreateResult cc = process_run((ProcessCStrBuf)BUF_ARRAY(args), PROCESS_OPTION_SEARCH_USER_PATH);
+    if (!cc.present)
+    {
+        (void)fprintf(err, "error: failed to run cc\n");
+        return 1;
+    }
+    int code = cc.value.returnCode;
+    process_destroy(&cc.value);
+    if (code != 0)
+    {
+        (void)fprintf(err, "error: cc exited with status %d\n", code);
+        return 1;
+    }
+    return 0;
+}
+
+static bool find_main(const WaccIrModule* ir, uint32_t* index, FILE* err)
+{
+    for (uint64_t i = 0; i < ir->functions.len; i++)
+    {
+        if (str_eq(ir->functions.ptr[i]->name, str_lit("main")))
+        {
+            *index = (uint32_t)i;
+            return true;
+        }
+    }
+    (void)fprintf(err, "error: no main function\n");
+    return false;
+}
+
+// Where assembly goes: the output, or a temporary file to link from with
+// --libc. Returns NULL after reporting why it cannot be opened.
+static FILE* open_asm(const CompileOptions* options, char* temp_path, FILE* out, FILE* err)
+{
+    if (options->emit_asm)
+    {
+        FILE* asm_file = str_is_empty(options->output) ? out : fopen(options->output.ptr, "w");
+        if (asm_file == NULL)
+        {
+            (void)fprintf(err, "error: cannot open '" str_fmt "'\n", str_arg(options->output));
+        }
+        return asm_file;
+    }
+    int fd = mkstemps(temp_path, 2);
+    FILE* asm_file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (asm_file == NULL)
+    {
+        (void)fprintf(err, "error: cannot create a temporary file\n");
+    }
+    return asm_file;
+}
+
+// finish the assembly open_asm started, linking it with --libc if `result` is
+// still 0
+static int close_asm(
+    FILE* asm_file, const CompileOptions* options, const char* temp_path, int result, FILE* out, FILE* err)
+{
+    if (asm_file != out)
+    {
+        (void)fclose(asm_file);
+    }
+    if (!options->emit_asm)
+    {
+        if (result == 0)
+        {
+            result = assemble(temp_path, str_is_empty(options->output) ? "a.out" : options->output.ptr, err);
+        }
+        (void)remove(temp_path);
+    }
+    return result;
+}
+
+static int generate(const WaccIrModule* ir, const CompileOptions* options, FILE* out, FILE* err)
+{
+    WaccX86Stats stats = {0};
+    int result = 0;
+    if (options->emit_asm || options->libc)
+    {
+        char temp_path[] = "/tmp/wacc-XXXXXX.s";
+        FILE* asm_file = open_asm(options, temp_path, out, err);
+        if (asm_file == NULL)
+        {
+            return 1;
+        }
+        wacc_x86_compile(ir, &options->x86, &stats, asm_file);
+        result = close_asm(asm_file, options, temp_path, result, out, err);
+    }
+    else
+    {
+        uint32_t main_index;
+        if (!find_main(ir, &main_index, err))
+        {
+            return 1;
+        }
+        const char* output = str_is_empty(options->output) ? "a.out" : options->output.ptr;
+        WaccX86Code code;
+        wacc_x86_compile_code(ir, &options->x86, &stats, &code);
+        if (!wacc_x86_write_executable(&code, main_index, output))
+        {
+            (void)fprintf(err, "error: cannot write '%s'\n", output);
+            result = 1;
+        }
+        wacc_x86_code_free(&code);
+    }
+    if (options->opt_stats)
+    {
+        wacc_x86_print_stats(&stats, err);
+    }
+    return result;
+}
+
+// run `main` with the interpreter; its result is the exit status the compiled
+// program would have
+static int interpret(const WaccIrModule* ir, const Allocator* alloc, FILE* err)
+{
+    uint32_t main_index;
+    if (!find_main(ir, &main_index, err))
+    {
+        return 1;
+    }
+    WaccInterp* interp = wacc_interp_new(ir, alloc);
+    WaccInterpResult result = wacc_interp_call(interp, main_index, NULL, 0);
+    bool written = result.status != WACC_INTERP_OK || ir->counters.num_counters == 0 ||
+                   wacc_profile_write(&ir->counters, interp->counters.ptr, err);
+    wacc_interp_free(interp);
+    if (result.status != WACC_INTERP_OK)
+    {
+        (void)fprintf(err, "error: %s\n", wacc_interp_status_message(result.status));
+        return 1;
+    }
+    return written ? (int)(result.value & 255) : 1;
+}
+
+// encode the program into executable memory and call `main` in-process
+static int jit(const WaccIrModule* ir, const CompileOptions* options, FILE* err)
+{
+    uint32_t main_index;
+    if (!find_main(ir, &main_index, err))
+    {
+        return 1;
+    }
+    WaccX86Stats stats = {0};
+    WaccX86Code code;
+    wacc_x86_compile_code(ir, &options->x86, &stats, &code);
+    if (options->opt_stats)
+    {
+        wacc_x86_print_stats(&stats, err);
+    }
+    WaccX86Jit loaded;
+    if (!wacc_x86_jit_load(&loaded, &code))
+    {
+        (void)fprintf(err, "error: cannot map executable memory\n");
+        wacc_x86_code_free(&code);
+        return 1;
+    }
+    int (*entry)(void) = (int (*)(void))wacc_x86_jit_address(&loaded, &code, main_index);
+    int result = entry() & 255;
+    if (loaded.counters != NULL && !wacc_profile_write(&ir->counters, loaded.counters, err))
+    {
+        result = 1;
+    }
+    wacc_x86_jit_unload(&loaded);
+    wacc_x86_code_free(&code);
+    return result;
+}
+
+// Assembly written as the functions are parsed, with --stream: each one is
+// optimized on its own, compiled and released before the next is read.
+typedef struct
+{
+    FILE* asm_file;
+    WaccOptStats opt_stats;
+    WaccX86Stats x86_stats;
+} Stream;
+
+static bool stream_function(
+    WaccIrModule* ir, WaccIrFunction* function, const CompileOptions* options, Stream* stream, FILE* err)
+{
+    wacc_opt_function(function, &options->opt, &stream->opt_stats);
+#ifndef NDEBUG
+    if (!wacc_ir_verify(function, err))
+    {
+        return false;
+    }
+#else
+    (void)err;
+#endif
+    uint32_t index = (uint32_t)(ir->functions.len - 1);
+    wacc_x86_compile_function(ir, index, &options->x86, &stream->x86_stats, stream->asm_file);
+    // the declaration stays for the calls that follow
+    wacc_ir_function_release(function);
+    return true;
+}
+
+// Parse the program one function at a time, build each into `ir` and hand it
+// to `stream`, so a call can only go to a function parsed before its caller.
+// Nothing is built after a syntax error, though parsing goes on to report the
+// others, and nothing is streamed after any error.
+static bool build_stream(WaccSystem* sys, WaccIrModule* ir, const CompileOptions* options, Stream* stream, FILE* err)
+{
+    wacc_context_t* ctx = wacc_create(sys);
+    WaccIrBuilder* builder = wacc_ir_builder_new(sys, ir);
+    bool parsed = true;
+    bool valid = true;
+    bool more = true;
+    while (more)
+    {
+        size_t errors = sys->source.num_errors;
+        WaccNode* unit = NULL;
+        more = wacc_parse(ctx, &unit) != 0;
+        if (unit == NULL)
+        {
+            parsed = false;
+            break;
+        }
+        parsed = parsed && sys->source.num_errors == errors;
+        if (parsed && unit->as.function->type == WACC_FUNC_FUNCTION)
+        {
+            WaccIrFunction* function =
+                wacc_ir_build_function(builder, (const WaccActualFunction*)unit->as.function);
+#ifndef NDEBUG
+            valid = wacc_ir_verify(function, err) && valid;
+#endif
+            if (valid && sys->source.num_errors == 0)
+            {
+                valid = stream_function(ir, function, options, stream, err);
+            }
+        }
+        ast_free(sys->alloc, unit);
+        if (sys->source.num_errors == 0)
+        {
+            // the AST is gone and the IR keeps its own copy of every name
+            wacc_system_forget_lines(sys);
+        }
+    }
+    if (!parsed)
+    {
+        (void)fprintf(err, "parse error\n");
+    }
+    wacc_ir_builder_free(builder);
+    wacc_destroy(ctx);
+    return valid && sys->source.num_errors == 0;
+}
+
+typedef BUF(WaccNode*) UnitBuf;
+
+// parse all of the file of `sys` into `units`, false after a syntax error
+static bool parse_file(WaccSystem* sys, UnitBuf* units)
+{
+    wacc_context_t* ctx = wacc_create(sys);
+    bool parsed = true;
+    bool more = true;
+    while (more)
+    {
+        size_t errors = sys->source.num_errors;
+        WaccNode* unit = NULL;
+        more = wacc_parse(ctx, &unit) != 0;
+        if (unit == NULL)
+        {
+            parsed = false;
+            break;
+        }
+        parsed = parsed && sys->source.num_errors == errors;
+        BUF_PUSH(units, unit);
+    }
+    wacc_destroy(ctx);
+    return parsed;
+}
+
+// Build a program of one file or several. Every file is parsed first and its
+// functions declared before any body is built, so that a call can go to a
+// function defined after its caller or in any other file; the files keep
+// their text and syntax trees until then.
+static bool build_program(WaccSystem** systems, uint32_t num_files, WaccIrModule* ir, FILE* err)
+{
+    BUF(UnitBuf) units = BUF_NEW;
+    bool parsed = true;
+    for (uint32_t f = 0; f < num_files; f++)
+    {
+        UnitBuf file_units = BUF_NEW;
+        parsed = parse_file(systems[f], &file_units) && parsed;
+        BUF_PUSH(&units, file_units);
+    }
+    bool valid = parsed;
+    if (parsed)
+    {
+        WaccIrBuilder* builder = wacc_ir_builder_new(systems[0], ir);
+        for (uint32_t f = 0; f < num_files; f++)
+        {
+            wacc_ir_builder_set_file(builder, systems[f]);
+            for (uint64_t u = 0; u < units.ptr[f].len; u++)
+            {
+                const WaccFunction* function = units.ptr[f].ptr[u]->as.function;
+                if (function->type == WACC_FUNC_FUNCTION)
+                {
+                    (void)wacc_ir_declare_function(builder, (const WaccActualFunction*)function);
+                }
+            }
+        }
+        uint32_t index = 0;
+        for (uint32_t f = 0; f < num_files; f++)
+        {
+            wacc_ir_builder_set_file(builder, systems[f]);
+            for (uint64_t u = 0; u < units.ptr[f].len; u++)
+            {
+                const WaccFunction* function = units.ptr[f].ptr[u]->as.function;
+                if (function->type == WACC_FUNC_FUNCTION)
+                {
+                    wacc_ir_define_function(builder, index++, (const WaccActualFunction*)function);
+                }
+            }
+        }
+        wacc_ir_builder_free(builder);
+#ifndef NDEBUG
+        valid = verify_module(ir, err);
+#endif
+    }
+    else
+    {
+        (void)fprintf(err, "parse error\n");
+    }
+    for (uint32_t f = 0; f < num_files; f++)
+    {
+        for (uint64_t u = 0; u < units.ptr[f].len; u++)
+        {
+            ast_free(systems[f]->alloc, units.ptr[f].ptr[u]);
+        }
+        BUF_FREE(units.ptr[f]);
+        valid = valid && systems[f]->source.num_errors == 0;
+    }
+    BUF_FREE(units);
+    return valid;
+}
+
+static int compile_stream(WaccSystem* sys, WaccIrModule* ir, const CompileOptions* options, FILE* out, FILE* err)
+{
+    char temp_path[] = "/tmp/wacc-XXXXXX.s";
+    Stream stream = {.asm_file = open_asm(options, temp_path, out, err)};
+    if (stream.asm_file == NULL)
+    {
+        return 1;
+    }
+    wacc_x86_emit_begin(options->x86.debug_source, stream.asm_file);
+    int result = build_stream(sys, ir, options, &stream, err) ? 0 : 1;
+    wacc_x86_emit_end(stream.asm_file);
+    if (options->opt_stats)
+    {
+        wacc_opt_print_stats(&stream.opt_stats, err);
+        wacc_x86_print_stats(&stream.x86_stats, err);
+    }
+    return close_asm(stream.asm_file, options, temp_path, result, out, err);
+}
+
+static int compile_module(
+    WaccSystem** systems, uint32_t num_files, WaccIrModule* ir, const CompileOptions* options, FILE* out, FILE* err)
+{
+    if (!build_program(systems, num_files, ir, err))
+    {
+        return 1;
+    }
+    if (options->whole_program)
+    {
+        // only the startup code calls into the program, so the inliner may
+        // take over every other function and the dead ones go, whichever
+        // file they are in
+        for (uint64_t f = 0; f < ir->functions.len; f++)
+        {
+            ir->functions.ptr[f]->exported = str_eq(ir->functions.ptr[f]->name, str_lit("main"));
+        }
+    }
+    // the counters are numbered over the module as built, before any pass
+    // changes its shape
+    if (!str_is_empty(options->profile_generate))
+    {
+        wacc_profile_instrument(ir, options->profile_generate);
+    }
+    else if (!str_is_empty(options->profile_use) && !wacc_profile_annotate(ir, options->profile_use, err))
+    {
+        return 1;
+    }
+    // parsing and building are done in order on this thread; the passes
+    // after them take one function at a time, so they share the functions
+    // out between no more workers than there are functions
+    uint32_t jobs = options->jobs < ir->functions.len ? options->jobs : (uint32_t)ir->functions.len;
+    WaccPool* pool = wacc_pool_new(jobs);
+    CompileOptions threaded = *options;
+    threaded.opt.pool = pool;
+    threaded.x86.pool = pool;
+    int result = 0;
+    WaccOptStats stats = {0};
+    wacc_opt_module(ir, &threaded.opt, &stats);
+#ifndef NDEBUG
+    if (!verify_module(ir, err))
+    {
+        result = 1;
+    }
+#endif
+    if (options->opt_stats)
+    {
+        wacc_opt_print_stats(&stats, err);
+    }
+    if (options->print_ir)
+    {
+        wacc_ir_print(ir, out);
+    }
+    else if (result == 0)
+    {
+        result = options->interpret ? interpret(ir, ir->alloc, err)
+                 : options->jit     ? jit(ir, &threaded, err)
+                                    : generate(ir, &threaded, out, err);
+    }
+    wacc_pool_free(pool);
+    return result;
+}
+
+// compile the files `paths`, more than one only for a whole program
+static int compile(
+    const str* paths, uint32_t num_files, const CompileOptions* options, const Allocator* alloc, FILE* out, FILE* err)
+{
+    BUF(WaccSystem*) systems = BUF_NEW;
+    int result = 0;
+    for (uint32_t f = 0; f < num_files && result == 0; f++)
+    {
+        BUF_PUSH(&systems, wacc_system_new(err, alloc));
+        result = wacc_system_open_file(systems.ptr[f], paths[f], err);
+    }
+    if (result == 0)
+    {
+        WaccIrModule* ir = wacc_ir_module_new(alloc);
+        result = options->stream ? compile_stream(systems.ptr[0], ir, options, out, err)
+                                 : compile_module(systems.ptr, num_files, ir, options, out, err);
+        wacc_ir_module_free(ir);
+    }
+    for (uint64_t f = 0; f < systems.len; f++)
+    {
+        wacc_system_free(systems.ptr[f]);
+    }
+    BUF_FREE(systems);
+    return result;
+}
+
+enum
+{
+    DEFAULT_ALIGN = 16,
+    DEFAULT_LOOP_MAX_SKIP = 10,
+    // a page; the code is never loaded at a coarser alignment
+    MAX_ALIGN = 4096,
+    MAX_JOBS = 1024,
+};
+
+// an alignment option, a power of two up to MAX_ALIGN; `alignment` keeps its
+// default if the option was not given
+static bool parse_alignment(str value, uint32_t* alignment, FILE* err)
+{
+    if (str_is_empty(value))
+    {
+        return true;
+    }
+    Str2U64Result parsed = str2u64(value, 10);
+    if (parsed.err != 0 || parsed.endptr != str_end(value) || parsed.value > MAX_ALIGN ||
+        (parsed.value & (parsed.value - 1)) != 0)
+    {
+        (void)fprintf(err, "error: invalid alignment '" str_fmt "'\n", str_arg(value));
+        return false;
+    }
+    *alignment = (uint32_t)parsed.value;
+    return true;
+}
+
 int run(WaccArgBuf args, FILE* out, FILE* err)
 {
     Arg help_arg =
         ARG_FLAG(.shortname = 'h', .longname = arg_str_lit("help"), .help = arg_str_lit("Print this help message"));
     Arg file_arg = ARG_POS(arg_str_lit("FILE"), arg_str_lit("The file to compile"));
     Arg output_arg = ARG_OPT(.shortname = 'o', .longname = arg_str_lit("out"), .help = arg_str_lit("The output file"));
-    Arg* supported_args[] = {&help_arg, &file_arg, &output_arg};
+    Arg allocator_arg = ARG_OPT(.longname = arg_str_lit("allocator"),
+        .help = arg_str_lit("Memory allocation strategy: malloc (default) or arena"));
+    Arg mem_stats_arg =
+        ARG_FLAG(.longname = arg_str_lit("mem-stats"), .help = arg_str_lit("Report memory usage on stderr"));
+    Arg ir_arg = ARG_FLAG(.longname = arg_str_lit("ir"), .help = arg_str_lit("Print the intermediate representation"));
+    Arg opt_arg = ARG_OPT(.shortname = 'O',
+        .longname = arg_str_lit("optimize"),
+        .help = arg_str_lit("Optimization level: 0 (default) or 1"));
+    Arg inline_arg = ARG_OPT(.longname = arg_str_lit("inline-threshold"),
+        .help = arg_str_lit("Inline callees of at most this many IR instructions (default 32)"));
+    Arg opt_stats_arg = ARG_FLAG(
+        .longname = arg_str_lit("opt-stats"), .help = arg_str_lit("Report what the optimizer did on stderr"));
+    Arg asm_arg = ARG_FLAG(.shortname = 'S',
+        .longname = arg_str_lit("asm"),
+        .help = arg_str_lit("Write assembly instead of an executable"));
+    Arg run_arg = ARG_FLAG(.longname = arg_str_lit("run"),
+        .help = arg_str_lit("Interpret the program and exit with the status of main instead of compiling it"));
+    Arg jit_arg = ARG_FLAG(.longname = arg_str_lit("jit"),
+        .help = arg_str_lit("Compile the program into memory and exit with the status of main instead of linking it"));
+    Arg libc_arg = ARG_FLAG(.longname = arg_str_lit("libc"),
+        .help = arg_str_lit("Link the executable against the C library with cc instead of writing it freestanding"));
+    Arg regalloc_arg = ARG_OPT(.longname = arg_str_lit("regalloc"),
+        .help = arg_str_lit("Register allocator: linear (default) or naive"));
+    Arg frame_pointer_arg = ARG_FLAG(.longname = arg_str_lit("no-omit-frame-pointer"),
+        .help = arg_str_lit("Keep the frame pointer in every function"));
+    Arg align_functions_arg = ARG_OPT(.longname = arg_str_lit("align-functions"),
+        .help = arg_str_lit("Align function entries to this many bytes (default 16 with -O1, none otherwise)"));
+    Arg align_loops_arg = ARG_OPT(.longname = arg_str_lit("align-loops"),
+        .help = arg_str_lit("Align loop headers to this many bytes (default 16 with -O1 unless it takes more than "
+                            "10 bytes of padding, none otherwise)"));
+    Arg debug_arg = ARG_FLAG(.shortname = 'g',
+        .longname = arg_str_lit("debug"),
+        .help = arg_str_lit("Describe functions and source lines in DWARF debug information"));
+    Arg stream_arg = ARG_FLAG(.longname = arg_str_lit("stream"),
+        .help = arg_str_lit("Generate each function as soon as it is parsed and release it, without optimizing "
+                            "across functions; needs -S or --libc"));
+    Arg jobs_arg = ARG_OPT(.shortname = 'j',
+        .longname = arg_str_lit("jobs"),
+        .help = arg_str_lit("Optimize and generate the functions on this many threads (default one per processor); "
+                            "--stream keeps to one"));
+    Arg whole_program_arg = ARG_FLAG(.longname = arg_str_lit("whole-program"),
+        .help = arg_str_lit("Compile FILE and the files given with --with as the whole program, inlining and removing "
+                            "functions across all of them; only main stays visible"));
+    Arg with_arg = ARG_OPT(.longname = arg_str_lit("with"),
+        .help = arg_str_lit("The other files of the program, separated by commas; needs --whole-program"));
+    Arg profile_generate_arg = ARG_OPT(.longname = arg_str_lit("profile-generate"),
+        .help = arg_str_lit("Count how often every block and branch runs and write the counts to this file as the "
+                            "program exits"));
+    Arg profile_use_arg = ARG_OPT(.longname = arg_str_lit("profile-use"),
+        .help = arg_str_lit("Lay out code, inline and allocate registers by the counts in this file, written by a "
+                            "run of the program compiled with --profile-generate"));
+    Arg* supported_args[] = {&help_arg,
+        &file_arg,
+        &output_arg,
+        &allocator_arg,
+        &mem_stats_arg,
+        &ir_arg,
+        &opt_arg,
+        &inline_arg,
+        &opt_stats_arg,
+        &asm_arg,
+        &run_arg,
+        &jit_arg,
+        &libc_arg,
+        &regalloc_arg,
+        &frame_pointer_arg,
+        &align_functions_arg,
+        &align_loops_arg,
+        &debug_arg,
+        &stream_arg,
+        &jobs_arg,
+        &whole_program_arg,
+        &with_arg,
+        &profile_generate_arg,
+        &profile_use_arg};
     ArgParser arg_parser = arg_parser_new(arg_str_lit("wacc"),
         arg_str_lit("What A C Compiler -- compile C programs to x86_64 ELF executable"),
         (ArgBuf)ARG_BUF_ARRAY(supported_args));
@@ -32,31 +633,189 @@ int run(WaccArgBuf args, FILE* out, FILE* err)
         (void)fprintf(err, str_fmt "\n", str_arg(arg_str_to_str(arg_parse_err.value)));
         return 1;
     }
-    WaccSystem* sys = wacc_system_new(err);
-    if (wacc_system_open_file(sys, arg_str_to_str(file_arg.value), err) != 0)
+
+    int opt_level = 0;
+    str level = arg_str_to_str(opt_arg.value);
+    if (!str_is_empty(level))
     {
+        Str2U64Result parsed = str2u64(level, 10);
+        if (parsed.err != 0 || parsed.endptr != str_end(level) || parsed.value > 1)
+        {
+            (void)fprintf(err, "error: unknown optimization level '" str_fmt "'\n", str_arg(level));
+            return 1;
+        }
+        opt_level = (int)parsed.value;
+    }
+
+    uint32_t inline_threshold = WACC_OPT_DEFAULT_INLINE_THRESHOLD;
+    str threshold = arg_str_to_str(inline_arg.value);
+    if (!str_is_empty(threshold))
+    {
+        Str2U64Result parsed = str2u64(threshold, 10);
+        if (parsed.err != 0 || parsed.endptr != str_end(threshold) || parsed.value > UINT32_MAX)
+        {
+            (void)fprintf(err, "error: invalid inline threshold '" str_fmt "'\n", str_arg(threshold));
+            return 1;
+        }
+        inline_threshold = (uint32_t)parsed.value;
+    }
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t jobs = processors > 0 && processors < MAX_JOBS ? (uint32_t)processors : 1;
+    str jobs_value = arg_str_to_str(jobs_arg.value);
+    if (!str_is_empty(jobs_value))
+    {
+        Str2U64Result parsed = str2u64(jobs_value, 10);
+        if (parsed.err != 0 || parsed.endptr != str_end(jobs_value) || parsed.value == 0 || parsed.value > MAX_JOBS)
+        {
+            (void)fprintf(err, "error: invalid number of jobs '" str_fmt "'\n", str_arg(jobs_value));
+            return 1;
+        }
+        jobs = (uint32_t)parsed.value;
+    }
+
+    WaccX86Regalloc regalloc = WACC_X86_REGALLOC_LINEAR_SCAN;
+    str regalloc_name = arg_str_to_str(regalloc_arg.value);
+    if (str_eq(regalloc_name, str_lit("naive")))
+    {
+        regalloc = WACC_X86_REGALLOC_NAIVE;
+    }
+    else if (!str_is_empty(regalloc_name) && !str_eq(regalloc_name, str_lit("linear")))
+    {
+        (void)fprintf(err, "error: unknown register allocator '" str_fmt "'\n", str_arg(regalloc_name));
         return 1;
     }
-    wacc_context_t* ctx = wacc_create(sys);
-    WaccNode* ast;
-    if (wacc_parse(ctx, &ast) != 0)
+
+    // the alignment gcc uses at -O2
+    uint32_t function_align = opt_level >= 1 ? DEFAULT_ALIGN : 0;
+    uint32_t loop_align = opt_level >= 1 ? DEFAULT_ALIGN : 0;
+    uint32_t loop_max_skip = opt_level >= 1 ? DEFAULT_LOOP_MAX_SKIP : 0;
+    if (!parse_alignment(arg_str_to_str(align_functions_arg.value), &function_align, err))
     {
-        (void)fprintf(err, "parse error\n");
-        wacc_system_free(sys);
-        wacc_destroy(ctx);
         return 1;
     }
-    if (sys->source.num_errors > 0)
+    str loop_align_value = arg_str_to_str(align_loops_arg.value);
+    if (!str_is_empty(loop_align_value))
+    {
+        // an explicit alignment is always kept
+        loop_max_skip = 0;
+    }
+    if (!parse_alignment(loop_align_value, &loop_align, err))
     {
-        (void)fprintf(err, "parse error\n");
-        ast_free(ast);
-        wacc_system_free(sys);
-        wacc_destroy(ctx);
         return 1;
     }
-    ast_free(ast);
-    wacc_system_free(sys);
-    wacc_destroy(ctx);
-    (void)fprintf(out, "Hello, World!\n");
-    return 0;
+
+    // only the assembly is written as functions arrive; the other outputs need
+    // the whole module
+    if (stream_arg.flagValue &&
+        (!(asm_arg.flagValue || libc_arg.flagValue) || ir_arg.flagValue || run_arg.flagValue || jit_arg.flagValue))
+    {
+        (void)fprintf(err, "error: --stream needs assembly output (-S or --libc)\n");
+        return 1;
+    }
+    if (stream_arg.flagValue && whole_program_arg.flagValue)
+    {
+        (void)fprintf(err, "error: --stream cannot optimize a whole program\n");
+        return 1;
+    }
+    str profile_generate = arg_str_to_str(profile_generate_arg.value);
+    str profile_use = arg_str_to_str(profile_use_arg.value);
+    if (!str_is_empty(profile_generate) && !str_is_empty(profile_use))
+    {
+        (void)fprintf(err, "error: --profile-generate and --profile-use cannot be used together\n");
+        return 1;
+    }
+    // a streamed function is gone before the program is complete, and with
+    // it the numbering of the counters
+    if (stream_arg.flagValue && (!str_is_empty(profile_generate) || !str_is_empty(profile_use)))
+    {
+        (void)fprintf(err, "error: --stream cannot be used with a profile\n");
+        return 1;
+    }
+    str with = arg_str_to_str(with_arg.value);
+    if (!str_is_empty(with) && !whole_program_arg.flagValue)
+    {
+        (void)fprintf(err, "error: --with needs --whole-program\n");
+        return 1;
+    }
+    // the line tables name a single source file
+    if (!str_is_empty(with) && debug_arg.flagValue)
+    {
+        (void)fprintf(err, "error: -g describes a single file and cannot be used with --with\n");
+        return 1;
+    }
+
+    Arena arena;
+    arena_init(&arena, 0);
+    Allocator arena_alloc = arena_allocator(&arena);
+    const Allocator* base = &malloc_allocator;
+    str strategy = arg_str_to_str(allocator_arg.value);
+    if (str_eq(strategy, str_lit("arena")))
+    {
+        base = &arena_alloc;
+    }
+    else if (!str_is_empty(strategy) && !str_eq(strategy, str_lit("malloc")))
+    {
+        (void)fprintf(err, "error: unknown allocator '" str_fmt "'\n", str_arg(strategy));
+        return 1;
+    }
+    CountingAllocator counter;
+    counting_allocator_init(&counter, base);
+    Allocator counting_alloc = counting_allocator(&counter);
+    const Allocator* alloc = mem_stats_arg.flagValue ? &counting_alloc : base;
+
+    const Allocator* prev_str_alloc = str_set_allocator(alloc);
+    CompileOptions options = {
+        .print_ir = ir_arg.flagValue,
+        .emit_asm = asm_arg.flagValue,
+        .libc = libc_arg.flagValue,
+        .interpret = run_arg.flagValue,
+        .jit = jit_arg.flagValue,
+        .opt_stats = opt_stats_arg.flagValue,
+        .stream = stream_arg.flagValue,
+        .jobs = jobs,
+        .whole_program = whole_program_arg.flagValue,
+        .profile_generate = profile_generate,
+        .profile_use = profile_use,
+        .output = arg_str_to_str(output_arg.value),
+        .opt = {.level = opt_level, .inline_threshold = inline_threshold},
+        .x86 =
+            {
+                .regalloc = regalloc,
+                .peephole = opt_level >= 1,
+                .omit_frame_pointer = !frame_pointer_arg.flagValue,
+                .debug_source = debug_arg.flagValue ? arg_str_to_str(file_arg.value) : str_null,
+                .function_align = function_align,
+                .loop_align = loop_align,
+                .loop_max_skip = loop_max_skip,
+            },
+    };
+    BUF(str) paths = BUF_NEW;
+    BUF_PUSH(&paths, arg_str_to_str(file_arg.value));
+    str_tok_state files;
+    str_tok_init(&files, with, str_lit(","));
+    str path = str_null;
+    while (str_tok(&path, &files))
+    {
+        BUF_PUSH(&paths, path);
+    }
+    int result = compile(paths.ptr, (uint32_t)paths.len, &options, alloc, out, err);
+    BUF_FREE(paths);
+    str_set_allocator(prev_str_alloc);
+
+    if (mem_stats_arg.flagValue)
+    {
+        // the resident peak also covers arena chunks, the source text and
+        // everything else the counter does not see
+        struct rusage usage;
+        long max_rss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+        (void)fprintf(err,
+            "memory: %zu allocations, %zu bytes, %zu bytes peak, %ld KiB peak resident\n",
+            counter.count,
+            counter.bytes,
+            counter.peak,
+            max_rss);
+    }
+    arena_free(&arena);
+    return result;
 }
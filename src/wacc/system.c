@@ -1,12 +1,15 @@
 #include "wacc/system.h"
 
+#include <assert.h>
+#include <string.h>
+
 typedef struct
 {
     size_t line;
     size_t col;
 } LineCol;
 
-static LineCol get_line_col(WaccSystem* system, size_t pos)
+static LineCol get_line_col(const WaccSystem* system, size_t pos)
 {
     size_t i;
     for (i = 0; i < system->source.line_starts.len; i++)
@@ -18,23 +21,30 @@ static LineCol get_line_col(WaccSystem* system, size_t pos)
     }
     if (i == 0)
     {
-        return (LineCol){1, pos + 1};
+        return (LineCol){system->source.forgotten_lines + 1, pos + 1};
     }
     return (LineCol){
-        .line = i + 1,
+        .line = system->source.forgotten_lines + i + 1,
         .col = pos - system->source.line_starts.ptr[i - 1] + 1,
     };
 }
 
-WaccSystem* wacc_system_new(FILE* err)
+WaccSystem* wacc_system_new(FILE* err, const Allocator* alloc)
 {
-    WaccSystem* system = malloc(sizeof(WaccSystem));
+    WaccSystem* system = allocator_alloc(alloc, sizeof(WaccSystem));
+    if (system == NULL)
+    {
+        allocator_oom();
+    }
     system->source.path = str_null;
     system->source.fp = NULL;
-    system->source.text = (Text)BUF_NEW;
-    system->source.line_starts = (LineStartBuf)BUF_NEW;
+    system->source.text = (Text)BUF_NEW_IN(alloc);
+    system->source.line_starts = (LineStartBuf)BUF_NEW_IN(alloc);
     system->source.num_errors = 0;
+    system->source.forgotten_lines = 0;
+    system->source.base = 0;
     system->err_stream = err;
+    system->alloc = alloc;
     return system;
 }
 
@@ -47,7 +57,7 @@ void wacc_system_free(WaccSystem* system)
     str_free(system->source.path);
     BUF_FREE(system->source.line_starts);
     BUF_FREE(system->source.text);
-    free(system);
+    allocator_free(system->alloc, system);
 }
 
 int wacc_system_open_file(WaccSystem* system, str path, FILE* err)
@@ -62,6 +72,29 @@ int wacc_system_open_file(WaccSystem* system, str path, FILE* err)
     return 0;
 }
 
+void wacc_system_open_stream(WaccSystem* system, str name, FILE* fp)
+{
+    str_cpy(&system->source.path, name);
+    system->source.fp = fp;
+}
+
+void wacc_system_reset(WaccSystem* system)
+{
+    if (system->source.fp != NULL)
+    {
+        (void)fclose(system->source.fp);
+        system->source.fp = NULL;
+    }
+    str_clear(&system->source.path);
+    // the grammar always reads its input to the end, so the next input starts right
+    // after everything read so far
+    system->source.base += system->source.text.len;
+    system->source.text.len = 0;
+    system->source.line_starts.len = 0;
+    system->source.num_errors = 0;
+    system->source.forgotten_lines = 0;
+}
+
 int wacc_system_read_source(WaccSystem* system)
 {
     int c = fgetc(system->source.fp);
@@ -99,3 +132,36 @@ void wacc_system_handle_error(WaccSystem* system, ErrorKind error, Range range)
 #undef X
     }
 }
+
+Range wacc_system_range(const WaccSystem* system, size_t start, size_t end)
+{
+    return range_new(start - system->source.base, end - system->source.base);
+}
+
+str wacc_system_text(const WaccSystem* system, Range range)
+{
+    assert(range.start <= range.end && range.end <= system->source.text.len);
+    return str_ref_chars(system->source.text.ptr + range.start, range.end - range.start);
+}
+
+size_t wacc_system_line(const WaccSystem* system, size_t pos)
+{
+    return get_line_col(system, pos).line;
+}
+
+void wacc_system_forget_lines(WaccSystem* system)
+{
+    Source* source = &system->source;
+    if (source->line_starts.len == 0)
+    {
+        return;
+    }
+    size_t cut = source->line_starts.ptr[source->line_starts.len - 1];
+    memmove(source->text.ptr, source->text.ptr + cut, source->text.len - cut);
+    source->text.len -= cut;
+    source->forgotten_lines += source->line_starts.len;
+    source->line_starts.len = 0;
+    // positions the parser reports count from the start of its input, so the dropped
+    // text moves where the buffer begins in that count
+    source->base += cut;
+}
@@ -0,0 +1,38 @@
+#include "wacc/x86.h"
+
+// Code alignment. A loop header aligned to the fetch block size lets each
+// iteration start decoding at the beginning of a block; the padding in front
+// of it only runs when the loop is entered by falling through. Blocks are in
+// their final order here, so a branch from a block at or after its target is
+// a back edge and its target a loop header. With a profile, only a back edge
+// that ran makes one: loops that never ran are not worth the padding, nor are
+// blocks the layout moved after their cold predecessors.
+
+void wacc_x86_align(WaccX86Function* function, const WaccX86Options* options)
+{
+    function->align = options->function_align;
+    if (options->loop_align <= 1)
+    {
+        return;
+    }
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        if (function->profiled && function->blocks.ptr[b].count == 0)
+        {
+            continue;
+        }
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            const WaccX86Inst* inst = &insts->ptr[i];
+            bool branch = inst->op == WACC_X86_JMP || inst->op == WACC_X86_JCC;
+            // the entry is aligned with the function, if at all
+            if (branch && inst->ops[0].block <= b && inst->ops[0].block > 0)
+            {
+                WaccX86Block* header = &function->blocks.ptr[inst->ops[0].block];
+                header->align = options->loop_align;
+                header->max_skip = options->loop_max_skip;
+            }
+        }
+    }
+}
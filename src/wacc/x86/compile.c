@@ -0,0 +1,99 @@
+#include "wacc/x86.h"
+
+#include <string.h>
+
+typedef struct
+{
+    WaccX86Module* module;
+    // the IR function of the first function of the module
+    uint32_t first;
+    const WaccX86Options* options;
+    // one per worker
+    WaccX86Stats* stats;
+} Generate;
+
+static void generate_function(void* context, uint64_t index, uint32_t worker)
+{
+    Generate* g = context;
+    WaccX86Function* function = g->module->functions.ptr[index];
+    wacc_x86_lower_function(function, g->module->ir->functions.ptr[g->first + index]);
+    wacc_x86_regalloc(function, g->options, &g->stats[worker]);
+    wacc_x86_frame(function, g->options);
+    if (g->options->peephole)
+    {
+        wacc_x86_peephole(function, &g->stats[worker]);
+    }
+    wacc_x86_align(function, g->options);
+}
+
+// Lower and allocate functions `first` to `first + count - 1` of `ir`. The
+// functions are made here, as the module's allocator is not the workers' to
+// share; everything else about them is done by whichever worker takes them.
+static WaccX86Module* generate(
+    const WaccIrModule* ir, uint32_t first, uint32_t count, const WaccX86Options* options, WaccX86Stats* stats)
+{
+    WaccX86Module* module = wacc_x86_module_new(ir->alloc);
+    module->ir = ir;
+    module->source = options->debug_source;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        (void)wacc_x86_function_new(module, str_ref(ir->functions.ptr[i]->name));
+    }
+    uint32_t num_workers = wacc_pool_size(options->pool);
+    BUF(WaccX86Stats) worker_stats = BUF_NEW;
+    BUF_RESERVE(&worker_stats, num_workers);
+    memset(worker_stats.ptr, 0, num_workers * sizeof(WaccX86Stats));
+    Generate g = {.module = module, .first = first, .options = options, .stats = worker_stats.ptr};
+    wacc_pool_for(options->pool, count, generate_function, &g);
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        const WaccX86Stats* s = &worker_stats.ptr[w];
+        stats->spilled += s->spilled;
+        stats->spill_loads += s->spill_loads;
+        stats->spill_stores += s->spill_stores;
+        for (uint32_t r = 0; r < WACC_X86_NUM_PEEPHOLE_RULES; r++)
+        {
+            stats->peephole[r] += s->peephole[r];
+        }
+    }
+    BUF_FREE(worker_stats);
+    return module;
+}
+
+void wacc_x86_compile(const WaccIrModule* ir, const WaccX86Options* options, WaccX86Stats* stats, FILE* out)
+{
+    WaccX86Module* module = generate(ir, 0, (uint32_t)ir->functions.len, options, stats);
+    wacc_x86_emit(module, options->pool, out);
+    wacc_x86_module_free(module);
+}
+
+void wacc_x86_compile_function(
+    const WaccIrModule* ir, uint32_t index, const WaccX86Options* options, WaccX86Stats* stats, FILE* out)
+{
+    WaccX86Module* module = generate(ir, index, 1, options, stats);
+    wacc_x86_emit_functions(module, options->pool, out);
+    wacc_x86_module_free(module);
+}
+
+void wacc_x86_compile_code(
+    const WaccIrModule* ir, const WaccX86Options* options, WaccX86Stats* stats, WaccX86Code* code)
+{
+    WaccX86Module* module = generate(ir, 0, (uint32_t)ir->functions.len, options, stats);
+    wacc_x86_encode(module, options->pool, code);
+    wacc_x86_module_free(module);
+}
+
+void wacc_x86_print_stats(const WaccX86Stats* stats, FILE* out)
+{
+    (void)fprintf(out,
+        "regalloc: %zu spilled, %zu spill loads, %zu spill stores\n",
+        stats->spilled,
+        stats->spill_loads,
+        stats->spill_stores);
+    (void)fputs("peephole:", out);
+    for (uint32_t r = 0; r < WACC_X86_NUM_PEEPHOLE_RULES; r++)
+    {
+        (void)fprintf(out, "%s %zu %s", r == 0 ? "" : ",", stats->peephole[r], wacc_x86_peephole_descriptions[r]);
+    }
+    (void)fputc('\n', out);
+}
@@ -0,0 +1,292 @@
+#include "wacc/x86.h"
+
+#include <unistd.h>
+
+// Just enough DWARF 4 for a debugger or profiler to map addresses back to the
+// source: a compilation unit whose children are the functions with their
+// address ranges, and a line program with one sequence over the whole code.
+
+enum
+{
+    DWARF_VERSION = 4,
+    ADDRESS_SIZE = 8,
+
+    DW_TAG_COMPILE_UNIT = 0x11,
+    DW_TAG_SUBPROGRAM = 0x2e,
+    DW_CHILDREN_NO = 0,
+    DW_CHILDREN_YES = 1,
+
+    DW_AT_NAME = 0x03,
+    DW_AT_STMT_LIST = 0x10,
+    DW_AT_LOW_PC = 0x11,
+    DW_AT_HIGH_PC = 0x12,
+    DW_AT_LANGUAGE = 0x13,
+    DW_AT_COMP_DIR = 0x1b,
+    DW_AT_PRODUCER = 0x25,
+    DW_AT_DECL_FILE = 0x3a,
+    DW_AT_DECL_LINE = 0x3b,
+    DW_AT_EXTERNAL = 0x3f,
+
+    DW_FORM_ADDR = 0x01,
+    DW_FORM_DATA2 = 0x05,
+    DW_FORM_DATA4 = 0x06,
+    // with DW_AT_high_pc, the size of the range rather than its end
+    DW_FORM_DATA8 = 0x07,
+    DW_FORM_STRING = 0x08,
+    DW_FORM_DATA1 = 0x0b,
+    DW_FORM_FLAG = 0x0c,
+    DW_FORM_SEC_OFFSET = 0x17,
+
+    DW_LANG_C99 = 0x0c,
+
+    DW_LNS_COPY = 1,
+    DW_LNS_ADVANCE_PC = 2,
+    DW_LNS_ADVANCE_LINE = 3,
+    DW_LNE_END_SEQUENCE = 1,
+    DW_LNE_SET_ADDRESS = 2,
+
+    // the line program parameters gcc uses
+    LINE_BASE = -5,
+    LINE_RANGE = 14,
+    OPCODE_BASE = 13,
+
+    ABBREV_COMPILE_UNIT = 1,
+    ABBREV_SUBPROGRAM = 2,
+    // the only entry of the file table
+    SOURCE_FILE = 1,
+};
+
+// operands of each standard opcode below OPCODE_BASE
+static const uint8_t standard_opcode_lengths[OPCODE_BASE - 1] = {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
+
+static void put8(WaccX86Bytes* out, uint8_t byte)
+{
+    BUF_PUSH(out, byte);
+}
+
+static void put_le(WaccX86Bytes* out, uint64_t value, uint32_t bytes)
+{
+    for (uint32_t i = 0; i < bytes; i++)
+    {
+        put8(out, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void patch_le(WaccX86Bytes* out, uint64_t at, uint64_t value, uint32_t bytes)
+{
+    for (uint32_t i = 0; i < bytes; i++)
+    {
+        out->ptr[at + i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void put_uleb(WaccX86Bytes* out, uint64_t value)
+{
+    do
+    {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        put8(out, value != 0 ? byte | 0x80 : byte);
+    } while (value != 0);
+}
+
+static void put_sleb(WaccX86Bytes* out, int64_t value)
+{
+    bool more = true;
+    while (more)
+    {
+        uint8_t byte = (uint8_t)(value & 0x7f);
+        // arithmetic shift, as C2x guarantees for signed values
+        value >>= 7;
+        more = !((value == 0 && (byte & 0x40) == 0) || (value == -1 && (byte & 0x40) != 0));
+        put8(out, more ? byte | 0x80 : byte);
+    }
+}
+
+static void put_str(WaccX86Bytes* out, str s)
+{
+    for (uint64_t i = 0; i < s.len; i++)
+    {
+        put8(out, (uint8_t)s.ptr[i]);
+    }
+    put8(out, 0);
+}
+
+// a unit length to fill in once the unit is complete; returns where it is
+static uint64_t begin_unit(WaccX86Bytes* out)
+{
+    uint64_t at = out->len;
+    put_le(out, 0, 4);
+    return at;
+}
+
+static void end_unit(WaccX86Bytes* out, uint64_t at)
+{
+    patch_le(out, at, out->len - at - 4, 4);
+}
+
+static void build_abbrev(WaccX86Bytes* out)
+{
+    static const uint8_t abbrev[] = {
+        ABBREV_COMPILE_UNIT, DW_TAG_COMPILE_UNIT, DW_CHILDREN_YES,
+        DW_AT_PRODUCER, DW_FORM_STRING,
+        DW_AT_LANGUAGE, DW_FORM_DATA2,
+        DW_AT_NAME, DW_FORM_STRING,
+        DW_AT_COMP_DIR, DW_FORM_STRING,
+        DW_AT_LOW_PC, DW_FORM_ADDR,
+        DW_AT_HIGH_PC, DW_FORM_DATA8,
+        DW_AT_STMT_LIST, DW_FORM_SEC_OFFSET,
+        0, 0,
+        ABBREV_SUBPROGRAM, DW_TAG_SUBPROGRAM, DW_CHILDREN_NO,
+        DW_AT_NAME, DW_FORM_STRING,
+        DW_AT_DECL_FILE, DW_FORM_DATA1,
+        DW_AT_DECL_LINE, DW_FORM_DATA4,
+        DW_AT_EXTERNAL, DW_FORM_FLAG,
+        DW_AT_LOW_PC, DW_FORM_ADDR,
+        DW_AT_HIGH_PC, DW_FORM_DATA8,
+        0, 0,
+        0,
+    };
+    for (uint64_t i = 0; i < sizeof(abbrev); i++)
+    {
+        put8(out, abbrev[i]);
+    }
+}
+
+static void build_info(const WaccX86Code* code, uint64_t address, WaccX86Bytes* out)
+{
+    char cwd[4096];
+    str comp_dir = getcwd(cwd, sizeof(cwd)) != NULL ? str_ref(cwd) : str_lit("");
+
+    uint64_t unit = begin_unit(out);
+    put_le(out, DWARF_VERSION, 2);
+    // .debug_abbrev offset
+    put_le(out, 0, 4);
+    put8(out, ADDRESS_SIZE);
+
+    put_uleb(out, ABBREV_COMPILE_UNIT);
+    put_str(out, str_lit("wacc"));
+    put_le(out, DW_LANG_C99, 2);
+    put_str(out, code->source);
+    put_str(out, comp_dir);
+    put_le(out, address, ADDRESS_SIZE);
+    put_le(out, code->bytes.len, 8);
+    // .debug_line offset
+    put_le(out, 0, 4);
+
+    for (uint64_t i = 0; i < code->functions.len; i++)
+    {
+        const WaccX86CodeFunction* function = &code->functions.ptr[i];
+        put_uleb(out, ABBREV_SUBPROGRAM);
+        put_str(out, function->name);
+        put8(out, SOURCE_FILE);
+        put_le(out, function->line, 4);
+        put8(out, function->exported);
+        put_le(out, address + function->offset, ADDRESS_SIZE);
+        put_le(out, function->size, 8);
+    }
+    // end of the compilation unit's children
+    put8(out, 0);
+    end_unit(out, unit);
+}
+
+// one row of the line table: a special opcode when the advance fits one,
+// explicit advances and a copy otherwise
+static void put_row(WaccX86Bytes* out, uint64_t address_advance, int64_t line_advance)
+{
+    if (line_advance >= LINE_BASE && line_advance < LINE_BASE + LINE_RANGE)
+    {
+        uint64_t opcode = (uint64_t)(line_advance - LINE_BASE) + LINE_RANGE * address_advance + OPCODE_BASE;
+        if (opcode <= UINT8_MAX)
+        {
+            put8(out, (uint8_t)opcode);
+            return;
+        }
+    }
+    if (address_advance != 0)
+    {
+        put8(out, DW_LNS_ADVANCE_PC);
+        put_uleb(out, address_advance);
+    }
+    if (line_advance != 0)
+    {
+        put8(out, DW_LNS_ADVANCE_LINE);
+        put_sleb(out, line_advance);
+    }
+    put8(out, DW_LNS_COPY);
+}
+
+static void put_extended(WaccX86Bytes* out, uint8_t opcode, uint64_t length)
+{
+    put8(out, 0);
+    put_uleb(out, length + 1);
+    put8(out, opcode);
+}
+
+static void build_line(const WaccX86Code* code, uint64_t address, WaccX86Bytes* out)
+{
+    uint64_t unit = begin_unit(out);
+    put_le(out, DWARF_VERSION, 2);
+    uint64_t header = out->len;
+    put_le(out, 0, 4);
+    uint64_t header_start = out->len;
+    // minimum instruction length, maximum operations per instruction and
+    // default is_stmt
+    put8(out, 1);
+    put8(out, 1);
+    put8(out, 1);
+    put8(out, (uint8_t)LINE_BASE);
+    put8(out, LINE_RANGE);
+    put8(out, OPCODE_BASE);
+    for (uint32_t i = 0; i < sizeof(standard_opcode_lengths); i++)
+    {
+        put8(out, standard_opcode_lengths[i]);
+    }
+    // no include directories; the source relative to the compilation
+    // directory, without a modification time or length
+    put8(out, 0);
+    put_str(out, code->source);
+    put_uleb(out, 0);
+    put_uleb(out, 0);
+    put_uleb(out, 0);
+    put8(out, 0);
+    patch_le(out, header, out->len - header_start, 4);
+
+    put_extended(out, DW_LNE_SET_ADDRESS, ADDRESS_SIZE);
+    put_le(out, address, ADDRESS_SIZE);
+    uint64_t offset = 0;
+    int64_t line = 1;
+    for (uint64_t i = 0; i < code->lines.len; i++)
+    {
+        const WaccX86CodeLine* row = &code->lines.ptr[i];
+        put_row(out, row->offset - offset, (int64_t)row->line - line);
+        offset = row->offset;
+        line = row->line;
+    }
+    if (code->bytes.len > offset)
+    {
+        put8(out, DW_LNS_ADVANCE_PC);
+        put_uleb(out, code->bytes.len - offset);
+    }
+    put_extended(out, DW_LNE_END_SEQUENCE, 0);
+    end_unit(out, unit);
+}
+
+void wacc_x86_dwarf(const WaccX86Code* code, uint64_t address, WaccX86Dwarf* dwarf)
+{
+    *dwarf = (WaccX86Dwarf){
+        .abbrev = BUF_NEW,
+        .info = BUF_NEW,
+        .line = BUF_NEW,
+    };
+    build_abbrev(&dwarf->abbrev);
+    build_info(code, address, &dwarf->info);
+    build_line(code, address, &dwarf->line);
+}
+
+void wacc_x86_dwarf_free(WaccX86Dwarf* dwarf)
+{
+    BUF_FREE(dwarf->abbrev);
+    BUF_FREE(dwarf->info);
+    BUF_FREE(dwarf->line);
+}
@@ -0,0 +1,376 @@
+#include "wacc/x86.h"
+
+#include "wacc/profile.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// A static executable without the C library: the ELF header and a single
+// loadable, read-only and executable segment mapping the whole file, with the
+// code after a `_start` that calls main and passes its result to exit_group.
+// Without debug information there are no section headers, as nothing but the
+// kernel reads the file. With it, the DWARF sections, a symbol table and the
+// section headers describing them follow the code, outside the segment.
+//
+// An instrumented program has a second, writable segment after the code with
+// the header of the profile file, the counters and the file's path, and its
+// `_start` writes the header and counters to the file before it exits.
+
+enum
+{
+    // the traditional non-PIE load address
+    LOAD_ADDRESS = 0x400000,
+    SEGMENT_ALIGN = 0x1000,
+    SYS_WRITE = 1,
+    SYS_OPEN = 2,
+    SYS_CLOSE = 3,
+    SYS_EXIT_GROUP = 231,
+    INT3 = 0xcc,
+    PROFILE_FLAGS = O_WRONLY | O_CREAT | O_TRUNC,
+    PROFILE_MODE = 0644,
+};
+
+// call main; mov %eax, %edi; mov $SYS_EXIT_GROUP, %eax; syscall. The kernel
+// enters with %rsp 16-byte aligned, so main sees the alignment of a call.
+static const uint8_t start_stub[] = {
+    0xe8, 0, 0, 0, 0, 0x89, 0xc7, 0xb8, SYS_EXIT_GROUP, 0, 0, 0, 0x0f, 0x05,
+};
+
+// The same keeping the result in %ebx while it writes the profile:
+//     call main; mov %eax, %ebx
+//     mov $SYS_OPEN, %eax; lea path(%rip), %rdi; mov $PROFILE_FLAGS, %esi;
+//     mov $PROFILE_MODE, %edx; syscall; test %eax, %eax; js 1f
+//     mov %eax, %edi; mov $SYS_WRITE, %eax; lea header(%rip), %rsi;
+//     mov $size, %edx; syscall; mov $SYS_CLOSE, %eax; syscall
+// 1:  mov %ebx, %edi; mov $SYS_EXIT_GROUP, %eax; syscall
+static const uint8_t profile_stub[] = {
+    0xe8, 0, 0, 0, 0, 0x89, 0xc3,
+    0xb8, SYS_OPEN, 0, 0, 0, 0x48, 0x8d, 0x3d, 0, 0, 0, 0,
+    0xbe, PROFILE_FLAGS & 0xff, PROFILE_FLAGS >> 8, 0, 0,
+    0xba, PROFILE_MODE & 0xff, PROFILE_MODE >> 8, 0, 0,
+    0x0f, 0x05, 0x85, 0xc0, 0x78, 0x1c,
+    0x89, 0xc7, 0xb8, SYS_WRITE, 0, 0, 0, 0x48, 0x8d, 0x35, 0, 0, 0, 0,
+    0xba, 0, 0, 0, 0,
+    0x0f, 0x05, 0xb8, SYS_CLOSE, 0, 0, 0, 0x0f, 0x05,
+    0x89, 0xdf, 0xb8, SYS_EXIT_GROUP, 0, 0, 0, 0x0f, 0x05,
+};
+
+enum
+{
+    // where the call's displacement counts from
+    CALL_END = 5,
+    // the displacements of the profile stub and where they count from, and
+    // its size of the write
+    PATH_REL = 15,
+    PATH_END = 19,
+    HEADER_REL = 45,
+    HEADER_END = 49,
+    WRITE_SIZE = 50,
+};
+
+static bool instrumented(const WaccX86Code* code)
+{
+    return code->counters.num_counters > 0;
+}
+
+static uint64_t headers_size(const WaccX86Code* code)
+{
+    return sizeof(Elf64_Ehdr) + (instrumented(code) ? 2 : 1) * sizeof(Elf64_Phdr);
+}
+
+static uint64_t stub_size(const WaccX86Code* code)
+{
+    return instrumented(code) ? sizeof(profile_stub) : sizeof(start_stub);
+}
+
+// where the code starts in the file and, past LOAD_ADDRESS, in memory: after
+// the stub, padded to the alignment the code needs
+static uint64_t code_offset(const WaccX86Code* code)
+{
+    uint64_t align = code->align > 1 ? code->align : 1;
+    return (headers_size(code) + stub_size(code) + align - 1) / align * align;
+}
+
+// The writable segment of an instrumented program: the profile file as it is
+// written, header and counters, then the path to write it to. It starts at
+// `offset` in the file, after the code, and is mapped a page further on in
+// memory than the code would put it, so that the two never share a page.
+static void build_profile(const WaccX86Code* code, WaccX86Bytes* data)
+{
+    uint8_t header[WACC_PROFILE_HEADER_SIZE];
+    wacc_profile_header(&code->counters, header);
+    BUF_EXTEND(data, header, sizeof(header));
+    for (uint64_t i = 0; i < (uint64_t)code->counters.num_counters * 8; i++)
+    {
+        BUF_PUSH(data, 0);
+    }
+    BUF_EXTEND(data, (const uint8_t*)code->counters.path.ptr, code->counters.path.len);
+    BUF_PUSH(data, 0);
+}
+
+static uint64_t profile_address(uint64_t offset)
+{
+    return LOAD_ADDRESS + SEGMENT_ALIGN + offset;
+}
+
+static void put32(uint8_t* at, uint32_t value)
+{
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        at[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// the sections after the code, in the order of their headers
+enum
+{
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_DEBUG_ABBREV,
+    SECTION_DEBUG_INFO,
+    SECTION_DEBUG_LINE,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_SHSTRTAB,
+    NUM_SECTIONS,
+};
+
+static const char* const section_names[NUM_SECTIONS] = {
+    "", ".text", ".debug_abbrev", ".debug_info", ".debug_line", ".symtab", ".strtab", ".shstrtab",
+};
+
+typedef struct
+{
+    WaccX86Bytes bytes;
+    Elf64_Shdr headers[NUM_SECTIONS];
+} Sections;
+
+static void append(WaccX86Bytes* out, const void* data, uint64_t size)
+{
+    BUF_EXTEND(out, (const uint8_t*)data, size);
+}
+
+// pad `out`, which starts at file offset `base`
+static void align(WaccX86Bytes* out, uint64_t base, uint64_t alignment)
+{
+    while ((base + out->len) % alignment != 0)
+    {
+        BUF_PUSH(out, 0);
+    }
+}
+
+// append `data` as the contents of `section`, which starts at file offset
+// `base` plus where it lands in `sections->bytes`
+static void add_section(
+    Sections* sections, uint32_t section, Elf64_Word type, uint64_t base, const WaccX86Bytes* data, uint64_t alignment)
+{
+    align(&sections->bytes, base, alignment);
+    sections->headers[section].sh_type = type;
+    sections->headers[section].sh_offset = base + sections->bytes.len;
+    sections->headers[section].sh_size = data->len;
+    sections->headers[section].sh_addralign = alignment;
+    append(&sections->bytes, data->ptr, data->len);
+}
+
+static Elf64_Word add_string(WaccX86Bytes* strings, str s)
+{
+    Elf64_Word at = (Elf64_Word)strings->len;
+    append(strings, s.ptr, s.len);
+    BUF_PUSH(strings, 0);
+    return at;
+}
+
+// a symbol per function and one for the entry point, locals first as the
+// format requires; returns the index of the first global
+static Elf64_Word build_symbols(const WaccX86Code* code, WaccX86Bytes* symbols, WaccX86Bytes* strings)
+{
+    uint64_t code_address = LOAD_ADDRESS + code_offset(code);
+    Elf64_Sym null = {0};
+    append(symbols, &null, sizeof(null));
+    BUF_PUSH(strings, 0);
+    Elf64_Word first_global = 0;
+    for (int global = 0; global <= 1; global++)
+    {
+        if (global)
+        {
+            first_global = (Elf64_Word)(symbols->len / sizeof(Elf64_Sym));
+            Elf64_Sym start = {
+                .st_name = add_string(strings, str_lit("_start")),
+                .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC),
+                .st_shndx = SECTION_TEXT,
+                .st_value = LOAD_ADDRESS + headers_size(code),
+                .st_size = stub_size(code),
+            };
+            append(symbols, &start, sizeof(start));
+        }
+        for (uint64_t i = 0; i < code->functions.len; i++)
+        {
+            const WaccX86CodeFunction* function = &code->functions.ptr[i];
+            if (function->exported != global)
+            {
+                continue;
+            }
+            Elf64_Sym symbol = {
+                .st_name = add_string(strings, function->name),
+                .st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, STT_FUNC),
+                .st_shndx = SECTION_TEXT,
+                .st_value = code_address + function->offset,
+                .st_size = function->size,
+            };
+            append(symbols, &symbol, sizeof(symbol));
+        }
+    }
+    return first_global;
+}
+
+// the DWARF sections, symbol table and section headers for a file whose code
+// ends at `code_end`, placed from `base` on
+static void build_sections(const WaccX86Code* code, uint64_t code_end, uint64_t base, Sections* sections)
+{
+    WaccX86Dwarf dwarf;
+    wacc_x86_dwarf(code, LOAD_ADDRESS + code_offset(code), &dwarf);
+    WaccX86Bytes symbols = BUF_NEW;
+    WaccX86Bytes strings = BUF_NEW;
+    Elf64_Word first_global = build_symbols(code, &symbols, &strings);
+    WaccX86Bytes names = BUF_NEW;
+    BUF_PUSH(&names, 0);
+    for (uint32_t i = 1; i < NUM_SECTIONS; i++)
+    {
+        sections->headers[i].sh_name = add_string(&names, str_ref(section_names[i]));
+    }
+
+    sections->headers[SECTION_TEXT] = (Elf64_Shdr){
+        .sh_name = sections->headers[SECTION_TEXT].sh_name,
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+        .sh_addr = LOAD_ADDRESS + headers_size(code),
+        .sh_offset = headers_size(code),
+        .sh_size = code_end - headers_size(code),
+        .sh_addralign = 1,
+    };
+    add_section(sections, SECTION_DEBUG_ABBREV, SHT_PROGBITS, base, &dwarf.abbrev, 1);
+    add_section(sections, SECTION_DEBUG_INFO, SHT_PROGBITS, base, &dwarf.info, 1);
+    add_section(sections, SECTION_DEBUG_LINE, SHT_PROGBITS, base, &dwarf.line, 1);
+    add_section(sections, SECTION_SYMTAB, SHT_SYMTAB, base, &symbols, 8);
+    sections->headers[SECTION_SYMTAB].sh_link = SECTION_STRTAB;
+    sections->headers[SECTION_SYMTAB].sh_info = first_global;
+    sections->headers[SECTION_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    add_section(sections, SECTION_STRTAB, SHT_STRTAB, base, &strings, 1);
+    add_section(sections, SECTION_SHSTRTAB, SHT_STRTAB, base, &names, 1);
+    align(&sections->bytes, base, 8);
+
+    wacc_x86_dwarf_free(&dwarf);
+    BUF_FREE(symbols);
+    BUF_FREE(strings);
+    BUF_FREE(names);
+}
+
+bool wacc_x86_write_executable(const WaccX86Code* code, uint32_t main_function, const char* path)
+{
+    uint64_t headers_end = headers_size(code);
+    uint64_t code_start = code_offset(code);
+    uint64_t code_end = code_start + code->bytes.len;
+    WaccX86Bytes data = BUF_NEW;
+    uint64_t data_offset = (code_end + 7) / 8 * 8;
+    if (instrumented(code))
+    {
+        build_profile(code, &data);
+    }
+    uint64_t data_end = instrumented(code) ? data_offset + data.len : code_end;
+    bool debug = code->source.len > 0;
+    Sections sections = {.bytes = BUF_NEW};
+    if (debug)
+    {
+        build_sections(code, code_end, data_end, &sections);
+    }
+    Elf64_Ehdr header = {
+        .e_ident = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV},
+        .e_type = ET_EXEC,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_entry = LOAD_ADDRESS + headers_end,
+        .e_phoff = sizeof(Elf64_Ehdr),
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_phentsize = sizeof(Elf64_Phdr),
+        .e_phnum = instrumented(code) ? 2 : 1,
+    };
+    if (debug)
+    {
+        header.e_shoff = data_end + sections.bytes.len;
+        header.e_shentsize = sizeof(Elf64_Shdr);
+        header.e_shnum = NUM_SECTIONS;
+        header.e_shstrndx = SECTION_SHSTRTAB;
+    }
+    Elf64_Phdr segments[2] = {
+        {
+            .p_type = PT_LOAD,
+            .p_flags = PF_R | PF_X,
+            .p_offset = 0,
+            .p_vaddr = LOAD_ADDRESS,
+            .p_paddr = LOAD_ADDRESS,
+            .p_filesz = code_end,
+            .p_memsz = code_end,
+            .p_align = SEGMENT_ALIGN,
+        },
+        {
+            .p_type = PT_LOAD,
+            .p_flags = PF_R | PF_W,
+            .p_offset = data_offset,
+            .p_vaddr = profile_address(data_offset),
+            .p_paddr = profile_address(data_offset),
+            .p_filesz = data.len,
+            .p_memsz = data.len,
+            .p_align = SEGMENT_ALIGN,
+        },
+    };
+    uint8_t stub[sizeof(profile_stub)];
+    memcpy(stub, instrumented(code) ? profile_stub : start_stub, stub_size(code));
+    put32(stub + 1, (uint32_t)(code_start - headers_end + code->functions.ptr[main_function].offset - CALL_END));
+    // the code, with the counters it adds to placed
+    WaccX86Bytes copy = BUF_NEW;
+    const uint8_t* bytes = code->bytes.ptr;
+    if (instrumented(code))
+    {
+        uint64_t stub_address = LOAD_ADDRESS + headers_end;
+        uint64_t counters_address = profile_address(data_offset) + WACC_PROFILE_HEADER_SIZE;
+        uint64_t path_address = counters_address + 8 * (uint64_t)code->counters.num_counters;
+        put32(stub + PATH_REL, (uint32_t)(path_address - (stub_address + PATH_END)));
+        put32(stub + HEADER_REL, (uint32_t)(profile_address(data_offset) - (stub_address + HEADER_END)));
+        put32(stub + WRITE_SIZE, (uint32_t)(path_address - profile_address(data_offset)));
+        BUF_EXTEND(&copy, code->bytes.ptr, code->bytes.len);
+        wacc_x86_place_counters(code, copy.ptr, (int64_t)(counters_address - (LOAD_ADDRESS + code_start)));
+        bytes = copy.ptr;
+    }
+
+    // executable by whoever the umask allows, as a linker would leave it
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    FILE* out = fd < 0 ? NULL : fdopen(fd, "wb");
+    bool ok = out != NULL && fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(segments, sizeof(Elf64_Phdr), header.e_phnum, out) == header.e_phnum &&
+              fwrite(stub, stub_size(code), 1, out) == 1;
+    // the stub does not return, so the padding after it is never run
+    for (uint64_t at = headers_end + stub_size(code); at < code_start && ok; at++)
+    {
+        ok = fputc(INT3, out) != EOF;
+    }
+    ok = ok && fwrite(bytes, 1, code->bytes.len, out) == code->bytes.len;
+    if (instrumented(code))
+    {
+        for (uint64_t at = code_end; at < data_offset && ok; at++)
+        {
+            ok = fputc(0, out) != EOF;
+        }
+        ok = ok && fwrite(data.ptr, 1, data.len, out) == data.len;
+    }
+    if (debug)
+    {
+        ok = ok && fwrite(sections.bytes.ptr, 1, sections.bytes.len, out) == sections.bytes.len &&
+             fwrite(sections.headers, sizeof(sections.headers), 1, out) == 1;
+    }
+    BUF_FREE(copy);
+    BUF_FREE(data);
+    BUF_FREE(sections.bytes);
+    return out != NULL && fclose(out) == 0 && ok;
+}
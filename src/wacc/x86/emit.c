@@ -0,0 +1,380 @@
+#include "wacc/x86.h"
+
+#include "wacc/profile.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+// AT&T syntax for the GNU assembler: sources before destinations, sizes as
+// mnemonic suffixes.
+
+static void print_reg(uint32_t reg, uint8_t size, FILE* out)
+{
+    if (wacc_x86_is_vreg(reg))
+    {
+        // only seen when dumping code before allocation
+        (void)fprintf(out, "%%v%" PRIu32, reg - WACC_X86_FIRST_VREG);
+        return;
+    }
+    const WaccX86RegInfo* info = &wacc_x86_regs[reg];
+    (void)fprintf(out, "%%%s", size == 1 ? info->name8 : size == 4 ? info->name32 : info->name64);
+}
+
+static void print_operand(
+    const WaccX86Module* module, const WaccX86Function* function, const WaccX86Operand* op, uint8_t size, FILE* out)
+{
+    switch (op->kind)
+    {
+        case WACC_X86_OPERAND_NONE:
+            break;
+        case WACC_X86_OPERAND_REG:
+            print_reg(op->reg, size, out);
+            break;
+        case WACC_X86_OPERAND_IMM:
+            (void)fprintf(out, "$%" PRId64, op->imm);
+            break;
+        case WACC_X86_OPERAND_MEM:
+            if (op->mem.disp != 0)
+            {
+                (void)fprintf(out, "%" PRId32, op->mem.disp);
+            }
+            (void)fputc('(', out);
+            print_reg(op->mem.base, 8, out);
+            if (op->mem.index != WACC_X86_NO_REG)
+            {
+                (void)fputc(',', out);
+                print_reg(op->mem.index, 8, out);
+                (void)fprintf(out, ",%u", op->mem.scale);
+            }
+            (void)fputc(')', out);
+            break;
+        case WACC_X86_OPERAND_SLOT:
+            // only seen when dumping code before the frame is laid out
+            (void)fprintf(out, "slot%" PRIu32, op->slot);
+            break;
+        case WACC_X86_OPERAND_BLOCK:
+            (void)fprintf(out, ".L" str_fmt ".%" PRIu32, str_arg(function->name), op->block);
+            break;
+        case WACC_X86_OPERAND_FUNC:
+            (void)fprintf(out, str_fmt, str_arg(module->ir->functions.ptr[op->func]->name));
+            break;
+        case WACC_X86_OPERAND_COUNTER:
+            (void)fprintf(out, ".Lwacc_counters+%" PRIu64 "(%%rip)", (uint64_t)op->counter * 8);
+            break;
+    }
+}
+
+// the sizes operands 0 and 1 are printed at
+static void operand_sizes(const WaccX86Inst* inst, uint8_t sizes[2])
+{
+    sizes[0] = inst->size;
+    sizes[1] = inst->size;
+    switch (inst->op)
+    {
+        case WACC_X86_MOVSX:
+            sizes[0] = 8;
+            sizes[1] = 4;
+            break;
+        case WACC_X86_MOVZX8:
+            sizes[0] = 4;
+            sizes[1] = 1;
+            break;
+        case WACC_X86_MOVZX32:
+            sizes[0] = 4;
+            sizes[1] = 4;
+            break;
+        case WACC_X86_SETCC:
+            sizes[0] = 1;
+            break;
+        case WACC_X86_SHL:
+        case WACC_X86_SAR:
+        case WACC_X86_SHR:
+            // a variable count is always %cl
+            sizes[1] = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+static void print_mnemonic(const WaccX86Inst* inst, FILE* out)
+{
+    switch (inst->op)
+    {
+        case WACC_X86_CDQ:
+            (void)fputs(inst->size == 8 ? "cqto" : "cltd", out);
+            return;
+        case WACC_X86_SETCC:
+        case WACC_X86_JCC:
+            (void)fprintf(out, "%s%s", wacc_x86_opcodes[inst->op].mnemonic, wacc_x86_cond_suffixes[inst->cond]);
+            return;
+        case WACC_X86_MOV:
+            if (inst->size == 8 && inst->ops[1].kind == WACC_X86_OPERAND_IMM &&
+                (inst->ops[1].imm < INT32_MIN || inst->ops[1].imm > INT32_MAX))
+            {
+                (void)fputs("movabsq", out);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    (void)fputs(wacc_x86_opcodes[inst->op].mnemonic, out);
+    if (!wacc_x86_has_flag(inst->op, WACC_X86_UNSIZED))
+    {
+        (void)fputc(inst->size == 8 ? 'q' : 'l', out);
+    }
+}
+
+static void emit_inst(const WaccX86Module* module, const WaccX86Function* function, const WaccX86Inst* inst, FILE* out)
+{
+    (void)fputc('\t', out);
+    print_mnemonic(inst, out);
+    uint8_t sizes[2];
+    operand_sizes(inst, sizes);
+    if (inst->ops[1].kind != WACC_X86_OPERAND_NONE)
+    {
+        (void)fputc('\t', out);
+        print_operand(module, function, &inst->ops[1], sizes[1], out);
+        (void)fputs(", ", out);
+        print_operand(module, function, &inst->ops[0], sizes[0], out);
+    }
+    else if (inst->ops[0].kind != WACC_X86_OPERAND_NONE)
+    {
+        (void)fputc('\t', out);
+        print_operand(module, function, &inst->ops[0], sizes[0], out);
+    }
+    (void)fputc('\n', out);
+}
+
+// a .loc directive when `line` is known and differs from the current one; the
+// assembler turns these into the line table
+static void emit_line(const WaccX86Module* module, uint32_t line, uint32_t* current, FILE* out)
+{
+    if (module->source.len > 0 && line != 0 && line != *current)
+    {
+        (void)fprintf(out, "\t.loc\t1 %" PRIu32 "\n", line);
+        *current = line;
+    }
+}
+
+// pad with no-ops to a multiple of `align` bytes, a power of two
+static void emit_align(uint32_t align, uint32_t max_skip, FILE* out)
+{
+    if (align <= 1)
+    {
+        return;
+    }
+    uint32_t log2 = 0;
+    while ((UINT32_C(1) << log2) < align)
+    {
+        log2++;
+    }
+    if (max_skip > 0)
+    {
+        (void)fprintf(out, "\t.p2align\t%" PRIu32 ",,%" PRIu32 "\n", log2, max_skip);
+    }
+    else
+    {
+        (void)fprintf(out, "\t.p2align\t%" PRIu32 "\n", log2);
+    }
+}
+
+static void emit_function(const WaccX86Module* module, const WaccX86Function* function, FILE* out)
+{
+    emit_align(function->align, 0, out);
+    if (function->exported)
+    {
+        (void)fprintf(out, "\t.globl\t" str_fmt "\n", str_arg(function->name));
+    }
+    (void)fprintf(out, "\t.type\t" str_fmt ", @function\n", str_arg(function->name));
+    (void)fprintf(out, str_fmt ":\n", str_arg(function->name));
+    uint32_t line = 0;
+    emit_line(module, function->line, &line, out);
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        if (b > 0)
+        {
+            emit_align(function->blocks.ptr[b].align, function->blocks.ptr[b].max_skip, out);
+            WaccX86Operand label = wacc_x86_block((uint32_t)b);
+            print_operand(module, function, &label, 0, out);
+            (void)fputs(":\n", out);
+        }
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            emit_line(module, insts->ptr[i].line, &line, out);
+            emit_inst(module, function, &insts->ptr[i], out);
+        }
+    }
+    (void)fprintf(out, "\t.size\t" str_fmt ", .-" str_fmt "\n", str_arg(function->name), str_arg(function->name));
+}
+
+void wacc_x86_emit_begin(str source, FILE* out)
+{
+    if (source.len > 0)
+    {
+        (void)fprintf(out, "\t.file\t1 \"" str_fmt "\"\n", str_arg(source));
+    }
+    (void)fputs("\t.text\n", out);
+}
+
+// where the text of a function ended up in the buffer of the worker that
+// printed it
+typedef struct
+{
+    uint32_t worker;
+    long start;
+    long end;
+} Piece;
+
+typedef struct
+{
+    const WaccX86Module* module;
+    // one per worker
+    FILE** streams;
+    Piece* pieces;
+} Printing;
+
+static void print_function(void* context, uint64_t index, uint32_t worker)
+{
+    Printing* printing = context;
+    FILE* stream = printing->streams[worker];
+    long start = ftell(stream);
+    emit_function(printing->module, printing->module->functions.ptr[index], stream);
+    printing->pieces[index] = (Piece){worker, start, ftell(stream)};
+}
+
+void wacc_x86_emit_functions(const WaccX86Module* module, WaccPool* pool, FILE* out)
+{
+    uint32_t num_workers = wacc_pool_size(pool);
+    if (num_workers == 1 || module->functions.len <= 1)
+    {
+        for (uint64_t i = 0; i < module->functions.len; i++)
+        {
+            emit_function(module, module->functions.ptr[i], out);
+        }
+        return;
+    }
+    // each worker prints into memory of its own, and the functions are
+    // copied out in order once all are printed
+    BUF(FILE*) streams = BUF_NEW;
+    BUF(char*) texts = BUF_NEW;
+    BUF(size_t) sizes = BUF_NEW;
+    BUF(Piece) pieces = BUF_NEW;
+    BUF_RESERVE(&streams, num_workers);
+    BUF_RESERVE(&texts, num_workers);
+    BUF_RESERVE(&sizes, num_workers);
+    BUF_RESERVE(&pieces, module->functions.len);
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        streams.ptr[w] = open_memstream(&texts.ptr[w], &sizes.ptr[w]);
+        if (streams.ptr[w] == NULL)
+        {
+            allocator_oom();
+        }
+    }
+    Printing printing = {.module = module, .streams = streams.ptr, .pieces = pieces.ptr};
+    wacc_pool_for(pool, module->functions.len, print_function, &printing);
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        (void)fclose(streams.ptr[w]);
+    }
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        const Piece* piece = &pieces.ptr[i];
+        (void)fwrite(texts.ptr[piece->worker] + piece->start, 1, (size_t)(piece->end - piece->start), out);
+    }
+    for (uint32_t w = 0; w < num_workers; w++)
+    {
+        free(texts.ptr[w]);
+    }
+    BUF_FREE(pieces);
+    BUF_FREE(sizes);
+    BUF_FREE(texts);
+    BUF_FREE(streams);
+}
+
+enum
+{
+    SYS_WRITE = 1,
+    SYS_OPEN = 2,
+    SYS_CLOSE = 3,
+    PROFILE_MODE = 0644,
+};
+
+static void emit_bytes(const uint8_t* bytes, uint64_t size, FILE* out)
+{
+    for (uint64_t i = 0; i < size; i++)
+    {
+        if (i % 16 == 0)
+        {
+            (void)fprintf(out, "%s\t.byte\t%u", i > 0 ? "\n" : "", bytes[i]);
+        }
+        else
+        {
+            (void)fprintf(out, ",%u", bytes[i]);
+        }
+    }
+    (void)fputc('\n', out);
+}
+
+// The counters of an instrumented module, after the header of the profile
+// file and before its path, and a function the C library runs at exit that
+// writes the header and the counters to the file with raw system calls.
+static void emit_profile(const WaccIrCounters* counters, FILE* out)
+{
+    uint8_t header[WACC_PROFILE_HEADER_SIZE];
+    wacc_profile_header(counters, header);
+    (void)fputs("\t.data\n\t.p2align\t3\n.Lwacc_profile:\n", out);
+    emit_bytes(header, sizeof(header), out);
+    (void)fprintf(out, ".Lwacc_counters:\n\t.zero\t%" PRIu64 "\n", (uint64_t)counters->num_counters * 8);
+    (void)fputs(".Lwacc_profile_path:\n", out);
+    emit_bytes((const uint8_t*)counters->path.ptr, counters->path.len, out);
+    (void)fputs("\t.byte\t0\n", out);
+    (void)fprintf(out,
+        "\t.text\n"
+        ".Lwacc_profile_write:\n"
+        "\tmovl\t$%d, %%eax\n"
+        "\tleaq\t.Lwacc_profile_path(%%rip), %%rdi\n"
+        "\tmovl\t$%d, %%esi\n"
+        "\tmovl\t$%d, %%edx\n"
+        "\tsyscall\n"
+        "\ttestl\t%%eax, %%eax\n"
+        "\tjs\t.Lwacc_profile_done\n"
+        "\tmovl\t%%eax, %%edi\n"
+        "\tmovl\t$%d, %%eax\n"
+        "\tleaq\t.Lwacc_profile(%%rip), %%rsi\n"
+        "\tmovl\t$%" PRIu64 ", %%edx\n"
+        "\tsyscall\n"
+        "\tmovl\t$%d, %%eax\n"
+        "\tsyscall\n"
+        ".Lwacc_profile_done:\n"
+        "\tret\n"
+        "\t.section\t.fini_array,\"aw\"\n"
+        "\t.p2align\t3\n"
+        "\t.quad\t.Lwacc_profile_write\n",
+        SYS_OPEN,
+        O_WRONLY | O_CREAT | O_TRUNC,
+        PROFILE_MODE,
+        SYS_WRITE,
+        WACC_PROFILE_HEADER_SIZE + (uint64_t)counters->num_counters * 8,
+        SYS_CLOSE);
+}
+
+void wacc_x86_emit_end(FILE* out)
+{
+    (void)fputs("\t.section\t.note.GNU-stack,\"\",@progbits\n", out);
+}
+
+void wacc_x86_emit(const WaccX86Module* module, WaccPool* pool, FILE* out)
+{
+    wacc_x86_emit_begin(module->source, out);
+    wacc_x86_emit_functions(module, pool, out);
+    if (module->ir->counters.num_counters > 0)
+    {
+        emit_profile(&module->ir->counters, out);
+    }
+    wacc_x86_emit_end(out);
+}
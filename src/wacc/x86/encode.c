@@ -0,0 +1,923 @@
+#include "wacc/x86.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Machine code for an allocated module, as the assembler would produce from
+// the emitter's output: REX prefix, opcode, ModRM, SIB, displacement and
+// immediate, with the same choice of forms where the assembler has one.
+// Calls take a 32-bit displacement and are patched once every function has
+// its offset. Counters are addressed relative to %rip as well, but live
+// outside the code, so their displacements are left for whoever loads it.
+//
+// Branches are relaxed as the assembler does: every branch of a function
+// starts with an 8-bit displacement, and a pass over the function that finds
+// one out of range widens it to 32 bits and encodes the function again. Sizes
+// only grow, so this settles after a few passes, usually one.
+
+// a block or function index to resolve
+typedef struct
+{
+    // offset of the displacement, which counts from its end
+    uint32_t at;
+    uint32_t target;
+    // of the displacement, 1 or 4
+    uint32_t size;
+} Fixup;
+
+typedef BUF(Fixup) FixupBuf;
+typedef BUF(uint32_t) OffsetBuf;
+
+typedef struct
+{
+    WaccX86Code* code;
+    // added to offsets in `code` to align them, for a function encoded apart
+    // from where it will finally go
+    uint64_t shift;
+    // the first line table row of the current function
+    uint64_t first_line;
+    // where each block of the current function starts
+    OffsetBuf blocks;
+    // one per branch of the current function, in order, like block_fixups
+    FixupBuf block_fixups;
+    FixupBuf call_fixups;
+    // whether each branch of the current function needs a 32-bit
+    // displacement
+    BUF(bool) long_branches;
+} Encoder;
+
+enum
+{
+    REX = 0x40,
+    REX_W = 0x08,
+    REX_R = 0x04,
+    REX_X = 0x02,
+    REX_B = 0x01,
+    MOD_INDIRECT = 0x00,
+    MOD_DISP8 = 0x40,
+    MOD_DISP32 = 0x80,
+    MOD_REG = 0xc0,
+    // ModRM.rm and SIB.index values with a special meaning
+    RM_SIB = 4,
+    // with MOD_INDIRECT
+    RM_RIP = 5,
+    SIB_NO_INDEX = 4,
+};
+
+static void put8(Encoder* e, uint8_t byte)
+{
+    BUF_PUSH(&e->code->bytes, byte);
+}
+
+static void put_le(Encoder* e, uint64_t value, uint32_t bytes)
+{
+    for (uint32_t i = 0; i < bytes; i++)
+    {
+        put8(e, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static bool fits_int8(int64_t value)
+{
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool fits_int32(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static uint8_t low3(uint32_t reg)
+{
+    assert(reg < WACC_X86_NUM_REGS);
+    return (uint8_t)(reg & 7);
+}
+
+// %spl to %dil exist only with a REX prefix, which turns %ah to %bh off
+static bool needs_byte_rex(uint32_t reg)
+{
+    return reg >= WACC_X86_RSP && reg <= WACC_X86_RDI;
+}
+
+static void put_rex(Encoder* e, uint8_t rex, bool force)
+{
+    if (rex != 0 || force)
+    {
+        put8(e, REX | rex);
+    }
+}
+
+static uint8_t scale_bits(uint8_t scale)
+{
+    switch (scale)
+    {
+        case 1:
+            return 0;
+        case 2:
+            return 1;
+        case 4:
+            return 2;
+        default:
+            assert(scale == 8);
+            return 3;
+    }
+}
+
+// The prefix, `opcode` and addressing bytes for an instruction whose ModRM.reg
+// is `reg`, a register or an opcode extension, and whose ModRM.rm is the
+// register or memory operand `rm`. `wide` sets REX.W; `byte_rm` marks `rm` as
+// an 8-bit register, some of which need a REX prefix to be addressable.
+static void put_modrm(Encoder* e,
+    const uint8_t* opcode,
+    uint32_t opcode_len,
+    bool wide,
+    uint32_t reg,
+    const WaccX86Operand* rm,
+    bool byte_rm)
+{
+    uint8_t rex = (wide ? REX_W : 0) | (reg >= 8 ? REX_R : 0);
+    bool force_rex = false;
+    if (rm->kind == WACC_X86_OPERAND_REG)
+    {
+        rex |= rm->reg >= 8 ? REX_B : 0;
+        force_rex = byte_rm && needs_byte_rex(rm->reg);
+    }
+    else if (rm->kind == WACC_X86_OPERAND_MEM)
+    {
+        rex |= rm->mem.base >= 8 ? REX_B : 0;
+        rex |= rm->mem.index != WACC_X86_NO_REG && rm->mem.index >= 8 ? REX_X : 0;
+    }
+    put_rex(e, rex, force_rex);
+    for (uint32_t i = 0; i < opcode_len; i++)
+    {
+        put8(e, opcode[i]);
+    }
+    uint8_t modrm_reg = (uint8_t)((reg & 7) << 3);
+    if (rm->kind == WACC_X86_OPERAND_REG)
+    {
+        put8(e, MOD_REG | modrm_reg | low3(rm->reg));
+        return;
+    }
+    uint32_t base = rm->mem.base;
+    int32_t disp = rm->mem.disp;
+    if (rm->kind == WACC_X86_OPERAND_COUNTER)
+    {
+        // rip-relative; the end of the instruction is filled in once known
+        put8(e, MOD_INDIRECT | modrm_reg | RM_RIP);
+        WaccX86CodeCounter ref = {.at = (uint32_t)e->code->bytes.len, .counter = rm->counter};
+        BUF_PUSH(&e->code->counter_refs, ref);
+        put_le(e, 0, 4);
+        return;
+    }
+    // %rbp and %r13 as a base without a displacement would mean rip-relative
+    // or no base, so they take a zero disp8
+    uint8_t mod = disp == 0 && low3(base) != WACC_X86_RBP ? MOD_INDIRECT : fits_int8(disp) ? MOD_DISP8 : MOD_DISP32;
+    // %rsp and %r12 as a base need a SIB byte
+    if (rm->mem.index != WACC_X86_NO_REG || low3(base) == WACC_X86_RSP)
+    {
+        bool indexed = rm->mem.index != WACC_X86_NO_REG;
+        uint8_t sib_index = indexed ? low3(rm->mem.index) : SIB_NO_INDEX;
+        uint8_t sib_scale = indexed ? scale_bits(rm->mem.scale) : 0;
+        put8(e, mod | modrm_reg | RM_SIB);
+        put8(e, (uint8_t)(sib_scale << 6 | sib_index << 3 | low3(base)));
+    }
+    else
+    {
+        put8(e, mod | modrm_reg | low3(base));
+    }
+    if (mod == MOD_DISP8)
+    {
+        put8(e, (uint8_t)disp);
+    }
+    else if (mod == MOD_DISP32)
+    {
+        put_le(e, (uint32_t)disp, 4);
+    }
+}
+
+static void put_op1(Encoder* e, uint8_t opcode, bool wide, uint32_t reg, const WaccX86Operand* rm)
+{
+    put_modrm(e, &opcode, 1, wide, reg, rm, false);
+}
+
+static void put_op2(Encoder* e, uint8_t opcode, bool wide, uint32_t reg, const WaccX86Operand* rm)
+{
+    uint8_t bytes[] = {0x0f, opcode};
+    put_modrm(e, bytes, 2, wide, reg, rm, false);
+}
+
+// an opcode with the register in its low bits
+static void put_op_reg(Encoder* e, uint8_t opcode, bool wide, uint32_t reg)
+{
+    put_rex(e, (wide ? REX_W : 0) | (reg >= 8 ? REX_B : 0), false);
+    put8(e, opcode | low3(reg));
+}
+
+// a displacement of `size` bytes to `target`, patched later
+static void put_rel(Encoder* e, FixupBuf* fixups, uint32_t target, uint32_t size)
+{
+    BUF_PUSH(fixups, ((Fixup){(uint32_t)e->code->bytes.len, target, size}));
+    put_le(e, 0, size);
+}
+
+static int64_t displacement(const Fixup* fixup, uint32_t target_offset)
+{
+    return (int64_t)target_offset - (int64_t)(fixup->at + fixup->size);
+}
+
+static void patch_rel(Encoder* e, const Fixup* fixup, uint32_t target_offset)
+{
+    uint32_t rel = (uint32_t)displacement(fixup, target_offset);
+    for (uint32_t i = 0; i < fixup->size; i++)
+    {
+        e->code->bytes.ptr[fixup->at + i] = (uint8_t)(rel >> (8 * i));
+    }
+}
+
+// whether the next branch of the current function takes the 32-bit form; a
+// branch not seen before starts short
+static bool next_branch_long(Encoder* e)
+{
+    uint64_t branch = e->block_fixups.len;
+    if (branch == e->long_branches.len)
+    {
+        BUF_PUSH(&e->long_branches, false);
+    }
+    return e->long_branches.ptr[branch];
+}
+
+// The no-ops the assembler pads with: the longest a single instruction can
+// be, then one for the rest.
+enum
+{
+    MAX_NOP = 11,
+};
+
+static const uint8_t nops[MAX_NOP][MAX_NOP] = {
+    {0x90},
+    {0x66, 0x90},
+    {0x0f, 0x1f, 0x00},
+    {0x0f, 0x1f, 0x40, 0x00},
+    {0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+
+// pad to a multiple of `align` bytes, a power of two, unless that takes more
+// than `max_skip` bytes
+static void put_align(Encoder* e, uint32_t align, uint32_t max_skip)
+{
+    if (align <= 1)
+    {
+        return;
+    }
+    if (align > e->code->align)
+    {
+        e->code->align = align;
+    }
+    uint32_t padding = (uint32_t)(-(e->code->bytes.len + e->shift) & (align - 1));
+    if (max_skip > 0 && padding > max_skip)
+    {
+        return;
+    }
+    while (padding > 0)
+    {
+        uint32_t size = padding < MAX_NOP ? padding : MAX_NOP;
+        for (uint32_t i = 0; i < size; i++)
+        {
+            put8(e, nops[size - 1][i]);
+        }
+        padding -= size;
+    }
+}
+
+// the /digit of the immediate group and the base of the register forms
+static void alu_encoding(WaccX86Opcode op, uint8_t* ext, uint8_t* base)
+{
+    switch (op)
+    {
+        case WACC_X86_ADD:
+            *ext = 0;
+            break;
+        case WACC_X86_OR:
+            *ext = 1;
+            break;
+        case WACC_X86_AND:
+            *ext = 4;
+            break;
+        case WACC_X86_SUB:
+            *ext = 5;
+            break;
+        case WACC_X86_XOR:
+            *ext = 6;
+            break;
+        default:
+            assert(op == WACC_X86_CMP);
+            *ext = 7;
+            break;
+    }
+    *base = (uint8_t)(*ext << 3);
+}
+
+static void encode_alu(Encoder* e, const WaccX86Inst* inst)
+{
+    bool wide = inst->size == 8;
+    const WaccX86Operand* dst = &inst->ops[0];
+    const WaccX86Operand* src = &inst->ops[1];
+    uint8_t ext;
+    uint8_t base;
+    alu_encoding(inst->op, &ext, &base);
+    if (src->kind == WACC_X86_OPERAND_IMM)
+    {
+        if (fits_int8(src->imm))
+        {
+            put_op1(e, 0x83, wide, ext, dst);
+            put8(e, (uint8_t)src->imm);
+        }
+        else if (dst->kind == WACC_X86_OPERAND_REG && dst->reg == WACC_X86_RAX)
+        {
+            // the short form for %eax and %rax
+            put_rex(e, wide ? REX_W : 0, false);
+            put8(e, base | 0x05);
+            put_le(e, (uint64_t)src->imm, 4);
+        }
+        else
+        {
+            put_op1(e, 0x81, wide, ext, dst);
+            put_le(e, (uint64_t)src->imm, 4);
+        }
+    }
+    else if (src->kind == WACC_X86_OPERAND_REG)
+    {
+        put_op1(e, base | 0x01, wide, src->reg, dst);
+    }
+    else
+    {
+        put_op1(e, base | 0x03, wide, dst->reg, src);
+    }
+}
+
+static void encode_mov(Encoder* e, const WaccX86Inst* inst)
+{
+    bool wide = inst->size == 8;
+    const WaccX86Operand* dst = &inst->ops[0];
+    const WaccX86Operand* src = &inst->ops[1];
+    if (src->kind == WACC_X86_OPERAND_IMM)
+    {
+        if (dst->kind == WACC_X86_OPERAND_REG && (!wide || !fits_int32(src->imm)))
+        {
+            // movl $imm32 or movabsq $imm64
+            put_op_reg(e, 0xb8, wide, dst->reg);
+            put_le(e, (uint64_t)src->imm, wide ? 8 : 4);
+        }
+        else
+        {
+            put_op1(e, 0xc7, wide, 0, dst);
+            put_le(e, (uint64_t)src->imm, 4);
+        }
+    }
+    else if (src->kind == WACC_X86_OPERAND_REG)
+    {
+        put_op1(e, 0x89, wide, src->reg, dst);
+    }
+    else
+    {
+        put_op1(e, 0x8b, wide, dst->reg, src);
+    }
+}
+
+// the /digit of shifts and of the 0xf7 group
+static uint8_t group_ext(WaccX86Opcode op)
+{
+    switch (op)
+    {
+        case WACC_X86_SHL:
+            return 4;
+        case WACC_X86_SHR:
+            return 5;
+        case WACC_X86_SAR:
+            return 7;
+        case WACC_X86_NOT:
+            return 2;
+        case WACC_X86_NEG:
+            return 3;
+        case WACC_X86_MUL_WIDE:
+            return 4;
+        case WACC_X86_IMUL_WIDE:
+            return 5;
+        case WACC_X86_DIV:
+            return 6;
+        default:
+            assert(op == WACC_X86_IDIV);
+            return 7;
+    }
+}
+
+static void encode_shift(Encoder* e, const WaccX86Inst* inst)
+{
+    bool wide = inst->size == 8;
+    uint8_t ext = group_ext(inst->op);
+    const WaccX86Operand* count = &inst->ops[1];
+    if (count->kind == WACC_X86_OPERAND_REG)
+    {
+        assert(count->reg == WACC_X86_RCX);
+        put_op1(e, 0xd3, wide, ext, &inst->ops[0]);
+    }
+    else if (count->imm == 1)
+    {
+        put_op1(e, 0xd1, wide, ext, &inst->ops[0]);
+    }
+    else
+    {
+        put_op1(e, 0xc1, wide, ext, &inst->ops[0]);
+        put8(e, (uint8_t)count->imm);
+    }
+}
+
+static void encode_imul(Encoder* e, const WaccX86Inst* inst)
+{
+    bool wide = inst->size == 8;
+    const WaccX86Operand* dst = &inst->ops[0];
+    const WaccX86Operand* src = &inst->ops[1];
+    assert(dst->kind == WACC_X86_OPERAND_REG);
+    if (src->kind == WACC_X86_OPERAND_IMM)
+    {
+        // the three-operand form with the destination as the source
+        bool short_imm = fits_int8(src->imm);
+        put_op1(e, short_imm ? 0x6b : 0x69, wide, dst->reg, dst);
+        put_le(e, (uint64_t)src->imm, short_imm ? 1 : 4);
+    }
+    else
+    {
+        put_op2(e, 0xaf, wide, dst->reg, src);
+    }
+}
+
+static void encode_test(Encoder* e, const WaccX86Inst* inst)
+{
+    bool wide = inst->size == 8;
+    const WaccX86Operand* dst = &inst->ops[0];
+    const WaccX86Operand* src = &inst->ops[1];
+    if (src->kind == WACC_X86_OPERAND_IMM)
+    {
+        if (dst->kind == WACC_X86_OPERAND_REG && dst->reg == WACC_X86_RAX)
+        {
+            put_rex(e, wide ? REX_W : 0, false);
+            put8(e, 0xa9);
+        }
+        else
+        {
+            put_op1(e, 0xf7, wide, 0, dst);
+        }
+        put_le(e, (uint64_t)src->imm, 4);
+    }
+    else if (src->kind == WACC_X86_OPERAND_REG)
+    {
+        put_op1(e, 0x85, wide, src->reg, dst);
+    }
+    else
+    {
+        // test is symmetric, and only has the memory operand in r/m
+        put_op1(e, 0x85, wide, dst->reg, src);
+    }
+}
+
+static void encode_push_pop(Encoder* e, const WaccX86Inst* inst)
+{
+    const WaccX86Operand* op = &inst->ops[0];
+    bool push = inst->op == WACC_X86_PUSH;
+    if (op->kind == WACC_X86_OPERAND_REG)
+    {
+        put_op_reg(e, push ? 0x50 : 0x58, false, op->reg);
+    }
+    else if (op->kind == WACC_X86_OPERAND_IMM)
+    {
+        assert(push);
+        put8(e, fits_int8(op->imm) ? 0x6a : 0x68);
+        put_le(e, (uint64_t)op->imm, fits_int8(op->imm) ? 1 : 4);
+    }
+    else
+    {
+        put_op1(e, push ? 0xff : 0x8f, false, push ? 6 : 0, op);
+    }
+}
+
+static void encode_inst(Encoder* e, const WaccX86Inst* inst)
+{
+    bool wide = inst->size == 8;
+    const WaccX86Operand* dst = &inst->ops[0];
+    const WaccX86Operand* src = &inst->ops[1];
+    switch (inst->op)
+    {
+        case WACC_X86_MOV:
+            encode_mov(e, inst);
+            break;
+        case WACC_X86_MOVSX:
+            put_op1(e, 0x63, true, dst->reg, src);
+            break;
+        case WACC_X86_MOVZX8:
+        {
+            uint8_t opcode[] = {0x0f, 0xb6};
+            put_modrm(e, opcode, 2, false, dst->reg, src, true);
+            break;
+        }
+        case WACC_X86_MOVZX32:
+        {
+            WaccX86Inst mov = *inst;
+            mov.op = WACC_X86_MOV;
+            mov.size = 4;
+            encode_mov(e, &mov);
+            break;
+        }
+        case WACC_X86_LEA:
+            put_op1(e, 0x8d, wide, dst->reg, src);
+            break;
+        case WACC_X86_ADD:
+        case WACC_X86_SUB:
+        case WACC_X86_AND:
+        case WACC_X86_OR:
+        case WACC_X86_XOR:
+        case WACC_X86_CMP:
+            encode_alu(e, inst);
+            break;
+        case WACC_X86_IMUL:
+            encode_imul(e, inst);
+            break;
+        case WACC_X86_SHL:
+        case WACC_X86_SAR:
+        case WACC_X86_SHR:
+            encode_shift(e, inst);
+            break;
+        case WACC_X86_NEG:
+        case WACC_X86_NOT:
+        case WACC_X86_IMUL_WIDE:
+        case WACC_X86_MUL_WIDE:
+        case WACC_X86_IDIV:
+        case WACC_X86_DIV:
+            put_op1(e, 0xf7, wide, group_ext(inst->op), dst);
+            break;
+        case WACC_X86_CDQ:
+            put_rex(e, wide ? REX_W : 0, false);
+            put8(e, 0x99);
+            break;
+        case WACC_X86_TEST:
+            encode_test(e, inst);
+            break;
+        case WACC_X86_SETCC:
+        {
+            uint8_t opcode[] = {0x0f, (uint8_t)(0x90 | inst->cond)};
+            put_modrm(e, opcode, 2, false, 0, dst, true);
+            break;
+        }
+        case WACC_X86_JMP:
+            if (next_branch_long(e))
+            {
+                put8(e, 0xe9);
+                put_rel(e, &e->block_fixups, dst->block, 4);
+            }
+            else
+            {
+                put8(e, 0xeb);
+                put_rel(e, &e->block_fixups, dst->block, 1);
+            }
+            break;
+        case WACC_X86_JCC:
+            if (next_branch_long(e))
+            {
+                put8(e, 0x0f);
+                put8(e, (uint8_t)(0x80 | inst->cond));
+                put_rel(e, &e->block_fixups, dst->block, 4);
+            }
+            else
+            {
+                put8(e, (uint8_t)(0x70 | inst->cond));
+                put_rel(e, &e->block_fixups, dst->block, 1);
+            }
+            break;
+        case WACC_X86_CALL:
+            put8(e, 0xe8);
+            put_rel(e, &e->call_fixups, dst->func, 4);
+            break;
+        case WACC_X86_RET:
+            put8(e, 0xc3);
+            break;
+        case WACC_X86_PUSH:
+        case WACC_X86_POP:
+            encode_push_pop(e, inst);
+            break;
+    }
+}
+
+// start a line table row at the current offset if `line` is known and differs
+// from the previous row of the function; see join_lines for the rows before
+static void mark_line(Encoder* e, uint32_t line)
+{
+    WaccX86Code* code = e->code;
+    bool rows = code->lines.len > e->first_line;
+    if (code->source.len == 0 || line == 0 || (rows && code->lines.ptr[code->lines.len - 1].line == line))
+    {
+        return;
+    }
+    WaccX86CodeLine row = {.offset = (uint32_t)code->bytes.len, .line = line};
+    if (rows && code->lines.ptr[code->lines.len - 1].offset == row.offset)
+    {
+        // the previous row covers no code
+        code->lines.ptr[code->lines.len - 1] = row;
+        return;
+    }
+    BUF_PUSH(&code->lines, row);
+}
+
+// encode `function` with the branch forms chosen so far; false if a short
+// branch turns out to be out of range, which is then widened
+static bool encode_pass(Encoder* e, const WaccX86Function* function)
+{
+    e->blocks.len = 0;
+    e->block_fixups.len = 0;
+    // the prologue belongs to the line of the definition
+    mark_line(e, function->line);
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccX86Block* block = &function->blocks.ptr[b];
+        put_align(e, block->align, block->max_skip);
+        BUF_PUSH(&e->blocks, (uint32_t)e->code->bytes.len);
+        for (uint64_t i = 0; i < block->insts.len; i++)
+        {
+            mark_line(e, block->insts.ptr[i].line);
+            uint64_t refs = e->code->counter_refs.len;
+            encode_inst(e, &block->insts.ptr[i]);
+            if (e->code->counter_refs.len > refs)
+            {
+                e->code->counter_refs.ptr[refs].end = (uint32_t)e->code->bytes.len;
+            }
+        }
+    }
+    bool settled = true;
+    for (uint64_t i = 0; i < e->block_fixups.len; i++)
+    {
+        const Fixup* fixup = &e->block_fixups.ptr[i];
+        if (fixup->size == 1 && !fits_int8(displacement(fixup, e->blocks.ptr[fixup->target])))
+        {
+            e->long_branches.ptr[i] = true;
+            settled = false;
+        }
+    }
+    return settled;
+}
+
+static void encode_function(Encoder* e, const WaccX86Function* function)
+{
+    WaccX86Code* code = e->code;
+    uint64_t start = code->bytes.len;
+    uint64_t lines = code->lines.len;
+    uint64_t calls = e->call_fixups.len;
+    uint64_t refs = code->counter_refs.len;
+    e->first_line = lines;
+    e->long_branches.len = 0;
+    while (!encode_pass(e, function))
+    {
+        code->bytes.len = start;
+        code->lines.len = lines;
+        e->call_fixups.len = calls;
+        code->counter_refs.len = refs;
+    }
+    for (uint64_t i = 0; i < e->block_fixups.len; i++)
+    {
+        const Fixup* fixup = &e->block_fixups.ptr[i];
+        patch_rel(e, fixup, e->blocks.ptr[fixup->target]);
+    }
+}
+
+// A function that continues the line the one before it ended on starts no
+// row of its own, as mark_line would have it if both were encoded in one go.
+static void join_lines(WaccX86Code* code, uint64_t first)
+{
+    if (first > 0 && first < code->lines.len && code->lines.ptr[first].line == code->lines.ptr[first - 1].line)
+    {
+        memmove(&code->lines.ptr[first],
+            &code->lines.ptr[first + 1],
+            (code->lines.len - first - 1) * sizeof(WaccX86CodeLine));
+        code->lines.len--;
+    }
+}
+
+static Encoder encoder_new(WaccX86Code* code, const Allocator* alloc)
+{
+    return (Encoder){
+        .code = code,
+        .blocks = BUF_NEW_IN(alloc),
+        .block_fixups = BUF_NEW_IN(alloc),
+        .call_fixups = BUF_NEW_IN(alloc),
+        .long_branches = BUF_NEW_IN(alloc),
+    };
+}
+
+static void encoder_free(Encoder* e)
+{
+    BUF_FREE(e->blocks);
+    BUF_FREE(e->block_fixups);
+    BUF_FREE(e->call_fixups);
+    BUF_FREE(e->long_branches);
+}
+
+// a function encoded apart by one of the workers
+typedef struct
+{
+    uint32_t worker;
+    // its bytes, line table rows and calls in the worker's encoder
+    uint64_t start;
+    uint64_t end;
+    uint64_t first_line;
+    uint64_t end_line;
+    uint64_t first_call;
+    uint64_t end_call;
+    uint64_t first_ref;
+    uint64_t end_ref;
+    // the coarsest alignment of a block; the padding in front of the blocks
+    // holds wherever the function goes at a multiple of it
+    uint32_t align;
+} Piece;
+
+typedef struct
+{
+    const WaccX86Module* module;
+    // one per worker, which only the worker touches, with code of its own
+    Encoder* encoders;
+    Piece* pieces;
+} Apart;
+
+static void encode_apart(void* context, uint64_t index, uint32_t worker)
+{
+    Apart* apart = context;
+    const WaccX86Function* function = apart->module->functions.ptr[index];
+    Encoder* e = &apart->encoders[worker];
+    WaccX86Code* code = e->code;
+    Piece piece = {
+        .worker = worker,
+        .start = code->bytes.len,
+        .first_line = code->lines.len,
+        .first_call = e->call_fixups.len,
+        .first_ref = code->counter_refs.len,
+        .align = 1,
+    };
+    // padded as if the function started at offset 0
+    e->shift = -piece.start;
+    encode_function(e, function);
+    piece.end = code->bytes.len;
+    piece.end_line = code->lines.len;
+    piece.end_call = e->call_fixups.len;
+    piece.end_ref = code->counter_refs.len;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        if (function->blocks.ptr[b].align > piece.align)
+        {
+            piece.align = function->blocks.ptr[b].align;
+        }
+    }
+    apart->pieces[index] = piece;
+}
+
+// append the function of `piece` at offset `offset` of the code of `e`
+static void place_piece(Encoder* e, const Apart* apart, const Piece* piece, uint32_t offset)
+{
+    WaccX86Code* code = e->code;
+    const Encoder* from = &apart->encoders[piece->worker];
+    BUF_EXTEND(&code->bytes, from->code->bytes.ptr + piece->start, piece->end - piece->start);
+    uint64_t first = code->lines.len;
+    for (uint64_t i = piece->first_line; i < piece->end_line; i++)
+    {
+        WaccX86CodeLine row = from->code->lines.ptr[i];
+        row.offset = (uint32_t)(row.offset - piece->start + offset);
+        BUF_PUSH(&code->lines, row);
+    }
+    join_lines(code, first);
+    for (uint64_t i = piece->first_call; i < piece->end_call; i++)
+    {
+        Fixup fixup = from->call_fixups.ptr[i];
+        fixup.at = (uint32_t)(fixup.at - piece->start + offset);
+        BUF_PUSH(&e->call_fixups, fixup);
+    }
+    for (uint64_t i = piece->first_ref; i < piece->end_ref; i++)
+    {
+        WaccX86CodeCounter ref = from->code->counter_refs.ptr[i];
+        ref.at = (uint32_t)(ref.at - piece->start + offset);
+        ref.end = (uint32_t)(ref.end - piece->start + offset);
+        BUF_PUSH(&code->counter_refs, ref);
+    }
+    if (piece->align > code->align)
+    {
+        code->align = piece->align;
+    }
+}
+
+void wacc_x86_encode(const WaccX86Module* module, WaccPool* pool, WaccX86Code* code)
+{
+    *code = (WaccX86Code){
+        .bytes = BUF_NEW_IN(module->alloc),
+        .functions = BUF_NEW_IN(module->alloc),
+        .lines = BUF_NEW_IN(module->alloc),
+        .counter_refs = BUF_NEW_IN(module->alloc),
+        .counters = module->ir->counters,
+        .source = module->source,
+        .align = 1,
+    };
+    Encoder e = encoder_new(code, module->alloc);
+
+    // The workers encode the functions into code of their own, and the
+    // functions are then placed one after another. A function whose blocks
+    // are aligned more coarsely than where it lands is encoded again there,
+    // which the usual equal alignment of functions and loops never asks for.
+    uint32_t num_workers = wacc_pool_size(pool);
+    bool parallel = num_workers > 1 && module->functions.len > 1;
+    // on the heap rather than `module->alloc`, which is not the workers' to share
+    BUF(WaccX86Code) codes = BUF_NEW;
+    BUF(Encoder) encoders = BUF_NEW;
+    BUF(Piece) pieces = BUF_NEW;
+    Apart apart = {.module = module};
+    if (parallel)
+    {
+        for (uint32_t w = 0; w < num_workers; w++)
+        {
+            WaccX86Code worker_code = {
+                .bytes = BUF_NEW,
+                .functions = BUF_NEW,
+                .lines = BUF_NEW,
+                .counter_refs = BUF_NEW,
+                .source = module->source,
+                .align = 1,
+            };
+            BUF_PUSH(&codes, worker_code);
+        }
+        for (uint32_t w = 0; w < num_workers; w++)
+        {
+            BUF_PUSH(&encoders, encoder_new(&codes.ptr[w], NULL));
+        }
+        BUF_RESERVE(&pieces, module->functions.len);
+        apart = (Apart){.module = module, .encoders = encoders.ptr, .pieces = pieces.ptr};
+        wacc_pool_for(pool, module->functions.len, encode_apart, &apart);
+    }
+
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        const WaccX86Function* function = module->functions.ptr[i];
+        put_align(&e, function->align, 0);
+        uint32_t offset = (uint32_t)code->bytes.len;
+        if (parallel && offset % apart.pieces[i].align == 0)
+        {
+            place_piece(&e, &apart, &apart.pieces[i], offset);
+        }
+        else
+        {
+            uint64_t first = code->lines.len;
+            encode_function(&e, function);
+            join_lines(code, first);
+        }
+        WaccX86CodeFunction info = {
+            .offset = offset,
+            .size = (uint32_t)code->bytes.len - offset,
+            .name = function->name,
+            .exported = function->exported,
+            .line = function->line,
+        };
+        BUF_PUSH(&code->functions, info);
+    }
+    for (uint64_t i = 0; i < e.call_fixups.len; i++)
+    {
+        const Fixup* fixup = &e.call_fixups.ptr[i];
+        patch_rel(&e, fixup, code->functions.ptr[fixup->target].offset);
+    }
+    encoder_free(&e);
+    for (uint64_t w = 0; w < encoders.len; w++)
+    {
+        encoder_free(&encoders.ptr[w]);
+        wacc_x86_code_free(&codes.ptr[w]);
+    }
+    BUF_FREE(pieces);
+    BUF_FREE(encoders);
+    BUF_FREE(codes);
+}
+
+void wacc_x86_code_free(WaccX86Code* code)
+{
+    BUF_FREE(code->bytes);
+    BUF_FREE(code->functions);
+    BUF_FREE(code->lines);
+    BUF_FREE(code->counter_refs);
+}
+
+void wacc_x86_place_counters(const WaccX86Code* code, uint8_t* bytes, int64_t distance)
+{
+    for (uint64_t i = 0; i < code->counter_refs.len; i++)
+    {
+        const WaccX86CodeCounter* ref = &code->counter_refs.ptr[i];
+        uint32_t rel = (uint32_t)(distance + 8 * (int64_t)ref->counter - ref->end);
+        for (uint32_t k = 0; k < 4; k++)
+        {
+            bytes[ref->at + k] = (uint8_t)(rel >> (8 * k));
+        }
+    }
+}
@@ -0,0 +1,178 @@
+#include "wacc/x86.h"
+
+// Frame layout, from the return address down:
+//
+//     saved %rbp                  <- %rbp
+//     callee-saved registers the allocator used
+//     stack slots, padded so %rsp stays 16-byte aligned at calls
+//
+// Slots are addressed relative to %rbp, which also leaves %rsp free to move
+// while the arguments of a call are pushed.
+//
+// A leaf function that saves no registers and whose slots fit in the 128-byte
+// red zone below %rsp needs no frame at all: unless the frame pointer is kept
+// for profilers and debuggers, it gets no prologue or epilogue and addresses
+// its slots relative to %rsp.
+
+#define REG_BIT(reg) (UINT32_C(1) << (reg))
+
+static WaccX86Inst frame_inst(WaccX86Opcode op, WaccX86Operand dst, WaccX86Operand src)
+{
+    return (WaccX86Inst){.op = op, .size = 8, .ops = {dst, src}};
+}
+
+enum
+{
+    RED_ZONE_SIZE = 128,
+};
+
+static bool is_leaf(const WaccX86Function* function)
+{
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            if (insts->ptr[i].op == WACC_X86_CALL || insts->ptr[i].op == WACC_X86_PUSH)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static uint32_t preserved_regs_used(const WaccX86Function* function)
+{
+    uint32_t mask = 0;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            for (uint32_t k = 0; k < 2; k++)
+            {
+                const WaccX86Operand* op = &insts->ptr[i].ops[k];
+                if (op->kind == WACC_X86_OPERAND_REG && op->reg < WACC_X86_NUM_REGS)
+                {
+                    mask |= REG_BIT(op->reg);
+                }
+            }
+        }
+    }
+    uint32_t preserved = 0;
+    for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+    {
+        if (wacc_x86_regs[r].preserved && r != WACC_X86_RSP && r != WACC_X86_RBP)
+        {
+            preserved |= REG_BIT(r);
+        }
+    }
+    return mask & preserved;
+}
+
+static uint32_t count_bits(uint32_t mask)
+{
+    uint32_t n = 0;
+    for (; mask != 0; mask &= mask - 1)
+    {
+        n++;
+    }
+    return n;
+}
+
+// rewrite slot operands into `base` + `first_disp` - 8 * slot
+static void resolve_slots(WaccX86Function* function, uint32_t base, int32_t first_disp)
+{
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            for (uint32_t k = 0; k < 2; k++)
+            {
+                WaccX86Operand* op = &insts->ptr[i].ops[k];
+                if (op->kind == WACC_X86_OPERAND_SLOT)
+                {
+                    *op = (WaccX86Operand){
+                        .kind = WACC_X86_OPERAND_MEM,
+                        .mem = {base, WACC_X86_NO_REG, 1, first_disp - 8 * (int32_t)op->slot},
+                    };
+                }
+            }
+        }
+    }
+}
+
+void wacc_x86_frame(WaccX86Function* function, const WaccX86Options* options)
+{
+    uint32_t saved = preserved_regs_used(function);
+    if (options->omit_frame_pointer && saved == 0 && 8 * function->num_slots <= RED_ZONE_SIZE && is_leaf(function))
+    {
+        function->preserved_mask = 0;
+        function->frame_size = 0;
+        function->frame_pointer = false;
+        resolve_slots(function, WACC_X86_RSP, -8);
+        return;
+    }
+    uint32_t num_saved = count_bits(saved);
+    uint32_t frame_size = 8 * function->num_slots;
+    // %rsp is 16-byte aligned again once %rbp is pushed
+    if ((8 * num_saved + frame_size) % 16 != 0)
+    {
+        frame_size += 8;
+    }
+    function->preserved_mask = saved;
+    function->frame_size = frame_size;
+    function->frame_pointer = true;
+    resolve_slots(function, WACC_X86_RBP, -8 * (int32_t)(num_saved + 1));
+
+    WaccX86Operand rsp = wacc_x86_reg(WACC_X86_RSP);
+    WaccX86Operand rbp = wacc_x86_reg(WACC_X86_RBP);
+    WaccX86InstBuf prologue = BUF_NEW_IN(&function->alloc);
+    BUF_PUSH(&prologue, frame_inst(WACC_X86_PUSH, rbp, (WaccX86Operand){0}));
+    BUF_PUSH(&prologue, frame_inst(WACC_X86_MOV, rbp, rsp));
+    for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+    {
+        if (saved & REG_BIT(r))
+        {
+            BUF_PUSH(&prologue, frame_inst(WACC_X86_PUSH, wacc_x86_reg(r), (WaccX86Operand){0}));
+        }
+    }
+    if (frame_size > 0)
+    {
+        BUF_PUSH(&prologue, frame_inst(WACC_X86_SUB, rsp, wacc_x86_imm(frame_size)));
+    }
+    WaccX86InstBuf* entry = &function->blocks.ptr[0].insts;
+    BUF_EXTEND(&prologue, entry->ptr, entry->len);
+    BUF_FREE(*entry);
+    *entry = prologue;
+
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        WaccX86InstBuf out = BUF_NEW_IN(&function->alloc);
+        BUF_RESERVE(&out, insts->len);
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            if (insts->ptr[i].op == WACC_X86_RET)
+            {
+                if (frame_size > 0)
+                {
+                    BUF_PUSH(&out, frame_inst(WACC_X86_ADD, rsp, wacc_x86_imm(frame_size)));
+                }
+                for (uint32_t r = WACC_X86_NUM_REGS; r-- > 0;)
+                {
+                    if (saved & REG_BIT(r))
+                    {
+                        BUF_PUSH(&out, frame_inst(WACC_X86_POP, wacc_x86_reg(r), (WaccX86Operand){0}));
+                    }
+                }
+                BUF_PUSH(&out, frame_inst(WACC_X86_POP, rbp, (WaccX86Operand){0}));
+            }
+            BUF_PUSH(&out, insts->ptr[i]);
+        }
+        BUF_FREE(*insts);
+        *insts = out;
+    }
+}
@@ -0,0 +1,45 @@
+#include "wacc/x86.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+bool wacc_x86_jit_load(WaccX86Jit* jit, const WaccX86Code* code)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t code_size = (code->bytes.len + page - 1) / page * page;
+    if (code_size == 0)
+    {
+        code_size = page;
+    }
+    // the counters follow on pages of their own, zero as mapped
+    size_t counters_size = ((size_t)code->counters.num_counters * 8 + page - 1) / page * page;
+    size_t size = code_size + counters_size;
+    uint8_t* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((void*)memory == MAP_FAILED)
+    {
+        return false;
+    }
+    if (code->bytes.len > 0)
+    {
+        memcpy(memory, code->bytes.ptr, code->bytes.len);
+    }
+    wacc_x86_place_counters(code, memory, (int64_t)code_size);
+    if (mprotect(memory, code_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        (void)munmap(memory, size);
+        return false;
+    }
+    *jit = (WaccX86Jit){
+        .memory = memory,
+        .size = size,
+        .counters = counters_size > 0 ? (uint64_t*)(memory + code_size) : NULL,
+    };
+    return true;
+}
+
+void wacc_x86_jit_unload(WaccX86Jit* jit)
+{
+    (void)munmap(jit->memory, jit->size);
+    *jit = (WaccX86Jit){0};
+}
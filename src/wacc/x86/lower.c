@@ -0,0 +1,1254 @@
+#include "wacc/x86.h"
+
+#include <string.h>
+
+// Lowering from the IR to machine instructions over virtual registers.
+//
+// Every IR value gets a virtual register, except constants: they are
+// rematerialized at each use, as an immediate where the instruction takes one
+// and with a `mov` into a fresh register otherwise, so they never occupy a
+// register across the function. Arithmetic and comparisons are selected by
+// tiling their expression trees with the rules of wacc/x86/patterns.def; the
+// other instructions are lowered one at a time. Phis become moves at the end
+// of their predecessors; edges from a conditional branch into a block with
+// phis are split first.
+//
+// Blocks are laid out in reverse postorder, or, for a function with a
+// profile, in chains along the edges taken most often, so that the hot path
+// falls through and the blocks that never ran go to the end.
+
+typedef struct Label Label;
+
+typedef struct
+{
+    const WaccIrFunction* ir;
+    WaccX86Function* function;
+    // MIR block of each IR block, WACC_X86_NO_REG if unreachable
+    BUF(uint32_t) block_map;
+    // MIR block instructions are currently appended to
+    uint32_t block;
+    // the defining instruction of every IR value
+    BUF(const WaccIrInst*) defs;
+    // whether each value is computed inside its user's expression tree
+    BUF(bool) folded;
+    // instruction selection state of the values selected through the rules
+    BUF(Label) labels;
+} Lower;
+
+static uint8_t type_size(WaccIrType type)
+{
+    return type == WACC_IR_TYPE_I64 ? 8 : 4;
+}
+
+static bool fits_imm32(int64_t imm)
+{
+    return imm >= INT32_MIN && imm <= INT32_MAX;
+}
+
+static void emit(Lower* l, WaccX86Opcode op, uint8_t size, WaccX86Operand dst, WaccX86Operand src)
+{
+    wacc_x86_append(l->function, l->block, (WaccX86Inst){.op = op, .size = size, .ops = {dst, src}});
+}
+
+static uint32_t vreg(WaccIrValue value)
+{
+    return WACC_X86_FIRST_VREG + value;
+}
+
+static bool is_const(const Lower* l, WaccIrValue value)
+{
+    return l->defs.ptr[value] != NULL && l->defs.ptr[value]->op == WACC_IR_CONST;
+}
+
+// `value` in a register
+static WaccX86Operand reg_operand(Lower* l, WaccIrValue value)
+{
+    if (is_const(l, value))
+    {
+        uint32_t tmp = wacc_x86_vreg_new(l->function);
+        emit(l,
+            WACC_X86_MOV,
+            type_size(wacc_ir_value_type(l->ir, value)),
+            wacc_x86_reg(tmp),
+            wacc_x86_imm(l->defs.ptr[value]->imm));
+        return wacc_x86_reg(tmp);
+    }
+    return wacc_x86_reg(vreg(value));
+}
+
+// `value` as an immediate if it fits in the 32-bit immediate of most
+// instructions, otherwise in a register
+static WaccX86Operand src_operand(Lower* l, WaccIrValue value)
+{
+    if (is_const(l, value) && fits_imm32(l->defs.ptr[value]->imm))
+    {
+        return wacc_x86_imm(l->defs.ptr[value]->imm);
+    }
+    return reg_operand(l, value);
+}
+
+static WaccX86Cond compare_cond(WaccIrOpcode op)
+{
+    switch (op)
+    {
+        case WACC_IR_EQ:
+            return WACC_X86_COND_E;
+        case WACC_IR_NE:
+            return WACC_X86_COND_NE;
+        case WACC_IR_SLT:
+            return WACC_X86_COND_L;
+        case WACC_IR_SLE:
+            return WACC_X86_COND_LE;
+        case WACC_IR_SGT:
+            return WACC_X86_COND_G;
+        case WACC_IR_SGE:
+            return WACC_X86_COND_GE;
+        case WACC_IR_ULT:
+            return WACC_X86_COND_B;
+        case WACC_IR_ULE:
+            return WACC_X86_COND_BE;
+        case WACC_IR_UGT:
+            return WACC_X86_COND_A;
+        case WACC_IR_UGE:
+            return WACC_X86_COND_AE;
+        default:
+            abort();
+    }
+}
+
+// the condition that holds after swapping the operands of a comparison
+static WaccX86Cond swap_cond(WaccX86Cond cond)
+{
+    switch (cond)
+    {
+        case WACC_X86_COND_L:
+            return WACC_X86_COND_G;
+        case WACC_X86_COND_LE:
+            return WACC_X86_COND_GE;
+        case WACC_X86_COND_G:
+            return WACC_X86_COND_L;
+        case WACC_X86_COND_GE:
+            return WACC_X86_COND_LE;
+        case WACC_X86_COND_B:
+            return WACC_X86_COND_A;
+        case WACC_X86_COND_BE:
+            return WACC_X86_COND_AE;
+        case WACC_X86_COND_A:
+            return WACC_X86_COND_B;
+        case WACC_X86_COND_AE:
+            return WACC_X86_COND_BE;
+        default:
+            return cond;
+    }
+}
+
+// Instruction selection for expression trees, by bottom-up rewriting over the
+// rules of wacc/x86/patterns.def.
+//
+// A value the table covers becomes an inner node of its user's tree when it
+// has no other use and both sit in the same block; as both are pure, computing
+// it at the user is safe. Labelling visits the nodes bottom-up and records, for
+// each nonterminal, the cheapest rule deriving it and its cost, closing over
+// the chain rules. Reduction then walks each root top-down along the chosen
+// rules and emits their instructions, so an addition of a scaled index and a
+// constant becomes a single lea instead of a shift, a move and two additions.
+
+typedef enum
+{
+    NONTERMINAL_NONE,
+    NONTERMINAL_REG,
+    NONTERMINAL_IMM,
+    // a register or an immediate
+    NONTERMINAL_SRC,
+    NONTERMINAL_INDEX,
+    NONTERMINAL_BASE_INDEX,
+    NONTERMINAL_ADDR,
+    NUM_NONTERMINALS,
+} Nonterminal;
+
+// IR opcodes, then the operators only rules use
+typedef enum
+{
+#define X(x, args, flags) OPERATOR_##x,
+#include "wacc/ir/opcodes.def"
+#undef X
+    OPERATOR_LEAF,
+    OPERATOR_CHAIN,
+    // any comparison
+    OPERATOR_COMPARE,
+} Operator;
+
+#define NO_COST UINT32_MAX
+
+struct Label
+{
+    uint32_t cost[NUM_NONTERMINALS];
+    uint8_t rule[NUM_NONTERMINALS];
+    // whether the rule matched the operands in swapped order
+    bool swapped[NUM_NONTERMINALS];
+};
+
+typedef struct Rule Rule;
+
+// whether a rule applies to `inst` with operands `left` and `right`, in the
+// order the rule reads them
+typedef bool (*Predicate)(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right);
+// emits the instructions of a rule for `value` and returns what it derives;
+// `kids` holds the operands reduced to the nonterminals the rule asks for
+typedef WaccX86Operand (*Action)(
+    Lower* l, WaccIrValue value, const Rule* rule, bool swapped, const WaccX86Operand kids[2]);
+
+struct Rule
+{
+    Nonterminal nonterminal;
+    Operator operator;
+    Nonterminal left;
+    Nonterminal right;
+    uint32_t cost;
+    Predicate predicate;
+    Action action;
+    WaccX86Opcode opcode;
+};
+
+static int64_t const_imm(const Lower* l, WaccIrValue value)
+{
+    return l->defs.ptr[value]->imm;
+}
+
+static uint32_t shift_mask(const WaccIrInst* inst)
+{
+    return type_size(inst->type) * 8 - 1;
+}
+
+static WaccX86Operand address(uint32_t base, uint32_t index, uint8_t scale, int32_t disp)
+{
+    return (WaccX86Operand){.kind = WACC_X86_OPERAND_MEM, .mem = {base, index, scale, disp}};
+}
+
+// x * c for a positive c that is 1, 3, 5 or 9 times another of those times a
+// power of two, in at most two lea and shift instructions; returns false for
+// other constants
+static bool cheap_multiplier(int64_t c, uint8_t* first, uint8_t* second, uint32_t* shift)
+{
+    static const uint8_t factors[] = {1, 3, 5, 9};
+    if (c <= 0)
+    {
+        return false;
+    }
+    *shift = 0;
+    while (c % 2 == 0)
+    {
+        c /= 2;
+        (*shift)++;
+    }
+    for (uint32_t i = 0; i < sizeof(factors); i++)
+    {
+        for (uint32_t j = i; j < sizeof(factors); j++)
+        {
+            uint32_t steps = (factors[i] > 1) + (factors[j] > 1) + (*shift > 0);
+            if (factors[i] * factors[j] == c && steps <= 2 && steps > 0)
+            {
+                *first = factors[j];
+                *second = factors[i];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool any(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)l;
+    (void)inst;
+    (void)left;
+    (void)right;
+    return true;
+}
+
+static bool is_imm32(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)l;
+    (void)left;
+    (void)right;
+    return fits_imm32(inst->imm);
+}
+
+// a shift by 0 to 3 is a scale of 1, 2, 4 or 8
+static bool is_scale_shift(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)left;
+    return (const_imm(l, right) & shift_mask(inst)) <= 3;
+}
+
+static bool is_scale(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)inst;
+    (void)left;
+    int64_t c = const_imm(l, right);
+    return c == 1 || c == 2 || c == 4 || c == 8;
+}
+
+// x * c as x + x * (c - 1)
+static bool is_self_scale(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)inst;
+    (void)left;
+    int64_t c = const_imm(l, right);
+    return c == 2 || c == 3 || c == 5 || c == 9;
+}
+
+static bool is_negatable(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)inst;
+    (void)left;
+    return const_imm(l, right) != INT32_MIN;
+}
+
+static bool is_cheap_multiplier(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)inst;
+    (void)left;
+    uint8_t first;
+    uint8_t second;
+    uint32_t shift;
+    return cheap_multiplier(const_imm(l, right), &first, &second, &shift);
+}
+
+static bool is_bool(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    (void)l;
+    (void)left;
+    (void)right;
+    return inst->type == WACC_IR_TYPE_I1;
+}
+
+static bool is_integer(const Lower* l, const WaccIrInst* inst, WaccIrValue left, WaccIrValue right)
+{
+    return !is_bool(l, inst, left, right);
+}
+
+static WaccX86Operand value(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)l;
+    (void)rule;
+    (void)swapped;
+    (void)kids;
+    return wacc_x86_reg(vreg(v));
+}
+
+static WaccX86Operand immediate(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)rule;
+    (void)swapped;
+    (void)kids;
+    return wacc_x86_imm(const_imm(l, v));
+}
+
+static WaccX86Operand load_const(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)rule;
+    (void)swapped;
+    (void)kids;
+    return reg_operand(l, v);
+}
+
+static WaccX86Operand forward(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)l;
+    (void)v;
+    (void)rule;
+    (void)swapped;
+    return kids[0];
+}
+
+static WaccX86Operand as_index(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)l;
+    (void)v;
+    (void)rule;
+    (void)swapped;
+    return address(WACC_X86_NO_REG, kids[0].reg, 1, 0);
+}
+
+static WaccX86Operand scale_index(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)rule;
+    (void)swapped;
+    const WaccIrInst* inst = l->defs.ptr[v];
+    int64_t c = kids[1].imm;
+    uint8_t scale = inst->op == WACC_IR_SHL ? (uint8_t)(1 << (c & shift_mask(inst))) : (uint8_t)c;
+    return address(WACC_X86_NO_REG, kids[0].reg, scale, 0);
+}
+
+static WaccX86Operand as_base(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)l;
+    (void)v;
+    (void)rule;
+    (void)swapped;
+    return address(kids[0].reg, WACC_X86_NO_REG, 1, 0);
+}
+
+static WaccX86Operand base_index(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)l;
+    (void)v;
+    (void)rule;
+    (void)swapped;
+    return address(kids[0].reg, kids[1].mem.index, kids[1].mem.scale, 0);
+}
+
+static WaccX86Operand self_index(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)l;
+    (void)v;
+    (void)rule;
+    (void)swapped;
+    return address(kids[0].reg, kids[0].reg, (uint8_t)(kids[1].imm - 1), 0);
+}
+
+static WaccX86Operand displace(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)rule;
+    (void)swapped;
+    WaccX86Operand addr = kids[0];
+    addr.mem.disp = (int32_t)(l->defs.ptr[v]->op == WACC_IR_SUB ? -kids[1].imm : kids[1].imm);
+    return addr;
+}
+
+static WaccX86Operand lea(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)rule;
+    (void)swapped;
+    WaccX86Operand dst = wacc_x86_reg(vreg(v));
+    emit(l, WACC_X86_LEA, type_size(wacc_ir_value_type(l->ir, v)), dst, kids[0]);
+    return dst;
+}
+
+static WaccX86Operand alu(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)swapped;
+    uint8_t size = type_size(wacc_ir_value_type(l->ir, v));
+    WaccX86Operand dst = wacc_x86_reg(vreg(v));
+    emit(l, WACC_X86_MOV, size, dst, kids[0]);
+    emit(l, rule->opcode, size, dst, kids[1]);
+    return dst;
+}
+
+static WaccX86Operand multiply_const(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)rule;
+    (void)swapped;
+    uint8_t first;
+    uint8_t second;
+    uint32_t shift;
+    (void)cheap_multiplier(kids[1].imm, &first, &second, &shift);
+    uint8_t size = type_size(wacc_ir_value_type(l->ir, v));
+    uint32_t src = kids[0].reg;
+    WaccX86Operand dst = wacc_x86_reg(vreg(v));
+    if (first == 1)
+    {
+        emit(l, WACC_X86_MOV, size, dst, kids[0]);
+    }
+    else
+    {
+        emit(l, WACC_X86_LEA, size, dst, address(src, src, first - 1, 0));
+    }
+    if (second > 1)
+    {
+        emit(l, WACC_X86_LEA, size, dst, address(dst.reg, dst.reg, second - 1, 0));
+    }
+    if (shift > 0)
+    {
+        emit(l, WACC_X86_SHL, size, dst, wacc_x86_imm(shift));
+    }
+    return dst;
+}
+
+static WaccX86Operand shift(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)swapped;
+    const WaccIrInst* inst = l->defs.ptr[v];
+    uint8_t size = type_size(inst->type);
+    WaccX86Operand dst = wacc_x86_reg(vreg(v));
+    WaccX86Operand count = kids[1];
+    if (count.kind == WACC_X86_OPERAND_IMM)
+    {
+        // the hardware masks the count the same way
+        count.imm &= shift_mask(inst);
+    }
+    else
+    {
+        emit(l, WACC_X86_MOV, 4, wacc_x86_reg(WACC_X86_RCX), count);
+        count = wacc_x86_reg(WACC_X86_RCX);
+    }
+    emit(l, WACC_X86_MOV, size, dst, kids[0]);
+    emit(l, rule->opcode, size, dst, count);
+    return dst;
+}
+
+static WaccX86Operand unary(Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    (void)swapped;
+    uint8_t size = type_size(wacc_ir_value_type(l->ir, v));
+    WaccX86Operand dst = wacc_x86_reg(vreg(v));
+    emit(l, WACC_X86_MOV, size, dst, kids[0]);
+    // logical not of an i1 flips its only bit
+    emit(l, rule->opcode, size, dst, rule->opcode == WACC_X86_XOR ? wacc_x86_imm(1) : (WaccX86Operand){0});
+    return dst;
+}
+
+static WaccX86Operand compare(
+    Lower* l, WaccIrValue v, const Rule* rule, bool swapped, const WaccX86Operand kids[2])
+{
+    const WaccIrInst* inst = l->defs.ptr[v];
+    WaccX86Cond cond = compare_cond(inst->op);
+    if (swapped)
+    {
+        cond = swap_cond(cond);
+    }
+    emit(l, rule->opcode, type_size(wacc_ir_value_type(l->ir, inst->args[0])), kids[0], kids[1]);
+    uint32_t dst = vreg(v);
+    WaccX86Inst setcc = {.op = WACC_X86_SETCC, .size = 1, .cond = cond, .ops = {wacc_x86_reg(dst)}};
+    wacc_x86_append(l->function, l->block, setcc);
+    emit(l, WACC_X86_MOVZX8, 4, wacc_x86_reg(dst), wacc_x86_reg(dst));
+    return wacc_x86_reg(dst);
+}
+
+static const Rule rules[] = {
+#define X(x, nonterminal, operator, left, right, cost, predicate, action, opcode)                                     \
+    {NONTERMINAL_##nonterminal,                                                                                        \
+        OPERATOR_##operator,                                                                                           \
+        NONTERMINAL_##left,                                                                                            \
+        NONTERMINAL_##right,                                                                                           \
+        cost,                                                                                                          \
+        predicate,                                                                                                     \
+        action,                                                                                                        \
+        WACC_X86_##opcode},
+#include "wacc/x86/patterns.def"
+#undef X
+};
+
+enum
+{
+    NUM_RULES = sizeof(rules) / sizeof(rules[0]),
+};
+
+static bool rule_matches(const Rule* rule, WaccIrOpcode op)
+{
+    return (Operator)op == rule->operator ||
+        (rule->operator == OPERATOR_COMPARE && wacc_ir_has_flag(op, WACC_IR_COMPARE));
+}
+
+// whether instructions of `op` are selected through the rules
+static bool is_tree_operator(WaccIrOpcode op)
+{
+    if (op == WACC_IR_CONST)
+    {
+        return false;
+    }
+    for (uint32_t r = 0; r < NUM_RULES; r++)
+    {
+        if (rule_matches(&rules[r], op))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void label_init(Label* label)
+{
+    for (uint32_t n = 0; n < NUM_NONTERMINALS; n++)
+    {
+        label->cost[n] = NO_COST;
+    }
+}
+
+static void label_closure(Label* label)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint32_t r = 0; r < NUM_RULES; r++)
+        {
+            const Rule* rule = &rules[r];
+            if (rule->operator != OPERATOR_CHAIN || label->cost[rule->left] == NO_COST)
+            {
+                continue;
+            }
+            uint32_t cost = label->cost[rule->left] + rule->cost;
+            if (cost < label->cost[rule->nonterminal])
+            {
+                label->cost[rule->nonterminal] = cost;
+                label->rule[rule->nonterminal] = (uint8_t)r;
+                label->swapped[rule->nonterminal] = false;
+                changed = true;
+            }
+        }
+    }
+}
+
+// the label of a value computed outside the tree it is an operand of
+static void label_leaf(const Lower* l, WaccIrValue v, Label* label)
+{
+    label_init(label);
+    Operator op = is_const(l, v) ? OPERATOR_CONST : OPERATOR_LEAF;
+    for (uint32_t r = 0; r < NUM_RULES; r++)
+    {
+        const Rule* rule = &rules[r];
+        if (rule->operator == op && rule->cost < label->cost[rule->nonterminal] &&
+            rule->predicate(l, l->defs.ptr[v], WACC_IR_NO_VALUE, WACC_IR_NO_VALUE))
+        {
+            label->cost[rule->nonterminal] = rule->cost;
+            label->rule[rule->nonterminal] = (uint8_t)r;
+            label->swapped[rule->nonterminal] = false;
+        }
+    }
+    label_closure(label);
+}
+
+static const Label* operand_label(const Lower* l, WaccIrValue v, Label* leaf)
+{
+    if (l->folded.ptr[v])
+    {
+        return &l->labels.ptr[v];
+    }
+    label_leaf(l, v, leaf);
+    return leaf;
+}
+
+static void label_node(Lower* l, const WaccIrInst* inst)
+{
+    Label* label = &l->labels.ptr[inst->dest];
+    label_init(label);
+    bool swappable = wacc_ir_has_flag(inst->op, WACC_IR_COMMUTATIVE | WACC_IR_COMPARE);
+    for (uint32_t r = 0; r < NUM_RULES; r++)
+    {
+        const Rule* rule = &rules[r];
+        if (!rule_matches(rule, inst->op))
+        {
+            continue;
+        }
+        bool binary = rule->right != NONTERMINAL_NONE;
+        for (uint32_t o = 0; o < (binary && swappable ? 2 : 1); o++)
+        {
+            WaccIrValue left = inst->args[o];
+            WaccIrValue right = binary ? inst->args[1 - o] : WACC_IR_NO_VALUE;
+            Label left_leaf;
+            Label right_leaf;
+            uint32_t left_cost = operand_label(l, left, &left_leaf)->cost[rule->left];
+            uint32_t right_cost = binary ? operand_label(l, right, &right_leaf)->cost[rule->right] : 0;
+            if (left_cost == NO_COST || right_cost == NO_COST)
+            {
+                continue;
+            }
+            uint32_t cost = rule->cost + left_cost + right_cost;
+            if (cost < label->cost[rule->nonterminal] && rule->predicate(l, inst, left, right))
+            {
+                label->cost[rule->nonterminal] = cost;
+                label->rule[rule->nonterminal] = (uint8_t)r;
+                label->swapped[rule->nonterminal] = o == 1;
+            }
+        }
+    }
+    label_closure(label);
+}
+
+static WaccX86Operand reduce_label(Lower* l, WaccIrValue v, const Label* label, Nonterminal nonterminal);
+
+static WaccX86Operand reduce(Lower* l, WaccIrValue v, Nonterminal nonterminal)
+{
+    Label leaf;
+    return reduce_label(l, v, operand_label(l, v, &leaf), nonterminal);
+}
+
+static WaccX86Operand reduce_label(Lower* l, WaccIrValue v, const Label* label, Nonterminal nonterminal)
+{
+    if (label->cost[nonterminal] == NO_COST)
+    {
+        abort();
+    }
+    const Rule* rule = &rules[label->rule[nonterminal]];
+    bool swapped = label->swapped[nonterminal];
+    WaccX86Operand kids[2] = {0};
+    if (rule->operator == OPERATOR_CHAIN)
+    {
+        kids[0] = reduce_label(l, v, label, rule->left);
+    }
+    else if (rule->left != NONTERMINAL_NONE)
+    {
+        const WaccIrInst* inst = l->defs.ptr[v];
+        kids[0] = reduce(l, inst->args[swapped ? 1 : 0], rule->left);
+        if (rule->right != NONTERMINAL_NONE)
+        {
+            kids[1] = reduce(l, inst->args[swapped ? 0 : 1], rule->right);
+        }
+    }
+    return rule->action(l, v, rule, swapped, kids);
+}
+
+// Decide which values become inner nodes and label every tree operator; an
+// operand's label is final before its user's since both are in one block.
+static void label_function(Lower* l)
+{
+    WaccIrUses uses;
+    wacc_ir_uses_build(l->ir, &uses);
+    uint64_t num_values = l->ir->value_types.len;
+    BUF_RESERVE(&l->folded, num_values);
+    memset(l->folded.ptr, 0, num_values * sizeof(bool));
+    l->folded.len = num_values;
+    BUF_RESERVE(&l->labels, num_values);
+    l->labels.len = num_values;
+    for (WaccIrValue v = 1; v < num_values; v++)
+    {
+        const WaccIrInst* def = l->defs.ptr[v];
+        if (def == NULL || !is_tree_operator(def->op) || uses.start.ptr[v + 1] - uses.start.ptr[v] != 1)
+        {
+            continue;
+        }
+        WaccIrInstRef user = uses.users.ptr[uses.start.ptr[v]];
+        WaccIrInstRef at = uses.defs.ptr[v];
+        l->folded.ptr[v] =
+            user.block == at.block && is_tree_operator(l->ir->blocks.ptr[user.block].insts.ptr[user.index].op);
+    }
+    for (uint64_t b = 0; b < l->ir->blocks.len; b++)
+    {
+        const WaccIrInstBuf* insts = &l->ir->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            if (is_tree_operator(insts->ptr[i].op))
+            {
+                label_node(l, &insts->ptr[i]);
+            }
+        }
+    }
+    wacc_ir_uses_free(&uses);
+}
+
+static void lower_multiply_high(Lower* l, const WaccIrInst* inst)
+{
+    uint8_t size = type_size(inst->type);
+    WaccIrValue a = inst->args[0];
+    WaccIrValue b = inst->args[1];
+    if (is_const(l, b) && !is_const(l, a))
+    {
+        WaccIrValue tmp = a;
+        a = b;
+        b = tmp;
+    }
+    WaccX86Operand factor = reg_operand(l, b);
+    emit(l, WACC_X86_MOV, size, wacc_x86_reg(WACC_X86_RAX), src_operand(l, a));
+    emit(l,
+        inst->op == WACC_IR_SMULH ? WACC_X86_IMUL_WIDE : WACC_X86_MUL_WIDE,
+        size,
+        factor,
+        (WaccX86Operand){0});
+    emit(l, WACC_X86_MOV, size, wacc_x86_reg(vreg(inst->dest)), wacc_x86_reg(WACC_X86_RDX));
+}
+
+static void lower_division(Lower* l, const WaccIrInst* inst)
+{
+    uint8_t size = type_size(inst->type);
+    bool is_signed = inst->op == WACC_IR_SDIV || inst->op == WACC_IR_SREM;
+    bool is_rem = inst->op == WACC_IR_SREM || inst->op == WACC_IR_UREM;
+    WaccX86Operand divisor = reg_operand(l, inst->args[1]);
+    emit(l, WACC_X86_MOV, size, wacc_x86_reg(WACC_X86_RAX), src_operand(l, inst->args[0]));
+    if (is_signed)
+    {
+        emit(l, WACC_X86_CDQ, size, (WaccX86Operand){0}, (WaccX86Operand){0});
+    }
+    else
+    {
+        emit(l, WACC_X86_MOV, size, wacc_x86_reg(WACC_X86_RDX), wacc_x86_imm(0));
+    }
+    emit(l, is_signed ? WACC_X86_IDIV : WACC_X86_DIV, size, divisor, (WaccX86Operand){0});
+    emit(l,
+        WACC_X86_MOV,
+        size,
+        wacc_x86_reg(vreg(inst->dest)),
+        wacc_x86_reg(is_rem ? WACC_X86_RDX : WACC_X86_RAX));
+}
+
+static void lower_convert(Lower* l, const WaccIrInst* inst)
+{
+    WaccX86Operand dst = wacc_x86_reg(vreg(inst->dest));
+    WaccIrType from = wacc_ir_value_type(l->ir, inst->args[0]);
+    if (inst->op == WACC_IR_SEXT && from == WACC_IR_TYPE_I32)
+    {
+        emit(l, WACC_X86_MOVSX, 8, dst, reg_operand(l, inst->args[0]));
+        return;
+    }
+    if (inst->op == WACC_IR_ZEXT && from == WACC_IR_TYPE_I32)
+    {
+        emit(l, WACC_X86_MOVZX32, 4, dst, reg_operand(l, inst->args[0]));
+        return;
+    }
+    // i1 values are already 0 or 1 in the whole register
+    emit(l, WACC_X86_MOV, from == WACC_IR_TYPE_I64 ? 4 : type_size(from), dst, src_operand(l, inst->args[0]));
+    if (inst->op == WACC_IR_SEXT && from == WACC_IR_TYPE_I1)
+    {
+        emit(l, WACC_X86_NEG, type_size(inst->type), dst, (WaccX86Operand){0});
+    }
+    else if (inst->op == WACC_IR_TRUNC && inst->type == WACC_IR_TYPE_I1)
+    {
+        emit(l, WACC_X86_AND, 4, dst, wacc_x86_imm(1));
+    }
+}
+
+static void lower_call(Lower* l, const WaccIrInst* inst)
+{
+    const WaccIrOperand* args = wacc_ir_operands(l->ir, inst);
+    uint32_t num_reg_args = inst->count < 6 ? inst->count : 6;
+    uint32_t num_stack_args = inst->count - num_reg_args;
+    // the stack stays 16-byte aligned at the call
+    int64_t stack_bytes = 8 * (int64_t)(num_stack_args + num_stack_args % 2);
+    if (num_stack_args % 2 != 0)
+    {
+        emit(l, WACC_X86_SUB, 8, wacc_x86_reg(WACC_X86_RSP), wacc_x86_imm(8));
+    }
+    for (uint32_t i = inst->count; i > num_reg_args; i--)
+    {
+        emit(l, WACC_X86_PUSH, 8, src_operand(l, args[i - 1].value), (WaccX86Operand){0});
+    }
+    for (uint32_t i = 0; i < num_reg_args; i++)
+    {
+        WaccIrType type = wacc_ir_value_type(l->ir, args[i].value);
+        emit(l, WACC_X86_MOV, type_size(type), wacc_x86_reg(wacc_x86_arg_regs[i]), src_operand(l, args[i].value));
+    }
+    wacc_x86_append(l->function,
+        l->block,
+        (WaccX86Inst){
+            .op = WACC_X86_CALL,
+            .num_args = (uint8_t)num_reg_args,
+            .has_value = inst->dest != WACC_IR_NO_VALUE,
+            .ops = {{.kind = WACC_X86_OPERAND_FUNC, .func = (uint32_t)inst->imm}},
+        });
+    if (stack_bytes > 0)
+    {
+        emit(l, WACC_X86_ADD, 8, wacc_x86_reg(WACC_X86_RSP), wacc_x86_imm(stack_bytes));
+    }
+    if (inst->dest != WACC_IR_NO_VALUE)
+    {
+        emit(l, WACC_X86_MOV, type_size(inst->type), wacc_x86_reg(vreg(inst->dest)), wacc_x86_reg(WACC_X86_RAX));
+    }
+}
+
+typedef struct
+{
+    uint32_t dst;
+    WaccIrValue src;
+    uint8_t size;
+} PhiMove;
+
+typedef BUF(PhiMove) PhiMoveBuf;
+
+// the moves of the phis of `to` for the edge from `from`, as a parallel copy
+static void lower_phi_moves(Lower* l, WaccIrBlockId from, WaccIrBlockId to)
+{
+    const WaccIrBlock* block = &l->ir->blocks.ptr[to];
+    PhiMoveBuf moves = BUF_NEW;
+    for (uint64_t i = 0; i < block->insts.len && block->insts.ptr[i].op == WACC_IR_PHI; i++)
+    {
+        const WaccIrInst* phi = &block->insts.ptr[i];
+        const WaccIrOperand* operands = wacc_ir_operands(l->ir, phi);
+        for (uint32_t j = 0; j < phi->count; j++)
+        {
+            if (operands[j].block == from && operands[j].value != phi->dest)
+            {
+                BUF_PUSH(&moves, ((PhiMove){vreg(phi->dest), operands[j].value, type_size(phi->type)}));
+                break;
+            }
+        }
+    }
+
+    // Register moves first: a move may go ahead once no other pending move
+    // still reads its destination; a cycle is broken by saving one
+    // destination in a temporary.
+    BUF(uint32_t) srcs = BUF_NEW;
+    BUF(bool) done = BUF_NEW;
+    for (uint64_t i = 0; i < moves.len; i++)
+    {
+        BUF_PUSH(&srcs, is_const(l, moves.ptr[i].src) ? WACC_X86_NO_REG : vreg(moves.ptr[i].src));
+        BUF_PUSH(&done, srcs.ptr[i] == WACC_X86_NO_REG);
+    }
+    for (;;)
+    {
+        bool progress = false;
+        for (uint64_t i = 0; i < moves.len; i++)
+        {
+            if (done.ptr[i])
+            {
+                continue;
+            }
+            bool blocked = false;
+            for (uint64_t j = 0; j < moves.len && !blocked; j++)
+            {
+                blocked = j != i && !done.ptr[j] && srcs.ptr[j] == moves.ptr[i].dst;
+            }
+            if (!blocked)
+            {
+                emit(l, WACC_X86_MOV, moves.ptr[i].size, wacc_x86_reg(moves.ptr[i].dst), wacc_x86_reg(srcs.ptr[i]));
+                done.ptr[i] = true;
+                progress = true;
+            }
+        }
+        uint64_t pending = 0;
+        while (pending < moves.len && done.ptr[pending])
+        {
+            pending++;
+        }
+        if (pending == moves.len)
+        {
+            break;
+        }
+        if (!progress)
+        {
+            uint32_t saved = moves.ptr[pending].dst;
+            uint32_t tmp = wacc_x86_vreg_new(l->function);
+            emit(l, WACC_X86_MOV, 8, wacc_x86_reg(tmp), wacc_x86_reg(saved));
+            for (uint64_t j = 0; j < moves.len; j++)
+            {
+                if (!done.ptr[j] && srcs.ptr[j] == saved)
+                {
+                    srcs.ptr[j] = tmp;
+                }
+            }
+        }
+    }
+    for (uint64_t i = 0; i < moves.len; i++)
+    {
+        if (srcs.ptr[i] == WACC_X86_NO_REG)
+        {
+            emit(l,
+                WACC_X86_MOV,
+                moves.ptr[i].size,
+                wacc_x86_reg(moves.ptr[i].dst),
+                wacc_x86_imm(l->defs.ptr[moves.ptr[i].src]->imm));
+        }
+    }
+    BUF_FREE(done);
+    BUF_FREE(srcs);
+    BUF_FREE(moves);
+}
+
+static bool has_phis(const Lower* l, WaccIrBlockId block)
+{
+    const WaccIrInstBuf* insts = &l->ir->blocks.ptr[block].insts;
+    return insts->len > 0 && insts->ptr[0].op == WACC_IR_PHI;
+}
+
+// the MIR block a conditional branch from `from` to `to` jumps to, splitting
+// the edge if it needs phi moves
+static uint32_t edge_target(Lower* l, WaccIrBlockId from, WaccIrBlockId to)
+{
+    if (!has_phis(l, to))
+    {
+        return l->block_map.ptr[to];
+    }
+    uint32_t saved = l->block;
+    l->block = wacc_x86_block_new(l->function);
+    uint32_t edge = l->block;
+    l->function->blocks.ptr[edge].count = wacc_ir_edge_count(l->ir, from, to);
+    lower_phi_moves(l, from, to);
+    emit(l, WACC_X86_JMP, 0, wacc_x86_block(l->block_map.ptr[to]), (WaccX86Operand){0});
+    l->block = saved;
+    return edge;
+}
+
+static void emit_jcc(Lower* l, WaccX86Cond cond, uint32_t target)
+{
+    wacc_x86_append(l->function,
+        l->block,
+        (WaccX86Inst){.op = WACC_X86_JCC, .cond = cond, .ops = {wacc_x86_block(target)}});
+}
+
+static void lower_terminator(Lower* l, WaccIrBlockId block, const WaccIrInst* inst)
+{
+    uint32_t next = l->block + 1;
+    switch (inst->op)
+    {
+        case WACC_IR_BR:
+            lower_phi_moves(l, block, inst->targets[0]);
+            if (l->block_map.ptr[inst->targets[0]] != next)
+            {
+                emit(l, WACC_X86_JMP, 0, wacc_x86_block(l->block_map.ptr[inst->targets[0]]), (WaccX86Operand){0});
+            }
+            break;
+        case WACC_IR_CBR:
+        {
+            WaccIrBlockId taken = inst->targets[0];
+            if (inst->targets[0] != inst->targets[1] && is_const(l, inst->args[0]))
+            {
+                taken = inst->targets[l->defs.ptr[inst->args[0]]->imm != 0 ? 0 : 1];
+            }
+            if (inst->targets[0] == inst->targets[1] || is_const(l, inst->args[0]))
+            {
+                lower_phi_moves(l, block, taken);
+                if (l->block_map.ptr[taken] != next)
+                {
+                    emit(l, WACC_X86_JMP, 0, wacc_x86_block(l->block_map.ptr[taken]), (WaccX86Operand){0});
+                }
+                break;
+            }
+            uint32_t if_true = edge_target(l, block, inst->targets[0]);
+            uint32_t if_false = edge_target(l, block, inst->targets[1]);
+            WaccX86Operand cond = reg_operand(l, inst->args[0]);
+            emit(l, WACC_X86_TEST, type_size(inst->type), cond, cond);
+            if (if_true == next)
+            {
+                emit_jcc(l, WACC_X86_COND_E, if_false);
+                break;
+            }
+            emit_jcc(l, WACC_X86_COND_NE, if_true);
+            if (if_false != next)
+            {
+                emit(l, WACC_X86_JMP, 0, wacc_x86_block(if_false), (WaccX86Operand){0});
+            }
+            break;
+        }
+        case WACC_IR_RET:
+        {
+            bool has_value = inst->args[0] != WACC_IR_NO_VALUE;
+            if (has_value)
+            {
+                emit(l, WACC_X86_MOV, type_size(inst->type), wacc_x86_reg(WACC_X86_RAX), src_operand(l, inst->args[0]));
+            }
+            wacc_x86_append(l->function, l->block, (WaccX86Inst){.op = WACC_X86_RET, .has_value = has_value});
+            break;
+        }
+        default:
+            abort();
+    }
+}
+
+static void lower_inst(Lower* l, const WaccIrInst* inst)
+{
+    switch (inst->op)
+    {
+        case WACC_IR_NOP:
+        case WACC_IR_CONST:
+        case WACC_IR_PARAM:
+        case WACC_IR_PHI:
+            break;
+        case WACC_IR_COPY:
+            emit(l, WACC_X86_MOV, type_size(inst->type), wacc_x86_reg(vreg(inst->dest)), src_operand(l, inst->args[0]));
+            break;
+        case WACC_IR_SMULH:
+        case WACC_IR_UMULH:
+            lower_multiply_high(l, inst);
+            break;
+        case WACC_IR_SDIV:
+        case WACC_IR_UDIV:
+        case WACC_IR_SREM:
+        case WACC_IR_UREM:
+            lower_division(l, inst);
+            break;
+        case WACC_IR_SEXT:
+        case WACC_IR_ZEXT:
+        case WACC_IR_TRUNC:
+            lower_convert(l, inst);
+            break;
+        case WACC_IR_CALL:
+            lower_call(l, inst);
+            break;
+        case WACC_IR_COUNT:
+            emit(l,
+                WACC_X86_ADD,
+                8,
+                (WaccX86Operand){.kind = WACC_X86_OPERAND_COUNTER, .counter = (uint32_t)inst->imm},
+                wacc_x86_imm(1));
+            break;
+        default:
+            // inner nodes are emitted with the root of their tree
+            if (!l->folded.ptr[inst->dest])
+            {
+                (void)reduce_label(l, inst->dest, &l->labels.ptr[inst->dest], NONTERMINAL_REG);
+            }
+            break;
+    }
+}
+
+// copy the parameters out of the argument registers before anything can
+// overwrite them
+static void lower_params(Lower* l)
+{
+    for (uint64_t b = 0; b < l->ir->blocks.len; b++)
+    {
+        const WaccIrInstBuf* insts = &l->ir->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            const WaccIrInst* inst = &insts->ptr[i];
+            if (inst->op != WACC_IR_PARAM)
+            {
+                continue;
+            }
+            WaccX86Operand src;
+            if (inst->imm < 6)
+            {
+                src = wacc_x86_reg(wacc_x86_arg_regs[inst->imm]);
+            }
+            else
+            {
+                // above the saved %rbp and the return address
+                src = (WaccX86Operand){
+                    .kind = WACC_X86_OPERAND_MEM,
+                    .mem = {WACC_X86_RBP, WACC_X86_NO_REG, 1, (int32_t)(16 + 8 * (inst->imm - 6))},
+                };
+            }
+            emit(l, WACC_X86_MOV, type_size(inst->type), wacc_x86_reg(vreg(inst->dest)), src);
+        }
+    }
+}
+
+// attribute the instructions of the current block from `first` on to `line`
+static void set_line(Lower* l, uint64_t first, uint32_t line)
+{
+    WaccX86InstBuf* insts = &l->function->blocks.ptr[l->block].insts;
+    for (uint64_t i = first; i < insts->len; i++)
+    {
+        insts->ptr[i].line = line;
+    }
+}
+
+// Lay the blocks of a profiled function out in chains: a chain goes on from
+// its last block to the successor it went to most often, unless that one is
+// placed already, and the next chain starts at the first block of `order`
+// that ran and is not placed yet. The entry comes first whatever its count.
+static void chain_blocks(const WaccIrFunction* ir, WaccIrBlockIdBuf* order)
+{
+    BUF(bool) placed = BUF_NEW;
+    BUF_RESERVE(&placed, ir->blocks.len);
+    memset(placed.ptr, 0, ir->blocks.len * sizeof(bool));
+    placed.len = ir->blocks.len;
+    WaccIrBlockIdBuf chains = BUF_NEW;
+    for (uint64_t k = 0; k < order->len; k++)
+    {
+        WaccIrBlockId b = order->ptr[k];
+        if (placed.ptr[b] || (k > 0 && ir->blocks.ptr[b].count == 0))
+        {
+            continue;
+        }
+        while (b != WACC_IR_NO_BLOCK)
+        {
+            placed.ptr[b] = true;
+            BUF_PUSH(&chains, b);
+            WaccIrBlockId succs[2];
+            uint32_t n = wacc_ir_successors(&ir->blocks.ptr[b], succs);
+            WaccIrBlockId next = WACC_IR_NO_BLOCK;
+            uint64_t best = 0;
+            for (uint32_t s = 0; s < n; s++)
+            {
+                uint64_t count = wacc_ir_edge_count(ir, b, succs[s]);
+                if (!placed.ptr[succs[s]] && count > best)
+                {
+                    next = succs[s];
+                    best = count;
+                }
+            }
+            b = next;
+        }
+    }
+    // the cold blocks, in their order
+    for (uint64_t k = 0; k < order->len; k++)
+    {
+        if (!placed.ptr[order->ptr[k]])
+        {
+            BUF_PUSH(&chains, order->ptr[k]);
+        }
+    }
+    memcpy(order->ptr, chains.ptr, chains.len * sizeof(WaccIrBlockId));
+    BUF_FREE(chains);
+    BUF_FREE(placed);
+}
+
+void wacc_x86_lower_function(WaccX86Function* function, const WaccIrFunction* ir)
+{
+    function->exported = ir->exported;
+    function->line = ir->line;
+    function->profiled = ir->profiled;
+    for (uint64_t v = 0; v < ir->value_types.len; v++)
+    {
+        (void)wacc_x86_vreg_new(function);
+    }
+    Lower l = {
+        .ir = ir,
+        .function = function,
+        .block_map = BUF_NEW,
+        .defs = BUF_NEW,
+        .folded = BUF_NEW,
+        .labels = BUF_NEW,
+    };
+    BUF_RESERVE(&l.defs, ir->value_types.len);
+    memset(l.defs.ptr, 0, ir->value_types.len * sizeof(const WaccIrInst*));
+    l.defs.len = ir->value_types.len;
+    for (uint64_t b = 0; b < ir->blocks.len; b++)
+    {
+        const WaccIrInstBuf* insts = &ir->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            if (insts->ptr[i].dest != WACC_IR_NO_VALUE)
+            {
+                l.defs.ptr[insts->ptr[i].dest] = &insts->ptr[i];
+            }
+        }
+        BUF_PUSH(&l.block_map, WACC_X86_NO_REG);
+    }
+    label_function(&l);
+
+    WaccIrBlockIdBuf order = BUF_NEW;
+    wacc_ir_reverse_postorder(ir, &order);
+    if (ir->profiled)
+    {
+        chain_blocks(ir, &order);
+    }
+    for (uint64_t i = 0; i < order.len; i++)
+    {
+        l.block_map.ptr[order.ptr[i]] = wacc_x86_block_new(function);
+        function->blocks.ptr[l.block_map.ptr[order.ptr[i]]].count = ir->blocks.ptr[order.ptr[i]].count;
+    }
+    l.block = 0;
+    lower_params(&l);
+    for (uint64_t i = 0; i < order.len; i++)
+    {
+        WaccIrBlockId b = order.ptr[i];
+        l.block = l.block_map.ptr[b];
+        const WaccIrInstBuf* insts = &ir->blocks.ptr[b].insts;
+        for (uint64_t j = 0; j + 1 < insts->len; j++)
+        {
+            uint64_t first = function->blocks.ptr[l.block].insts.len;
+            lower_inst(&l, &insts->ptr[j]);
+            set_line(&l, first, insts->ptr[j].line);
+        }
+        uint64_t first = function->blocks.ptr[l.block].insts.len;
+        lower_terminator(&l, b, &insts->ptr[insts->len - 1]);
+        set_line(&l, first, insts->ptr[insts->len - 1].line);
+    }
+
+    BUF_FREE(order);
+    BUF_FREE(l.labels);
+    BUF_FREE(l.folded);
+    BUF_FREE(l.defs);
+    BUF_FREE(l.block_map);
+}
+
+WaccX86Module* wacc_x86_lower(const WaccIrModule* ir, const Allocator* alloc)
+{
+    WaccX86Module* module = wacc_x86_module_new(alloc);
+    module->ir = ir;
+    for (uint64_t i = 0; i < ir->functions.len; i++)
+    {
+        const WaccIrFunction* function = ir->functions.ptr[i];
+        wacc_x86_lower_function(wacc_x86_function_new(module, str_ref(function->name)), function);
+    }
+    return module;
+}
@@ -0,0 +1,181 @@
+#include "wacc/x86.h"
+
+const WaccX86RegInfo wacc_x86_regs[] = {
+#define X(x, name64, name32, name8, preserved) {name64, name32, name8, preserved},
+#include "wacc/x86/regs.def"
+#undef X
+};
+
+const WaccX86Reg wacc_x86_arg_regs[6] = {
+    WACC_X86_RDI,
+    WACC_X86_RSI,
+    WACC_X86_RDX,
+    WACC_X86_RCX,
+    WACC_X86_R8,
+    WACC_X86_R9,
+};
+
+const char* const wacc_x86_cond_suffixes[] = {
+#define X(x, suffix, code) suffix,
+#include "wacc/x86/conds.def"
+#undef X
+};
+
+const WaccX86OpcodeInfo wacc_x86_opcodes[] = {
+#define X(x, mnemonic, flags) {mnemonic, flags},
+#include "wacc/x86/opcodes.def"
+#undef X
+};
+
+enum
+{
+    FUNCTION_ARENA_CHUNK_SIZE = 4096,
+};
+
+#define REG_BIT(reg) (UINT32_C(1) << (reg))
+
+WaccX86Module* wacc_x86_module_new(const Allocator* alloc)
+{
+    WaccX86Module* module = allocator_alloc(alloc, sizeof(WaccX86Module));
+    if (module == NULL)
+    {
+        allocator_oom();
+    }
+    module->functions = (WaccX86FunctionBuf)BUF_NEW_IN(alloc);
+    module->ir = NULL;
+    module->source = str_null;
+    module->alloc = alloc;
+    return module;
+}
+
+void wacc_x86_module_free(WaccX86Module* module)
+{
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        arena_free(&module->functions.ptr[i]->arena);
+        allocator_free(module->alloc, module->functions.ptr[i]);
+    }
+    BUF_FREE(module->functions);
+    allocator_free(module->alloc, module);
+}
+
+WaccX86Function* wacc_x86_function_new(WaccX86Module* module, str name)
+{
+    WaccX86Function* function = allocator_alloc(module->alloc, sizeof(WaccX86Function));
+    if (function == NULL)
+    {
+        allocator_oom();
+    }
+    *function = (WaccX86Function){
+        .name = name,
+        .exported = true,
+        .num_regs = WACC_X86_FIRST_VREG,
+    };
+    arena_init(&function->arena, FUNCTION_ARENA_CHUNK_SIZE);
+    function->alloc = arena_allocator(&function->arena);
+    function->blocks = (WaccX86BlockBuf)BUF_NEW_IN(&function->alloc);
+    function->unspillable = (__typeof__(function->unspillable))BUF_NEW_IN(&function->alloc);
+    BUF_RESERVE(&function->unspillable, WACC_X86_FIRST_VREG);
+    for (uint32_t r = 0; r < WACC_X86_FIRST_VREG; r++)
+    {
+        BUF_PUSH(&function->unspillable, true);
+    }
+    BUF_PUSH(&module->functions, function);
+    return function;
+}
+
+uint32_t wacc_x86_block_new(WaccX86Function* function)
+{
+    WaccX86Block block = {.insts = BUF_NEW_IN(&function->alloc)};
+    BUF_PUSH(&function->blocks, block);
+    return (uint32_t)(function->blocks.len - 1);
+}
+
+uint32_t wacc_x86_vreg_new(WaccX86Function* function)
+{
+    BUF_PUSH(&function->unspillable, false);
+    return function->num_regs++;
+}
+
+uint32_t wacc_x86_slot_new(WaccX86Function* function)
+{
+    return function->num_slots++;
+}
+
+void wacc_x86_append(WaccX86Function* function, uint32_t block, WaccX86Inst inst)
+{
+    BUF_PUSH(&function->blocks.ptr[block].insts, inst);
+}
+
+void wacc_x86_implicit_regs(const WaccX86Inst* inst, uint32_t* uses, uint32_t* defs)
+{
+    *uses = 0;
+    *defs = 0;
+    switch (inst->op)
+    {
+        case WACC_X86_CDQ:
+            *uses = REG_BIT(WACC_X86_RAX);
+            *defs = REG_BIT(WACC_X86_RDX);
+            break;
+        case WACC_X86_IMUL_WIDE:
+        case WACC_X86_MUL_WIDE:
+            *uses = REG_BIT(WACC_X86_RAX);
+            *defs = REG_BIT(WACC_X86_RAX) | REG_BIT(WACC_X86_RDX);
+            break;
+        case WACC_X86_IDIV:
+        case WACC_X86_DIV:
+            *uses = REG_BIT(WACC_X86_RAX) | REG_BIT(WACC_X86_RDX);
+            *defs = REG_BIT(WACC_X86_RAX) | REG_BIT(WACC_X86_RDX);
+            break;
+        case WACC_X86_CALL:
+            for (uint32_t i = 0; i < inst->num_args; i++)
+            {
+                *uses |= REG_BIT(wacc_x86_arg_regs[i]);
+            }
+            // every register the callee may change
+            for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+            {
+                if (!wacc_x86_regs[r].preserved)
+                {
+                    *defs |= REG_BIT(r);
+                }
+            }
+            break;
+        case WACC_X86_RET:
+            if (inst->has_value)
+            {
+                *uses = REG_BIT(WACC_X86_RAX);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+uint32_t wacc_x86_successors(const WaccX86Function* function, uint32_t block, uint32_t out[2])
+{
+    const WaccX86InstBuf* insts = &function->blocks.ptr[block].insts;
+    uint32_t n = 0;
+    bool falls_through = true;
+    for (uint64_t i = 0; i < insts->len; i++)
+    {
+        const WaccX86Inst* inst = &insts->ptr[i];
+        if (inst->op == WACC_X86_JMP || inst->op == WACC_X86_JCC)
+        {
+            if (n == 0 || out[0] != inst->ops[0].block)
+            {
+                out[n++] = inst->ops[0].block;
+            }
+            falls_through = inst->op == WACC_X86_JCC;
+        }
+        else if (inst->op == WACC_X86_RET)
+        {
+            falls_through = false;
+        }
+    }
+    if (falls_through && block + 1 < function->blocks.len && (n == 0 || out[0] != block + 1))
+    {
+        out[n++] = block + 1;
+    }
+    return n;
+}
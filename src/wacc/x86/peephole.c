@@ -0,0 +1,346 @@
+#include "wacc/x86.h"
+
+// Peephole rewriting over the final instructions of a function.
+//
+// Each block is rewritten into a fresh instruction list: at every position the
+// rules of wacc/x86/peephole.def are tried in order, and the first one whose
+// opcode pattern matches and whose conditions hold replaces the matched
+// instructions. Blocks are rewritten until no rule fires, so one rewrite can
+// expose another.
+//
+// Rules that delete a register write consult the hardware registers live after
+// each instruction. Liveness is computed once per function; rewriting only ever
+// removes uses, so the sets stay conservative.
+
+#define REG_BIT(reg) (UINT32_C(1) << (reg))
+
+enum
+{
+    MAX_PATTERN = 5,
+};
+
+typedef BUF(uint32_t) MaskBuf;
+
+typedef struct
+{
+    const WaccX86InstBuf* insts;
+    // index of the first matched instruction in `insts`
+    uint64_t index;
+    // registers live after each instruction of `insts`
+    const MaskBuf* live_after;
+} Peephole;
+
+typedef bool (*PeepholeFunc)(const Peephole* p, const WaccX86Inst* window, WaccX86InstBuf* out);
+
+typedef struct
+{
+    PeepholeFunc rule;
+    WaccX86Opcode pattern[MAX_PATTERN];
+    uint32_t length;
+} PeepholeRule;
+
+// registers `inst` reads and writes, operands and implicit ones alike
+static void inst_regs(const WaccX86Inst* inst, uint32_t* uses, uint32_t* defs)
+{
+    wacc_x86_implicit_regs(inst, uses, defs);
+    for (uint32_t k = 0; k < 2; k++)
+    {
+        const WaccX86Operand* op = &inst->ops[k];
+        if (op->kind == WACC_X86_OPERAND_REG)
+        {
+            if (wacc_x86_has_flag(inst->op, k == 0 ? WACC_X86_USE0 : WACC_X86_USE1))
+            {
+                *uses |= REG_BIT(op->reg);
+            }
+            if (k == 0 && wacc_x86_has_flag(inst->op, WACC_X86_DEF0))
+            {
+                *defs |= REG_BIT(op->reg);
+            }
+        }
+        else if (op->kind == WACC_X86_OPERAND_MEM)
+        {
+            *uses |= REG_BIT(op->mem.base);
+            if (op->mem.index != WACC_X86_NO_REG)
+            {
+                *uses |= REG_BIT(op->mem.index);
+            }
+        }
+    }
+    if (inst->op == WACC_X86_PUSH || inst->op == WACC_X86_POP || inst->op == WACC_X86_CALL)
+    {
+        *uses |= REG_BIT(WACC_X86_RSP);
+    }
+    if (inst->op == WACC_X86_RET)
+    {
+        // the caller expects its values back in the callee-saved registers
+        for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+        {
+            if (wacc_x86_regs[r].preserved)
+            {
+                *uses |= REG_BIT(r);
+            }
+        }
+    }
+}
+
+static void compute_live_out(const WaccX86Function* function, MaskBuf* live_out)
+{
+    uint64_t num_blocks = function->blocks.len;
+    MaskBuf live_in = BUF_NEW;
+    BUF_RESERVE(&live_in, num_blocks);
+    BUF_RESERVE(live_out, num_blocks);
+    for (uint64_t b = 0; b < num_blocks; b++)
+    {
+        BUF_PUSH(&live_in, 0);
+        BUF_PUSH(live_out, 0);
+    }
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint64_t b = num_blocks; b-- > 0;)
+        {
+            uint32_t succs[2];
+            uint32_t num_succs = wacc_x86_successors(function, (uint32_t)b, succs);
+            uint32_t live = 0;
+            for (uint32_t s = 0; s < num_succs; s++)
+            {
+                live |= live_in.ptr[succs[s]];
+            }
+            live_out->ptr[b] = live;
+            const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+            for (uint64_t i = insts->len; i-- > 0;)
+            {
+                uint32_t uses;
+                uint32_t defs;
+                inst_regs(&insts->ptr[i], &uses, &defs);
+                live = (live & ~defs) | uses;
+            }
+            if (live != live_in.ptr[b])
+            {
+                live_in.ptr[b] = live;
+                changed = true;
+            }
+        }
+    }
+    BUF_FREE(live_in);
+}
+
+static void compute_live_after(const WaccX86InstBuf* insts, uint32_t live_out, MaskBuf* live_after)
+{
+    live_after->len = 0;
+    BUF_RESERVE(live_after, insts->len);
+    live_after->len = insts->len;
+    uint32_t live = live_out;
+    for (uint64_t i = insts->len; i-- > 0;)
+    {
+        live_after->ptr[i] = live;
+        uint32_t uses;
+        uint32_t defs;
+        inst_regs(&insts->ptr[i], &uses, &defs);
+        live = (live & ~defs) | uses;
+    }
+}
+
+// whether an instruction after position `index` reads the flags before they
+// are written again; the lowering never keeps flags live across blocks
+static bool flags_live_after(const Peephole* p, uint64_t index)
+{
+    for (uint64_t i = index + 1; i < p->insts->len; i++)
+    {
+        WaccX86Opcode op = p->insts->ptr[i].op;
+        if (wacc_x86_has_flag(op, WACC_X86_READS_FLAGS))
+        {
+            return true;
+        }
+        if (wacc_x86_has_flag(op, WACC_X86_FLAGS))
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool is_reg(const WaccX86Operand* op, uint32_t reg)
+{
+    return op->kind == WACC_X86_OPERAND_REG && op->reg == reg;
+}
+
+// mov %r, %r
+static bool self_move(const Peephole* p, const WaccX86Inst* window, WaccX86InstBuf* out)
+{
+    (void)p;
+    (void)out;
+    return window[0].ops[0].kind == WACC_X86_OPERAND_REG && is_reg(&window[0].ops[1], window[0].ops[0].reg);
+}
+
+// push x; pop %r -> mov x, %r, or nothing when x is %r
+static bool push_pop(const Peephole* p, const WaccX86Inst* window, WaccX86InstBuf* out)
+{
+    (void)p;
+    const WaccX86Operand* src = &window[0].ops[0];
+    const WaccX86Operand* dst = &window[1].ops[0];
+    if (dst->kind != WACC_X86_OPERAND_REG || (src->kind == WACC_X86_OPERAND_MEM && src->mem.base == WACC_X86_RSP))
+    {
+        return false;
+    }
+    if (!is_reg(src, dst->reg))
+    {
+        BUF_PUSH(out, ((WaccX86Inst){.op = WACC_X86_MOV, .size = 8, .ops = {*dst, *src}}));
+    }
+    return true;
+}
+
+// mov $0, %r -> xor %r, %r, which needs the flags to be dead
+static bool zero_idiom(const Peephole* p, const WaccX86Inst* window, WaccX86InstBuf* out)
+{
+    const WaccX86Inst* mov = &window[0];
+    if (mov->ops[0].kind != WACC_X86_OPERAND_REG || mov->ops[1].kind != WACC_X86_OPERAND_IMM ||
+        mov->ops[1].imm != 0 || flags_live_after(p, p->index))
+    {
+        return false;
+    }
+    // the 32-bit form clears the whole register
+    BUF_PUSH(out, ((WaccX86Inst){.op = WACC_X86_XOR, .size = 4, .ops = {mov->ops[0], mov->ops[0]}}));
+    return true;
+}
+
+// movq $imm, %r -> movl $imm, %r for an immediate the zero extension keeps
+static bool mov_imm32(const Peephole* p, const WaccX86Inst* window, WaccX86InstBuf* out)
+{
+    (void)p;
+    WaccX86Inst mov = window[0];
+    if (mov.size != 8 || mov.ops[0].kind != WACC_X86_OPERAND_REG || mov.ops[1].kind != WACC_X86_OPERAND_IMM ||
+        mov.ops[1].imm < 0 || mov.ops[1].imm > UINT32_MAX)
+    {
+        return false;
+    }
+    mov.size = 4;
+    BUF_PUSH(out, mov);
+    return true;
+}
+
+// cmp; setcc %r; movzbl %r, %r; test %r, %r; je/jne -> cmp; jcc when the
+// comparison result is not needed afterwards
+static bool compare_branch(const Peephole* p, const WaccX86Inst* window, WaccX86InstBuf* out)
+{
+    const WaccX86Operand* result = &window[1].ops[0];
+    if (result->kind != WACC_X86_OPERAND_REG)
+    {
+        return false;
+    }
+    uint32_t reg = result->reg;
+    if (!is_reg(&window[2].ops[0], reg) || !is_reg(&window[2].ops[1], reg) || !is_reg(&window[3].ops[0], reg) ||
+        !is_reg(&window[3].ops[1], reg) || (window[4].cond != WACC_X86_COND_NE && window[4].cond != WACC_X86_COND_E) ||
+        (p->live_after->ptr[p->index + 4] & REG_BIT(reg)) != 0)
+    {
+        return false;
+    }
+    WaccX86Inst jcc = window[4];
+    // conditions come in pairs that differ in the lowest bit of the encoding
+    jcc.cond = window[4].cond == WACC_X86_COND_NE ? window[1].cond : (WaccX86Cond)(window[1].cond ^ 1);
+    BUF_PUSH(out, window[0]);
+    BUF_PUSH(out, jcc);
+    return true;
+}
+
+// cmp $0, %r -> test %r, %r, which sets the flags the same way
+static bool cmp_zero(const Peephole* p, const WaccX86Inst* window, WaccX86InstBuf* out)
+{
+    (void)p;
+    WaccX86Inst cmp = window[0];
+    if (cmp.ops[0].kind != WACC_X86_OPERAND_REG || cmp.ops[1].kind != WACC_X86_OPERAND_IMM || cmp.ops[1].imm != 0)
+    {
+        return false;
+    }
+    cmp.op = WACC_X86_TEST;
+    cmp.ops[1] = cmp.ops[0];
+    BUF_PUSH(out, cmp);
+    return true;
+}
+
+#define PATTERN_LENGTH(...) ((uint32_t)(sizeof((WaccX86Opcode[]){__VA_ARGS__}) / sizeof(WaccX86Opcode)))
+
+static const PeepholeRule rules[] = {
+#define X(x, rule, description, ...) {rule, {__VA_ARGS__}, PATTERN_LENGTH(__VA_ARGS__)},
+#include "wacc/x86/peephole.def"
+#undef X
+};
+
+const char* const wacc_x86_peephole_descriptions[] = {
+#define X(x, rule, description, ...) description,
+#include "wacc/x86/peephole.def"
+#undef X
+};
+
+static bool matches(const PeepholeRule* rule, const WaccX86InstBuf* insts, uint64_t index)
+{
+    if (index + rule->length > insts->len)
+    {
+        return false;
+    }
+    for (uint32_t k = 0; k < rule->length; k++)
+    {
+        if (insts->ptr[index + k].op != rule->pattern[k])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// one pass over `block`; returns whether any rule fired
+static bool rewrite_block(
+    WaccX86Function* function, uint32_t block, uint32_t live_out, MaskBuf* live_after, WaccX86Stats* stats)
+{
+    WaccX86InstBuf* insts = &function->blocks.ptr[block].insts;
+    compute_live_after(insts, live_out, live_after);
+    WaccX86InstBuf out = BUF_NEW_IN(&function->alloc);
+    BUF_RESERVE(&out, insts->len);
+    Peephole p = {.insts = insts, .live_after = live_after};
+    bool fired = false;
+    for (uint64_t i = 0; i < insts->len;)
+    {
+        p.index = i;
+        uint32_t consumed = 0;
+        for (uint32_t r = 0; r < WACC_X86_NUM_PEEPHOLE_RULES && consumed == 0; r++)
+        {
+            uint64_t first = out.len;
+            if (matches(&rules[r], insts, i) && rules[r].rule(&p, &insts->ptr[i], &out))
+            {
+                stats->peephole[r]++;
+                consumed = rules[r].length;
+                fired = true;
+                // replacements come from the line of the first instruction
+                for (uint64_t k = first; k < out.len; k++)
+                {
+                    out.ptr[k].line = insts->ptr[i].line;
+                }
+            }
+        }
+        if (consumed == 0)
+        {
+            BUF_PUSH(&out, insts->ptr[i]);
+            consumed = 1;
+        }
+        i += consumed;
+    }
+    BUF_FREE(*insts);
+    *insts = out;
+    return fired;
+}
+
+void wacc_x86_peephole(WaccX86Function* function, WaccX86Stats* stats)
+{
+    MaskBuf live_out = BUF_NEW;
+    MaskBuf live_after = BUF_NEW;
+    compute_live_out(function, &live_out);
+    for (uint32_t b = 0; b < function->blocks.len; b++)
+    {
+        while (rewrite_block(function, b, live_out.ptr[b], &live_after, stats))
+        {
+        }
+    }
+    BUF_FREE(live_out);
+    BUF_FREE(live_after);
+}
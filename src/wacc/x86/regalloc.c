@@ -0,0 +1,772 @@
+#include "wacc/x86.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Linear-scan register allocation after Poletto and Sarkar.
+//
+// Every virtual register gets one live interval, from its first definition or
+// live-in block to its last use or live-out block; instructions are numbered
+// so that an instruction reads its operands at an even position and writes its
+// results at the next odd one. Hardware registers used by the lowering (call
+// arguments, %rax and %rdx around a division, %cl for shifts, everything the
+// callee may clobber at a call) form fixed ranges that a virtual register may
+// not overlap if it is to live in that register. This is how values live across
+// a call end up in callee-saved registers.
+//
+// When registers run out, the interval ending furthest away is spilled, or in
+// a function with a profile the one whose uses and definitions ran least
+// often, which keeps the values of hot loops in registers. The spilled one
+// gets a stack slot, every use loads it into a fresh short-lived register and
+// every definition stores it back, and allocation starts over. Those short
+// registers are never spilled again, so the process terminates.
+//
+// A virtual register moved to or from a hardware register, such as a call
+// argument, a call result or a parameter, first tries that register, so the
+// move becomes a move to itself that the peephole pass deletes.
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t end;
+} LiveRange;
+
+typedef BUF(LiveRange) RangeBuf;
+typedef BUF(uint64_t) WordBuf;
+typedef BUF(uint32_t) U32Buf;
+typedef BUF(bool) BoolBuf;
+
+typedef struct
+{
+    const WaccX86Function* function;
+    uint32_t num_vregs;
+    // words per bitset over the virtual registers
+    uint32_t words;
+    WordBuf live_in;
+    WordBuf live_out;
+    // indexed by virtual register - WACC_X86_FIRST_VREG
+    RangeBuf intervals;
+    // how often the uses and definitions of each virtual register ran, by
+    // the block counts, plus one each so that counts of zero still tell
+    WordBuf weights;
+    RangeBuf fixed[WACC_X86_NUM_REGS];
+    // the hardware register each virtual register is first moved to or from,
+    // WACC_X86_NO_REG if none
+    U32Buf hints;
+} Liveness;
+
+#define REG_BIT(reg) (UINT32_C(1) << (reg))
+
+// registers handed out, scratch registers first so values that do not live
+// across a call leave the callee-saved ones alone
+static const WaccX86Reg allocation_order[] = {
+    WACC_X86_RAX,
+    WACC_X86_RCX,
+    WACC_X86_RDX,
+    WACC_X86_RSI,
+    WACC_X86_RDI,
+    WACC_X86_R8,
+    WACC_X86_R9,
+    WACC_X86_R10,
+    WACC_X86_R11,
+    WACC_X86_RBX,
+    WACC_X86_R12,
+    WACC_X86_R13,
+    WACC_X86_R14,
+    WACC_X86_R15,
+};
+
+enum
+{
+    NUM_ALLOCATABLE = sizeof(allocation_order) / sizeof(allocation_order[0]),
+    // at most two operands, each a register or a base and an index
+    MAX_INST_REGS = 4,
+};
+
+typedef struct
+{
+    uint32_t uses[MAX_INST_REGS];
+    uint32_t num_uses;
+    uint32_t def;
+} InstRegs;
+
+// the registers named by the operands of `inst`
+static void inst_regs(const WaccX86Inst* inst, InstRegs* out)
+{
+    out->num_uses = 0;
+    out->def = WACC_X86_NO_REG;
+    for (uint32_t k = 0; k < 2; k++)
+    {
+        const WaccX86Operand* op = &inst->ops[k];
+        if (op->kind == WACC_X86_OPERAND_REG)
+        {
+            if (wacc_x86_has_flag(inst->op, k == 0 ? WACC_X86_USE0 : WACC_X86_USE1))
+            {
+                out->uses[out->num_uses++] = op->reg;
+            }
+            if (k == 0 && wacc_x86_has_flag(inst->op, WACC_X86_DEF0))
+            {
+                out->def = op->reg;
+            }
+        }
+        else if (op->kind == WACC_X86_OPERAND_MEM)
+        {
+            out->uses[out->num_uses++] = op->mem.base;
+            if (op->mem.index != WACC_X86_NO_REG)
+            {
+                out->uses[out->num_uses++] = op->mem.index;
+            }
+        }
+    }
+}
+
+static bool bit_test(const uint64_t* set, uint32_t i)
+{
+    return (set[i / 64] >> (i % 64)) & 1;
+}
+
+static void bit_set(uint64_t* set, uint32_t i)
+{
+    set[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+static void extend(LiveRange* range, uint32_t pos)
+{
+    if (pos < range->start)
+    {
+        range->start = pos;
+    }
+    if (pos > range->end)
+    {
+        range->end = pos;
+    }
+}
+
+static void compute_live_sets(Liveness* live)
+{
+    const WaccX86Function* function = live->function;
+    uint64_t num_blocks = function->blocks.len;
+    uint64_t total = num_blocks * live->words;
+    WordBuf gen = BUF_NEW;
+    WordBuf kill = BUF_NEW;
+    WordBuf* sets[] = {&live->live_in, &live->live_out, &gen, &kill};
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+    {
+        BUF_RESERVE(sets[s], total);
+        memset(sets[s]->ptr, 0, total * sizeof(uint64_t));
+        sets[s]->len = total;
+    }
+
+    for (uint64_t b = 0; b < num_blocks; b++)
+    {
+        uint64_t* block_gen = gen.ptr + b * live->words;
+        uint64_t* block_kill = kill.ptr + b * live->words;
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            InstRegs regs;
+            inst_regs(&insts->ptr[i], &regs);
+            for (uint32_t u = 0; u < regs.num_uses; u++)
+            {
+                if (wacc_x86_is_vreg(regs.uses[u]))
+                {
+                    uint32_t v = regs.uses[u] - WACC_X86_FIRST_VREG;
+                    if (!bit_test(block_kill, v))
+                    {
+                        bit_set(block_gen, v);
+                    }
+                }
+            }
+            if (wacc_x86_is_vreg(regs.def))
+            {
+                bit_set(block_kill, regs.def - WACC_X86_FIRST_VREG);
+            }
+        }
+    }
+
+    // backwards dataflow to a fixed point; visiting the blocks last to first
+    // follows the direction of the flow for all but back edges
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint64_t b = num_blocks; b-- > 0;)
+        {
+            uint64_t* out = live->live_out.ptr + b * live->words;
+            uint64_t* in = live->live_in.ptr + b * live->words;
+            uint32_t succs[2];
+            uint32_t n = wacc_x86_successors(function, (uint32_t)b, succs);
+            for (uint32_t s = 0; s < n; s++)
+            {
+                const uint64_t* succ_in = live->live_in.ptr + (uint64_t)succs[s] * live->words;
+                for (uint32_t w = 0; w < live->words; w++)
+                {
+                    out[w] |= succ_in[w];
+                }
+            }
+            for (uint32_t w = 0; w < live->words; w++)
+            {
+                uint64_t new_in = gen.ptr[b * live->words + w] | (out[w] & ~kill.ptr[b * live->words + w]);
+                if (new_in != in[w])
+                {
+                    in[w] = new_in;
+                    changed = true;
+                }
+            }
+        }
+    }
+    BUF_FREE(kill);
+    BUF_FREE(gen);
+}
+
+// close the open fixed range of `reg`, if any
+static void close_fixed(Liveness* live, LiveRange* open, uint32_t reg)
+{
+    if (open[reg].start != UINT32_MAX)
+    {
+        BUF_PUSH(&live->fixed[reg], open[reg]);
+        open[reg].start = UINT32_MAX;
+    }
+}
+
+static void fixed_use(LiveRange* open, uint32_t reg, uint32_t block_start, uint32_t pos)
+{
+    if (open[reg].start == UINT32_MAX)
+    {
+        open[reg].start = block_start;
+    }
+    open[reg].end = pos;
+}
+
+static void fixed_def(Liveness* live, LiveRange* open, uint32_t reg, uint32_t pos)
+{
+    close_fixed(live, open, reg);
+    open[reg] = (LiveRange){pos, pos};
+}
+
+static void build_intervals(Liveness* live)
+{
+    const WaccX86Function* function = live->function;
+    BUF_RESERVE(&live->intervals, live->num_vregs);
+    live->intervals.len = live->num_vregs;
+    BUF_RESERVE(&live->weights, live->num_vregs);
+    live->weights.len = live->num_vregs;
+    for (uint32_t v = 0; v < live->num_vregs; v++)
+    {
+        live->intervals.ptr[v] = (LiveRange){UINT32_MAX, 0};
+        live->weights.ptr[v] = 0;
+    }
+
+    uint32_t pos = 0;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        uint32_t block_start = pos;
+        uint32_t block_end = pos + 2 * (uint32_t)insts->len - 1;
+        if (insts->len == 0)
+        {
+            block_end = pos;
+        }
+        uint64_t weight = function->blocks.ptr[b].count + 1;
+        const uint64_t* in = live->live_in.ptr + b * live->words;
+        const uint64_t* out = live->live_out.ptr + b * live->words;
+        for (uint32_t v = 0; v < live->num_vregs; v++)
+        {
+            if (bit_test(in, v))
+            {
+                extend(&live->intervals.ptr[v], block_start);
+            }
+            if (bit_test(out, v))
+            {
+                extend(&live->intervals.ptr[v], block_end);
+            }
+        }
+
+        LiveRange open[WACC_X86_NUM_REGS];
+        for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+        {
+            open[r].start = UINT32_MAX;
+        }
+        for (uint64_t i = 0; i < insts->len; i++, pos += 2)
+        {
+            const WaccX86Inst* inst = &insts->ptr[i];
+            InstRegs regs;
+            inst_regs(inst, &regs);
+            uint32_t implicit_uses;
+            uint32_t implicit_defs;
+            wacc_x86_implicit_regs(inst, &implicit_uses, &implicit_defs);
+            for (uint32_t u = 0; u < regs.num_uses; u++)
+            {
+                if (wacc_x86_is_vreg(regs.uses[u]))
+                {
+                    extend(&live->intervals.ptr[regs.uses[u] - WACC_X86_FIRST_VREG], pos);
+                    live->weights.ptr[regs.uses[u] - WACC_X86_FIRST_VREG] += weight;
+                }
+                else
+                {
+                    implicit_uses |= REG_BIT(regs.uses[u]);
+                }
+            }
+            if (wacc_x86_is_vreg(regs.def))
+            {
+                extend(&live->intervals.ptr[regs.def - WACC_X86_FIRST_VREG], pos + 1);
+                live->weights.ptr[regs.def - WACC_X86_FIRST_VREG] += weight;
+            }
+            else if (regs.def != WACC_X86_NO_REG)
+            {
+                implicit_defs |= REG_BIT(regs.def);
+            }
+            for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+            {
+                if (implicit_uses & REG_BIT(r))
+                {
+                    fixed_use(open, r, block_start, pos);
+                }
+            }
+            for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+            {
+                if (implicit_defs & REG_BIT(r))
+                {
+                    fixed_def(live, open, r, pos + 1);
+                }
+            }
+        }
+        for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+        {
+            close_fixed(live, open, r);
+        }
+        if (insts->len == 0)
+        {
+            pos += 2;
+        }
+    }
+}
+
+static void compute_hints(Liveness* live)
+{
+    U32Buf* hints = &live->hints;
+    BUF_RESERVE(hints, live->num_vregs);
+    hints->len = live->num_vregs;
+    for (uint32_t v = 0; v < live->num_vregs; v++)
+    {
+        hints->ptr[v] = WACC_X86_NO_REG;
+    }
+    const WaccX86Function* function = live->function;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            const WaccX86Inst* inst = &insts->ptr[i];
+            if (inst->op != WACC_X86_MOV || inst->ops[0].kind != WACC_X86_OPERAND_REG ||
+                inst->ops[1].kind != WACC_X86_OPERAND_REG)
+            {
+                continue;
+            }
+            uint32_t dst = inst->ops[0].reg;
+            uint32_t src = inst->ops[1].reg;
+            if (wacc_x86_is_vreg(dst) != wacc_x86_is_vreg(src))
+            {
+                uint32_t v = (wacc_x86_is_vreg(dst) ? dst : src) - WACC_X86_FIRST_VREG;
+                if (hints->ptr[v] == WACC_X86_NO_REG)
+                {
+                    hints->ptr[v] = wacc_x86_is_vreg(dst) ? src : dst;
+                }
+            }
+        }
+    }
+}
+
+static void liveness_build(Liveness* live, const WaccX86Function* function)
+{
+    *live = (Liveness){
+        .function = function,
+        .num_vregs = function->num_regs - WACC_X86_FIRST_VREG,
+        .live_in = BUF_NEW,
+        .live_out = BUF_NEW,
+        .intervals = BUF_NEW,
+        .weights = BUF_NEW,
+        .hints = BUF_NEW,
+    };
+    live->words = (live->num_vregs + 63) / 64;
+    for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+    {
+        live->fixed[r] = (RangeBuf)BUF_NEW;
+    }
+    compute_live_sets(live);
+    build_intervals(live);
+    compute_hints(live);
+}
+
+static void liveness_free(Liveness* live)
+{
+    for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+    {
+        BUF_FREE(live->fixed[r]);
+    }
+    BUF_FREE(live->intervals);
+    BUF_FREE(live->weights);
+    BUF_FREE(live->hints);
+    BUF_FREE(live->live_out);
+    BUF_FREE(live->live_in);
+}
+
+// whether `reg` is fixed somewhere within `range`; the fixed ranges of a
+// register are sorted and disjoint, so binary search for the first one that
+// ends at or after the start of `range`
+static bool fixed_conflict(const Liveness* live, uint32_t reg, LiveRange range)
+{
+    const RangeBuf* fixed = &live->fixed[reg];
+    uint64_t lo = 0;
+    uint64_t hi = fixed->len;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (fixed->ptr[mid].end < range.start)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo < fixed->len && fixed->ptr[lo].start <= range.end;
+}
+
+static bool allocatable(uint32_t reg)
+{
+    for (uint32_t k = 0; k < NUM_ALLOCATABLE; k++)
+    {
+        if (allocation_order[k] == reg)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// whether the interval of virtual register `a` is a better one to spill than
+// that of `b`
+static bool spill_first(const Liveness* live, uint32_t a, uint32_t b)
+{
+    if (live->function->profiled && live->weights.ptr[a] != live->weights.ptr[b])
+    {
+        return live->weights.ptr[a] < live->weights.ptr[b];
+    }
+    return live->intervals.ptr[a].end > live->intervals.ptr[b].end;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Run the scan; returns false and marks the registers to spill in `spill`
+// if it ran out of registers.
+static bool scan(const WaccX86Function* function, const Liveness* live, U32Buf* assignment, BoolBuf* spill)
+{
+    // intervals by start, as the start in the upper and the register in the
+    // lower half of a key
+    WordBuf order = BUF_NEW;
+    for (uint32_t v = 0; v < live->num_vregs; v++)
+    {
+        assignment->ptr[v] = WACC_X86_NO_REG;
+        if (live->intervals.ptr[v].start != UINT32_MAX)
+        {
+            BUF_PUSH(&order, (uint64_t)live->intervals.ptr[v].start << 32 | v);
+        }
+    }
+    qsort(order.ptr, order.len, sizeof(uint64_t), compare_u64);
+
+    // virtual register held by each hardware register
+    uint32_t holder[WACC_X86_NUM_REGS];
+    for (uint32_t r = 0; r < WACC_X86_NUM_REGS; r++)
+    {
+        holder[r] = WACC_X86_NO_REG;
+    }
+    bool spilled = false;
+    for (uint64_t i = 0; i < order.len; i++)
+    {
+        uint32_t v = (uint32_t)order.ptr[i];
+        LiveRange cur = live->intervals.ptr[v];
+        for (uint32_t k = 0; k < NUM_ALLOCATABLE; k++)
+        {
+            WaccX86Reg r = allocation_order[k];
+            if (holder[r] != WACC_X86_NO_REG && live->intervals.ptr[holder[r]].end < cur.start)
+            {
+                holder[r] = WACC_X86_NO_REG;
+            }
+        }
+
+        WaccX86Reg chosen = WACC_X86_NUM_REGS;
+        uint32_t hint = live->hints.ptr[v];
+        if (hint != WACC_X86_NO_REG && allocatable(hint) && holder[hint] == WACC_X86_NO_REG &&
+            !fixed_conflict(live, hint, cur))
+        {
+            chosen = (WaccX86Reg)hint;
+        }
+        for (uint32_t k = 0; k < NUM_ALLOCATABLE && chosen == WACC_X86_NUM_REGS; k++)
+        {
+            WaccX86Reg r = allocation_order[k];
+            if (holder[r] == WACC_X86_NO_REG && !fixed_conflict(live, r, cur))
+            {
+                chosen = r;
+            }
+        }
+        if (chosen == WACC_X86_NUM_REGS)
+        {
+            // take the register of the interval best to spill, unless the
+            // current one is better still
+            WaccX86Reg victim = WACC_X86_NUM_REGS;
+            for (uint32_t k = 0; k < NUM_ALLOCATABLE; k++)
+            {
+                WaccX86Reg r = allocation_order[k];
+                uint32_t w = holder[r];
+                if (w == WACC_X86_NO_REG || function->unspillable.ptr[w + WACC_X86_FIRST_VREG] ||
+                    fixed_conflict(live, r, cur))
+                {
+                    continue;
+                }
+                if (victim == WACC_X86_NUM_REGS || spill_first(live, w, holder[victim]))
+                {
+                    victim = r;
+                }
+            }
+            bool cur_spillable = !function->unspillable.ptr[v + WACC_X86_FIRST_VREG];
+            if (victim == WACC_X86_NUM_REGS || (cur_spillable && !spill_first(live, holder[victim], v)))
+            {
+                if (!cur_spillable)
+                {
+                    (void)fprintf(stderr, "internal error: no register for " str_fmt "\n", str_arg(function->name));
+                    abort();
+                }
+                spill->ptr[v] = true;
+                spilled = true;
+                continue;
+            }
+            spill->ptr[holder[victim]] = true;
+            assignment->ptr[holder[victim]] = WACC_X86_NO_REG;
+            spilled = true;
+            chosen = victim;
+        }
+        holder[chosen] = v;
+        assignment->ptr[v] = chosen;
+    }
+    BUF_FREE(order);
+    return !spilled;
+}
+
+static void load_slot(WaccX86InstBuf* out, uint32_t reg, uint32_t slot)
+{
+    BUF_PUSH(out, ((WaccX86Inst){.op = WACC_X86_MOV, .size = 8, .ops = {wacc_x86_reg(reg), wacc_x86_slot(slot)}}));
+}
+
+static void store_slot(WaccX86InstBuf* out, uint32_t reg, uint32_t slot)
+{
+    BUF_PUSH(out, ((WaccX86Inst){.op = WACC_X86_MOV, .size = 8, .ops = {wacc_x86_slot(slot), wacc_x86_reg(reg)}}));
+}
+
+// the slot of `reg` if it is spilled, WACC_X86_NO_REG otherwise
+static uint32_t slot_of(const U32Buf* slots, uint32_t reg)
+{
+    return wacc_x86_is_vreg(reg) ? slots->ptr[reg - WACC_X86_FIRST_VREG] : WACC_X86_NO_REG;
+}
+
+// a fresh register standing in for `reg` within one instruction
+static uint32_t temp_for(WaccX86Function* function, uint32_t reg, uint32_t map[][2], uint32_t* map_len)
+{
+    for (uint32_t i = 0; i < *map_len; i++)
+    {
+        if (map[i][0] == reg)
+        {
+            return map[i][1];
+        }
+    }
+    uint32_t tmp = wacc_x86_vreg_new(function);
+    function->unspillable.ptr[tmp] = true;
+    map[*map_len][0] = reg;
+    map[*map_len][1] = tmp;
+    (*map_len)++;
+    return tmp;
+}
+
+static void rewrite_inst(WaccX86Function* function,
+    const WaccX86Inst* original,
+    const U32Buf* slots,
+    WaccX86InstBuf* out,
+    WaccX86Stats* stats)
+{
+    WaccX86Inst inst = *original;
+    // a plain move reads or writes the slot directly
+    if (inst.op == WACC_X86_MOV)
+    {
+        uint32_t src_slot =
+            inst.ops[1].kind == WACC_X86_OPERAND_REG ? slot_of(slots, inst.ops[1].reg) : WACC_X86_NO_REG;
+        uint32_t dst_slot =
+            inst.ops[0].kind == WACC_X86_OPERAND_REG ? slot_of(slots, inst.ops[0].reg) : WACC_X86_NO_REG;
+        if (src_slot != WACC_X86_NO_REG && inst.ops[0].kind == WACC_X86_OPERAND_REG && dst_slot == WACC_X86_NO_REG)
+        {
+            inst.ops[1] = wacc_x86_slot(src_slot);
+            inst.size = 8;
+            BUF_PUSH(out, inst);
+            stats->spill_loads++;
+            return;
+        }
+        if (dst_slot != WACC_X86_NO_REG && src_slot == WACC_X86_NO_REG &&
+            (inst.ops[1].kind == WACC_X86_OPERAND_REG ||
+                (inst.ops[1].kind == WACC_X86_OPERAND_IMM && inst.ops[1].imm >= INT32_MIN &&
+                    inst.ops[1].imm <= INT32_MAX)))
+        {
+            inst.ops[0] = wacc_x86_slot(dst_slot);
+            if (inst.ops[1].kind == WACC_X86_OPERAND_REG)
+            {
+                inst.size = 8;
+            }
+            BUF_PUSH(out, inst);
+            stats->spill_stores++;
+            return;
+        }
+    }
+
+    InstRegs regs;
+    inst_regs(&inst, &regs);
+    uint32_t map[MAX_INST_REGS + 1][2];
+    uint32_t map_len = 0;
+    for (uint32_t k = 0; k < 2; k++)
+    {
+        WaccX86Operand* op = &inst.ops[k];
+        if (op->kind == WACC_X86_OPERAND_REG && slot_of(slots, op->reg) != WACC_X86_NO_REG)
+        {
+            op->reg = temp_for(function, op->reg, map, &map_len);
+        }
+        else if (op->kind == WACC_X86_OPERAND_MEM)
+        {
+            if (slot_of(slots, op->mem.base) != WACC_X86_NO_REG)
+            {
+                op->mem.base = temp_for(function, op->mem.base, map, &map_len);
+            }
+            if (op->mem.index != WACC_X86_NO_REG && slot_of(slots, op->mem.index) != WACC_X86_NO_REG)
+            {
+                op->mem.index = temp_for(function, op->mem.index, map, &map_len);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < map_len; i++)
+    {
+        bool used = false;
+        for (uint32_t u = 0; u < regs.num_uses; u++)
+        {
+            used = used || regs.uses[u] == map[i][0];
+        }
+        if (used)
+        {
+            load_slot(out, map[i][1], slot_of(slots, map[i][0]));
+            stats->spill_loads++;
+        }
+    }
+    BUF_PUSH(out, inst);
+    if (regs.def != WACC_X86_NO_REG && slot_of(slots, regs.def) != WACC_X86_NO_REG)
+    {
+        uint32_t tmp = temp_for(function, regs.def, map, &map_len);
+        store_slot(out, tmp, slot_of(slots, regs.def));
+        stats->spill_stores++;
+    }
+}
+
+static void rewrite_spills(WaccX86Function* function, const BoolBuf* spill, uint32_t num_vregs, WaccX86Stats* stats)
+{
+    U32Buf slots = BUF_NEW;
+    for (uint32_t v = 0; v < num_vregs; v++)
+    {
+        uint32_t slot = WACC_X86_NO_REG;
+        if (spill->ptr[v])
+        {
+            slot = wacc_x86_slot_new(function);
+            stats->spilled++;
+        }
+        BUF_PUSH(&slots, slot);
+    }
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        WaccX86InstBuf out = BUF_NEW_IN(&function->alloc);
+        BUF_RESERVE(&out, insts->len);
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            rewrite_inst(function, &insts->ptr[i], &slots, &out, stats);
+        }
+        BUF_FREE(*insts);
+        *insts = out;
+    }
+    BUF_FREE(slots);
+}
+
+static void apply(WaccX86Function* function, const U32Buf* assignment)
+{
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            for (uint32_t k = 0; k < 2; k++)
+            {
+                WaccX86Operand* op = &insts->ptr[i].ops[k];
+                if (op->kind == WACC_X86_OPERAND_REG && wacc_x86_is_vreg(op->reg))
+                {
+                    op->reg = assignment->ptr[op->reg - WACC_X86_FIRST_VREG];
+                }
+                else if (op->kind == WACC_X86_OPERAND_MEM)
+                {
+                    if (wacc_x86_is_vreg(op->mem.base))
+                    {
+                        op->mem.base = assignment->ptr[op->mem.base - WACC_X86_FIRST_VREG];
+                    }
+                    if (wacc_x86_is_vreg(op->mem.index))
+                    {
+                        op->mem.index = assignment->ptr[op->mem.index - WACC_X86_FIRST_VREG];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void wacc_x86_regalloc(WaccX86Function* function, const WaccX86Options* options, WaccX86Stats* stats)
+{
+    BoolBuf spill = BUF_NEW;
+    if (options->regalloc == WACC_X86_REGALLOC_NAIVE)
+    {
+        uint32_t num_vregs = function->num_regs - WACC_X86_FIRST_VREG;
+        for (uint32_t v = 0; v < num_vregs; v++)
+        {
+            BUF_PUSH(&spill, !function->unspillable.ptr[v + WACC_X86_FIRST_VREG]);
+        }
+        rewrite_spills(function, &spill, num_vregs, stats);
+    }
+    U32Buf assignment = BUF_NEW;
+    for (;;)
+    {
+        Liveness live;
+        liveness_build(&live, function);
+        spill.len = 0;
+        assignment.len = 0;
+        BUF_RESERVE(&spill, live.num_vregs);
+        BUF_RESERVE(&assignment, live.num_vregs);
+        memset(spill.ptr, 0, live.num_vregs * sizeof(bool));
+        spill.len = live.num_vregs;
+        assignment.len = live.num_vregs;
+        bool done = scan(function, &live, &assignment, &spill);
+        liveness_free(&live);
+        if (done)
+        {
+            break;
+        }
+        rewrite_spills(function, &spill, (uint32_t)spill.len, stats);
+    }
+    apply(function, &assignment);
+    BUF_FREE(assignment);
+    BUF_FREE(spill);
+}
@@ -0,0 +1,164 @@
+#include "wacc/test/alloc.h"
+
+#include <alloc/alloc.h>
+#include <str/str.h>
+#include <string.h>
+
+enum
+{
+    CHUNK_SIZE = 1024,
+};
+
+// whether the `size` bytes at `ptr` all hold `byte`
+static bool filled(const void* ptr, size_t size, unsigned char byte)
+{
+    const unsigned char* bytes = ptr;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (bytes[i] != byte)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the most recent block grows where it is; any other moves, keeping its bytes
+static TEST_FUNC(state, arena_realloc)
+{
+    Arena arena;
+    arena_init(&arena, CHUNK_SIZE);
+    Allocator alloc = arena_allocator(&arena);
+    char* last = allocator_alloc(&alloc, 16);
+    memset(last, 'a', 16);
+    char* grown = allocator_realloc(&alloc, last, 256);
+    TEST_ASSERT(state, grown == last, arena_free(&arena), "the last block did not grow in place");
+    TEST_ASSERT(state, filled(grown, 16, 'a'), arena_free(&arena), "growing in place lost the contents");
+
+    char* next = allocator_alloc(&alloc, 16);
+    memset(next, 'b', 16);
+    char* moved = allocator_realloc(&alloc, grown, 512);
+    TEST_ASSERT(state, moved != grown, arena_free(&arena), "a block followed by another grew in place");
+    TEST_ASSERT(state, filled(moved, 16, 'a'), arena_free(&arena), "moving the block lost its contents");
+    TEST_ASSERT(state, filled(next, 16, 'b'), arena_free(&arena), "moving a block overwrote the next one");
+    arena_free(&arena);
+    PASS();
+}
+
+// a block larger than a chunk gets a chunk of its own
+static TEST_FUNC(state, arena_large)
+{
+    Arena arena;
+    arena_init(&arena, CHUNK_SIZE);
+    Allocator alloc = arena_allocator(&arena);
+    char* small = allocator_alloc(&alloc, 16);
+    char* large = allocator_alloc(&alloc, 4 * CHUNK_SIZE);
+    char* after = allocator_alloc(&alloc, 16);
+    TEST_ASSERT(state,
+        small != NULL && large != NULL && after != NULL,
+        arena_free(&arena),
+        "an allocation larger than a chunk failed");
+    memset(small, 's', 16);
+    memset(large, 'l', 4 * CHUNK_SIZE);
+    memset(after, 'a', 16);
+    TEST_ASSERT(state,
+        filled(small, 16, 's') && filled(large, 4 * CHUNK_SIZE, 'l') && filled(after, 16, 'a'),
+        arena_free(&arena),
+        "blocks around a large one overlap it");
+    arena_free(&arena);
+    PASS();
+}
+
+// reset frees every chunk but the largest, which the next blocks reuse
+static TEST_FUNC(state, arena_reset)
+{
+    Arena arena;
+    arena_init(&arena, CHUNK_SIZE);
+    Allocator alloc = arena_allocator(&arena);
+    (void)allocator_alloc(&alloc, 16);
+    // the first block of its own chunk
+    char* large = allocator_alloc(&alloc, 8 * CHUNK_SIZE);
+    (void)allocator_alloc(&alloc, 16);
+    arena_reset(&arena);
+    char* reused = allocator_alloc(&alloc, 4 * CHUNK_SIZE);
+    TEST_ASSERT(state, reused == large, arena_free(&arena), "reset did not keep the largest chunk");
+    arena_reset(&arena);
+    arena_reset(&arena);
+    TEST_ASSERT(state, allocator_alloc(&alloc, 16) == large, arena_free(&arena), "a reset arena did not start over");
+    arena_free(&arena);
+    PASS();
+}
+
+static TEST_FUNC(state, counting)
+{
+    CountingAllocator counter;
+    counting_allocator_init(&counter, NULL);
+    Allocator alloc = counting_allocator(&counter);
+    char* a = allocator_alloc(&alloc, 100);
+    char* b = allocator_alloc(&alloc, 50);
+    TEST_ASSERT(state,
+        counter.count == 2 && counter.bytes == 150 && counter.live == 150 && counter.peak == 150,
+        CLEANUP((allocator_free(&alloc, a), allocator_free(&alloc, b))),
+        "after two allocations: count %zu, bytes %zu, live %zu, peak %zu",
+        counter.count,
+        counter.bytes,
+        counter.live,
+        counter.peak);
+
+    // only the growth of a realloc counts as requested
+    a = allocator_realloc(&alloc, a, 200);
+    TEST_ASSERT(state,
+        counter.count == 3 && counter.bytes == 250 && counter.live == 250 && counter.peak == 250,
+        CLEANUP((allocator_free(&alloc, a), allocator_free(&alloc, b))),
+        "after growing: count %zu, bytes %zu, live %zu, peak %zu",
+        counter.count,
+        counter.bytes,
+        counter.live,
+        counter.peak);
+    a = allocator_realloc(&alloc, a, 20);
+    TEST_ASSERT(state,
+        counter.count == 4 && counter.bytes == 250 && counter.live == 70 && counter.peak == 250,
+        CLEANUP((allocator_free(&alloc, a), allocator_free(&alloc, b))),
+        "after shrinking: count %zu, bytes %zu, live %zu, peak %zu",
+        counter.count,
+        counter.bytes,
+        counter.live,
+        counter.peak);
+
+    allocator_free(&alloc, b);
+    allocator_free(&alloc, a);
+    allocator_free(&alloc, NULL);
+    TEST_ASSERT(state,
+        counter.count == 4 && counter.live == 0 && counter.peak == 250,
+        NO_CLEANUP,
+        "after freeing: count %zu, live %zu, peak %zu",
+        counter.count,
+        counter.live,
+        counter.peak);
+    PASS();
+}
+
+// a string goes back to the allocator it came from, not the one current when
+// it is freed
+static TEST_FUNC(state, str_owner)
+{
+    CountingAllocator counter;
+    counting_allocator_init(&counter, NULL);
+    Allocator alloc = counting_allocator(&counter);
+    const Allocator* prev = str_set_allocator(&alloc);
+    str s = str_printf("%d", 12345);
+    (void)str_set_allocator(prev);
+    size_t live = counter.live;
+    str_free(s);
+    TEST_ASSERT(state, live == 6 && counter.live == 0, NO_CLEANUP, "the string was not freed through its allocator");
+    PASS();
+}
+
+SUITE_FUNC(state, alloc)
+{
+    RUN_TEST(state, arena_realloc, str_lit("arena realloc"));
+    RUN_TEST(state, arena_large, str_lit("arena large"));
+    RUN_TEST(state, arena_reset, str_lit("arena reset"));
+    RUN_TEST(state, counting, str_lit("counting"));
+    RUN_TEST(state, str_owner, str_lit("str owner"));
+}
@@ -0,0 +1,184 @@
+#include "wacc/test/buf.h"
+
+#include <alloc/alloc.h>
+#include <buf/buf.h>
+
+typedef BUF(uint64_t) U64Buf;
+
+// whether `buf` holds 0, 1, ... len - 1
+static bool counts_up(const U64Buf* buf)
+{
+    for (uint64_t i = 0; i < buf->len; i++)
+    {
+        if (buf->ptr[i] != i)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the first push allocates BUF_MIN_CAP elements, and each later allocation
+// doubles the capacity
+static TEST_FUNC(state, growth)
+{
+    CountingAllocator counter;
+    counting_allocator_init(&counter, NULL);
+    Allocator alloc = counting_allocator(&counter);
+    U64Buf buf = BUF_NEW_IN(&alloc);
+    BUF_PUSH(&buf, 0);
+    TEST_ASSERT(state,
+        buf.cap == BUF_MIN_CAP && counter.count == 1,
+        BUF_FREE(buf),
+        "expected a first capacity of %d, got %zu",
+        BUF_MIN_CAP,
+        buf.cap);
+    for (uint64_t i = 1; i < BUF_MIN_CAP; i++)
+    {
+        BUF_PUSH(&buf, i);
+    }
+    TEST_ASSERT(state, counter.count == 1, BUF_FREE(buf), "filling the first capacity reallocated");
+    for (uint64_t i = BUF_MIN_CAP; i < 100; i++)
+    {
+        BUF_PUSH(&buf, i);
+    }
+    // 8, 16, 32, 64 and 128
+    TEST_ASSERT(state,
+        buf.cap == 128 && counter.count == 5,
+        BUF_FREE(buf),
+        "expected capacity 128 after 5 allocations, got %zu after %zu",
+        buf.cap,
+        counter.count);
+    TEST_ASSERT(state, buf.len == 100 && counts_up(&buf), BUF_FREE(buf), "growing lost elements");
+    BUF_FREE(buf);
+    TEST_ASSERT(state, counter.live == 0, NO_CLEANUP, "freeing left %zu bytes", counter.live);
+    PASS();
+}
+
+// reserving grows once to fit, and not at all when the capacity suffices
+static TEST_FUNC(state, reserve)
+{
+    CountingAllocator counter;
+    counting_allocator_init(&counter, NULL);
+    Allocator alloc = counting_allocator(&counter);
+    U64Buf buf = BUF_NEW_IN(&alloc);
+    BUF_RESERVE(&buf, 20);
+    TEST_ASSERT(state,
+        buf.cap == 32 && counter.count == 1,
+        BUF_FREE(buf),
+        "expected one allocation of capacity 32, got %zu of %zu",
+        counter.count,
+        buf.cap);
+    BUF_RESERVE(&buf, 10);
+    BUF_RESERVE(&buf, 32);
+    for (uint64_t i = 0; i < 32; i++)
+    {
+        BUF_PUSH(&buf, i);
+    }
+    TEST_ASSERT(state,
+        buf.cap == 32 && counter.count == 1,
+        BUF_FREE(buf),
+        "reserving within the capacity reallocated");
+    BUF_FREE(buf);
+    PASS();
+}
+
+static TEST_FUNC(state, extend)
+{
+    enum
+    {
+        COUNT = 1000,
+    };
+
+    CountingAllocator counter;
+    counting_allocator_init(&counter, NULL);
+    Allocator alloc = counting_allocator(&counter);
+    uint64_t values[COUNT];
+    for (uint64_t i = 0; i < COUNT; i++)
+    {
+        values[i] = i;
+    }
+    U64Buf buf = BUF_NEW_IN(&alloc);
+    BUF_EXTEND(&buf, values, 0);
+    TEST_ASSERT(state,
+        buf.ptr == NULL && buf.len == 0 && counter.count == 0,
+        BUF_FREE(buf),
+        "extending by nothing allocated");
+    BUF_EXTEND(&buf, values, 1);
+    BUF_EXTEND(&buf, values + 1, COUNT - 1);
+    BUF_EXTEND(&buf, values, 0);
+    // 8, then straight to 1024
+    TEST_ASSERT(state,
+        buf.len == COUNT && buf.cap == 1024 && counter.count == 2,
+        BUF_FREE(buf),
+        "expected %d elements in capacity 1024 after 2 allocations, got %zu in %zu after %zu",
+        COUNT,
+        buf.len,
+        buf.cap,
+        counter.count);
+    TEST_ASSERT(state, counts_up(&buf), BUF_FREE(buf), "extending copied the wrong elements");
+    BUF_FREE(buf);
+    PASS();
+}
+
+static TEST_FUNC(state, shrink)
+{
+    CountingAllocator counter;
+    counting_allocator_init(&counter, NULL);
+    Allocator alloc = counting_allocator(&counter);
+    U64Buf buf = BUF_NEW_IN(&alloc);
+    for (uint64_t i = 0; i < 10; i++)
+    {
+        BUF_PUSH(&buf, i);
+    }
+    BUF_SHRINK(&buf);
+    TEST_ASSERT(state,
+        buf.cap == 10 && counter.live == 10 * sizeof(uint64_t),
+        BUF_FREE(buf),
+        "expected to shrink to 10 elements, got capacity %zu",
+        buf.cap);
+    TEST_ASSERT(state, buf.len == 10 && counts_up(&buf), BUF_FREE(buf), "shrinking lost elements");
+    BUF_SHRINK(&buf);
+    TEST_ASSERT(state, buf.cap == 10 && counter.count == 3, BUF_FREE(buf), "shrinking a full buffer reallocated");
+
+    buf.len = 0;
+    BUF_SHRINK(&buf);
+    TEST_ASSERT(state,
+        buf.ptr == NULL && buf.cap == 0 && counter.live == 0,
+        BUF_FREE(buf),
+        "shrinking an empty buffer kept its storage");
+    BUF_PUSH(&buf, 0);
+    TEST_ASSERT(state, buf.cap == BUF_MIN_CAP, BUF_FREE(buf), "a shrunk buffer did not grow again");
+    BUF_FREE(buf);
+    PASS();
+}
+
+// a buffer in an arena grows there, and freeing it leaves the arena to do so
+static TEST_FUNC(state, arena)
+{
+    Arena arena;
+    arena_init(&arena, 0);
+    Allocator alloc = arena_allocator(&arena);
+    CountingAllocator counter;
+    counting_allocator_init(&counter, &alloc);
+    Allocator counting = counting_allocator(&counter);
+    U64Buf buf = BUF_NEW_IN(&counting);
+    for (uint64_t i = 0; i < 1000; i++)
+    {
+        BUF_PUSH(&buf, i);
+    }
+    bool ok = buf.len == 1000 && counts_up(&buf) && counter.count == 8;
+    BUF_FREE(buf);
+    arena_free(&arena);
+    TEST_ASSERT(state, ok, NO_CLEANUP, "expected 1000 elements after 8 allocations in the arena");
+    PASS();
+}
+
+SUITE_FUNC(state, buf)
+{
+    RUN_TEST(state, growth, str_lit("growth"));
+    RUN_TEST(state, reserve, str_lit("reserve"));
+    RUN_TEST(state, extend, str_lit("extend"));
+    RUN_TEST(state, shrink, str_lit("shrink"));
+    RUN_TEST(state, arena, str_lit("arena"));
+}
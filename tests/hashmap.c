@@ -0,0 +1,88 @@
+#include "wacc/test/hashmap.h"
+
+#include <hashmap/hashmap.h>
+#include <str/str.h>
+
+typedef HASHMAP(str, uint64_t) StrMap;
+typedef HASHMAP(uint64_t, uint64_t) U64Map;
+
+static TEST_FUNC(state, str_keys)
+{
+    StrMap map = HASHMAP_NEW;
+    HASHMAP_PUT(&map, str_lit("main"), 1, str_hash, str_eq);
+    HASHMAP_PUT(&map, str_lit("foo"), 2, str_hash, str_eq);
+    HASHMAP_PUT(&map, str_lit("main"), 3, str_hash, str_eq);
+
+    uint64_t* value = NULL;
+    HASHMAP_GET(map, str_lit("main"), str_hash, str_eq, &value);
+    TEST_ASSERT(state, value != NULL && *value == 3, HASHMAP_FREE(map), "'main' should map to 3");
+    TEST_ASSERT(state, map.len == 2, HASHMAP_FREE(map), "expected 2 entries, got %zu", map.len);
+
+    value = NULL;
+    HASHMAP_GET(map, str_lit("bar"), str_hash, str_eq, &value);
+    TEST_ASSERT(state, value == NULL, HASHMAP_FREE(map), "'bar' should be absent");
+
+    HASHMAP_FREE(map);
+    PASS();
+}
+
+static TEST_FUNC(state, remove)
+{
+    enum
+    {
+        COUNT = 10000,
+    };
+
+    U64Map map = HASHMAP_NEW;
+    for (uint64_t i = 0; i < COUNT; i++)
+    {
+        HASHMAP_PUT(&map, i, i * 2, hashmap_hash_u64, hashmap_eq_scalar);
+    }
+    for (uint64_t i = 0; i < COUNT; i += 2)
+    {
+        HASHMAP_REMOVE(&map, i, hashmap_hash_u64, hashmap_eq_scalar, NULL);
+    }
+    TEST_ASSERT(state, map.len == COUNT / 2, HASHMAP_FREE(map), "expected %d entries, got %zu", COUNT / 2, map.len);
+
+    for (uint64_t i = 0; i < COUNT; i++)
+    {
+        uint64_t* value = NULL;
+        HASHMAP_GET(map, i, hashmap_hash_u64, hashmap_eq_scalar, &value);
+        if (i % 2 == 0)
+        {
+            TEST_ASSERT(state, value == NULL, HASHMAP_FREE(map), "%zu should have been removed", i);
+        }
+        else
+        {
+            TEST_ASSERT(state, value != NULL && *value == i * 2, HASHMAP_FREE(map), "%zu should map to %zu", i, i * 2);
+        }
+    }
+
+    HASHMAP_FREE(map);
+    PASS();
+}
+
+static TEST_FUNC(state, reserve)
+{
+    U64Map map = HASHMAP_NEW;
+    HASHMAP_RESERVE(&map, 1000);
+    uint64_t cap = map.cap;
+    for (uint64_t i = 0; i < 1000; i++)
+    {
+        HASHMAP_PUT(&map, i, i, hashmap_hash_u64, hashmap_eq_scalar);
+    }
+    TEST_ASSERT(state, map.cap == cap, HASHMAP_FREE(map), "map grew after reserving");
+
+    HASHMAP_CLEAR(&map);
+    TEST_ASSERT(state, map.len == 0 && map.cap == cap, HASHMAP_FREE(map), "clear should keep capacity");
+
+    HASHMAP_FREE(map);
+    PASS();
+}
+
+SUITE_FUNC(state, hashmap)
+{
+    RUN_TEST(state, str_keys, str_lit("str keys"));
+    RUN_TEST(state, remove, str_lit("remove"));
+    RUN_TEST(state, reserve, str_lit("reserve"));
+}
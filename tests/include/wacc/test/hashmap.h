@@ -0,0 +1,5 @@
+#pragma once
+
+#include "wacc/test/test.h"
+
+SUITE_FUNC(state, hashmap);
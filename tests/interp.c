@@ -0,0 +1,129 @@
+#include "wacc/test/interp.h"
+
+#include <wacc/interp.h>
+#include <wacc/ir.h>
+
+#include <stdint.h>
+
+// fib(n) with a loop: (a, b) = (b, a + b), whose phis read each other
+static void build_fib_loop(WaccIrModule* module)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("fib"), i32, 1);
+    WaccIrBlockId head = wacc_ir_block_new(f);
+    WaccIrBlockId body = wacc_ir_block_new(f);
+    WaccIrBlockId exit = wacc_ir_block_new(f);
+    WaccIrValue n = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue zero = wacc_ir_emit_const(f, 0, i32, 0);
+    WaccIrValue one = wacc_ir_emit_const(f, 0, i32, 1);
+    wacc_ir_emit_br(f, 0, head);
+    WaccIrOperand a_in[] = {{zero, 0}, {WACC_IR_NO_VALUE, body}};
+    WaccIrOperand b_in[] = {{one, 0}, {WACC_IR_NO_VALUE, body}};
+    WaccIrOperand i_in[] = {{zero, 0}, {WACC_IR_NO_VALUE, body}};
+    WaccIrValue a = wacc_ir_emit_phi(f, head, i32, a_in, 2);
+    WaccIrValue b = wacc_ir_emit_phi(f, head, i32, b_in, 2);
+    WaccIrValue i = wacc_ir_emit_phi(f, head, i32, i_in, 2);
+    wacc_ir_emit_cbr(f, head, wacc_ir_emit_binary(f, head, WACC_IR_SLT, WACC_IR_TYPE_I1, i, n), body, exit);
+    WaccIrValue sum = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, a, b);
+    WaccIrValue i_next = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, i, one);
+    wacc_ir_emit_br(f, body, head);
+    wacc_ir_emit_ret(f, exit, a);
+    WaccIrInst* phis = f->blocks.ptr[head].insts.ptr;
+    wacc_ir_operands(f, &phis[0])[1].value = b;
+    wacc_ir_operands(f, &phis[1])[1].value = sum;
+    wacc_ir_operands(f, &phis[2])[1].value = i_next;
+    wacc_ir_compute_preds(f);
+}
+
+// fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2)
+static void build_fib_recursive(WaccIrModule* module)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    uint32_t self = (uint32_t)module->functions.len;
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("fib"), i32, 1);
+    WaccIrBlockId base = wacc_ir_block_new(f);
+    WaccIrBlockId recurse = wacc_ir_block_new(f);
+    WaccIrValue n = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue two = wacc_ir_emit_const(f, 0, i32, 2);
+    wacc_ir_emit_cbr(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_SLT, WACC_IR_TYPE_I1, n, two), base, recurse);
+    wacc_ir_emit_ret(f, base, n);
+    WaccIrValue n1 = wacc_ir_emit_binary(f, recurse, WACC_IR_SUB, i32, n, wacc_ir_emit_const(f, recurse, i32, 1));
+    WaccIrValue n2 = wacc_ir_emit_binary(f, recurse, WACC_IR_SUB, i32, n, two);
+    WaccIrValue x = wacc_ir_emit_call(f, recurse, i32, self, &n1, 1);
+    WaccIrValue y = wacc_ir_emit_call(f, recurse, i32, self, &n2, 1);
+    wacc_ir_emit_ret(f, recurse, wacc_ir_emit_binary(f, recurse, WACC_IR_ADD, i32, x, y));
+    wacc_ir_compute_preds(f);
+}
+
+static TEST_FUNC(state, loop)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_fib_loop(module);
+    WaccInterp* interp = wacc_interp_new(module, NULL);
+    wacc_ir_module_free(module);
+    int64_t n = 40;
+    WaccInterpResult result = wacc_interp_call(interp, 0, &n, 1);
+    wacc_interp_free(interp);
+    TEST_ASSERT(state,
+        result.status == WACC_INTERP_OK && result.value == 102334155,
+        NO_CLEANUP,
+        "expected fib(40) = 102334155, got %lld (%s)",
+        (long long)result.value,
+        wacc_interp_status_message(result.status));
+    PASS();
+}
+
+static TEST_FUNC(state, calls)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_fib_recursive(module);
+    WaccInterp* interp = wacc_interp_new(module, NULL);
+    wacc_ir_module_free(module);
+    int64_t n = 20;
+    WaccInterpResult result = wacc_interp_call(interp, 0, &n, 1);
+    wacc_interp_free(interp);
+    TEST_ASSERT(state,
+        result.status == WACC_INTERP_OK && result.value == 6765,
+        NO_CLEANUP,
+        "expected fib(20) = 6765, got %lld (%s)",
+        (long long)result.value,
+        wacc_interp_status_message(result.status));
+    PASS();
+}
+
+// f(x, y) = (x << 33) / y: the count wraps as on the machine, the division traps
+static TEST_FUNC(state, machine_semantics)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("f"), i32, 2);
+    WaccIrValue x = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue y = wacc_ir_emit_param(f, 0, i32, 1);
+    WaccIrValue shifted = wacc_ir_emit_binary(f, 0, WACC_IR_SHL, i32, x, wacc_ir_emit_const(f, 0, i32, 33));
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_SDIV, i32, shifted, y));
+    WaccInterp* interp = wacc_interp_new(module, NULL);
+    wacc_ir_module_free(module);
+    int64_t args[] = {3, 1};
+    WaccInterpResult shift = wacc_interp_call(interp, 0, args, 2);
+    args[1] = 0;
+    WaccInterpResult trap = wacc_interp_call(interp, 0, args, 2);
+    wacc_interp_free(interp);
+    TEST_ASSERT(state,
+        shift.status == WACC_INTERP_OK && shift.value == 6,
+        NO_CLEANUP,
+        "expected 3 << 33 to shift by 1, got %lld",
+        (long long)shift.value);
+    TEST_ASSERT(state,
+        trap.status == WACC_INTERP_ARITHMETIC_TRAP,
+        NO_CLEANUP,
+        "expected division by zero to trap, got %s",
+        wacc_interp_status_message(trap.status));
+    PASS();
+}
+
+SUITE_FUNC(state, interp)
+{
+    RUN_TEST(state, loop, str_lit("loop"));
+    RUN_TEST(state, calls, str_lit("calls"));
+    RUN_TEST(state, machine_semantics, str_lit("machine semantics"));
+}
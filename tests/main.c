@@ -1,56 +1,128 @@
 #include "process/process.h"
 #include "wacc/run.h"
+#include "wacc/test/alloc.h"
+#include "wacc/test/buf.h"
 #include "wacc/test/collect.h"
+#include "wacc/test/hashmap.h"
+#include "wacc/test/interp.h"
+#include "wacc/test/opt.h"
 #include "wacc/test/test.h"
+#include "wacc/test/x86.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-static TEST_FUNC(state, execute, TestCase test)
+// only every this many valid cases is also assembled, linked and run as a
+// process; the rest are checked against gcc through the interpreter and the jit
+enum
 {
-    char* args[] = {"wacc", "-o", "wacc.out", (char*)test.path.ptr};
-    int outpipe[2];
-    int errpipe[2];
-    assert(pipe(outpipe) == 0);
-    assert(pipe(errpipe) == 0);
-    FILE* out = fdopen(outpipe[1], "w");
-    FILE* err = fdopen(errpipe[1], "w");
-    int res = run((WaccArgBuf)BUF_ARRAY(args), out, err);
+    NATIVE_SMOKE_STRIDE = 8,
+};
+
+// run wacc in-process with `args`, leaving whatever it wrote to stdout in
+// `out` and to stderr in `err`
+static int run_wacc_to(char** args, uint64_t num_args, FILE* out, FILE* err)
+{
+    int res = run((WaccArgBuf)BUF_REF(args, num_args), out, err);
+    (void)fflush(out);
+    rewind(out);
+    (void)fflush(err);
+    rewind(err);
+    return res;
+}
+
+// run wacc in-process with `args`, leaving whatever it wrote to stderr in `err`
+static int run_wacc(char** args, uint64_t num_args, FILE* err)
+{
+    FILE* out = tmpfile();
+    assert(out != NULL);
+    int res = run_wacc_to(args, num_args, out, err);
     (void)fclose(out);
-    (void)fclose(err);
-    if (test.valid)
+    return res;
+}
+
+static void print_diagnostics(FILE* err)
+{
+    char* line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, err) != -1)
     {
-        if (res != 0)
-        {
-            if (test.skip_on_failure)
-            {
-                (void)remove("wacc.out");
-                SKIP();
-            }
-            FILE* err_in = fdopen(errpipe[0], "r");
-            char* line = NULL;
-            size_t len = 0;
-            while (getline(&line, &len, err_in) != -1)
-            {
-                (void)fprintf(stderr, "%s", line);
-            }
-            FAIL(state, CLEANUP((void)remove("wacc.out")), "wacc failed to compile valid test");
-        }
+        (void)fprintf(stderr, "%s", line);
     }
-    else
+    free(line);
+}
+
+static TEST_FUNC(state, execute, TestCase test, bool native)
+{
+    FILE* err = tmpfile();
+    assert(err != NULL);
+    if (!test.valid)
     {
+        char* args[] = {"wacc", "-o", "wacc.out", (char*)test.path.ptr};
+        int res = run_wacc(args, sizeof args / sizeof *args, err);
+        (void)fclose(err);
         TEST_ASSERT(state, res != 0, CLEANUP((void)remove("wacc.out")), "wacc compiled invalid test");
         PASS();
     }
 
-    const char* run_args[] = {"./wacc.out"};
-    ProcessCreateResult wacc_result =
-        process_run((ProcessCStrBuf)BUF_ARRAY(run_args), PROCESS_OPTION_COMBINED_STDOUT_STDERR);
-    TEST_ASSERT(state, wacc_result.present, CLEANUP((void)remove("wacc.out")), "wacc.out failed to run");
+    // the interpreter reports compile errors and traps on stderr, and otherwise
+    // exits with the status of main
+    char* interp_args[] = {"wacc", "--run", (char*)test.path.ptr};
+    int interp_code = run_wacc(interp_args, sizeof interp_args / sizeof *interp_args, err);
+    bool failed = fgetc(err) != EOF;
+    if (failed && test.skip_on_failure)
+    {
+        (void)fclose(err);
+        SKIP();
+    }
+    rewind(err);
+    print_diagnostics(err);
+    (void)fclose(err);
+    TEST_ASSERT(state, !failed, NO_CLEANUP, "wacc failed to interpret valid test");
+
+    char* jit_args[] = {"wacc", "--jit", (char*)test.path.ptr};
+    err = tmpfile();
+    assert(err != NULL);
+    int jit_code = run_wacc(jit_args, sizeof jit_args / sizeof *jit_args, err);
+    print_diagnostics(err);
+    (void)fclose(err);
+    TEST_ASSERT(state,
+        jit_code == interp_code,
+        NO_CLEANUP,
+        "jit and interpreted results differ: %d (jit) vs %d (interpreted)",
+        jit_code,
+        interp_code);
+
+    if (native)
+    {
+        char* args[] = {"wacc", "-o", "wacc.out", (char*)test.path.ptr};
+        err = tmpfile();
+        assert(err != NULL);
+        int res = run_wacc(args, sizeof args / sizeof *args, err);
+        if (res != 0)
+        {
+            print_diagnostics(err);
+        }
+        (void)fclose(err);
+        TEST_ASSERT(state, res == 0, CLEANUP((void)remove("wacc.out")), "wacc failed to compile valid test");
 
-    int wacc_code = wacc_result.value.returnCode;
-    process_destroy(&wacc_result.value);
-    (void)remove("wacc.out");
+        const char* run_args[] = {"./wacc.out"};
+        ProcessCreateResult wacc_result =
+            process_run((ProcessCStrBuf)BUF_ARRAY(run_args), PROCESS_OPTION_COMBINED_STDOUT_STDERR);
+        TEST_ASSERT(state, wacc_result.present, CLEANUP((void)remove("wacc.out")), "wacc.out failed to run");
+
+        int wacc_code = wacc_result.value.returnCode;
+        process_destroy(&wacc_result.value);
+        (void)remove("wacc.out");
+        TEST_ASSERT(state,
+            wacc_code == interp_code,
+            NO_CLEANUP,
+            "compiled and interpreted results differ: %d (compiled) vs %d (interpreted)",
+            wacc_code,
+            interp_code);
+    }
 
     const char* gcc_args[] = {"gcc", "-o", "gcc.out", (char*)test.path.ptr};
     ProcessCreateResult gcc_result = process_run(
@@ -69,21 +141,357 @@ static TEST_FUNC(state, execute, TestCase test)
     (void)remove("gcc.out");
 
     TEST_ASSERT(state,
-        wacc_code == gcc_code,
+        interp_code == gcc_code,
         NO_CLEANUP,
         "wacc and gcc produced different results: %d (wacc) vs %d (gcc)",
-        wacc_code,
+        interp_code,
         gcc_code);
     PASS();
 }
 
+// a program of whole source files, each written to a temporary file
+static bool write_program(char* path, const char* source)
+{
+    int fd = mkstemps(path, 2);
+    if (fd < 0)
+    {
+        return false;
+    }
+    FILE* file = fdopen(fd, "w");
+    if (file == NULL)
+    {
+        (void)close(fd);
+        return false;
+    }
+    (void)fputs(source, file);
+    return fclose(file) == 0;
+}
+
+// parameter lists of every form, and calls nested in the arguments of others
+static TEST_FUNC(state, functions)
+{
+    char path[] = "/tmp/wacc-functions-XXXXXX.c";
+    bool written = write_program(path,
+        "int zero() { return 0; }\n"
+        "int four(void) { return 4; }\n"
+        "int third(int a, int b, int c) { return c; }\n"
+        "int main() { return third(zero(), third(1, 2, 3), third(four(), zero(), third(5, 6, 7))); }\n");
+    TEST_ASSERT(state, written, CLEANUP((void)remove(path)), "failed to write the program");
+
+    FILE* err = tmpfile();
+    assert(err != NULL);
+    char* interp_args[] = {"wacc", "--run", path};
+    int interp_code = run_wacc(interp_args, sizeof interp_args / sizeof *interp_args, err);
+    char* jit_args[] = {"wacc", "--jit", "--optimize", "1", path};
+    int jit_code = run_wacc(jit_args, sizeof jit_args / sizeof *jit_args, err);
+    (void)fclose(err);
+    (void)remove(path);
+    TEST_ASSERT(state, interp_code == 7, NO_CLEANUP, "interpreted program returned %d", interp_code);
+    TEST_ASSERT(state, jit_code == 7, NO_CLEANUP, "optimized program returned %d", jit_code);
+    PASS();
+}
+
+typedef struct
+{
+    const char* kind;
+    const char* source;
+    // of the name reported
+    uint32_t line;
+    uint32_t col;
+} Diagnostic;
+
+static const Diagnostic DIAGNOSTICS[] = {
+    {"DUPLICATE_FUNCTION", "int f() { return 1; }\nint f() { return 2; }\nint main() { return f(); }\n", 2, 5},
+    {"DUPLICATE_PARAMETER", "int f(int a, int a) { return a; }\nint main() { return f(1, 2); }\n", 1, 18},
+    {"UNKNOWN_FUNCTION", "int main() { return g(1); }\n", 1, 21},
+    {"UNKNOWN_VARIABLE", "int f(int a) { return b; }\nint main() { return f(1); }\n", 1, 23},
+    {"WRONG_ARGUMENT_COUNT", "int f(int a) { return a; }\nint main() { return f(1, 2); }\n", 2, 21},
+};
+
+// a program that names a function or variable wrongly is rejected at the name
+static TEST_FUNC(state, diagnostic, Diagnostic diagnostic)
+{
+    char path[] = "/tmp/wacc-diagnostic-XXXXXX.c";
+    TEST_ASSERT(
+        state, write_program(path, diagnostic.source), CLEANUP((void)remove(path)), "failed to write the program");
+
+    FILE* err = tmpfile();
+    assert(err != NULL);
+    char* args[] = {"wacc", "-S", path};
+    int code = run_wacc(args, sizeof args / sizeof *args, err);
+    str expected = str_printf("%s:%u:%u: error: %s\n", path, diagnostic.line, diagnostic.col, diagnostic.kind);
+    char* line = NULL;
+    size_t len = 0;
+    bool reported = getline(&line, &len, err) != -1 && str_eq(str_ref(line), expected);
+    free(line);
+    (void)fclose(err);
+    (void)remove(path);
+    TEST_ASSERT(state, code != 0, CLEANUP(str_free(expected)), "the program compiled");
+    TEST_ASSERT(state, reported, CLEANUP(str_free(expected)), "expected " str_fmt, str_arg(expected));
+    str_free(expected);
+    PASS();
+}
+
+// a function may call one defined after it, and two may call each other,
+// except when streamed, where every callee must already have been parsed
+static TEST_FUNC(state, forward_call)
+{
+    char forward_path[] = "/tmp/wacc-forward-XXXXXX.c";
+    char mutual_path[] = "/tmp/wacc-mutual-XXXXXX.c";
+    bool written = write_program(forward_path,
+                       "int main() { return later(7, 5); }\n"
+                       "int later(int a, int b) { return b; }\n") &&
+                   write_program(mutual_path,
+                       "int main() { return ping(1); }\n"
+                       "int ping(int a) { return pong(a); }\n"
+                       "int pong(int a) { return ping(a); }\n");
+    TEST_ASSERT(state,
+        written,
+        CLEANUP(((void)remove(forward_path), (void)remove(mutual_path))),
+        "failed to write the program");
+
+    FILE* err = tmpfile();
+    assert(err != NULL);
+    char* run_args[] = {"wacc", "--run", forward_path};
+    int run_code = run_wacc(run_args, sizeof run_args / sizeof *run_args, err);
+    // never run, since neither returns
+    char* mutual_args[] = {"wacc", "-S", mutual_path};
+    int mutual_code = run_wacc(mutual_args, sizeof mutual_args / sizeof *mutual_args, err);
+    char* stream_args[] = {"wacc", "--stream", "-S", forward_path};
+    int stream_code = run_wacc(stream_args, sizeof stream_args / sizeof *stream_args, err);
+    char* line = NULL;
+    size_t len = 0;
+    bool unknown = false;
+    while (getline(&line, &len, err) != -1)
+    {
+        unknown = unknown || strstr(line, ":1:21: error: UNKNOWN_FUNCTION") != NULL;
+    }
+    free(line);
+    (void)fclose(err);
+    (void)remove(forward_path);
+    (void)remove(mutual_path);
+    TEST_ASSERT(state, run_code == 5, NO_CLEANUP, "forward call returned %d", run_code);
+    TEST_ASSERT(state, mutual_code == 0, NO_CLEANUP, "mutually recursive functions failed to compile");
+    TEST_ASSERT(state, stream_code != 0 && unknown, NO_CLEANUP, "a streamed forward call was not reported");
+    PASS();
+}
+
+// whether the files at `a` and `b` hold the same bytes
+static bool same_contents(const char* a, const char* b)
+{
+    FILE* file_a = fopen(a, "r");
+    FILE* file_b = fopen(b, "r");
+    bool same = file_a != NULL && file_b != NULL;
+    while (same)
+    {
+        int c = fgetc(file_a);
+        same = c == fgetc(file_b);
+        if (c == EOF)
+        {
+            break;
+        }
+    }
+    if (file_a != NULL)
+    {
+        (void)fclose(file_a);
+    }
+    if (file_b != NULL)
+    {
+        (void)fclose(file_b);
+    }
+    return same;
+}
+
+// Streaming writes the same assembly as compiling the whole module, reports
+// an error by its line in the file even after the lines before it were
+// dropped, and --mem-stats adds the resident peak.
+static TEST_FUNC(state, stream)
+{
+    char program_path[] = "/tmp/wacc-stream-XXXXXX.c";
+    char error_path[] = "/tmp/wacc-error-XXXXXX.c";
+    char module_asm[] = "/tmp/wacc-module-XXXXXX.s";
+    char stream_asm[] = "/tmp/wacc-stream-XXXXXX.s";
+    bool written = write_program(program_path,
+                       "int add(int a, int b) { return b; }\n"
+                       "int twice(int a) { return add(a, a); }\n"
+                       "int main() { return twice(add(1, 9)); }\n") &&
+                   write_program(error_path,
+                       "int first(int a) { return a; }\n"
+                       "int second(int a) { return first(a); }\n"
+                       "\n"
+                       "int main() { return second(b); }\n") &&
+                   write_program(module_asm, "") && write_program(stream_asm, "");
+    TEST_ASSERT(state,
+        written,
+        CLEANUP(((void)remove(program_path), (void)remove(error_path), (void)remove(module_asm),
+            (void)remove(stream_asm))),
+        "failed to write the program");
+
+    FILE* err = tmpfile();
+    assert(err != NULL);
+    char* module_args[] = {"wacc", "-S", "-o", module_asm, program_path};
+    int module_code = run_wacc(module_args, sizeof module_args / sizeof *module_args, err);
+    char* stream_args[] = {"wacc", "--stream", "-S", "-o", stream_asm, program_path};
+    int stream_code = run_wacc(stream_args, sizeof stream_args / sizeof *stream_args, err);
+    bool same = same_contents(module_asm, stream_asm);
+    char* error_args[] = {"wacc", "--stream", "-S", error_path};
+    int error_code = run_wacc(error_args, sizeof error_args / sizeof *error_args, err);
+    char* line = NULL;
+    size_t len = 0;
+    bool located = getline(&line, &len, err) != -1 && strstr(line, ":4:28: error: UNKNOWN_VARIABLE") != NULL;
+    (void)fclose(err);
+
+    err = tmpfile();
+    assert(err != NULL);
+    char* stats_args[] = {"wacc", "--stream", "-S", "--mem-stats", program_path};
+    int stats_code = run_wacc(stats_args, sizeof stats_args / sizeof *stats_args, err);
+    bool resident = false;
+    while (getline(&line, &len, err) != -1)
+    {
+        resident = resident || (strstr(line, "memory: ") != NULL && strstr(line, " KiB peak resident") != NULL);
+    }
+    free(line);
+    (void)fclose(err);
+    (void)remove(program_path);
+    (void)remove(error_path);
+    (void)remove(module_asm);
+    (void)remove(stream_asm);
+    TEST_ASSERT(state,
+        module_code == 0 && stream_code == 0,
+        NO_CLEANUP,
+        "compiling returned %d (module) vs %d (streamed)",
+        module_code,
+        stream_code);
+    TEST_ASSERT(state, same, NO_CLEANUP, "streamed assembly differs from the whole module's");
+    TEST_ASSERT(state, error_code != 0 && located, NO_CLEANUP, "the streamed error was not reported at 4:28");
+    TEST_ASSERT(state, stats_code == 0 && resident, NO_CLEANUP, "--mem-stats did not report the resident peak");
+    PASS();
+}
+
+// main calls into a file that comes after its own, whose functions are then
+// inlined into it; a second file defining the same function is an error
+static TEST_FUNC(state, whole_program)
+{
+    char main_path[] = "/tmp/wacc-main-XXXXXX.c";
+    char lib_path[] = "/tmp/wacc-lib-XXXXXX.c";
+    char dup_path[] = "/tmp/wacc-dup-XXXXXX.c";
+    bool written = write_program(main_path, "int main() { return twice(add(21, 1)); }\n") &&
+                   write_program(lib_path,
+                       "int add(int a, int b) { return a; }\n"
+                       "int twice(int a) { return add(a, a); }\n") &&
+                   write_program(dup_path, "int add(int a, int b) { return b; }\n");
+    TEST_ASSERT(state,
+        written,
+        CLEANUP(((void)remove(main_path), (void)remove(lib_path), (void)remove(dup_path))),
+        "failed to write the program");
+    char with_dup[sizeof lib_path + sizeof dup_path];
+    (void)snprintf(with_dup, sizeof with_dup, "%s,%s", lib_path, dup_path);
+
+    FILE* err = tmpfile();
+    assert(err != NULL);
+    char* interp_args[] = {"wacc", "--run", "--whole-program", "--with", lib_path, main_path};
+    int interp_code = run_wacc(interp_args, sizeof interp_args / sizeof *interp_args, err);
+    char* jit_args[] = {"wacc", "--jit", "--optimize", "1", "--whole-program", "--with", lib_path, main_path};
+    int jit_code = run_wacc(jit_args, sizeof jit_args / sizeof *jit_args, err);
+    char* dup_args[] = {"wacc", "--run", "--whole-program", "--with", with_dup, main_path};
+    int dup_code = run_wacc(dup_args, sizeof dup_args / sizeof *dup_args, err);
+    (void)fclose(err);
+
+    // add and twice are inlined into main across the files, then removed
+    FILE* out = tmpfile();
+    err = tmpfile();
+    assert(out != NULL && err != NULL);
+    char* ir_args[] = {
+        "wacc", "--ir", "--optimize", "1", "--opt-stats", "--whole-program", "--with", lib_path, main_path};
+    int ir_code = run_wacc_to(ir_args, sizeof ir_args / sizeof *ir_args, out, err);
+    size_t inlined = 0;
+    size_t removed = 0;
+    bool counted = fscanf(err, "opt: %zu inlined, %*u folded, %*u branches resolved, %*u instructions removed, "
+                               "%*u blocks removed, %zu functions removed", &inlined, &removed) == 2;
+    char* line = NULL;
+    size_t len = 0;
+    size_t functions = 0;
+    bool only_main = true;
+    while (getline(&line, &len, out) != -1)
+    {
+        if (strncmp(line, "function ", strlen("function ")) == 0)
+        {
+            functions++;
+            only_main = only_main && strncmp(line, "function main(", strlen("function main(")) == 0;
+        }
+    }
+    free(line);
+    (void)fclose(out);
+    (void)fclose(err);
+    (void)remove(main_path);
+    (void)remove(lib_path);
+    (void)remove(dup_path);
+    TEST_ASSERT(state, interp_code == 21, NO_CLEANUP, "interpreted whole program returned %d", interp_code);
+    TEST_ASSERT(state, jit_code == 21, NO_CLEANUP, "optimized whole program returned %d", jit_code);
+    TEST_ASSERT(state, dup_code != 0, NO_CLEANUP, "a function defined in two files compiled");
+    TEST_ASSERT(state,
+        ir_code == 0 && counted && inlined == 3 && removed == 2,
+        NO_CLEANUP,
+        "expected the 3 calls inlined and 2 functions removed, got %zu and %zu",
+        inlined,
+        removed);
+    TEST_ASSERT(state, functions == 1 && only_main, NO_CLEANUP, "expected only main left in the module");
+    PASS();
+}
+
+// a profile written by an instrumented run is read back when the same program
+// is compiled again, and refused for another program
+static TEST_FUNC(state, profile)
+{
+    char program_path[] = "/tmp/wacc-program-XXXXXX.c";
+    char other_path[] = "/tmp/wacc-other-XXXXXX.c";
+    char profile_path[] = "/tmp/wacc-profile-XXXXXX";
+    int fd = mkstemp(profile_path);
+    bool written = fd >= 0 && close(fd) == 0 &&
+                   write_program(program_path,
+                       "int add(int a, int b) { return b; }\n"
+                       "int main() { return add(1, add(2, 3)); }\n") &&
+                   write_program(other_path, "int main() { return 3; }\n");
+    TEST_ASSERT(state,
+        written,
+        CLEANUP(((void)remove(program_path), (void)remove(other_path), (void)remove(profile_path))),
+        "failed to write the program");
+
+    FILE* err = tmpfile();
+    assert(err != NULL);
+    char* generate_args[] = {"wacc", "--run", "--profile-generate", profile_path, program_path};
+    int generate_code = run_wacc(generate_args, sizeof generate_args / sizeof *generate_args, err);
+    char* use_args[] = {"wacc", "--jit", "--optimize", "1", "--profile-use", profile_path, program_path};
+    int use_code = run_wacc(use_args, sizeof use_args / sizeof *use_args, err);
+    char* other_args[] = {"wacc", "--run", "--profile-use", profile_path, other_path};
+    int other_code = run_wacc(other_args, sizeof other_args / sizeof *other_args, err);
+    (void)fclose(err);
+    (void)remove(program_path);
+    (void)remove(other_path);
+    (void)remove(profile_path);
+    TEST_ASSERT(state, generate_code == 3, NO_CLEANUP, "instrumented program returned %d", generate_code);
+    TEST_ASSERT(state, use_code == 3, NO_CLEANUP, "program compiled with its profile returned %d", use_code);
+    TEST_ASSERT(state, other_code != 0, NO_CLEANUP, "the profile of another program was accepted");
+    PASS();
+}
+
 static SUITE_FUNC(state, wacc)
 {
+    RUN_TEST(state, functions, str_lit("functions"));
+    for (uint64_t i = 0; i < sizeof DIAGNOSTICS / sizeof *DIAGNOSTICS; i++)
+    {
+        RUN_TEST(state, diagnostic, str_printf("diagnostic %s", DIAGNOSTICS[i].kind), DIAGNOSTICS[i]);
+    }
+    RUN_TEST(state, forward_call, str_lit("forward call"));
+    RUN_TEST(state, stream, str_lit("stream"));
+    RUN_TEST(state, whole_program, str_lit("whole program"));
+    RUN_TEST(state, profile, str_lit("profile"));
     TestCaseBuf cases = collect_tests();
     for (uint64_t i = 0; i < cases.len; i++)
     {
         TestCase test = cases.ptr[i];
-        RUN_TEST(state, execute, str_printf("test case " str_fmt, str_arg(test.path)), test);
+        bool native = i % NATIVE_SMOKE_STRIDE == 0;
+        RUN_TEST(state, execute, str_printf("test case " str_fmt, str_arg(test.path)), test, native);
         str_free(test.path);
     }
     BUF_FREE(cases);
@@ -91,6 +499,12 @@ static SUITE_FUNC(state, wacc)
 
 static void run_all(TestState* state)
 {
+    RUN_SUITE(state, alloc, str_lit("alloc"));
+    RUN_SUITE(state, buf, str_lit("buf"));
+    RUN_SUITE(state, hashmap, str_lit("hashmap"));
+    RUN_SUITE(state, opt, str_lit("opt"));
+    RUN_SUITE(state, x86, str_lit("x86"));
+    RUN_SUITE(state, interp, str_lit("interp"));
     RUN_SUITE(state, wacc, str_lit("wacc"));
 }
 
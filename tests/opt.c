@@ -0,0 +1,742 @@
+#include "wacc/test/opt.h"
+
+#include <wacc/ir.h>
+#include <wacc/opt.h>
+#include <wacc/x86.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static TEST_FUNC(state, fold)
+{
+    static const struct
+    {
+        WaccIrOpcode op;
+        WaccIrType type;
+        int64_t a;
+        int64_t b;
+        bool folds;
+        int64_t expected;
+    } cases[] = {
+        {WACC_IR_ADD, WACC_IR_TYPE_I32, INT32_MAX, 1, true, INT32_MIN},
+        {WACC_IR_MUL, WACC_IR_TYPE_I32, 65536, 65536, true, 0},
+        {WACC_IR_SUB, WACC_IR_TYPE_I64, INT64_MIN, 1, true, INT64_MAX},
+        {WACC_IR_NEG, WACC_IR_TYPE_I32, INT32_MIN, 0, true, INT32_MIN},
+        {WACC_IR_SDIV, WACC_IR_TYPE_I32, -7, 2, true, -3},
+        {WACC_IR_SREM, WACC_IR_TYPE_I32, -7, 2, true, -1},
+        {WACC_IR_SDIV, WACC_IR_TYPE_I32, 1, 0, false, 0},
+        {WACC_IR_SREM, WACC_IR_TYPE_I32, INT32_MIN, -1, false, 0},
+        {WACC_IR_UDIV, WACC_IR_TYPE_I32, -1, 2, true, INT32_MAX},
+        {WACC_IR_UREM, WACC_IR_TYPE_I32, 7, 0, false, 0},
+        {WACC_IR_SHL, WACC_IR_TYPE_I32, 1, 31, true, INT32_MIN},
+        {WACC_IR_SHL, WACC_IR_TYPE_I32, 1, 32, false, 0},
+        {WACC_IR_SAR, WACC_IR_TYPE_I32, -8, 1, true, -4},
+        {WACC_IR_SHR, WACC_IR_TYPE_I32, -8, 28, true, 15},
+        {WACC_IR_SHR, WACC_IR_TYPE_I32, 8, -1, false, 0},
+        {WACC_IR_SLT, WACC_IR_TYPE_I32, -1, 0, true, 1},
+        {WACC_IR_ULT, WACC_IR_TYPE_I32, -1, 0, true, 0},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        WaccIrType result_type = wacc_ir_has_flag(cases[i].op, WACC_IR_COMPARE) ? WACC_IR_TYPE_I1 : cases[i].type;
+        int64_t result = 0;
+        bool folds = wacc_ir_fold(cases[i].op, result_type, cases[i].type, cases[i].a, cases[i].b, &result);
+        TEST_ASSERT(state,
+            folds == cases[i].folds && (!folds || result == cases[i].expected),
+            NO_CLEANUP,
+            "case %zu: %s %lld, %lld gave %s %lld",
+            i,
+            wacc_ir_opcodes[cases[i].op].name,
+            (long long)cases[i].a,
+            (long long)cases[i].b,
+            folds ? "folded" : "not folded",
+            (long long)result);
+    }
+    PASS();
+}
+
+// the value returned by the single `ret` of `function`, if it is a constant
+static bool returned_constant(const WaccIrFunction* function, int64_t* value)
+{
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccIrBlock* block = &function->blocks.ptr[b];
+        const WaccIrInst* ret = &block->insts.ptr[block->insts.len - 1];
+        if (ret->op != WACC_IR_RET)
+        {
+            continue;
+        }
+        for (uint64_t d = 0; d < function->blocks.len; d++)
+        {
+            const WaccIrInstBuf* insts = &function->blocks.ptr[d].insts;
+            for (uint64_t i = 0; i < insts->len; i++)
+            {
+                if (insts->ptr[i].dest == ret->args[0])
+                {
+                    *value = insts->ptr[i].imm;
+                    return insts->ptr[i].op == WACC_IR_CONST;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// x = 10; y = x > 5 ? x * 2 : x / 0; return y + 1;
+static TEST_FUNC(state, sccp_branch)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("branch"), WACC_IR_TYPE_I32, 0);
+    WaccIrBlockId entry = 0;
+    WaccIrBlockId then = wacc_ir_block_new(f);
+    WaccIrBlockId other = wacc_ir_block_new(f);
+    WaccIrBlockId join = wacc_ir_block_new(f);
+    WaccIrValue x = wacc_ir_emit_const(f, entry, WACC_IR_TYPE_I32, 10);
+    WaccIrValue five = wacc_ir_emit_const(f, entry, WACC_IR_TYPE_I32, 5);
+    WaccIrValue cond = wacc_ir_emit_binary(f, entry, WACC_IR_SGT, WACC_IR_TYPE_I1, x, five);
+    wacc_ir_emit_cbr(f, entry, cond, then, other);
+    WaccIrValue two = wacc_ir_emit_const(f, then, WACC_IR_TYPE_I32, 2);
+    WaccIrValue y1 = wacc_ir_emit_binary(f, then, WACC_IR_MUL, WACC_IR_TYPE_I32, x, two);
+    wacc_ir_emit_br(f, then, join);
+    WaccIrValue zero = wacc_ir_emit_const(f, other, WACC_IR_TYPE_I32, 0);
+    WaccIrValue y2 = wacc_ir_emit_binary(f, other, WACC_IR_SDIV, WACC_IR_TYPE_I32, x, zero);
+    wacc_ir_emit_br(f, other, join);
+    WaccIrOperand incoming[] = {{y1, then}, {y2, other}};
+    WaccIrValue y = wacc_ir_emit_phi(f, join, WACC_IR_TYPE_I32, incoming, 2);
+    WaccIrValue one = wacc_ir_emit_const(f, join, WACC_IR_TYPE_I32, 1);
+    wacc_ir_emit_ret(f, join, wacc_ir_emit_binary(f, join, WACC_IR_ADD, WACC_IR_TYPE_I32, y, one));
+    wacc_ir_compute_preds(f);
+
+    WaccOptStats stats = {0};
+    wacc_opt_sccp(f, &stats);
+    wacc_ir_compute_preds(f);
+    int64_t value = 0;
+    TEST_ASSERT(state, wacc_ir_verify(f, stderr), wacc_ir_module_free(module), "invalid IR after sccp");
+    TEST_ASSERT(state,
+        returned_constant(f, &value) && value == 21,
+        wacc_ir_module_free(module),
+        "expected the function to return the constant 21");
+    TEST_ASSERT(state,
+        stats.branches_resolved == 1,
+        wacc_ir_module_free(module),
+        "expected 1 resolved branch, got %zu",
+        stats.branches_resolved);
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+// k = 1; while (n) k = k * 1; return k;
+static TEST_FUNC(state, sccp_loop)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("loop"), WACC_IR_TYPE_I32, 1);
+    WaccIrBlockId entry = 0;
+    WaccIrBlockId head = wacc_ir_block_new(f);
+    WaccIrBlockId body = wacc_ir_block_new(f);
+    WaccIrBlockId exit = wacc_ir_block_new(f);
+    WaccIrValue n = wacc_ir_emit_param(f, entry, WACC_IR_TYPE_I32, 0);
+    WaccIrValue one = wacc_ir_emit_const(f, entry, WACC_IR_TYPE_I32, 1);
+    wacc_ir_emit_br(f, entry, head);
+    WaccIrOperand incoming[] = {{one, entry}, {WACC_IR_NO_VALUE, body}};
+    WaccIrValue k = wacc_ir_emit_phi(f, head, WACC_IR_TYPE_I32, incoming, 2);
+    WaccIrValue zero = wacc_ir_emit_const(f, head, WACC_IR_TYPE_I32, 0);
+    wacc_ir_emit_cbr(f, head, wacc_ir_emit_binary(f, head, WACC_IR_NE, WACC_IR_TYPE_I1, n, zero), body, exit);
+    WaccIrValue k2 = wacc_ir_emit_binary(f, body, WACC_IR_MUL, WACC_IR_TYPE_I32, k, one);
+    wacc_ir_emit_br(f, body, head);
+    wacc_ir_emit_ret(f, exit, k);
+    wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[0])[1].value = k2;
+    wacc_ir_compute_preds(f);
+
+    WaccOptStats stats = {0};
+    wacc_opt_sccp(f, &stats);
+    wacc_ir_compute_preds(f);
+    int64_t value = 0;
+    TEST_ASSERT(state, wacc_ir_verify(f, stderr), wacc_ir_module_free(module), "invalid IR after sccp");
+    TEST_ASSERT(state,
+        returned_constant(f, &value) && value == 1,
+        wacc_ir_module_free(module),
+        "expected the function to return the constant 1");
+    TEST_ASSERT(state,
+        stats.folded == 2 && stats.removed == 2,
+        wacc_ir_module_free(module),
+        "expected 2 folded and 2 removed, got %zu and %zu",
+        stats.folded,
+        stats.removed);
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+// return 10 / 0;
+static TEST_FUNC(state, sccp_trap)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("trap"), WACC_IR_TYPE_I32, 0);
+    WaccIrValue ten = wacc_ir_emit_const(f, 0, WACC_IR_TYPE_I32, 10);
+    WaccIrValue zero = wacc_ir_emit_const(f, 0, WACC_IR_TYPE_I32, 0);
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_SDIV, WACC_IR_TYPE_I32, ten, zero));
+
+    WaccOptStats stats = {0};
+    wacc_opt_sccp(f, &stats);
+    TEST_ASSERT(state,
+        stats.folded == 0 && f->blocks.ptr[0].insts.ptr[2].op == WACC_IR_SDIV,
+        wacc_ir_module_free(module),
+        "the division by zero should be left to run time");
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+static size_t count_calls(const WaccIrFunction* function)
+{
+    size_t calls = 0;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccIrInstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            calls += insts->ptr[i].op == WACC_IR_CALL;
+        }
+    }
+    return calls;
+}
+
+static bool verify_module(const WaccIrModule* module)
+{
+    bool ok = true;
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        ok = wacc_ir_verify(module->functions.ptr[i], stderr) && ok;
+    }
+    return ok;
+}
+
+// abs(p) { if (p < 0) return -p; return p; }
+static void build_abs(WaccIrModule* module, str name, bool exported)
+{
+    WaccIrFunction* f = wacc_ir_function_new(module, name, WACC_IR_TYPE_I32, 1);
+    f->exported = exported;
+    WaccIrBlockId negative = wacc_ir_block_new(f);
+    WaccIrBlockId positive = wacc_ir_block_new(f);
+    WaccIrValue p = wacc_ir_emit_param(f, 0, WACC_IR_TYPE_I32, 0);
+    WaccIrValue zero = wacc_ir_emit_const(f, 0, WACC_IR_TYPE_I32, 0);
+    wacc_ir_emit_cbr(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_SLT, WACC_IR_TYPE_I1, p, zero), negative, positive);
+    wacc_ir_emit_ret(f, negative, wacc_ir_emit_unary(f, negative, WACC_IR_NEG, WACC_IR_TYPE_I32, p));
+    wacc_ir_emit_ret(f, positive, p);
+    wacc_ir_compute_preds(f);
+}
+
+// add1(p) { return p + 1; } main() { return add1(41) * add1(1); }
+static TEST_FUNC(state, inline_small)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* main_function = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    WaccIrFunction* add1 = wacc_ir_function_new(module, str_lit("add1"), i32, 1);
+    WaccIrValue p = wacc_ir_emit_param(add1, 0, i32, 0);
+    wacc_ir_emit_ret(add1, 0, wacc_ir_emit_binary(add1, 0, WACC_IR_ADD, i32, p, wacc_ir_emit_const(add1, 0, i32, 1)));
+    wacc_ir_compute_preds(add1);
+    WaccIrValue a = wacc_ir_emit_const(main_function, 0, i32, 41);
+    WaccIrValue b = wacc_ir_emit_const(main_function, 0, i32, 1);
+    WaccIrValue x = wacc_ir_emit_call(main_function, 0, i32, 1, &a, 1);
+    WaccIrValue y = wacc_ir_emit_call(main_function, 0, i32, 1, &b, 1);
+    wacc_ir_emit_ret(main_function, 0, wacc_ir_emit_binary(main_function, 0, WACC_IR_MUL, i32, x, y));
+    wacc_ir_compute_preds(main_function);
+
+    WaccOptOptions options = {.level = 1, .inline_threshold = WACC_OPT_DEFAULT_INLINE_THRESHOLD};
+    WaccOptStats stats = {0};
+    wacc_opt_module(module, &options, &stats);
+    int64_t value = 0;
+    TEST_ASSERT(state, verify_module(module), wacc_ir_module_free(module), "invalid IR after inlining");
+    TEST_ASSERT(state,
+        stats.inlined == 2 && count_calls(main_function) == 0,
+        wacc_ir_module_free(module),
+        "expected both calls to be inlined, %zu were",
+        stats.inlined);
+    TEST_ASSERT(state,
+        returned_constant(main_function, &value) && value == 84,
+        wacc_ir_module_free(module),
+        "expected the inlined calls to fold to 84");
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+// main() { return abs(-5) + exported_abs(-7); } with no size budget: only the
+// static function with a single call site is inlined
+static TEST_FUNC(state, inline_single_site)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* main_function = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    build_abs(module, str_lit("abs"), false);
+    build_abs(module, str_lit("exported_abs"), true);
+    WaccIrValue a = wacc_ir_emit_const(main_function, 0, i32, -5);
+    WaccIrValue b = wacc_ir_emit_const(main_function, 0, i32, -7);
+    WaccIrValue x = wacc_ir_emit_call(main_function, 0, i32, 1, &a, 1);
+    WaccIrValue y = wacc_ir_emit_call(main_function, 0, i32, 2, &b, 1);
+    wacc_ir_emit_ret(main_function, 0, wacc_ir_emit_binary(main_function, 0, WACC_IR_ADD, i32, x, y));
+    wacc_ir_compute_preds(main_function);
+
+    WaccOptOptions options = {.level = 1, .inline_threshold = 0};
+    WaccOptStats stats = {0};
+    wacc_opt_inline(module, &options, &stats);
+    TEST_ASSERT(state, verify_module(module), wacc_ir_module_free(module), "invalid IR after inlining");
+    TEST_ASSERT(state,
+        stats.inlined == 1 && count_calls(main_function) == 1,
+        wacc_ir_module_free(module),
+        "expected only the static function to be inlined, %zu calls were",
+        stats.inlined);
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+// fact(n) { if (n < 2) return 1; return n * fact(n - 1); } main() { return fact(5); }
+static TEST_FUNC(state, inline_recursive)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* main_function = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    WaccIrFunction* fact = wacc_ir_function_new(module, str_lit("fact"), i32, 1);
+    WaccIrBlockId base = wacc_ir_block_new(fact);
+    WaccIrBlockId step = wacc_ir_block_new(fact);
+    WaccIrValue n = wacc_ir_emit_param(fact, 0, i32, 0);
+    WaccIrValue one = wacc_ir_emit_const(fact, 0, i32, 1);
+    WaccIrValue two = wacc_ir_emit_const(fact, 0, i32, 2);
+    wacc_ir_emit_cbr(fact, 0, wacc_ir_emit_binary(fact, 0, WACC_IR_SLT, WACC_IR_TYPE_I1, n, two), base, step);
+    wacc_ir_emit_ret(fact, base, one);
+    WaccIrValue m = wacc_ir_emit_binary(fact, step, WACC_IR_SUB, i32, n, one);
+    WaccIrValue r = wacc_ir_emit_call(fact, step, i32, 1, &m, 1);
+    wacc_ir_emit_ret(fact, step, wacc_ir_emit_binary(fact, step, WACC_IR_MUL, i32, n, r));
+    wacc_ir_compute_preds(fact);
+    WaccIrValue five = wacc_ir_emit_const(main_function, 0, i32, 5);
+    wacc_ir_emit_ret(main_function, 0, wacc_ir_emit_call(main_function, 0, i32, 1, &five, 1));
+    wacc_ir_compute_preds(main_function);
+
+    WaccOptOptions options = {.level = 1, .inline_threshold = 1000};
+    WaccOptStats stats = {0};
+    wacc_opt_inline(module, &options, &stats);
+    TEST_ASSERT(state, verify_module(module), wacc_ir_module_free(module), "invalid IR after inlining");
+    TEST_ASSERT(state,
+        count_calls(fact) == 1,
+        wacc_ir_module_free(module),
+        "expected the recursive call to stay out of line");
+    TEST_ASSERT(state,
+        stats.inlined == 1 && count_calls(main_function) == 1,
+        wacc_ir_module_free(module),
+        "expected fact to be inlined into main once, %zu calls were",
+        stats.inlined);
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+// n = p; i = 0; unused = 0; while (i < n) { i = i + 1; unused = unused + 1; } return i;
+// followed by a block nothing branches to
+static TEST_FUNC(state, dce)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("count"), i32, 1);
+    WaccIrBlockId entry = 0;
+    WaccIrBlockId head = wacc_ir_block_new(f);
+    WaccIrBlockId body = wacc_ir_block_new(f);
+    WaccIrBlockId unreachable = wacc_ir_block_new(f);
+    WaccIrBlockId exit = wacc_ir_block_new(f);
+    WaccIrValue n = wacc_ir_emit_param(f, entry, i32, 0);
+    WaccIrValue zero = wacc_ir_emit_const(f, entry, i32, 0);
+    wacc_ir_emit_br(f, entry, head);
+    WaccIrOperand incoming[] = {{zero, entry}, {WACC_IR_NO_VALUE, body}};
+    WaccIrValue i = wacc_ir_emit_phi(f, head, i32, incoming, 2);
+    WaccIrValue unused = wacc_ir_emit_phi(f, head, i32, incoming, 2);
+    wacc_ir_emit_cbr(f, head, wacc_ir_emit_binary(f, head, WACC_IR_SLT, WACC_IR_TYPE_I1, i, n), body, exit);
+    WaccIrValue one = wacc_ir_emit_const(f, body, i32, 1);
+    WaccIrValue i_next = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, i, one);
+    WaccIrValue unused_next = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, unused, one);
+    wacc_ir_emit_br(f, body, head);
+    wacc_ir_emit_ret(f, unreachable, wacc_ir_emit_const(f, unreachable, i32, 7));
+    wacc_ir_emit_ret(f, exit, i);
+    wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[0])[1].value = i_next;
+    wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[1])[1].value = unused_next;
+    wacc_ir_compute_preds(f);
+
+    WaccOptStats stats = {0};
+    wacc_opt_dce(f, &stats);
+    bool unused_left = false;
+    for (uint64_t b = 0; b < f->blocks.len; b++)
+    {
+        const WaccIrInstBuf* insts = &f->blocks.ptr[b].insts;
+        for (uint64_t k = 0; k < insts->len; k++)
+        {
+            unused_left |= insts->ptr[k].dest == unused || insts->ptr[k].dest == unused_next;
+        }
+    }
+    TEST_ASSERT(state, wacc_ir_verify(f, stderr), wacc_ir_module_free(module), "invalid IR after dce");
+    TEST_ASSERT(state,
+        stats.blocks_removed == 1 && f->blocks.len == 4,
+        wacc_ir_module_free(module),
+        "expected the unreachable block to be removed, %zu were",
+        stats.blocks_removed);
+    TEST_ASSERT(state,
+        !unused_left && stats.removed == 2,
+        wacc_ir_module_free(module),
+        "expected the unused counter to be removed, %zu instructions were",
+        stats.removed);
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+// main() calls the static helper(); the static unused() calls the static
+// unused_callee(); api() is exported
+static TEST_FUNC(state, dce_functions)
+{
+    static const struct
+    {
+        const char* name;
+        bool exported;
+        // index of the function called, or -1
+        int callee;
+    } functions[] = {
+        {"main", true, 2},
+        {"unused", false, 3},
+        {"helper", false, -1},
+        {"unused_callee", false, -1},
+        {"api", true, -1},
+    };
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    for (size_t k = 0; k < sizeof(functions) / sizeof(functions[0]); k++)
+    {
+        WaccIrFunction* f = wacc_ir_function_new(module, str_ref(functions[k].name), i32, 0);
+        f->exported = functions[k].exported;
+        if (functions[k].callee < 0)
+        {
+            wacc_ir_emit_ret(f, 0, wacc_ir_emit_const(f, 0, i32, (int64_t)k));
+        }
+        else
+        {
+            wacc_ir_emit_ret(f, 0, wacc_ir_emit_call(f, 0, i32, (uint32_t)functions[k].callee, NULL, 0));
+        }
+        wacc_ir_compute_preds(f);
+    }
+
+    WaccOptStats stats = {0};
+    wacc_opt_remove_dead_functions(module, &stats);
+    bool kept = module->functions.len == 3 && str_eq(module->functions.ptr[0]->name, str_lit("main")) &&
+                str_eq(module->functions.ptr[1]->name, str_lit("helper")) &&
+                str_eq(module->functions.ptr[2]->name, str_lit("api"));
+    const WaccIrInst* call = &module->functions.ptr[0]->blocks.ptr[0].insts.ptr[0];
+    bool renumbered = kept && call->op == WACC_IR_CALL && call->imm == 1;
+    wacc_ir_module_free(module);
+    TEST_ASSERT(state,
+        kept && stats.functions_removed == 2,
+        NO_CLEANUP,
+        "expected main, helper and api to remain, %zu functions were removed",
+        stats.functions_removed);
+    TEST_ASSERT(state, renumbered, NO_CLEANUP, "expected the call in main to name helper by its new index");
+    PASS();
+}
+
+// s = flag ? 0 : 1; for (i = 0; i < n; i++) s += a * b + i * a; return s;
+// with the loop entered from both arms of the branch on flag
+static TEST_FUNC(state, loops)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("loop"), i32, 4);
+    WaccIrBlockId entry = 0;
+    WaccIrBlockId left = wacc_ir_block_new(f);
+    WaccIrBlockId right = wacc_ir_block_new(f);
+    WaccIrBlockId head = wacc_ir_block_new(f);
+    WaccIrBlockId body = wacc_ir_block_new(f);
+    WaccIrBlockId exit = wacc_ir_block_new(f);
+    WaccIrValue a = wacc_ir_emit_param(f, entry, i32, 0);
+    WaccIrValue b = wacc_ir_emit_param(f, entry, i32, 1);
+    WaccIrValue n = wacc_ir_emit_param(f, entry, i32, 2);
+    WaccIrValue flag = wacc_ir_emit_param(f, entry, i32, 3);
+    WaccIrValue zero = wacc_ir_emit_const(f, entry, i32, 0);
+    WaccIrValue one = wacc_ir_emit_const(f, entry, i32, 1);
+    wacc_ir_emit_cbr(f, entry, wacc_ir_emit_binary(f, entry, WACC_IR_NE, WACC_IR_TYPE_I1, flag, zero), left, right);
+    wacc_ir_emit_br(f, left, head);
+    wacc_ir_emit_br(f, right, head);
+    WaccIrOperand i_in[] = {{zero, left}, {zero, right}, {WACC_IR_NO_VALUE, body}};
+    WaccIrOperand s_in[] = {{zero, left}, {one, right}, {WACC_IR_NO_VALUE, body}};
+    WaccIrValue i = wacc_ir_emit_phi(f, head, i32, i_in, 3);
+    WaccIrValue sum = wacc_ir_emit_phi(f, head, i32, s_in, 3);
+    wacc_ir_emit_cbr(f, head, wacc_ir_emit_binary(f, head, WACC_IR_SLT, WACC_IR_TYPE_I1, i, n), body, exit);
+    WaccIrValue t = wacc_ir_emit_binary(f, body, WACC_IR_MUL, i32, a, b);
+    WaccIrValue u = wacc_ir_emit_binary(f, body, WACC_IR_MUL, i32, a, i);
+    WaccIrValue v = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, t, u);
+    WaccIrValue sum_next = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, sum, v);
+    WaccIrValue i_next = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, i, wacc_ir_emit_const(f, body, i32, 1));
+    wacc_ir_emit_br(f, body, head);
+    wacc_ir_emit_ret(f, exit, sum);
+    wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[0])[2].value = i_next;
+    wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[1])[2].value = sum_next;
+    wacc_ir_compute_preds(f);
+    uint64_t num_blocks = f->blocks.len;
+
+    WaccOptStats stats = {0};
+    wacc_opt_loops(f, &stats);
+    wacc_ir_compute_preds(f);
+    size_t multiplies = 0;
+    WaccIrBlockId in_loop[] = {head, body};
+    for (size_t k = 0; k < 2; k++)
+    {
+        const WaccIrInstBuf* insts = &f->blocks.ptr[in_loop[k]].insts;
+        for (uint64_t j = 0; j < insts->len; j++)
+        {
+            multiplies += insts->ptr[j].op == WACC_IR_MUL;
+        }
+    }
+    TEST_ASSERT(state, wacc_ir_verify(f, stderr), wacc_ir_module_free(module), "invalid IR after loop optimization");
+    TEST_ASSERT(state,
+        f->blocks.len == num_blocks + 1,
+        wacc_ir_module_free(module),
+        "expected a preheader to be added");
+    TEST_ASSERT(state,
+        stats.hoisted == 1 && stats.ivs_reduced == 1 && multiplies == 0,
+        wacc_ir_module_free(module),
+        "expected a * b hoisted and i * a reduced, got %zu hoisted, %zu reduced, %zu multiplications left",
+        stats.hoisted,
+        stats.ivs_reduced,
+        multiplies);
+    wacc_ir_module_free(module);
+    PASS();
+}
+
+// run the straight-line function `f` on `x` with wacc_ir_fold; false if an
+// instruction does not fold
+static bool evaluate(const WaccIrFunction* f, int64_t x, int64_t* result)
+{
+    int64_t* values = calloc(f->value_types.len, sizeof(int64_t));
+    const WaccIrInstBuf* insts = &f->blocks.ptr[0].insts;
+    bool ok = true;
+    for (uint64_t i = 0; i < insts->len && ok; i++)
+    {
+        const WaccIrInst* inst = &insts->ptr[i];
+        switch (inst->op)
+        {
+            case WACC_IR_CONST:
+                values[inst->dest] = inst->imm;
+                break;
+            case WACC_IR_PARAM:
+                values[inst->dest] = wacc_ir_normalize(inst->type, x);
+                break;
+            case WACC_IR_RET:
+                *result = values[inst->args[0]];
+                break;
+            default:
+                ok = wacc_ir_fold(inst->op,
+                    inst->type,
+                    wacc_ir_value_type(f, inst->args[0]),
+                    values[inst->args[0]],
+                    wacc_ir_opcodes[inst->op].num_args == 2 ? values[inst->args[1]] : 0,
+                    &values[inst->dest]);
+                break;
+        }
+    }
+    free(values);
+    return ok;
+}
+
+static const int64_t strength_edges[] = {0, 1, 2, 3, 5, 6, 7, 9, 10, 11, 12, 13, 25, 60, 100, 641, 1000, 6700417,
+    1000000007, INT32_MAX - 1, INT32_MAX, (int64_t)INT32_MAX + 1, UINT32_MAX - 1, UINT32_MAX, (int64_t)UINT32_MAX + 1,
+    INT64_MAX / 3, INT64_MAX - 1, INT64_MAX};
+
+static const WaccIrType strength_types[] = {WACC_IR_TYPE_I32, WACC_IR_TYPE_I64};
+
+enum
+{
+    NUM_STRENGTH_VALUES = sizeof(strength_edges) / sizeof(strength_edges[0]) * 4,
+};
+
+// the edge values, their negations and their neighbours, and powers of two
+static void strength_values(int64_t* values)
+{
+    for (size_t i = 0; i < NUM_STRENGTH_VALUES / 4; i++)
+    {
+        values[4 * i] = strength_edges[i];
+        values[4 * i + 1] = (int64_t)(0 - (uint64_t)strength_edges[i]);
+        values[4 * i + 2] = (int64_t)(0 - (uint64_t)strength_edges[i] - 1);
+        values[4 * i + 3] = (int64_t)((uint64_t)1 << (i % 64));
+    }
+}
+
+// every operation against every divisor and dividend in a set of edge values,
+// reduced and evaluated instruction by instruction against the hardware result
+static TEST_FUNC(state, strength_exhaustive)
+{
+    static const WaccIrOpcode ops[] = {WACC_IR_MUL, WACC_IR_SDIV, WACC_IR_UDIV, WACC_IR_SREM, WACC_IR_UREM};
+    int64_t values[NUM_STRENGTH_VALUES];
+    strength_values(values);
+    size_t reduced = 0;
+    for (size_t t = 0; t < sizeof(strength_types) / sizeof(strength_types[0]); t++)
+    {
+        for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+        {
+            for (size_t di = 0; di < NUM_STRENGTH_VALUES; di++)
+            {
+                WaccIrType type = strength_types[t];
+                int64_t d = wacc_ir_normalize(type, values[di]);
+                WaccIrModule* module = wacc_ir_module_new(NULL);
+                WaccIrFunction* f = wacc_ir_function_new(module, str_lit("f"), type, 1);
+                WaccIrValue x = wacc_ir_emit_param(f, 0, type, 0);
+                WaccIrValue c = wacc_ir_emit_const(f, 0, type, d);
+                wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, ops[o], type, x, c));
+                WaccOptStats stats = {0};
+                wacc_opt_strength(f, &stats);
+                reduced += stats.reduced;
+                TEST_ASSERT(state, wacc_ir_verify(f, stderr), wacc_ir_module_free(module), "invalid IR after strength");
+                for (size_t xi = 0; xi < NUM_STRENGTH_VALUES; xi++)
+                {
+                    int64_t a = wacc_ir_normalize(type, values[xi]);
+                    int64_t expected = 0;
+                    int64_t actual = 0;
+                    if (!wacc_ir_fold(ops[o], type, type, a, d, &expected))
+                    {
+                        continue;
+                    }
+                    bool ok = evaluate(f, a, &actual);
+                    TEST_ASSERT(state,
+                        ok && actual == expected,
+                        wacc_ir_module_free(module),
+                        "%s %s %lld, %lld: expected %lld, got %lld",
+                        wacc_ir_opcodes[ops[o]].name,
+                        type == WACC_IR_TYPE_I32 ? "i32" : "i64",
+                        (long long)a,
+                        (long long)d,
+                        (long long)expected,
+                        (long long)actual);
+                }
+                wacc_ir_module_free(module);
+            }
+        }
+    }
+    TEST_ASSERT(state, reduced > 0, NO_CLEANUP, "nothing was strength-reduced");
+    PASS();
+}
+
+// `a` divided by `d` or the remainder, as the host computes it
+static int64_t strength_host(WaccIrOpcode op, WaccIrType type, int64_t a, int64_t d)
+{
+    if (type == WACC_IR_TYPE_I32)
+    {
+        int32_t sa = (int32_t)a;
+        int32_t sd = (int32_t)d;
+        uint32_t ua = (uint32_t)a;
+        uint32_t ud = (uint32_t)d;
+        return op == WACC_IR_SDIV   ? sa / sd
+               : op == WACC_IR_UDIV ? (int32_t)(ua / ud)
+               : op == WACC_IR_SREM ? sa % sd
+                                    : (int32_t)(ua % ud);
+    }
+    uint64_t ua = (uint64_t)a;
+    uint64_t ud = (uint64_t)d;
+    return op == WACC_IR_SDIV   ? a / d
+           : op == WACC_IR_UDIV ? (int64_t)(ua / ud)
+           : op == WACC_IR_SREM ? a % d
+                                : (int64_t)(ua % ud);
+}
+
+// call a function of one parameter and result of `type` at `address`
+static int64_t strength_call(uintptr_t address, WaccIrType type, int64_t a)
+{
+    if (type == WACC_IR_TYPE_I32)
+    {
+        return ((int32_t (*)(int32_t))address)((int32_t)a);
+    }
+    return ((int64_t (*)(int64_t))address)(a);
+}
+
+// the reduced divisions and remainders compiled, run on the machine and
+// checked against the host's / and % over every divisor and dividend of the
+// set above
+static TEST_FUNC(state, strength_jit)
+{
+    static const WaccIrOpcode ops[] = {WACC_IR_SDIV, WACC_IR_UDIV, WACC_IR_SREM, WACC_IR_UREM};
+    int64_t values[NUM_STRENGTH_VALUES];
+    strength_values(values);
+    size_t reduced = 0;
+    for (size_t t = 0; t < sizeof(strength_types) / sizeof(strength_types[0]); t++)
+    {
+        for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+        {
+            WaccIrType type = strength_types[t];
+            bool is_signed = ops[o] == WACC_IR_SDIV || ops[o] == WACC_IR_SREM;
+            int64_t min = type == WACC_IR_TYPE_I32 ? INT32_MIN : INT64_MIN;
+            // one function per divisor but 0, x / d or x % d
+            int64_t divisors[NUM_STRENGTH_VALUES];
+            uint32_t num_divisors = 0;
+            WaccIrModule* module = wacc_ir_module_new(NULL);
+            for (size_t di = 0; di < NUM_STRENGTH_VALUES; di++)
+            {
+                int64_t d = wacc_ir_normalize(type, values[di]);
+                if (d == 0)
+                {
+                    continue;
+                }
+                divisors[num_divisors++] = d;
+                WaccIrFunction* f = wacc_ir_function_new(module, str_lit("f"), type, 1);
+                WaccIrValue x = wacc_ir_emit_param(f, 0, type, 0);
+                WaccIrValue c = wacc_ir_emit_const(f, 0, type, d);
+                wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, ops[o], type, x, c));
+                WaccOptStats stats = {0};
+                wacc_opt_strength(f, &stats);
+                reduced += stats.reduced;
+                TEST_ASSERT(state, wacc_ir_verify(f, stderr), wacc_ir_module_free(module), "invalid IR after strength");
+            }
+            WaccX86Options options = {
+                .regalloc = WACC_X86_REGALLOC_LINEAR_SCAN, .peephole = true, .omit_frame_pointer = true};
+            WaccX86Stats x86_stats = {0};
+            WaccX86Code code;
+            wacc_x86_compile_code(module, &options, &x86_stats, &code);
+            wacc_ir_module_free(module);
+            WaccX86Jit jit;
+            bool loaded = wacc_x86_jit_load(&jit, &code);
+            TEST_ASSERT(state, loaded, CLEANUP(wacc_x86_code_free(&code)), "cannot map executable memory");
+            for (uint32_t k = 0; k < num_divisors; k++)
+            {
+                int64_t d = divisors[k];
+                uintptr_t address = wacc_x86_jit_address(&jit, &code, k);
+                for (size_t xi = 0; xi < NUM_STRENGTH_VALUES; xi++)
+                {
+                    int64_t a = wacc_ir_normalize(type, values[xi]);
+                    if (is_signed && a == min && d == -1)
+                    {
+                        // traps on the machine and is undefined on the host
+                        continue;
+                    }
+                    int64_t expected = strength_host(ops[o], type, a, d);
+                    int64_t actual = strength_call(address, type, a);
+                    TEST_ASSERT(state,
+                        actual == expected,
+                        CLEANUP((wacc_x86_jit_unload(&jit), wacc_x86_code_free(&code))),
+                        "%s %s %lld, %lld: expected %lld, got %lld",
+                        wacc_ir_opcodes[ops[o]].name,
+                        type == WACC_IR_TYPE_I32 ? "i32" : "i64",
+                        (long long)a,
+                        (long long)d,
+                        (long long)expected,
+                        (long long)actual);
+                }
+            }
+            wacc_x86_jit_unload(&jit);
+            wacc_x86_code_free(&code);
+        }
+    }
+    TEST_ASSERT(state, reduced > 0, NO_CLEANUP, "nothing was strength-reduced");
+    PASS();
+}
+
+SUITE_FUNC(state, opt)
+{
+    RUN_TEST(state, fold, str_lit("fold"));
+    RUN_TEST(state, sccp_branch, str_lit("sccp branch"));
+    RUN_TEST(state, sccp_loop, str_lit("sccp loop"));
+    RUN_TEST(state, sccp_trap, str_lit("sccp trap"));
+    RUN_TEST(state, strength_exhaustive, str_lit("strength exhaustive"));
+    RUN_TEST(state, strength_jit, str_lit("strength jit"));
+    RUN_TEST(state, inline_small, str_lit("inline small"));
+    RUN_TEST(state, inline_single_site, str_lit("inline single site"));
+    RUN_TEST(state, inline_recursive, str_lit("inline recursive"));
+    RUN_TEST(state, dce, str_lit("dce"));
+    RUN_TEST(state, dce_functions, str_lit("dce functions"));
+    RUN_TEST(state, loops, str_lit("loops"));
+}
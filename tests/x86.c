@@ -0,0 +1,902 @@
+#include "wacc/test/x86.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <elf.h>
+#include <inttypes.h>
+#include <process/process.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wacc/ir.h>
+#include <wacc/opt.h>
+#include <wacc/x86.h>
+
+enum
+{
+    KERNEL_ITERATIONS = 1000,
+    // the code of an executable follows the ELF headers and a `_start` of
+    // this many bytes
+    DEBUG_START_STUB_SIZE = 14,
+};
+
+static const WaccIrOpcode kernel_ops[] = {WACC_IR_ADD, WACC_IR_XOR, WACC_IR_SUB, WACC_IR_MUL};
+
+// kernel(n): `width` accumulators updated from themselves, their neighbour and
+// the counter, xor-ed together at the end; see kernel_reference
+static WaccIrFunction* build_kernel(WaccIrModule* module, uint32_t width)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("kernel"), i32, 1);
+    WaccIrBlockId entry = 0;
+    WaccIrBlockId head = wacc_ir_block_new(f);
+    WaccIrBlockId body = wacc_ir_block_new(f);
+    WaccIrBlockId exit = wacc_ir_block_new(f);
+    WaccIrValue n = wacc_ir_emit_param(f, entry, i32, 0);
+    WaccIrValue zero = wacc_ir_emit_const(f, entry, i32, 0);
+    assert(width >= 1);
+    WaccIrValue* acc = calloc(width, sizeof(WaccIrValue));
+    WaccIrValue* next = calloc(width, sizeof(WaccIrValue));
+    assert(acc != NULL && next != NULL);
+    for (uint32_t j = 0; j < width; j++)
+    {
+        next[j] = wacc_ir_emit_const(f, entry, i32, j + 1);
+    }
+    wacc_ir_emit_br(f, entry, head);
+    for (uint32_t j = 0; j < width; j++)
+    {
+        WaccIrOperand in[] = {{next[j], entry}, {WACC_IR_NO_VALUE, body}};
+        acc[j] = wacc_ir_emit_phi(f, head, i32, in, 2);
+    }
+    WaccIrOperand counter_in[] = {{zero, entry}, {WACC_IR_NO_VALUE, body}};
+    WaccIrValue i = wacc_ir_emit_phi(f, head, i32, counter_in, 2);
+    wacc_ir_emit_cbr(f, head, wacc_ir_emit_binary(f, head, WACC_IR_SLT, WACC_IR_TYPE_I1, i, n), body, exit);
+    for (uint32_t j = 0; j < width; j++)
+    {
+        WaccIrValue t = wacc_ir_emit_binary(f, body, kernel_ops[j % 4], i32, acc[j], acc[(j + 1) % width]);
+        next[j] = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, t, i);
+    }
+    WaccIrValue one = wacc_ir_emit_const(f, body, i32, 1);
+    WaccIrValue i_next = wacc_ir_emit_binary(f, body, WACC_IR_ADD, i32, i, one);
+    wacc_ir_emit_br(f, body, head);
+    WaccIrValue total = acc[0];
+    for (uint32_t j = 1; j < width; j++)
+    {
+        total = wacc_ir_emit_binary(f, exit, WACC_IR_XOR, i32, total, acc[j]);
+    }
+    wacc_ir_emit_ret(f, exit, total);
+    for (uint32_t j = 0; j < width; j++)
+    {
+        wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[j])[1].value = next[j];
+    }
+    wacc_ir_operands(f, &f->blocks.ptr[head].insts.ptr[width])[1].value = i_next;
+    wacc_ir_compute_preds(f);
+    free(acc);
+    free(next);
+    return f;
+}
+
+static uint32_t kernel_reference(uint32_t width, uint32_t n)
+{
+    uint32_t acc[32];
+    uint32_t next[32];
+    for (uint32_t j = 0; j < width; j++)
+    {
+        acc[j] = j + 1;
+    }
+    for (uint32_t i = 0; i < n; i++)
+    {
+        for (uint32_t j = 0; j < width; j++)
+        {
+            uint32_t a = acc[j];
+            uint32_t b = acc[(j + 1) % width];
+            uint32_t t = j % 4 == 0 ? a + b : j % 4 == 1 ? a ^ b : j % 4 == 2 ? a - b : a * b;
+            next[j] = t + i;
+        }
+        for (uint32_t j = 0; j < width; j++)
+        {
+            acc[j] = next[j];
+        }
+    }
+    uint32_t total = 0;
+    for (uint32_t j = 0; j < width; j++)
+    {
+        total ^= acc[j];
+    }
+    return total;
+}
+
+// main(): kernel(KERNEL_ITERATIONS) & 255
+static void build_main(WaccIrModule* module)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    WaccIrValue n = wacc_ir_emit_const(f, 0, i32, KERNEL_ITERATIONS);
+    WaccIrValue result = wacc_ir_emit_call(f, 0, i32, 0, &n, 1);
+    WaccIrValue mask = wacc_ir_emit_const(f, 0, i32, 255);
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_AND, i32, result, mask));
+}
+
+// whether every register operand of `function` is a hardware register
+static bool fully_allocated(const WaccX86Function* function)
+{
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            for (uint32_t k = 0; k < 2; k++)
+            {
+                const WaccX86Operand* op = &insts->ptr[i].ops[k];
+                if (op->kind == WACC_X86_OPERAND_REG && wacc_x86_is_vreg(op->reg))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// compile, assemble and run `module`; the exit status, or -1 on failure
+static int run_module(const WaccIrModule* module, WaccX86Regalloc regalloc)
+{
+    char asm_path[] = "/tmp/wacc-test-XXXXXX.s";
+    int fd = mkstemps(asm_path, 2);
+    FILE* asm_file = fd < 0 ? NULL : fdopen(fd, "w");
+    if (asm_file == NULL)
+    {
+        return -1;
+    }
+    WaccX86Options options = {.regalloc = regalloc, .peephole = true, .omit_frame_pointer = true};
+    WaccX86Stats stats = {0};
+    wacc_x86_compile(module, &options, &stats, asm_file);
+    (void)fclose(asm_file);
+
+    const char* cc_args[] = {"cc", "-o", "x86.out", asm_path};
+    ProcessCreateResult cc = process_run((ProcessCStrBuf)BUF_ARRAY(cc_args), PROCESS_OPTION_SEARCH_USER_PATH);
+    (void)remove(asm_path);
+    int code = -1;
+    if (cc.present && cc.value.returnCode == 0)
+    {
+        const char* run_args[] = {"./x86.out"};
+        ProcessCreateResult run = process_run((ProcessCStrBuf)BUF_ARRAY(run_args), PROCESS_OPTION_SEARCH_USER_PATH);
+        if (run.present)
+        {
+            code = run.value.returnCode;
+            process_destroy(&run.value);
+        }
+    }
+    if (cc.present)
+    {
+        process_destroy(&cc.value);
+    }
+    (void)remove("x86.out");
+    return code;
+}
+
+static TEST_FUNC(state, regalloc_no_spill)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_kernel(module, 4);
+    WaccX86Module* x86 = wacc_x86_lower(module, NULL);
+    WaccX86Options options = {.regalloc = WACC_X86_REGALLOC_LINEAR_SCAN};
+    WaccX86Stats stats = {0};
+    wacc_x86_regalloc(x86->functions.ptr[0], &options, &stats);
+    bool allocated = fully_allocated(x86->functions.ptr[0]);
+    wacc_x86_module_free(x86);
+    wacc_ir_module_free(module);
+    TEST_ASSERT(state, stats.spilled == 0, NO_CLEANUP, "expected no spills, got %zu", stats.spilled);
+    TEST_ASSERT(state, allocated, NO_CLEANUP, "virtual registers left after allocation");
+    PASS();
+}
+
+// x = p + 1; return f(x) + x;
+static TEST_FUNC(state, regalloc_across_call)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("f"), i32, 1);
+    WaccIrValue p = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue x = wacc_ir_emit_binary(f, 0, WACC_IR_ADD, i32, p, wacc_ir_emit_const(f, 0, i32, 1));
+    WaccIrValue y = wacc_ir_emit_call(f, 0, i32, 0, &x, 1);
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_ADD, i32, y, x));
+    WaccX86Module* x86 = wacc_x86_lower(module, NULL);
+    WaccX86Function* function = x86->functions.ptr[0];
+    WaccX86Options options = {.regalloc = WACC_X86_REGALLOC_LINEAR_SCAN};
+    WaccX86Stats stats = {0};
+    wacc_x86_regalloc(function, &options, &stats);
+    wacc_x86_frame(function, &options);
+    uint32_t preserved = function->preserved_mask & ~(UINT32_C(1) << WACC_X86_RBP);
+    wacc_x86_module_free(x86);
+    wacc_ir_module_free(module);
+    TEST_ASSERT(state, stats.spilled == 0, NO_CLEANUP, "expected no spills, got %zu", stats.spilled);
+    TEST_ASSERT(state, preserved != 0, NO_CLEANUP, "expected x to live in a callee-saved register");
+    PASS();
+}
+
+static TEST_FUNC(state, peephole)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_kernel(module, 4);
+    WaccX86Module* x86 = wacc_x86_lower(module, NULL);
+    WaccX86Function* function = x86->functions.ptr[0];
+    WaccX86Options options = {.regalloc = WACC_X86_REGALLOC_LINEAR_SCAN, .peephole = true};
+    WaccX86Stats stats = {0};
+    wacc_x86_regalloc(function, &options, &stats);
+    wacc_x86_frame(function, &options);
+    wacc_x86_peephole(function, &stats);
+    size_t setcc = 0;
+    for (uint64_t b = 0; b < function->blocks.len; b++)
+    {
+        const WaccX86InstBuf* insts = &function->blocks.ptr[b].insts;
+        for (uint64_t i = 0; i < insts->len; i++)
+        {
+            setcc += insts->ptr[i].op == WACC_X86_SETCC;
+        }
+    }
+    wacc_x86_module_free(x86);
+    wacc_ir_module_free(module);
+    TEST_ASSERT(state,
+        stats.peephole[WACC_X86_PEEPHOLE_COMPARE_BRANCH] == 1 && setcc == 0,
+        NO_CLEANUP,
+        "expected the loop test to branch on the comparison directly");
+    TEST_ASSERT(state,
+        stats.peephole[WACC_X86_PEEPHOLE_ZERO_IDIOM] > 0,
+        NO_CLEANUP,
+        "expected the counter to be cleared with xor");
+    PASS();
+}
+
+// f(p) = g(p + 2): the argument is computed straight into %edi, so the move
+// into the argument register is a move to itself that peephole drops
+static TEST_FUNC(state, argument_hint)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* g = wacc_ir_function_new(module, str_lit("g"), i32, 1);
+    wacc_ir_emit_ret(g, 0, wacc_ir_emit_param(g, 0, i32, 0));
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("f"), i32, 1);
+    WaccIrValue p = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue x = wacc_ir_emit_binary(f, 0, WACC_IR_ADD, i32, p, wacc_ir_emit_const(f, 0, i32, 2));
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_call(f, 0, i32, 0, &x, 1));
+    WaccX86Module* x86 = wacc_x86_lower(module, NULL);
+    WaccX86Function* function = x86->functions.ptr[1];
+    // the move of the argument into %edi, from a virtual register
+    const WaccX86InstBuf* insts = &function->blocks.ptr[0].insts;
+    uint64_t arg_move = insts->len;
+    for (uint64_t i = 0; i < insts->len; i++)
+    {
+        const WaccX86Inst* inst = &insts->ptr[i];
+        if (inst->op == WACC_X86_MOV && inst->ops[0].kind == WACC_X86_OPERAND_REG &&
+            inst->ops[0].reg == WACC_X86_RDI && inst->ops[1].kind == WACC_X86_OPERAND_REG &&
+            wacc_x86_is_vreg(inst->ops[1].reg))
+        {
+            arg_move = i;
+        }
+    }
+    bool found = arg_move < insts->len;
+    WaccX86Options options = {.regalloc = WACC_X86_REGALLOC_LINEAR_SCAN, .peephole = true};
+    WaccX86Stats stats = {0};
+    wacc_x86_regalloc(function, &options, &stats);
+    insts = &function->blocks.ptr[0].insts;
+    bool in_rdi = found && stats.spilled == 0 && insts->ptr[arg_move].ops[1].kind == WACC_X86_OPERAND_REG &&
+                  insts->ptr[arg_move].ops[1].reg == WACC_X86_RDI;
+    wacc_x86_frame(function, &options);
+    wacc_x86_peephole(function, &stats);
+    insts = &function->blocks.ptr[0].insts;
+    size_t self_moves = 0;
+    for (uint64_t i = 0; i < insts->len; i++)
+    {
+        const WaccX86Inst* inst = &insts->ptr[i];
+        self_moves += inst->op == WACC_X86_MOV && inst->ops[0].kind == WACC_X86_OPERAND_REG &&
+                      inst->ops[1].kind == WACC_X86_OPERAND_REG && inst->ops[0].reg == inst->ops[1].reg;
+    }
+    wacc_x86_module_free(x86);
+    wacc_ir_module_free(module);
+    TEST_ASSERT(state, found, NO_CLEANUP, "expected a move into %%edi");
+    TEST_ASSERT(state, in_rdi, NO_CLEANUP, "expected the argument to be allocated to %%edi");
+    TEST_ASSERT(state,
+        stats.peephole[WACC_X86_PEEPHOLE_SELF_MOVE] > 0 && self_moves == 0,
+        NO_CLEANUP,
+        "expected the move of %%edi to itself to be removed");
+    PASS();
+}
+
+static TEST_FUNC(state, frame_leaf)
+{
+    bool frame_pointer[2];
+    WaccX86Opcode first_op[2];
+    for (int keep = 0; keep < 2; keep++)
+    {
+        // return p * p + p;
+        const WaccIrType i32 = WACC_IR_TYPE_I32;
+        WaccIrModule* module = wacc_ir_module_new(NULL);
+        WaccIrFunction* f = wacc_ir_function_new(module, str_lit("leaf"), i32, 1);
+        WaccIrValue p = wacc_ir_emit_param(f, 0, i32, 0);
+        WaccIrValue square = wacc_ir_emit_binary(f, 0, WACC_IR_MUL, i32, p, p);
+        wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_ADD, i32, square, p));
+        WaccX86Module* x86 = wacc_x86_lower(module, NULL);
+        WaccX86Function* function = x86->functions.ptr[0];
+        WaccX86Options options = {.regalloc = WACC_X86_REGALLOC_NAIVE, .omit_frame_pointer = !keep};
+        WaccX86Stats stats = {0};
+        wacc_x86_regalloc(function, &options, &stats);
+        wacc_x86_frame(function, &options);
+        frame_pointer[keep] = function->frame_pointer;
+        first_op[keep] = function->blocks.ptr[0].insts.ptr[0].op;
+        wacc_x86_module_free(x86);
+        wacc_ir_module_free(module);
+    }
+    TEST_ASSERT(state,
+        !frame_pointer[0] && first_op[0] != WACC_X86_PUSH,
+        NO_CLEANUP,
+        "expected the leaf function to keep its slots in the red zone without a frame");
+    TEST_ASSERT(state,
+        frame_pointer[1] && first_op[1] == WACC_X86_PUSH,
+        NO_CLEANUP,
+        "expected a frame when the frame pointer is kept");
+    PASS();
+}
+
+static TEST_FUNC(state, regalloc_pressure)
+{
+    enum
+    {
+        WIDTH = 24,
+    };
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_kernel(module, WIDTH);
+    build_main(module);
+    int expected = (int)(kernel_reference(WIDTH, KERNEL_ITERATIONS) & 255);
+    int naive = run_module(module, WACC_X86_REGALLOC_NAIVE);
+    int linear = run_module(module, WACC_X86_REGALLOC_LINEAR_SCAN);
+    wacc_ir_module_free(module);
+    TEST_ASSERT(state,
+        naive == expected && linear == expected,
+        NO_CLEANUP,
+        "expected %d, got %d (naive) and %d (linear)",
+        expected,
+        naive,
+        linear);
+    PASS();
+}
+
+static const struct
+{
+    WaccIrOpcode op;
+    int32_t c;
+} strength_cases[] = {
+    {WACC_IR_MUL, 9},
+    {WACC_IR_MUL, 45},
+    {WACC_IR_MUL, 24},
+    {WACC_IR_SDIV, 7},
+    {WACC_IR_SDIV, -5},
+    {WACC_IR_SDIV, 16},
+    {WACC_IR_UDIV, 3},
+    {WACC_IR_UDIV, 7},
+    {WACC_IR_SREM, 10},
+    {WACC_IR_SREM, -8},
+    {WACC_IR_UREM, 1000},
+};
+
+static const int32_t strength_inputs[] = {0, 1, -1, 7, -7, 12345, -12345, INT32_MAX, INT32_MIN, INT32_MIN + 1};
+
+static uint32_t strength_reference(int32_t x)
+{
+    uint32_t result = 0;
+    for (size_t i = 0; i < sizeof(strength_cases) / sizeof(strength_cases[0]); i++)
+    {
+        int32_t c = strength_cases[i].c;
+        uint32_t value = 0;
+        switch (strength_cases[i].op)
+        {
+            case WACC_IR_MUL:
+                value = (uint32_t)x * (uint32_t)c;
+                break;
+            case WACC_IR_SDIV:
+                value = (uint32_t)(x / c);
+                break;
+            case WACC_IR_UDIV:
+                value = (uint32_t)x / (uint32_t)c;
+                break;
+            case WACC_IR_SREM:
+                value = (uint32_t)(x % c);
+                break;
+            default:
+                value = (uint32_t)x % (uint32_t)c;
+                break;
+        }
+        result = result * 31 + value;
+    }
+    return result;
+}
+
+// f(x) combines every strength case on x; main() xors f over the inputs
+static TEST_FUNC(state, strength_reduced)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("f"), i32, 1);
+    WaccIrValue x = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue result = wacc_ir_emit_const(f, 0, i32, 0);
+    for (size_t i = 0; i < sizeof(strength_cases) / sizeof(strength_cases[0]); i++)
+    {
+        WaccIrValue c = wacc_ir_emit_const(f, 0, i32, strength_cases[i].c);
+        WaccIrValue value = wacc_ir_emit_binary(f, 0, strength_cases[i].op, i32, x, c);
+        result = wacc_ir_emit_binary(f, 0, WACC_IR_MUL, i32, result, wacc_ir_emit_const(f, 0, i32, 31));
+        result = wacc_ir_emit_binary(f, 0, WACC_IR_ADD, i32, result, value);
+    }
+    wacc_ir_emit_ret(f, 0, result);
+    WaccOptStats stats = {0};
+    wacc_opt_strength(f, &stats);
+
+    WaccIrFunction* caller = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    WaccIrValue total = wacc_ir_emit_const(caller, 0, i32, 0);
+    uint32_t expected = 0;
+    for (size_t i = 0; i < sizeof(strength_inputs) / sizeof(strength_inputs[0]); i++)
+    {
+        WaccIrValue input = wacc_ir_emit_const(caller, 0, i32, strength_inputs[i]);
+        WaccIrValue value = wacc_ir_emit_call(caller, 0, i32, 0, &input, 1);
+        total = wacc_ir_emit_binary(caller, 0, WACC_IR_XOR, i32, total, value);
+        expected ^= strength_reference(strength_inputs[i]);
+    }
+    WaccIrValue mask = wacc_ir_emit_const(caller, 0, i32, 255);
+    wacc_ir_emit_ret(caller, 0, wacc_ir_emit_binary(caller, 0, WACC_IR_AND, i32, total, mask));
+    int code = run_module(module, WACC_X86_REGALLOC_LINEAR_SCAN);
+    wacc_ir_module_free(module);
+    TEST_ASSERT(state, stats.reduced > 0, NO_CLEANUP, "nothing was strength-reduced");
+    TEST_ASSERT(state, code == (int)(expected & 255), NO_CLEANUP, "expected %u, got %d", expected & 255, code);
+    PASS();
+}
+
+// f(a, b) = (a + b * 8 + 40) ^ (b * 5 - 3), which fits two lea and an xor
+static TEST_FUNC(state, select_address)
+{
+    const WaccIrType i32 = WACC_IR_TYPE_I32;
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    WaccIrFunction* f = wacc_ir_function_new(module, str_lit("f"), i32, 2);
+    WaccIrValue a = wacc_ir_emit_param(f, 0, i32, 0);
+    WaccIrValue b = wacc_ir_emit_param(f, 0, i32, 1);
+    WaccIrValue scaled = wacc_ir_emit_binary(f, 0, WACC_IR_MUL, i32, b, wacc_ir_emit_const(f, 0, i32, 8));
+    WaccIrValue sum = wacc_ir_emit_binary(f, 0, WACC_IR_ADD, i32, a, scaled);
+    sum = wacc_ir_emit_binary(f, 0, WACC_IR_ADD, i32, wacc_ir_emit_const(f, 0, i32, 40), sum);
+    WaccIrValue times5 = wacc_ir_emit_binary(f, 0, WACC_IR_MUL, i32, b, wacc_ir_emit_const(f, 0, i32, 5));
+    WaccIrValue diff = wacc_ir_emit_binary(f, 0, WACC_IR_SUB, i32, times5, wacc_ir_emit_const(f, 0, i32, 3));
+    wacc_ir_emit_ret(f, 0, wacc_ir_emit_binary(f, 0, WACC_IR_XOR, i32, sum, diff));
+
+    WaccIrFunction* caller = wacc_ir_function_new(module, str_lit("main"), i32, 0);
+    WaccIrValue args[] = {wacc_ir_emit_const(caller, 0, i32, 1000), wacc_ir_emit_const(caller, 0, i32, 21)};
+    WaccIrValue value = wacc_ir_emit_call(caller, 0, i32, 0, args, 2);
+    WaccIrValue mask = wacc_ir_emit_const(caller, 0, i32, 255);
+    wacc_ir_emit_ret(caller, 0, wacc_ir_emit_binary(caller, 0, WACC_IR_AND, i32, value, mask));
+
+    WaccX86Module* x86 = wacc_x86_lower(module, NULL);
+    const WaccX86InstBuf* insts = &x86->functions.ptr[0]->blocks.ptr[0].insts;
+    size_t lea = 0;
+    size_t arithmetic = 0;
+    for (uint64_t i = 0; i < insts->len; i++)
+    {
+        WaccX86Opcode op = insts->ptr[i].op;
+        lea += op == WACC_X86_LEA;
+        arithmetic += op == WACC_X86_ADD || op == WACC_X86_SUB || op == WACC_X86_IMUL || op == WACC_X86_SHL;
+    }
+    wacc_x86_module_free(x86);
+    int code = run_module(module, WACC_X86_REGALLOC_LINEAR_SCAN);
+    wacc_ir_module_free(module);
+    int expected = ((1000 + 21 * 8 + 40) ^ (21 * 5 - 3)) & 255;
+    TEST_ASSERT(state,
+        lea == 2 && arithmetic == 0,
+        NO_CLEANUP,
+        "expected two lea and no other arithmetic, got %zu lea and %zu others",
+        lea,
+        arithmetic);
+    TEST_ASSERT(state, code == expected, NO_CLEANUP, "expected %d, got %d", expected, code);
+    PASS();
+}
+
+// kernel and main loaded into memory and called directly, with and without
+// spills
+static TEST_FUNC(state, jit)
+{
+    const uint32_t widths[] = {4, 24};
+    const WaccX86Regalloc regallocs[] = {WACC_X86_REGALLOC_LINEAR_SCAN, WACC_X86_REGALLOC_NAIVE};
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+    {
+        for (size_t r = 0; r < sizeof(regallocs) / sizeof(regallocs[0]); r++)
+        {
+            WaccIrModule* module = wacc_ir_module_new(NULL);
+            build_kernel(module, widths[w]);
+            build_main(module);
+            WaccX86Options options = {.regalloc = regallocs[r], .peephole = true, .omit_frame_pointer = true};
+            WaccX86Stats stats = {0};
+            WaccX86Code code;
+            wacc_x86_compile_code(module, &options, &stats, &code);
+            wacc_ir_module_free(module);
+            WaccX86Jit jit;
+            bool loaded = wacc_x86_jit_load(&jit, &code);
+            TEST_ASSERT(state, loaded, CLEANUP(wacc_x86_code_free(&code)), "cannot map executable memory");
+            uint32_t (*kernel)(uint32_t) = (uint32_t (*)(uint32_t))wacc_x86_jit_address(&jit, &code, 0);
+            int (*entry)(void) = (int (*)(void))wacc_x86_jit_address(&jit, &code, 1);
+            uint32_t value = kernel(37);
+            int code_main = entry();
+            wacc_x86_jit_unload(&jit);
+            wacc_x86_code_free(&code);
+            uint32_t expected = kernel_reference(widths[w], 37);
+            int expected_main = (int)(kernel_reference(widths[w], KERNEL_ITERATIONS) & 255);
+            TEST_ASSERT(state,
+                value == expected && code_main == expected_main,
+                NO_CLEANUP,
+                "width %u: expected %u and %d, got %u and %d",
+                widths[w],
+                expected,
+                expected_main,
+                value,
+                code_main);
+        }
+    }
+    PASS();
+}
+
+// The length in bytes of the branch back to an earlier instruction in
+// function `function` of `code`, as objdump decodes it; 0 if there is none or
+// objdump cannot be run.
+static uint32_t back_edge_size(const WaccX86Code* code, uint32_t function)
+{
+    char path[] = "/tmp/wacc-code-XXXXXX";
+    int fd = mkstemp(path);
+    FILE* file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    const WaccX86CodeFunction* f = &code->functions.ptr[function];
+    (void)fwrite(code->bytes.ptr + f->offset, 1, f->size, file);
+    (void)fclose(file);
+    const char* args[] = {"objdump", "-D", "-b", "binary", "-m", "i386:x86-64", path};
+    ProcessCreateResult run = process_create((ProcessCStrBuf)BUF_ARRAY(args), PROCESS_OPTION_SEARCH_USER_PATH);
+    uint32_t size = 0;
+    if (run.present)
+    {
+        // "   1c:\t75 f2                \tjne    0x10"
+        char* line = NULL;
+        size_t len = 0;
+        while (getline(&line, &len, run.value.stdoutFile) != -1)
+        {
+            unsigned address = 0;
+            unsigned target = 0;
+            char* bytes = strchr(line, '\t');
+            char* mnemonic = bytes == NULL ? NULL : strchr(bytes + 1, '\t');
+            if (mnemonic == NULL || sscanf(line, " %x:", &address) != 1 || mnemonic[1] != 'j' ||
+                sscanf(strchr(mnemonic + 1, ' '), " 0x%x", &target) != 1 || target > address)
+            {
+                continue;
+            }
+            size = 0;
+            for (const char* c = bytes; c < mnemonic; c++)
+            {
+                size += isxdigit((unsigned char)*c) != 0;
+            }
+            // two hex digits per byte
+            size /= 2;
+        }
+        free(line);
+        ProcessJoinResult joined = process_join(&run.value);
+        process_destroy(&run.value);
+        size = joined.present && joined.value == 0 ? size : 0;
+    }
+    (void)remove(path);
+    return size;
+}
+
+// functions and loop headers padded to alignment, with branches across the
+// padding both in and out of 8-bit range
+static TEST_FUNC(state, aligned_code)
+{
+    const uint32_t widths[] = {4, 24};
+    // the loop closes with jmp rel8 around the narrow body, and with jmp rel32
+    // around a body of more than 127 bytes
+    const uint32_t back_edge_sizes[] = {2, 5};
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+    {
+        WaccIrModule* module = wacc_ir_module_new(NULL);
+        build_kernel(module, widths[w]);
+        build_main(module);
+        WaccX86Options options = {
+            .regalloc = WACC_X86_REGALLOC_LINEAR_SCAN,
+            .peephole = true,
+            .omit_frame_pointer = true,
+            .function_align = 32,
+            .loop_align = 16,
+        };
+        WaccX86Stats stats = {0};
+        WaccX86Code code;
+        wacc_x86_compile_code(module, &options, &stats, &code);
+        wacc_ir_module_free(module);
+        bool aligned = code.align == 32;
+        for (uint64_t i = 0; i < code.functions.len; i++)
+        {
+            aligned = aligned && code.functions.ptr[i].offset % 32 == 0;
+        }
+        TEST_ASSERT(state, aligned, CLEANUP(wacc_x86_code_free(&code)), "width %u: functions not aligned", widths[w]);
+        uint32_t back_edge = back_edge_size(&code, 0);
+        TEST_ASSERT(state,
+            back_edge == back_edge_sizes[w],
+            CLEANUP(wacc_x86_code_free(&code)),
+            "width %u: expected a %u-byte back edge, got %u (kernel of %u bytes)",
+            widths[w],
+            back_edge_sizes[w],
+            back_edge,
+            code.functions.ptr[0].size);
+        WaccX86Jit jit;
+        bool loaded = wacc_x86_jit_load(&jit, &code);
+        TEST_ASSERT(state, loaded, CLEANUP(wacc_x86_code_free(&code)), "cannot map executable memory");
+        int (*entry)(void) = (int (*)(void))wacc_x86_jit_address(&jit, &code, 1);
+        int result = entry();
+        wacc_x86_jit_unload(&jit);
+        wacc_x86_code_free(&code);
+        int expected = (int)(kernel_reference(widths[w], KERNEL_ITERATIONS) & 255);
+        TEST_ASSERT(
+            state, result == expected, NO_CLEANUP, "width %u: expected %d, got %d", widths[w], expected, result);
+    }
+    PASS();
+}
+
+enum
+{
+    // headers, _start and the kernel leave room to spare
+    MAX_EXECUTABLE_SIZE = 1024,
+};
+
+static TEST_FUNC(state, freestanding_executable)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_kernel(module, 4);
+    build_main(module);
+    WaccX86Options options = {.regalloc = WACC_X86_REGALLOC_LINEAR_SCAN, .peephole = true, .omit_frame_pointer = true};
+    WaccX86Stats stats = {0};
+    WaccX86Code code;
+    wacc_x86_compile_code(module, &options, &stats, &code);
+    wacc_ir_module_free(module);
+    bool written = wacc_x86_write_executable(&code, 1, "x86.out");
+    wacc_x86_code_free(&code);
+    TEST_ASSERT(state, written, CLEANUP((void)remove("x86.out")), "cannot write the executable");
+
+    FILE* file = fopen("x86.out", "rb");
+    long size = -1;
+    if (file != NULL && fseek(file, 0, SEEK_END) == 0)
+    {
+        size = ftell(file);
+    }
+    if (file != NULL)
+    {
+        (void)fclose(file);
+    }
+    const char* run_args[] = {"./x86.out"};
+    ProcessCreateResult run = process_run((ProcessCStrBuf)BUF_ARRAY(run_args), PROCESS_OPTION_SEARCH_USER_PATH);
+    int exit_code = -1;
+    if (run.present)
+    {
+        exit_code = run.value.returnCode;
+        process_destroy(&run.value);
+    }
+    (void)remove("x86.out");
+    int expected = (int)(kernel_reference(4, KERNEL_ITERATIONS) & 255);
+    TEST_ASSERT(state, exit_code == expected, NO_CLEANUP, "expected %d, got %d", expected, exit_code);
+    TEST_ASSERT(state,
+        size > 0 && size <= MAX_EXECUTABLE_SIZE,
+        NO_CLEANUP,
+        "expected at most %d bytes, got %ld",
+        MAX_EXECUTABLE_SIZE,
+        size);
+    PASS();
+}
+
+// what `addr2line -f -s` reports for `address` in x86.out: the function and
+// its file:line on two lines
+static bool addr2line(uint64_t address, char* out, int size)
+{
+    char address_arg[32];
+    (void)snprintf(address_arg, sizeof(address_arg), "%#" PRIx64, address);
+    const char* args[] = {"addr2line", "-f", "-s", "-e", "x86.out", address_arg};
+    ProcessCreateResult run = process_create((ProcessCStrBuf)BUF_ARRAY(args), PROCESS_OPTION_SEARCH_USER_PATH);
+    if (!run.present)
+    {
+        return false;
+    }
+    size_t read = fread(out, 1, (size_t)size - 1, run.value.stdoutFile);
+    out[read] = '\0';
+    ProcessJoinResult joined = process_join(&run.value);
+    process_destroy(&run.value);
+    return joined.present && joined.value == 0;
+}
+
+static TEST_FUNC(state, debug_info)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    build_kernel(module, 4);
+    build_main(module);
+    // function i is defined on line 10 * (i + 1) and each of its blocks is a
+    // line of its own below
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        WaccIrFunction* f = module->functions.ptr[i];
+        f->line = (uint32_t)(10 * (i + 1));
+        for (uint64_t b = 0; b < f->blocks.len; b++)
+        {
+            for (uint64_t k = 0; k < f->blocks.ptr[b].insts.len; k++)
+            {
+                f->blocks.ptr[b].insts.ptr[k].line = f->line + 1 + (uint32_t)b;
+            }
+        }
+    }
+    WaccX86Options options = {
+        .regalloc = WACC_X86_REGALLOC_LINEAR_SCAN,
+        .peephole = true,
+        .omit_frame_pointer = true,
+        .debug_source = str_lit("kernel.c"),
+    };
+    WaccX86Stats stats = {0};
+    WaccX86Code code;
+    wacc_x86_compile_code(module, &options, &stats, &code);
+    bool written = wacc_x86_write_executable(&code, 1, "x86.out");
+    TEST_ASSERT(state,
+        written,
+        CLEANUP(wacc_x86_code_free(&code); wacc_ir_module_free(module); (void)remove("x86.out")),
+        "cannot write the executable");
+
+    const char* run_args[] = {"./x86.out"};
+    ProcessCreateResult run = process_run((ProcessCStrBuf)BUF_ARRAY(run_args), PROCESS_OPTION_SEARCH_USER_PATH);
+    int exit_code = -1;
+    if (run.present)
+    {
+        exit_code = run.value.returnCode;
+        process_destroy(&run.value);
+    }
+    int expected = (int)(kernel_reference(4, KERNEL_ITERATIONS) & 255);
+    TEST_ASSERT(state,
+        exit_code == expected,
+        CLEANUP(wacc_x86_code_free(&code); wacc_ir_module_free(module); (void)remove("x86.out")),
+        "expected %d, got %d",
+        expected,
+        exit_code);
+
+    // every row of the line table, attributed to the function around it
+    uint64_t code_address = UINT64_C(0x400000) + sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr) + DEBUG_START_STUB_SIZE;
+    uint32_t function = 0;
+    bool ok = code.lines.len > 0;
+    char expected_out[128] = "";
+    char actual[128] = "";
+    for (uint64_t i = 0; i < code.lines.len && ok; i++)
+    {
+        const WaccX86CodeLine* row = &code.lines.ptr[i];
+        while (function + 1 < code.functions.len && code.functions.ptr[function + 1].offset <= row->offset)
+        {
+            function++;
+        }
+        str name = code.functions.ptr[function].name;
+        (void)snprintf(
+            expected_out, sizeof(expected_out), str_fmt "\nkernel.c:%" PRIu32 "\n", str_arg(name), row->line);
+        ok = addr2line(code_address + row->offset, actual, sizeof(actual)) &&
+             strncmp(actual, expected_out, strlen(expected_out) - 1) == 0;
+    }
+    wacc_x86_code_free(&code);
+    wacc_ir_module_free(module);
+    (void)remove("x86.out");
+    TEST_ASSERT(state, ok, NO_CLEANUP, "expected\n%sgot\n%s", expected_out, actual);
+    PASS();
+}
+
+enum
+{
+    NUM_PARALLEL_KERNELS = 24,
+    NUM_PARALLEL_WORKERS = 4,
+};
+
+// kernels of every width up to NUM_PARALLEL_KERNELS and main, optimized on
+// `pool`; functions two at a time share a line, as if defined on one
+static WaccIrModule* build_parallel(WaccPool* pool)
+{
+    WaccIrModule* module = wacc_ir_module_new(NULL);
+    for (uint32_t w = 1; w <= NUM_PARALLEL_KERNELS; w++)
+    {
+        build_kernel(module, w);
+    }
+    build_main(module);
+    for (uint64_t i = 0; i < module->functions.len; i++)
+    {
+        WaccIrFunction* f = module->functions.ptr[i];
+        f->line = (uint32_t)(10 * (i / 2 + 1));
+        for (uint64_t b = 0; b < f->blocks.len; b++)
+        {
+            for (uint64_t k = 0; k < f->blocks.ptr[b].insts.len; k++)
+            {
+                f->blocks.ptr[b].insts.ptr[k].line = f->line + (uint32_t)b;
+            }
+        }
+    }
+    WaccOptOptions opt = {.level = 1, .inline_threshold = WACC_OPT_DEFAULT_INLINE_THRESHOLD, .pool = pool};
+    WaccOptStats stats = {0};
+    wacc_opt_module(module, &opt, &stats);
+    return module;
+}
+
+// the assembly, the machine code and the statistics are the same on one
+// thread as on several, with functions and loops aligned alike and with loops
+// aligned more coarsely than functions
+static TEST_FUNC(state, parallel)
+{
+    const uint32_t function_aligns[] = {16, 0};
+    const uint32_t loop_aligns[] = {16, 32};
+    WaccPool* pool = wacc_pool_new(NUM_PARALLEL_WORKERS);
+    for (size_t a = 0; a < sizeof(function_aligns) / sizeof(function_aligns[0]); a++)
+    {
+        char* texts[2];
+        size_t sizes[2];
+        WaccX86Code codes[2];
+        WaccX86Stats stats[2] = {0};
+        for (int p = 0; p < 2; p++)
+        {
+            WaccPool* used = p == 0 ? NULL : pool;
+            WaccIrModule* module = build_parallel(used);
+            WaccX86Options options = {
+                .regalloc = WACC_X86_REGALLOC_LINEAR_SCAN,
+                .peephole = true,
+                .omit_frame_pointer = true,
+                .debug_source = str_lit("kernel.c"),
+                .function_align = function_aligns[a],
+                .loop_align = loop_aligns[a],
+                .pool = used,
+            };
+            FILE* text = open_memstream(&texts[p], &sizes[p]);
+            wacc_x86_compile(module, &options, &stats[p], text);
+            (void)fclose(text);
+            WaccX86Stats code_stats = {0};
+            wacc_x86_compile_code(module, &options, &code_stats, &codes[p]);
+            wacc_ir_module_free(module);
+        }
+        bool same_text = sizes[0] == sizes[1] && memcmp(texts[0], texts[1], sizes[0]) == 0;
+        bool same_stats = memcmp(&stats[0], &stats[1], sizeof(WaccX86Stats)) == 0;
+        size_t lines_size = codes[0].lines.len * sizeof(WaccX86CodeLine);
+        bool same_code = codes[0].align == codes[1].align && codes[0].bytes.len == codes[1].bytes.len &&
+                         memcmp(codes[0].bytes.ptr, codes[1].bytes.ptr, codes[0].bytes.len) == 0 &&
+                         codes[0].lines.len == codes[1].lines.len && codes[0].lines.len > 0 &&
+                         memcmp(codes[0].lines.ptr, codes[1].lines.ptr, lines_size) == 0;
+        for (uint64_t i = 0; i < codes[0].functions.len && same_code; i++)
+        {
+            same_code = codes[0].functions.ptr[i].offset == codes[1].functions.ptr[i].offset &&
+                        codes[0].functions.ptr[i].size == codes[1].functions.ptr[i].size;
+        }
+        for (int p = 0; p < 2; p++)
+        {
+            free(texts[p]);
+            wacc_x86_code_free(&codes[p]);
+        }
+        TEST_ASSERT(state,
+            same_text && same_stats && same_code,
+            CLEANUP(wacc_pool_free(pool)),
+            "alignment %u/%u: assembly %s, statistics %s, code %s",
+            function_aligns[a],
+            loop_aligns[a],
+            same_text ? "same" : "differs",
+            same_stats ? "same" : "differ",
+            same_code ? "same" : "differs");
+    }
+    wacc_pool_free(pool);
+    PASS();
+}
+
+SUITE_FUNC(state, x86)
+{
+    RUN_TEST(state, regalloc_no_spill, str_lit("regalloc no spill"));
+    RUN_TEST(state, regalloc_across_call, str_lit("regalloc across call"));
+    RUN_TEST(state, peephole, str_lit("peephole"));
+    RUN_TEST(state, argument_hint, str_lit("argument hint"));
+    RUN_TEST(state, frame_leaf, str_lit("frame leaf"));
+    RUN_TEST(state, regalloc_pressure, str_lit("regalloc pressure"));
+    RUN_TEST(state, strength_reduced, str_lit("strength reduced"));
+    RUN_TEST(state, select_address, str_lit("select address"));
+    RUN_TEST(state, jit, str_lit("jit"));
+    RUN_TEST(state, aligned_code, str_lit("aligned code"));
+    RUN_TEST(state, freestanding_executable, str_lit("freestanding executable"));
+    RUN_TEST(state, debug_info, str_lit("debug info"));
+    RUN_TEST(state, parallel, str_lit("parallel"));
+}